@@ -0,0 +1,112 @@
+/**
+ * \file block-arena.cpp
+ * \brief Pool of power-of-two sized memory blocks with per-size free lists
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <ipfixprobe/block-arena.hpp>
+
+namespace ipxp {
+
+BlockArena::BlockArena()
+{
+   memset(m_free, 0, sizeof(m_free));
+   for (int i = 0; i <= MAX_SHIFT; i++) {
+      m_released[i].store(nullptr, std::memory_order_relaxed);
+   }
+}
+
+BlockArena::~BlockArena()
+{
+   for (auto it : m_slabs) {
+      free(it);
+   }
+}
+
+int BlockArena::size_class(uint32_t size)
+{
+   int cls = MIN_SHIFT;
+   while ((static_cast<uint32_t>(1) << cls) < size) {
+      cls++;
+   }
+   return cls;
+}
+
+bool BlockArena::refill(int cls)
+{
+   uint32_t block = static_cast<uint32_t>(1) << cls;
+   uint32_t slab = block < SLAB_SIZE ? SLAB_SIZE : block;
+   uint8_t *mem = static_cast<uint8_t *>(malloc(slab));
+   if (mem == nullptr) {
+      return false;
+   }
+   try {
+      m_slabs.push_back(mem);
+   } catch (std::bad_alloc &e) {
+      free(mem);
+      return false;
+   }
+   for (uint32_t off = 0; off + block <= slab; off += block) {
+      FreeBlock *tmp = reinterpret_cast<FreeBlock *>(mem + off);
+      tmp->next = m_free[cls];
+      m_free[cls] = tmp;
+   }
+   return true;
+}
+
+void *BlockArena::alloc(uint32_t size)
+{
+   if (size > MAX_BLOCK) {
+      return nullptr;
+   }
+   int cls = size_class(size);
+
+   if (m_free[cls] == nullptr) {
+      // The whole list is taken at once, so releasing threads never see a popped block (no ABA)
+      m_free[cls] = m_released[cls].exchange(nullptr, std::memory_order_acquire);
+      if (m_free[cls] == nullptr && !refill(cls)) {
+         return nullptr;
+      }
+   }
+   FreeBlock *block = m_free[cls];
+   m_free[cls] = block->next;
+   return block;
+}
+
+void BlockArena::release(void *ptr, uint32_t size)
+{
+   int cls = size_class(size);
+   FreeBlock *block = static_cast<FreeBlock *>(ptr);
+
+   block->next = m_released[cls].load(std::memory_order_relaxed);
+   while (!m_released[cls].compare_exchange_weak(block->next, block,
+      std::memory_order_release, std::memory_order_relaxed)) {
+   }
+}
+
+}
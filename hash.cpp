@@ -0,0 +1,185 @@
+/**
+ * \file hash.cpp
+ * \brief Hash functions shared by flow caches and plugins
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+
+#include <config.h>
+#include <cstring>
+
+#ifdef HAVE_LIBCRYPTO
+#include <openssl/evp.h>
+#endif
+
+#include <ipfixprobe/hash.hpp>
+
+#define XXH_INLINE_ALL
+#include "storage/xxhash.h"
+#include "process/md5.hpp"
+#include "process/sha256.hpp"
+
+namespace ipxp {
+
+uint64_t hash_bytes(const void *data, size_t length)
+{
+   return XXH3_64bits_withSeed(data, length, IPXP_HASH_SEED);
+}
+
+#ifdef HAVE_LIBCRYPTO
+/**
+ * \brief Get OpenSSL digest by name, nullptr when it is not available.
+ */
+static const EVP_MD *openssl_fetch(const char *name, const EVP_MD *(*legacy)())
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+   // Explicit fetch, implicit fetch by EVP_md5() and others is repeated for every EVP_DigestInit_ex call
+   (void) legacy;
+   return EVP_MD_fetch(nullptr, name, nullptr);
+#else
+   (void) name;
+   return legacy();
+#endif
+}
+
+// Digest of the built-in implementation is selected by overload, nullptr is passed as the argument
+static const EVP_MD *openssl_digest(const MD5 *)
+{
+   static const EVP_MD *md = openssl_fetch("MD5", EVP_md5);
+   return md;
+}
+
+static const EVP_MD *openssl_digest(const SHA256 *)
+{
+   static const EVP_MD *md = openssl_fetch("SHA256", EVP_sha256);
+   return md;
+}
+#endif
+
+template<typename Builtin, size_t Size>
+const size_t BasicHash<Builtin, Size>::DIGEST_SIZE;
+
+template<typename Builtin, size_t Size>
+BasicHash<Builtin, Size>::BasicHash(bool builtin) : m_ctx(nullptr), m_builtin(nullptr)
+{
+   init(builtin);
+}
+
+template<typename Builtin, size_t Size>
+BasicHash<Builtin, Size>::BasicHash(const BasicHash &other) : m_ctx(nullptr), m_builtin(nullptr)
+{
+   init(other.m_ctx == nullptr);
+}
+
+template<typename Builtin, size_t Size>
+BasicHash<Builtin, Size> &BasicHash<Builtin, Size>::operator=(const BasicHash &other)
+{
+   reset();
+   return *this;
+}
+
+template<typename Builtin, size_t Size>
+BasicHash<Builtin, Size>::~BasicHash()
+{
+   release();
+}
+
+template<typename Builtin, size_t Size>
+void BasicHash<Builtin, Size>::init(bool builtin)
+{
+#ifdef HAVE_LIBCRYPTO
+   const EVP_MD *md = openssl_digest(static_cast<const Builtin *>(nullptr));
+   if (!builtin && md != nullptr) {
+      EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+      if (ctx != nullptr && EVP_DigestInit_ex(ctx, md, nullptr)) {
+         m_ctx = ctx;
+         return;
+      }
+      EVP_MD_CTX_free(ctx);
+   }
+#endif
+   m_builtin = new Builtin();
+}
+
+template<typename Builtin, size_t Size>
+void BasicHash<Builtin, Size>::release()
+{
+#ifdef HAVE_LIBCRYPTO
+   EVP_MD_CTX_free(static_cast<EVP_MD_CTX *>(m_ctx));
+   m_ctx = nullptr;
+#endif
+   delete m_builtin;
+   m_builtin = nullptr;
+}
+
+template<typename Builtin, size_t Size>
+void BasicHash<Builtin, Size>::reset()
+{
+#ifdef HAVE_LIBCRYPTO
+   if (m_ctx != nullptr) {
+      const EVP_MD *md = openssl_digest(static_cast<const Builtin *>(nullptr));
+      if (EVP_DigestInit_ex(static_cast<EVP_MD_CTX *>(m_ctx), md, nullptr)) {
+         return;
+      }
+      // Context cannot be reused, switch to the built-in implementation
+      release();
+      m_builtin = new Builtin();
+      return;
+   }
+#endif
+   *m_builtin = Builtin();
+}
+
+template<typename Builtin, size_t Size>
+void BasicHash<Builtin, Size>::update(const void *data, size_t length)
+{
+#ifdef HAVE_LIBCRYPTO
+   if (m_ctx != nullptr) {
+      EVP_DigestUpdate(static_cast<EVP_MD_CTX *>(m_ctx), data, length);
+      return;
+   }
+#endif
+   m_builtin->update(static_cast<const unsigned char *>(data), length);
+}
+
+template<typename Builtin, size_t Size>
+const uint8_t *BasicHash<Builtin, Size>::finalize()
+{
+#ifdef HAVE_LIBCRYPTO
+   if (m_ctx != nullptr) {
+      unsigned int len;
+      if (EVP_DigestFinal_ex(static_cast<EVP_MD_CTX *>(m_ctx), m_digest, &len)) {
+         return m_digest;
+      }
+      memset(m_digest, 0, Size);
+      return m_digest;
+   }
+#endif
+   memcpy(m_digest, m_builtin->finalize().binary_digest(), Size);
+   return m_digest;
+}
+
+template class BasicHash<MD5, 16>;
+template class BasicHash<SHA256, 32>;
+
+}
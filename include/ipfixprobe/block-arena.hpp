@@ -0,0 +1,88 @@
+/**
+ * \file block-arena.hpp
+ * \brief Pool of power-of-two sized memory blocks with per-size free lists
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+#ifndef IPXP_BLOCK_ARENA_HPP
+#define IPXP_BLOCK_ARENA_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace ipxp {
+
+/**
+ * \brief Pool of memory blocks for data that live as long as a flow record.
+ *
+ * Block sizes are rounded up to powers of two and released blocks are kept in per-size free lists,
+ * so blocks of exported flows are reused without calling malloc. Each arena is owned by a single
+ * pipeline or plugin instance and only its thread allocates, so allocation takes no lock. Blocks can
+ * be released from any thread (flow cache vs. plugin workers), they are pushed to lock-free lists
+ * which the owner takes over when its local free list is empty. Memory is returned to the system
+ * only when the arena is destroyed. The arena does not track outstanding blocks, so owners whose
+ * blocks are held by flow records (TCPReassembly, BSTATSPlugin) never destroy it: records can be
+ * released after their plugins finish. Such arenas are leaked on exit on purpose.
+ */
+class BlockArena
+{
+public:
+   static const uint32_t MAX_BLOCK = 1 << 17; /**< Largest block which can be allocated. */
+
+   BlockArena();
+   ~BlockArena();
+
+   /**
+    * \brief Allocate block of at least given size, must be called only by the owner thread.
+    * \return Pointer to the block or nullptr when memory cannot be allocated.
+    */
+   void *alloc(uint32_t size);
+
+   /**
+    * \brief Return block obtained from alloc() with the same size, can be called by any thread.
+    */
+   void release(void *ptr, uint32_t size);
+
+private:
+   static const int MIN_SHIFT = 4;
+   static const int MAX_SHIFT = 17;
+   static const uint32_t SLAB_SIZE = 65536;
+
+   struct FreeBlock {
+      FreeBlock *next;
+   };
+
+   FreeBlock *m_free[MAX_SHIFT + 1]; /**< Blocks available to the owner thread. */
+   std::atomic<FreeBlock *> m_released[MAX_SHIFT + 1]; /**< Released blocks, taken over by the owner. */
+   std::vector<void *> m_slabs;
+
+   BlockArena(const BlockArena &other) = delete;
+   BlockArena &operator=(const BlockArena &other) = delete;
+
+   static int size_class(uint32_t size);
+   bool refill(int cls);
+};
+
+}
+#endif /* IPXP_BLOCK_ARENA_HPP */
@@ -37,6 +37,7 @@
 #include <config.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 
 #ifdef WITH_NEMEA
@@ -121,6 +122,24 @@ struct RecordExt {
       return "";
    }
 
+   /**
+    * \brief Write text representation of exported elements into buffer.
+    * Output has to be the same as of get_text(). Default implementation copies the string,
+    * plugins with large records should override it and format directly into the buffer.
+    * \param [out] buffer Output buffer.
+    * \param [in] size Size of output buffer.
+    * \return Number of characters written or -1 if text does not fit into buffer.
+    */
+   virtual int write_text(char *buffer, int size) const
+   {
+      std::string text = get_text();
+      if (text.size() > static_cast<size_t>(size)) {
+         return -1;
+      }
+      memcpy(buffer, text.data(), text.size());
+      return text.size();
+   }
+
    /**
     * \brief Add extension at the end of linked list.
     * \param [in] ext Extension to add.
@@ -145,8 +164,179 @@ struct RecordExt {
    }
 };
 
+/**
+ * \brief Append-only buffer of raw observations shared by extensions of a single record.
+ *
+ * Lazy extensions append compact entries here while the flow is stored in the cache and encode them
+ * only when the flow is exported (in fill_ipfix, fill_unirec or get_text). Entries are tagged with
+ * extension ID, their data are aligned to 4 bytes. The buffer is cleared together with extensions
+ * of the record. Copying a record does not copy the buffer contents, the same as with extensions.
+ */
+class RecordArena
+{
+public:
+   static const uint32_t KEEP_CAPACITY = 256; /**< Memory kept for the next flow stored in the record. */
+
+   RecordArena() : m_data(nullptr), m_size(0), m_capacity(0)
+   {
+   }
+
+   RecordArena(const RecordArena &other) : m_data(nullptr), m_size(0), m_capacity(0)
+   {
+   }
+
+   RecordArena &operator=(const RecordArena &other)
+   {
+      clear();
+      return *this;
+   }
+
+   ~RecordArena()
+   {
+      free(m_data);
+   }
+
+   /**
+    * \brief Append new entry.
+    * \param [in] ext_id ID of extension owning the entry.
+    * \param [in] len Length of entry data.
+    * \return Pointer to entry data or nullptr when memory cannot be allocated.
+    */
+   void *append(int ext_id, uint16_t len)
+   {
+      uint32_t need = m_size + sizeof(EntryHdr) + ((len + 3) & ~3U);
+      if (need > m_capacity && !grow(need)) {
+         return nullptr;
+      }
+
+      EntryHdr *hdr = reinterpret_cast<EntryHdr *>(m_data + m_size);
+      hdr->ext_id = ext_id;
+      hdr->len = len;
+      m_size = need;
+      return hdr + 1;
+   }
+
+   /**
+    * \brief Find next entry of given extension.
+    * \param [in] ext_id ID of extension.
+    * \param [in,out] pos Iterator position, start with 0.
+    * \return Pointer to entry data or nullptr when there are no more entries.
+    */
+   const void *next(int ext_id, uint32_t &pos) const
+   {
+      while (pos < m_size) {
+         const EntryHdr *hdr = reinterpret_cast<const EntryHdr *>(m_data + pos);
+         pos += sizeof(EntryHdr) + ((hdr->len + 3) & ~3U);
+         if (hdr->ext_id == ext_id) {
+            return hdr + 1;
+         }
+      }
+      return nullptr;
+   }
+
+   /**
+    * \brief Remove all entries.
+    */
+   void clear()
+   {
+      m_size = 0;
+      if (m_capacity > KEEP_CAPACITY) {
+         free(m_data);
+         m_data = nullptr;
+         m_capacity = 0;
+      }
+   }
+
+   uint32_t size() const
+   {
+      return m_size;
+   }
+
+private:
+   struct EntryHdr {
+      uint16_t ext_id;
+      uint16_t len;
+   };
+
+   uint8_t *m_data;
+   uint32_t m_size;
+   uint32_t m_capacity;
+
+   bool grow(uint32_t need)
+   {
+      uint32_t capacity = m_capacity ? m_capacity * 2 : 64;
+      while (capacity < need) {
+         capacity *= 2;
+      }
+      uint8_t *tmp = static_cast<uint8_t *>(realloc(m_data, capacity));
+      if (tmp == nullptr) {
+         return false;
+      }
+      m_data = tmp;
+      m_capacity = capacity;
+      return true;
+   }
+};
+
+struct TCPStreamState;
+void tcp_stream_release(TCPStreamState *state);
+
+/**
+ * \brief Owner of TCP reassembly state of a record (see tcp-stream.hpp).
+ *
+ * The state is allocated by TCPReassembly when the first segment of a TCP flow is seen and returned
+ * to the arena of that reassembly together with extensions. Copying a record does not copy the state.
+ */
+class TCPStreamRef
+{
+public:
+   TCPStreamRef() : m_state(nullptr)
+   {
+   }
+
+   TCPStreamRef(const TCPStreamRef &other) : m_state(nullptr)
+   {
+   }
+
+   TCPStreamRef &operator=(const TCPStreamRef &other)
+   {
+      clear();
+      return *this;
+   }
+
+   ~TCPStreamRef()
+   {
+      clear();
+   }
+
+   TCPStreamState *get() const
+   {
+      return m_state;
+   }
+
+   void set(TCPStreamState *state)
+   {
+      clear();
+      m_state = state;
+   }
+
+   void clear()
+   {
+      if (m_state != nullptr) {
+         tcp_stream_release(m_state);
+         m_state = nullptr;
+      }
+   }
+
+private:
+   TCPStreamState *m_state;
+};
+
 struct Record {
    RecordExt *m_exts; /**< Extension headers. */
+   uint64_t m_ext_mask; /**< Bit mask of IDs of present extension headers (IDs lower than 64). */
+   RecordArena m_arena; /**< Raw observations of lazy extensions. */
+   TCPStreamRef m_streams; /**< Reassembled data of TCP streams. */
 
    /**
     * \brief Add new extension header.
@@ -154,6 +344,9 @@ struct Record {
     */
    void add_extension(RecordExt* ext)
    {
+      if (ext->m_ext_id >= 0 && ext->m_ext_id < 64) {
+         m_ext_mask |= static_cast<uint64_t>(1) << ext->m_ext_id;
+      }
       if (m_exts == nullptr) {
          m_exts = ext;
       } else {
@@ -202,6 +395,9 @@ struct Record {
              }
              ext->m_next = nullptr;
              delete ext;
+             if (id >= 0 && id < 64 && get_extension(id) == nullptr) {
+                m_ext_mask &= ~(static_cast<uint64_t>(1) << id);
+             }
              return true;
           }
           prev_ext = ext;
@@ -211,7 +407,7 @@ struct Record {
     }
 
    /**
-    * \brief Remove extension headers.
+    * \brief Remove extension headers, their raw observations and reassembled TCP data.
     */
    void remove_extensions()
    {
@@ -219,12 +415,15 @@ struct Record {
          delete m_exts;
          m_exts = nullptr;
       }
+      m_ext_mask = 0;
+      m_arena.clear();
+      m_streams.clear();
    }
 
    /**
     * \brief Constructor.
     */
-   Record() : m_exts(nullptr)
+   Record() : m_exts(nullptr), m_ext_mask(0)
    {
    }
 
@@ -0,0 +1,113 @@
+/**
+ * \file hash.hpp
+ * \brief Hash functions shared by flow caches and plugins
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+#ifndef IPXP_HASH_HPP
+#define IPXP_HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ipxp {
+
+#define IPXP_HASH_SEED 0x9e3779b97f4a7c15ULL /**< Seed of hash_bytes(), fixed so flow hashes are stable across runs. */
+
+class MD5;
+class SHA256;
+
+/**
+ * \brief Compute 64-bit non-cryptographic hash of data.
+ *
+ * XXH3 with a fixed seed is used, it is more than twice as fast as XXH64 on flow keys (13 to 45 bytes).
+ * \param [in] data Data to hash.
+ * \param [in] length Length of data.
+ * \return Hash value.
+ */
+uint64_t hash_bytes(const void *data, size_t length);
+
+/**
+ * \brief Streaming digest used for fingerprints (MD5 for JA3, SHA-256 for JA4).
+ *
+ * Digest is computed by OpenSSL when ipfixprobe is linked with libcrypto and the library allows
+ * the algorithm (MD5 is refused in FIPS mode), otherwise by the built-in implementation given by
+ * Builtin. OpenSSL algorithm is fetched once per process and selects the best kernel for the CPU
+ * by itself. Object should be reused for more digests by calling reset(), so the OpenSSL context
+ * is not allocated for every digest. Copying an object does not copy the digest state.
+ */
+template<typename Builtin, size_t Size>
+class BasicHash
+{
+public:
+   static const size_t DIGEST_SIZE = Size;
+
+   /**
+    * \param [in] builtin Use the built-in implementation even when OpenSSL is available.
+    */
+   explicit BasicHash(bool builtin = false);
+   BasicHash(const BasicHash &other);
+   BasicHash &operator=(const BasicHash &other);
+   ~BasicHash();
+
+   /**
+    * \brief Start a new digest.
+    */
+   void reset();
+
+   /**
+    * \brief Add data to the digest.
+    */
+   void update(const void *data, size_t length);
+
+   /**
+    * \brief Finish the digest.
+    * \return Pointer to DIGEST_SIZE bytes of binary digest, valid until the next reset().
+    */
+   const uint8_t *finalize();
+
+   /**
+    * \brief Check whether digest is computed by OpenSSL.
+    */
+   bool openssl() const
+   {
+      return m_ctx != nullptr;
+   }
+
+private:
+   void *m_ctx; /**< OpenSSL digest context or nullptr when built-in implementation is used. */
+   Builtin *m_builtin; /**< Built-in implementation. */
+   uint8_t m_digest[Size];
+
+   void init(bool builtin);
+   void release();
+};
+
+typedef BasicHash<MD5, 16> HashMD5;
+typedef BasicHash<SHA256, 32> HashSHA256;
+
+extern template class BasicHash<MD5, 16>;
+extern template class BasicHash<SHA256, 32>;
+
+}
+#endif /* IPXP_HASH_HPP */
@@ -61,7 +61,10 @@ public:
    int32_t FillBuffer(uint8_t *buffer, uint8_t *values, uint16_t len, uint16_t fieldID);
    int32_t FillBuffer(uint8_t *buffer, int8_t *values, uint16_t len, uint16_t fieldID);
 
-private:
+   /**
+    * \brief Write only header of the list, used when values are not stored in an array.
+    * \return Number of bytes written, values in network byte order have to follow.
+    */
    int32_t FillBufferHdr(uint8_t *buffer, uint16_t length, uint16_t elementLength, uint16_t fieldID);
 };
 
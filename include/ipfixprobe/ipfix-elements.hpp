@@ -81,6 +81,10 @@ namespace ipxp {
 #define OUTPUT_INTERFACE(F)           F(0,       14,    2,   nullptr)
 #define FLOW_END_REASON(F)            F(0,      136,    1,   &flow.end_reason)
 #define FLOW_ID(F)                    F(0,      148,    8,   &flow.flow_hash)
+#define HASH_OUTPUT_RANGE_MIN(F)      F(0,      328,    8,   nullptr)
+#define HASH_OUTPUT_RANGE_MAX(F)      F(0,      329,    8,   nullptr)
+#define HASH_SELECTED_RANGE_MIN(F)    F(0,      330,    8,   nullptr)
+#define HASH_SELECTED_RANGE_MAX(F)    F(0,      331,    8,   nullptr)
 
 #define ETHERTYPE(F)                  F(0,      256,    2,   nullptr)
 
@@ -259,6 +263,9 @@ namespace ipxp {
 #define FX_TCP_TRACKING(F)            F(5715,   1020,   1,   nullptr)
 #endif
 
+#define PLUGIN_SAMPLE_AFTER(F)        F(8057,    1110,   4,   nullptr)
+#define PLUGIN_SAMPLE_INTERVAL(F)     F(8057,    1111,   4,   nullptr)
+
 #define WG_CONF_LEVEL(F)              F(8057,    1100,   1,   nullptr)
 #define WG_SRC_PEER(F)                F(8057,    1101,   4,   nullptr)
 #define WG_DST_PEER(F)                F(8057,    1102,   4,   nullptr)
@@ -536,6 +543,14 @@ namespace ipxp {
 #define IPFIX_FLOW_HASH_TEMPLATE(F) \
    F(FLOW_ID)
 
+#define IPFIX_SAMPLING_TEMPLATE(F) \
+   F(HASH_OUTPUT_RANGE_MIN) \
+   F(HASH_OUTPUT_RANGE_MAX) \
+   F(HASH_SELECTED_RANGE_MIN) \
+   F(HASH_SELECTED_RANGE_MAX) \
+   F(PLUGIN_SAMPLE_AFTER) \
+   F(PLUGIN_SAMPLE_INTERVAL)
+
 #define IPFIX_MPLS_TEMPLATE(F) \
    F(MPLS_TOP_LABEL_STACK_SECTION)
 
@@ -585,7 +600,8 @@ namespace ipxp {
    IPFIX_ICMP_TEMPLATE(F) \
    IPFIX_VLAN_TEMPLATE(F) \
    IPFIX_NETTISA_TEMPLATE(F) \
-   IPFIX_FLOW_HASH_TEMPLATE(F)
+   IPFIX_FLOW_HASH_TEMPLATE(F) \
+   IPFIX_SAMPLING_TEMPLATE(F)
 
 /**
  * Helper macro, convert FIELD into its name as a C literal.
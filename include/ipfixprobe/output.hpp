@@ -30,6 +30,8 @@
 #ifndef IPXP_OUTPUT_HPP
 #define IPXP_OUTPUT_HPP
 
+#include <string>
+
 #include "plugin.hpp"
 #include "process.hpp"
 #include "flowifc.hpp"
@@ -47,10 +49,22 @@ public:
    typedef std::vector<std::pair<std::string, ProcessPlugin *>> Plugins;
    uint64_t m_flows_seen; /**< Number of flows received to export. */
    uint64_t m_flows_dropped; /**< Number of flows that could not be exported. */
+   uint64_t m_shaping_delay; /**< Time spent waiting for exporter rate limit in microseconds. */
 
-   OutputPlugin() : m_flows_seen(0), m_flows_dropped(0) {}
+   OutputPlugin() : m_flows_seen(0), m_flows_dropped(0), m_shaping_delay(0), m_worker_id(0), m_worker_cnt(1) {}
    virtual ~OutputPlugin() {}
 
+   /**
+    * \brief Set output worker which runs this instance, must be called before init.
+    * \param [in] id Index of the output worker.
+    * \param [in] cnt Number of output workers, each runs its own instance with the same parameters.
+    */
+   void set_worker(uint32_t id, uint32_t cnt)
+   {
+      m_worker_id = id;
+      m_worker_cnt = cnt;
+   }
+
    virtual void init(const char *params, Plugins &plugins) = 0;
 
    enum class Result {
@@ -70,6 +84,22 @@ public:
    virtual void flush()
    {
    }
+
+protected:
+   uint32_t m_worker_id;
+   uint32_t m_worker_cnt;
+
+   /**
+    * \brief Make path used by the instance unique by appending ".N" (index of output worker)
+    * when more output workers are running.
+    */
+   std::string worker_path(const std::string &path) const
+   {
+      if (m_worker_cnt <= 1) {
+         return path;
+      }
+      return path + "." + std::to_string(m_worker_id);
+   }
 };
 
 }
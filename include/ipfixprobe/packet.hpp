@@ -101,6 +101,7 @@ struct Packet : public Record {
    uint16_t    buffer_size; /**< Size of buffer */
 
    bool        source_pkt; /**< Direction of packet from flow point of view */
+   uint64_t    seq; /**< Sequence number of the packet in its input pipeline, 0 when not set */
 
    /**
     * \brief Constructor.
@@ -117,7 +118,7 @@ struct Packet : public Record {
       payload(nullptr), payload_len(0), payload_len_wire(0),
       custom(nullptr), custom_len(0),
       buffer(nullptr), buffer_size(0),
-      source_pkt(true)
+      source_pkt(true), seq(0)
    {
    }
 };
@@ -52,6 +52,13 @@ namespace ipxp {
  */
 #define FLOW_FLUSH_WITH_REINSERT    0x3
 
+/**
+ * \brief Returned from stream_data when plugin does not need more data of the stream direction.
+ */
+#define STREAM_DONE                 0x10
+
+struct TCPStreamData;
+
 /**
  * \brief Class template for flow cache plugins.
  */
@@ -110,6 +117,28 @@ public:
       return 0;
    }
 
+   /**
+    * \brief Get number of bytes from the start of each direction of TCP streams the plugin wants reassembled.
+    * Plugins returning nonzero value receive the data through stream_data().
+    * \return 0 when plugin does not use TCP reassembly.
+    */
+   virtual uint32_t stream_bytes() const
+   {
+      return 0;
+   }
+
+   /**
+    * \brief Called after post_create or post_update when new contiguous bytes of a TCP stream are available.
+    * \param [in,out] rec Reference to flow record.
+    * \param [in] pkt Parsed packet which extended the contiguous data.
+    * \param [in] stream Contiguous data from the start of the stream direction.
+    * \return 0 on success, FLOW_FLUSH option and/or STREAM_DONE.
+    */
+   virtual int stream_data(Flow &rec, const Packet &pkt, const TCPStreamData &stream)
+   {
+      return STREAM_DONE;
+   }
+
    /**
     * \brief Called before a flow record is exported from the cache.
     * \param [in,out] rec Reference to flow record.
@@ -0,0 +1,166 @@
+/**
+ * \file small-vector.hpp
+ * \brief Vector with inline storage for the first elements growing from a block arena
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+#ifndef IPXP_SMALL_VECTOR_HPP
+#define IPXP_SMALL_VECTOR_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "block-arena.hpp"
+
+namespace ipxp {
+
+/**
+ * \brief Array of trivially copyable elements for flow record extensions.
+ *
+ * The first N elements are stored inside the object, so short flows do not allocate any memory.
+ * When the array grows over N elements, its capacity is doubled in blocks of the arena given by
+ * the owner. The vector does not remember the arena, the owner has to pass the same arena
+ * to push_back() and release() (extensions usually keep a pointer to the arena of their plugin).
+ */
+template<typename T, uint16_t N>
+class SmallVector
+{
+   static_assert(std::is_trivially_copyable<T>::value, "SmallVector supports only trivially copyable types");
+
+public:
+   SmallVector() : m_data(m_inline), m_size(0), m_capacity(N)
+   {
+   }
+
+   /**
+    * \brief Take over elements of other vector, which is left empty.
+    *
+    * Copying would share the arena block, and assignment would need the arena to release the old one,
+    * so only move construction is supported.
+    */
+   SmallVector(SmallVector &&other) : m_data(m_inline), m_size(other.m_size), m_capacity(other.m_capacity)
+   {
+      if (other.m_data == other.m_inline) {
+         memcpy(m_inline, other.m_inline, m_size * sizeof(T));
+      } else {
+         m_data = other.m_data;
+      }
+      other.m_data = other.m_inline;
+      other.m_size = 0;
+      other.m_capacity = N;
+   }
+
+   SmallVector(const SmallVector &other) = delete;
+   SmallVector &operator=(const SmallVector &other) = delete;
+   SmallVector &operator=(SmallVector &&other) = delete;
+
+   /**
+    * \brief Append element.
+    * \param [in] arena Arena used when inline storage is exhausted.
+    * \param [in] value Element to append.
+    * \return True on success, false when memory cannot be allocated.
+    */
+   bool push_back(BlockArena &arena, const T &value)
+   {
+      if (m_size == m_capacity && !grow(arena)) {
+         return false;
+      }
+      m_data[m_size++] = value;
+      return true;
+   }
+
+   /**
+    * \brief Remove all elements and return memory to the arena.
+    */
+   void release(BlockArena &arena)
+   {
+      if (m_data != m_inline) {
+         arena.release(m_data, m_capacity * sizeof(T));
+         m_data = m_inline;
+         m_capacity = N;
+      }
+      m_size = 0;
+   }
+
+   T &operator[](uint16_t idx)
+   {
+      return m_data[idx];
+   }
+
+   const T &operator[](uint16_t idx) const
+   {
+      return m_data[idx];
+   }
+
+   T &back()
+   {
+      return m_data[m_size - 1];
+   }
+
+   const T *data() const
+   {
+      return m_data;
+   }
+
+   uint16_t size() const
+   {
+      return m_size;
+   }
+
+   bool empty() const
+   {
+      return m_size == 0;
+   }
+
+private:
+   T *m_data;
+   uint16_t m_size;
+   uint16_t m_capacity;
+   T m_inline[N];
+
+   bool grow(BlockArena &arena)
+   {
+      uint32_t capacity = static_cast<uint32_t>(m_capacity) * 2;
+      if (capacity > UINT16_MAX) {
+         capacity = UINT16_MAX;
+      }
+      if (capacity == m_capacity || capacity * sizeof(T) > BlockArena::MAX_BLOCK) {
+         return false;
+      }
+      T *tmp = static_cast<T *>(arena.alloc(capacity * sizeof(T)));
+      if (tmp == nullptr) {
+         return false;
+      }
+      memcpy(tmp, m_data, m_size * sizeof(T));
+      if (m_data != m_inline) {
+         arena.release(m_data, m_capacity * sizeof(T));
+      }
+      m_data = tmp;
+      m_capacity = capacity;
+      return true;
+   }
+};
+
+}
+#endif /* IPXP_SMALL_VECTOR_HPP */
@@ -37,6 +37,7 @@
 #include "flowifc.hpp"
 #include "ring.h"
 #include "process.hpp"
+#include "tcp-stream.hpp"
 
 namespace ipxp {
 
@@ -51,6 +52,7 @@ protected:
 private:
    ProcessPlugin **m_plugins; /**< Array of plugins. */
    uint32_t m_plugin_cnt;
+   TCPReassembly m_streams; /**< Reassembly for plugins which use TCP stream data. */
 
 public:
    StoragePlugin() : m_export_queue(nullptr), m_plugins(nullptr), m_plugin_cnt(0)
@@ -114,9 +116,26 @@ public:
          }
       }
       m_plugins[m_plugin_cnt++] = plugin;
+      m_streams.add_plugin(plugin);
    }
 
 protected:
+   /**
+    * \brief Get number of added plugins.
+    */
+   uint32_t get_plugin_cnt() const
+   {
+      return m_plugin_cnt;
+   }
+
+   /**
+    * \brief Get array of added plugins.
+    */
+   ProcessPlugin **get_plugins() const
+   {
+      return m_plugins;
+   }
+
    //Every StoragePlugin implementation should call these functions at appropriate places
 
    /**
@@ -134,7 +153,7 @@ protected:
    }
 
    /**
-    * \brief Call post_create function for each added plugin.
+    * \brief Call post_create function for each added plugin and pass TCP stream data to subscribed plugins.
     * \param [in,out] rec Stored flow record.
     * \param [in] pkt Input parsed packet.
     * \return Options for flow cache.
@@ -145,6 +164,9 @@ protected:
       for (unsigned int i = 0; i < m_plugin_cnt; i++) {
          ret |= m_plugins[i]->post_create(rec, pkt);
       }
+      if (m_streams.enabled()) {
+         ret |= m_streams.process(rec, pkt);
+      }
       return ret;
    }
 
@@ -164,7 +186,7 @@ protected:
    }
 
    /**
-    * \brief Call post_update function for each added plugin.
+    * \brief Call post_update function for each added plugin and pass TCP stream data to subscribed plugins.
     * \param [in,out] rec Stored flow record.
     * \param [in] pkt Input parsed packet.
     */
@@ -174,6 +196,9 @@ protected:
       for (unsigned int i = 0; i < m_plugin_cnt; i++) {
          ret |= m_plugins[i]->post_update(rec, pkt);
       }
+      if (m_streams.enabled()) {
+         ret |= m_streams.process(rec, pkt);
+      }
       return ret;
    }
 
@@ -186,6 +211,7 @@ protected:
       for (unsigned int i = 0; i < m_plugin_cnt; i++) {
          m_plugins[i]->pre_export(rec);
       }
+      rec.m_streams.clear();
    }
 };
 
@@ -0,0 +1,132 @@
+/**
+ * \file tcp-stream.hpp
+ * \brief Bounded reassembly of TCP streams shared by process plugins
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+#ifndef IPXP_TCP_STREAM_HPP
+#define IPXP_TCP_STREAM_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "block-arena.hpp"
+#include "flowifc.hpp"
+#include "packet.hpp"
+#include "process.hpp"
+
+namespace ipxp {
+
+#define TCP_STREAM_MAX_BYTES   65536 /**< Maximal number of reassembled bytes per direction. */
+#define TCP_STREAM_MAX_RANGES  4     /**< Maximal number of out-of-order data ranges per direction. */
+#define TCP_STREAM_MAX_PLUGINS 32    /**< Maximal number of plugins subscribed to stream data. */
+
+/**
+ * \brief Contiguous data from the start of one direction of a TCP stream.
+ */
+struct TCPStreamData {
+   const uint8_t *data; /**< First byte of the stream, i.e. the byte following SYN. */
+   uint32_t length; /**< Number of contiguous bytes. */
+   uint32_t offset; /**< Offset of the first byte not passed to plugins before. */
+   bool source; /**< Direction of the stream from flow point of view, same as Packet::source_pkt. */
+};
+
+/**
+ * \brief Reassembly state of one direction of a TCP stream.
+ */
+struct TCPStreamDir {
+   struct Range {
+      uint32_t start;
+      uint32_t end;
+   };
+
+   uint8_t *buffer; /**< Reassembly buffer, allocated when data are not passed directly from a packet. */
+   uint32_t base; /**< Sequence number of the first byte of the stream. */
+   uint32_t delivered; /**< Number of contiguous bytes passed to plugins. */
+   uint32_t subscribers; /**< Bit mask of plugins which still want data of the direction. */
+   bool base_known; /**< Base sequence number was set. */
+   uint8_t range_cnt; /**< Number of buffered out-of-order ranges. */
+   Range ranges[TCP_STREAM_MAX_RANGES]; /**< Buffered data above delivered bytes, sorted by start. */
+};
+
+/**
+ * \brief Reassembly state of a flow, owned by Record::m_streams.
+ */
+struct TCPStreamState {
+   BlockArena *arena; /**< Arena of the reassembly which allocated the state and buffers. */
+   uint32_t limit; /**< Size of direction buffers. */
+   TCPStreamDir dir[2]; /**< Source and destination direction of the flow. */
+};
+
+/**
+ * \brief Bounded reassembly of the first bytes of both directions of TCP flows.
+ *
+ * Plugins subscribe by returning nonzero value from ProcessPlugin::stream_bytes(). Reassembly buffers
+ * the first stream_bytes() (the maximum over plugins) of each direction, segments received out of
+ * order are kept in a small list of ranges. Whenever the contiguous prefix grows, subscribed plugins
+ * get ProcessPlugin::stream_data() call until they return STREAM_DONE for the direction. A prefix
+ * contained in a single segment is passed without copying and no buffer is allocated when plugins
+ * finish with it, which is the common case. Every instance (i.e. every pipeline or plugin worker)
+ * allocates states and buffers from its own arena, so pipelines do not share any lock.
+ *
+ * The arena is intentionally leaked. States are released by the flow cache when records are exported
+ * or destroyed, which can happen after the reassembly and its plugins are gone, and the arena does not
+ * count outstanding blocks to know when it is safe to free it. The leak is one arena per pipeline and
+ * plugin worker, created once at startup and holding at most the peak amount of stream memory.
+ */
+class TCPReassembly
+{
+public:
+   TCPReassembly();
+
+   /**
+    * \brief Subscribe plugin when it wants stream data.
+    */
+   void add_plugin(ProcessPlugin *plugin);
+
+   bool enabled() const
+   {
+      return !m_plugins.empty();
+   }
+
+   /**
+    * \brief Add TCP segment to the stream of the flow and notify plugins about new contiguous data.
+    * \param [in,out] rec Flow record of the packet.
+    * \param [in] pkt Packet with direction set by the flow cache.
+    * \return Options returned by plugins without STREAM_DONE.
+    */
+   int process(Flow &rec, const Packet &pkt);
+
+private:
+   std::vector<ProcessPlugin *> m_plugins;
+   uint32_t m_limit;
+   BlockArena *m_arena; /**< Never freed, see class description. */
+
+   TCPStreamState *create_state() const;
+   int deliver(Flow &rec, const Packet &pkt, TCPStreamDir &dir, const TCPStreamData &data);
+   static void add_range(TCPStreamDir &dir, uint32_t start, uint32_t end);
+   static uint32_t merge_ranges(TCPStreamDir &dir, uint32_t end);
+};
+
+}
+#endif /* IPXP_TCP_STREAM_HPP */
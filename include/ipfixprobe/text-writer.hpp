@@ -0,0 +1,183 @@
+/**
+ * \file text-writer.hpp
+ * \brief Bounded formatter of flow fields used by text based exporters
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+#ifndef IPXP_TEXT_WRITER_HPP
+#define IPXP_TEXT_WRITER_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+namespace ipxp {
+
+/**
+ * \brief Formats text into a caller provided buffer without any allocation.
+ *
+ * When the buffer is too small, the writer stops writing and result() returns -1,
+ * i.e. it follows the convention of RecordExt::fill_ipfix(). A truncating writer fills
+ * the rest of the buffer with the beginning of the text that does not fit instead.
+ */
+class TextWriter
+{
+public:
+   TextWriter(char *buffer, int size, bool truncate = false) :
+      m_begin(buffer), m_pos(buffer), m_end(buffer + size), m_overflow(false), m_truncate(truncate)
+   {
+   }
+
+   /**
+    * \brief Get number of written characters or -1 when the buffer overflowed.
+    */
+   int result() const
+   {
+      return m_overflow ? -1 : m_pos - m_begin;
+   }
+
+   /**
+    * \brief Get number of written characters including truncated text.
+    */
+   int length() const
+   {
+      return m_pos - m_begin;
+   }
+
+   void put(char c)
+   {
+      if (reserve(1)) {
+         *m_pos++ = c;
+      }
+   }
+
+   void put(const char *str, size_t len)
+   {
+      if (reserve(len)) {
+         memcpy(m_pos, str, len);
+         m_pos += len;
+      } else if (m_truncate) {
+         memcpy(m_pos, str, m_end - m_pos);
+         m_pos = m_end;
+      }
+   }
+
+   void put(const char *str)
+   {
+      put(str, strlen(str));
+   }
+
+   /**
+    * \brief Write unsigned number, padded by fill characters to at least width characters.
+    */
+   void put_uint(uint64_t value, unsigned width = 0, char fill = ' ')
+   {
+      static const char digits[] =
+         "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+         "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+         "8081828384858687888990919293949596979899";
+      char tmp[20];
+      char *p = tmp + sizeof(tmp);
+
+      while (value >= 100) {
+         unsigned idx = (value % 100) * 2;
+         value /= 100;
+         *--p = digits[idx + 1];
+         *--p = digits[idx];
+      }
+      if (value >= 10) {
+         *--p = digits[value * 2 + 1];
+         *--p = digits[value * 2];
+      } else {
+         *--p = '0' + value;
+      }
+
+      size_t len = tmp + sizeof(tmp) - p;
+      for (; width > len; width--) {
+         put(fill);
+      }
+      put(p, len);
+   }
+
+   void put_int(int64_t value)
+   {
+      if (value < 0) {
+         put('-');
+         put_uint(-static_cast<uint64_t>(value));
+      } else {
+         put_uint(value);
+      }
+   }
+
+   void put_mac(const uint8_t *mac)
+   {
+      static const char hex[] = "0123456789abcdef";
+      if (reserve(17)) {
+         for (int i = 0; i < 6; i++) {
+            if (i) {
+               *m_pos++ = ':';
+            }
+            *m_pos++ = hex[mac[i] >> 4];
+            *m_pos++ = hex[mac[i] & 0xf];
+         }
+      }
+   }
+
+   void put_ipv4(uint32_t addr)
+   {
+      const uint8_t *p = reinterpret_cast<const uint8_t *>(&addr);
+      put_uint(p[0]);
+      put('.');
+      put_uint(p[1]);
+      put('.');
+      put_uint(p[2]);
+      put('.');
+      put_uint(p[3]);
+   }
+
+   void put_ipv6(const uint8_t *addr)
+   {
+      char tmp[INET6_ADDRSTRLEN];
+      inet_ntop(AF_INET6, addr, tmp, sizeof(tmp));
+      put(tmp);
+   }
+
+private:
+   char *m_begin;
+   char *m_pos;
+   char *m_end;
+   bool m_overflow;
+   bool m_truncate;
+
+   bool reserve(size_t len)
+   {
+      if (m_overflow || static_cast<size_t>(m_end - m_pos) < len) {
+         m_overflow = true;
+         return false;
+      }
+      return true;
+   }
+};
+
+}
+#endif /* IPXP_TEXT_WRITER_HPP */
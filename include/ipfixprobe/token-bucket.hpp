@@ -0,0 +1,165 @@
+/**
+ * \file token-bucket.hpp
+ * \brief Token bucket rate limiter shared by exporters
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+
+#ifndef IPXP_TOKEN_BUCKET_HPP
+#define IPXP_TOKEN_BUCKET_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <time.h>
+
+namespace ipxp {
+
+/**
+ * \brief Clock of token bucket using monotonic system time.
+ */
+struct MonotonicClock {
+   /**
+    * \brief Get current time in nanoseconds.
+    */
+   static uint64_t now()
+   {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+   }
+
+   /**
+    * \brief Suspend calling thread.
+    * \param [in] ns Time to sleep in nanoseconds.
+    */
+   static void sleep(uint64_t ns)
+   {
+      struct timespec sleep_time = {static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000)};
+      nanosleep(&sleep_time, nullptr);
+   }
+};
+
+/**
+ * \brief Token bucket rate limiter.
+ *
+ * Tokens (flows, bytes, ...) are refilled at the given rate up to the burst size. Consuming tokens
+ * does not read the clock while the bucket is not empty. Once the bucket gets into debt, the caller
+ * sleeps until one refill quantum (10 ms of traffic at most) is available again, so sleep decisions
+ * are made per batch of consumed tokens and not for every consumption.
+ *
+ * \tparam Clock Source of time with static now() and sleep() working in nanoseconds, tests use
+ *   a simulated one.
+ */
+template<typename Clock>
+class BasicTokenBucket
+{
+public:
+   BasicTokenBucket() : m_rate(0), m_burst(0), m_quantum(0), m_tokens(0), m_last(0), m_delay(0)
+   {
+   }
+
+   /**
+    * \brief Set rate of the bucket.
+    * \param [in] rate Number of tokens per second, 0 disables the limit.
+    * \param [in] burst Bucket capacity, 0 selects tokens of 100 ms.
+    */
+   void init(uint64_t rate, uint64_t burst = 0)
+   {
+      m_rate = rate;
+      if (burst == 0) {
+         burst = rate / 10;
+      }
+      m_burst = burst ? burst : 1;
+      m_quantum = rate / 100 < m_burst ? rate / 100 : m_burst;
+      if (m_quantum < 1) {
+         m_quantum = 1;
+      }
+      m_tokens = m_burst;
+      m_last = Clock::now();
+   }
+
+   /**
+    * \brief Check whether the limit is enabled.
+    */
+   bool enabled() const
+   {
+      return m_rate != 0;
+   }
+
+   /**
+    * \brief Take tokens from the bucket and sleep when the bucket is in debt.
+    * \param [in] tokens Number of tokens to take.
+    */
+   void consume(uint64_t tokens)
+   {
+      if (m_tokens >= tokens || m_rate == 0) {
+         m_tokens -= tokens;
+         return;
+      }
+
+      // Refill before taking the tokens, so idle time cannot pay more than the burst
+      uint64_t ts = Clock::now();
+      refill(ts);
+      m_tokens -= tokens;
+      if (m_tokens >= 0) {
+         return;
+      }
+
+      Clock::sleep((m_quantum - m_tokens) * 1000000000.0 / m_rate);
+
+      uint64_t end = Clock::now();
+      refill(end);
+      m_delay.fetch_add((end - ts) / 1000, std::memory_order_relaxed);
+   }
+
+   /**
+    * \brief Get total time spent waiting for tokens.
+    * \return Delay in microseconds.
+    */
+   uint64_t delay() const
+   {
+      return m_delay.load(std::memory_order_relaxed);
+   }
+
+private:
+   uint64_t m_rate; /**< Tokens per second. */
+   double m_burst; /**< Bucket capacity. */
+   double m_quantum; /**< Tokens available after sleep. */
+   double m_tokens; /**< Current number of tokens, negative when in debt. */
+   uint64_t m_last; /**< Time of last refill in nanoseconds. */
+   std::atomic<uint64_t> m_delay; /**< Accumulated sleep time in microseconds, read by other threads. */
+
+   void refill(uint64_t ts)
+   {
+      m_tokens += (ts - m_last) * static_cast<double>(m_rate) / 1000000000.0;
+      if (m_tokens > m_burst) {
+         m_tokens = m_burst;
+      }
+      m_last = ts;
+   }
+};
+
+typedef BasicTokenBucket<MonotonicClock> TokenBucket;
+
+}
+#endif /* IPXP_TOKEN_BUCKET_HPP */
@@ -208,40 +208,46 @@ bool process_plugin_args(ipxp_conf_t &conf, IpfixprobeOptParser &parser)
    }
 
    // Output
-   ipx_ring_t *output_queue = ipx_ring_init(conf.oqueue_size, 1);
-   if (output_queue == nullptr) {
-      throw IPXPError("unable to initialize ring buffer");
-   }
-   OutputPlugin *output_plugin = nullptr;
-   try {
-      output_plugin = dynamic_cast<OutputPlugin *>(conf.mgr.get(output_name));
-      if (output_plugin == nullptr) {
+   // Flow rate limit is split between output workers
+   uint32_t output_fps = conf.fps / conf.output_cnt;
+   if (conf.fps != 0 && output_fps == 0) {
+      output_fps = 1;
+   }
+   for (uint32_t i = 0; i < conf.output_cnt; i++) {
+      ipx_ring_t *output_queue = ipx_ring_init(conf.oqueue_size, 1);
+      if (output_queue == nullptr) {
+         throw IPXPError("unable to initialize ring buffer");
+      }
+      OutputPlugin *output_plugin = nullptr;
+      try {
+         output_plugin = dynamic_cast<OutputPlugin *>(conf.mgr.get(output_name));
+         if (output_plugin == nullptr) {
+            ipx_ring_destroy(output_queue);
+            throw IPXPError("invalid output plugin " + output_name);
+         }
+
+         output_plugin->set_worker(i, conf.output_cnt);
+         output_plugin->init(output_params.c_str(), *process_plugins);
+         conf.active.output.push_back(output_plugin);
+         conf.active.all.push_back(output_plugin);
+      } catch (PluginError &e) {
+         ipx_ring_destroy(output_queue);
+         delete output_plugin;
+         throw IPXPError(output_name + std::string(": ") + e.what());
+      } catch (PluginExit &e) {
          ipx_ring_destroy(output_queue);
-         throw IPXPError("invalid output plugin " + output_name);
+         delete output_plugin;
+         return true;
+      } catch (PluginManagerError &e) {
+         throw IPXPError(output_name + std::string(": ") + e.what());
       }
 
-      output_plugin->init(output_params.c_str(), *process_plugins);
-      conf.active.output.push_back(output_plugin);
-      conf.active.all.push_back(output_plugin);
-   } catch (PluginError &e) {
-      ipx_ring_destroy(output_queue);
-      delete output_plugin;
-      throw IPXPError(output_name + std::string(": ") + e.what());
-   } catch (PluginExit &e) {
-      ipx_ring_destroy(output_queue);
-      delete output_plugin;
-      return true;
-   } catch (PluginManagerError &e) {
-      throw IPXPError(output_name + std::string(": ") + e.what());
-   }
-
-   {
       std::promise<WorkerResult> *output_res = new std::promise<WorkerResult>();
       auto output_stats = new std::atomic<OutputStats>();
       conf.output_stats.push_back(output_stats);
       OutputWorker tmp = {
               output_plugin,
-              new std::thread(output_worker, output_plugin, output_queue, output_res, output_stats, conf.fps),
+              new std::thread(output_worker, output_plugin, output_queue, output_res, output_stats, output_fps),
               output_res,
               output_stats,
               output_queue
@@ -282,7 +288,9 @@ bool process_plugin_args(ipxp_conf_t &conf, IpfixprobeOptParser &parser)
          if (storage_plugin == nullptr) {
             throw IPXPError("invalid storage plugin " + storage_name);
          }
-         storage_plugin->set_queue(output_queue);
+         // Pipelines are assigned to output workers in round robin, all flows of a storage
+         // instance go through the same queue because exported records are recycled in queue order
+         storage_plugin->set_queue(conf.outputs[pipeline_idx % conf.outputs.size()].queue);
          storage_plugin->init(storage_params.c_str());
          conf.active.storage.push_back(storage_plugin);
          conf.active.all.push_back(storage_plugin);
@@ -414,9 +422,15 @@ void finish(ipxp_conf_t &conf)
       std::setw(13) << "packets" <<
       std::setw(20) << "bytes (L4)" <<
       std::setw(13) << "dropped" <<
+      std::setw(13) << "delay (ms)" <<
       std::setw(7) << "status" << std::endl;
 
    idx = 0;
+   uint64_t total_biflows = 0;
+   uint64_t total_out_packets = 0;
+   uint64_t total_out_bytes = 0;
+   uint64_t total_out_dropped = 0;
+   uint64_t total_out_delay = 0;
    for (auto &it : conf.output_fut) {
       WorkerResult res = it.get();
       std::string status = "ok";
@@ -431,7 +445,23 @@ void finish(ipxp_conf_t &conf)
          std::setw(12) << stats.packets << " " <<
          std::setw(19) << stats.bytes << " " <<
          std::setw(12) << stats.dropped << " " <<
+         std::setw(12) << stats.delay / 1000 << " " <<
          std::setw(6) << status << std::endl;
+      total_biflows += stats.biflows;
+      total_out_packets += stats.packets;
+      total_out_bytes += stats.bytes;
+      total_out_dropped += stats.dropped;
+      total_out_delay += stats.delay;
+   }
+
+   if (conf.output_fut.size() > 1) {
+      std::cout <<
+         std::setw(3) << "SUM" <<
+         std::setw(13) << total_biflows <<
+         std::setw(13) << total_out_packets <<
+         std::setw(20) << total_out_bytes <<
+         std::setw(13) << total_out_dropped <<
+         std::setw(13) << total_out_delay / 1000 << std::endl;
    }
 
    if (!ok) {
@@ -612,10 +642,16 @@ int run(int argc, char *argv[])
       status = EXIT_FAILURE;
       goto EXIT;
    }
+   if (parser.m_oworkers < 1) {
+      error("number of output workers must be at least 1");
+      status = EXIT_FAILURE;
+      goto EXIT;
+   }
 
    conf.worker_cnt = parser.m_input.size();
    conf.iqueue_size = parser.m_iqueue;
    conf.oqueue_size = parser.m_oqueue;
+   conf.output_cnt = parser.m_oworkers;
    conf.fps = parser.m_fps;
    conf.pkt_bufsize = parser.m_pkt_bufsize;
    conf.max_pkts = parser.m_max_pkts;
@@ -80,6 +80,7 @@ public:
    bool m_daemon;
    uint32_t m_iqueue;
    uint32_t m_oqueue;
+   uint32_t m_oworkers;
    uint32_t m_fps;
    uint32_t m_pkt_bufsize;
    uint32_t m_max_pkts;
@@ -89,7 +90,7 @@ public:
 
    IpfixprobeOptParser() : OptionsParser("ipfixprobe", "flow exporter supporting various custom IPFIX elements"),
                            m_pid(""), m_daemon(false),
-                           m_iqueue(DEFAULT_IQUEUE_SIZE), m_oqueue(DEFAULT_OQUEUE_SIZE), m_fps(DEFAULT_FPS),
+                           m_iqueue(DEFAULT_IQUEUE_SIZE), m_oqueue(DEFAULT_OQUEUE_SIZE), m_oworkers(1), m_fps(DEFAULT_FPS),
                            m_pkt_bufsize(1600), m_max_pkts(0), m_help(false), m_help_str(""), m_version(false)
    {
       m_delim = ' ';
@@ -126,6 +127,12 @@ public:
                                   std::invalid_argument &e) { return false; }
                           return true;
                       }, OptionFlags::RequiredArgument);
+      register_option("-O", "--oworkers", "NUM", "Number of output workers, each with its own queue and output plugin instance",
+                      [this](const char *arg) {
+                          try { m_oworkers = str2num<decltype(m_oworkers)>(arg); } catch (
+                                  std::invalid_argument &e) { return false; }
+                          return true;
+                      }, OptionFlags::RequiredArgument);
       register_option("-B", "--pbuf", "SIZE", "Size of packet buffer",
                       [this](const char *arg) {
                           try { m_pkt_bufsize = str2num<decltype(m_pkt_bufsize)>(arg); } catch (std::invalid_argument &e) { return false; }
@@ -167,6 +174,7 @@ public:
 struct ipxp_conf_t {
    uint32_t iqueue_size;
    uint32_t oqueue_size;
+   uint32_t output_cnt;
    uint32_t worker_cnt;
    uint32_t fps;
    uint32_t max_pkts;
@@ -200,6 +208,7 @@ struct ipxp_conf_t {
 
    ipxp_conf_t() : iqueue_size(DEFAULT_IQUEUE_SIZE),
                    oqueue_size(DEFAULT_OQUEUE_SIZE),
+                   output_cnt(1),
                    worker_cnt(0), fps(0), max_pkts(0),
                    pkt_bufsize(1600), blocks_cnt(0), pkts_cnt(0), pkt_data_cnt(0), blocks(nullptr), pkts(nullptr), pkt_data(nullptr)
    {
@@ -172,7 +172,8 @@ int main(int argc, char *argv[])
          std::setw(10) << "biflows" <<
          std::setw(10) << "packets" <<
          std::setw(16) << "bytes" <<
-         std::setw(10) << "dropped" << std::endl;
+         std::setw(10) << "dropped" <<
+         std::setw(11) << "delay (ms)" << std::endl;
 
       idx = 0;
       for (size_t i = 0; i < hdr->outputs; i++) {
@@ -183,7 +184,8 @@ int main(int argc, char *argv[])
             std::setw(9) << stats->biflows << " " <<
             std::setw(9) << stats->packets << " " <<
             std::setw(15) << stats->bytes << " " <<
-            std::setw(9) << stats->dropped << " " << std::endl;
+            std::setw(9) << stats->dropped << " " <<
+            std::setw(10) << stats->delay / 1000 << " " << std::endl;
       }
 
       if (parser.m_one) {
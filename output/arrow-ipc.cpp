@@ -0,0 +1,476 @@
+/**
+ * \file arrow-ipc.cpp
+ * \brief Minimal writer of the Apache Arrow IPC file format
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+
+#include <cstring>
+
+#include "arrow-ipc.hpp"
+
+namespace ipxp {
+
+/* Constants of the Arrow flatbuffers schema (format/Schema.fbs, Message.fbs, File.fbs). */
+#define ARROW_METADATA_V5       4
+#define ARROW_ENDIAN_LITTLE     0
+#define ARROW_TIME_UNIT_USEC    2
+#define ARROW_TYPE_INT          2
+#define ARROW_TYPE_BINARY       4
+#define ARROW_TYPE_TIMESTAMP    10
+#define ARROW_TYPE_LIST         12
+#define ARROW_TYPE_FIXED_BINARY 15
+#define ARROW_HEADER_SCHEMA     1
+#define ARROW_HEADER_BATCH      3
+#define ARROW_CONTINUATION      0xFFFFFFFF
+
+static const char arrow_magic[8] = {'A', 'R', 'R', 'O', 'W', '1', 0, 0};
+
+static bool has_offsets(ArrowType type)
+{
+   return type == ArrowType::BINARY || type == ArrowType::LIST;
+}
+
+ArrowColumn::ArrowColumn(ArrowType type, uint32_t width) : m_type(type), m_width(width),
+   m_length(0), m_null_count(0)
+{
+   if (has_offsets(m_type)) {
+      m_offsets.push_back(0);
+   }
+}
+
+void ArrowColumn::set_valid(bool valid)
+{
+   if (m_length % 8 == 0) {
+      m_validity.push_back(0);
+   }
+   if (valid) {
+      m_validity.back() |= 1 << (m_length % 8);
+   } else {
+      m_null_count++;
+   }
+   m_length++;
+}
+
+void ArrowColumn::append(const void *data, uint32_t len)
+{
+   size_t pos = m_values.size();
+   if (m_type == ArrowType::BINARY) {
+      m_values.resize(pos + len);
+      memcpy(m_values.data() + pos, data, len);
+      m_offsets.push_back(m_values.size());
+   } else {
+      m_values.resize(pos + m_width);
+      memcpy(m_values.data() + pos, data, len < m_width ? len : m_width);
+   }
+   set_valid(true);
+}
+
+void ArrowColumn::append_null()
+{
+   if (m_type == ArrowType::BINARY) {
+      m_offsets.push_back(m_values.size());
+   } else if (m_type == ArrowType::LIST) {
+      m_offsets.push_back(m_values.size() / m_width);
+   } else {
+      m_values.resize(m_values.size() + m_width);
+   }
+   set_valid(false);
+}
+
+void ArrowColumn::append_item(const void *data, uint32_t len)
+{
+   size_t pos = m_values.size();
+   m_values.resize(pos + m_width);
+   memcpy(m_values.data() + pos, data, len < m_width ? len : m_width);
+}
+
+void ArrowColumn::end_list()
+{
+   m_offsets.push_back(m_values.size() / m_width);
+   set_valid(true);
+}
+
+void ArrowColumn::clear()
+{
+   m_length = 0;
+   m_null_count = 0;
+   m_validity.clear();
+   m_values.clear();
+   m_offsets.clear();
+   if (has_offsets(m_type)) {
+      m_offsets.push_back(0);
+   }
+}
+
+FlatBuilder::FlatBuilder() : m_buf(1024), m_head(1024), m_table_start(0)
+{
+}
+
+void FlatBuilder::reserve(size_t len)
+{
+   if (m_head >= len) {
+      return;
+   }
+   size_t used = size();
+   size_t capacity = m_buf.size();
+   while (capacity - used < len) {
+      capacity *= 2;
+   }
+   std::vector<uint8_t> tmp(capacity);
+   memcpy(tmp.data() + capacity - used, data(), used);
+   m_buf.swap(tmp);
+   m_head = capacity - used;
+}
+
+void FlatBuilder::align(size_t alignment, size_t additional)
+{
+   size_t pad = (alignment - (size() + additional) % alignment) % alignment;
+   reserve(pad);
+   m_head -= pad;
+   memset(m_buf.data() + m_head, 0, pad);
+}
+
+void FlatBuilder::push(const void *data, size_t len)
+{
+   if (len == 0) {
+      return;
+   }
+   reserve(len);
+   m_head -= len;
+   memcpy(m_buf.data() + m_head, data, len);
+}
+
+void FlatBuilder::push_uoffset(uint32_t target)
+{
+   align(sizeof(uint32_t));
+   uint32_t offset = size() + sizeof(uint32_t) - target;
+   push(&offset, sizeof(offset));
+}
+
+uint32_t FlatBuilder::create_string(const std::string &str)
+{
+   uint8_t zero = 0;
+   align(sizeof(uint32_t), str.size() + 1);
+   push(&zero, 1);
+   push(str.data(), str.size());
+   push_scalar<uint32_t>(str.size());
+   return size();
+}
+
+uint32_t FlatBuilder::create_offset_vector(const std::vector<uint32_t> &offsets)
+{
+   align(sizeof(uint32_t), offsets.size() * sizeof(uint32_t));
+   for (size_t i = offsets.size(); i > 0; i--) {
+      push_uoffset(offsets[i - 1]);
+   }
+   push_scalar<uint32_t>(offsets.size());
+   return size();
+}
+
+uint32_t FlatBuilder::create_struct_vector(const void *data, uint32_t size, uint32_t count)
+{
+   // All structs used by Arrow contain 64 bit members
+   align(sizeof(uint64_t), size);
+   push(data, size);
+   push_scalar<uint32_t>(count);
+   return this->size();
+}
+
+void FlatBuilder::start_table()
+{
+   m_fields.clear();
+   m_table_start = size();
+}
+
+void FlatBuilder::add_offset(uint16_t field, uint32_t offset)
+{
+   push_uoffset(offset);
+   m_fields.push_back(std::make_pair(field, size()));
+}
+
+uint32_t FlatBuilder::end_table()
+{
+   push_scalar<int32_t>(0);
+   uint32_t table = size();
+
+   uint16_t field_cnt = 0;
+   for (auto &it : m_fields) {
+      if (it.first + 1 > field_cnt) {
+         field_cnt = it.first + 1;
+      }
+   }
+   std::vector<uint16_t> vtable(field_cnt, 0);
+   for (auto &it : m_fields) {
+      vtable[it.first] = table - it.second;
+   }
+   for (size_t i = field_cnt; i > 0; i--) {
+      push_scalar<uint16_t>(vtable[i - 1]);
+   }
+   push_scalar<uint16_t>(table - m_table_start);
+   push_scalar<uint16_t>((field_cnt + 2) * sizeof(uint16_t));
+
+   // Vtable precedes the table, so the signed offset from table to vtable is positive
+   int32_t vtable_offset = size() - table;
+   memcpy(m_buf.data() + m_buf.size() - table, &vtable_offset, sizeof(vtable_offset));
+   m_fields.clear();
+   return table;
+}
+
+void FlatBuilder::finish(uint32_t root)
+{
+   align(sizeof(uint64_t), sizeof(uint32_t));
+   push_uoffset(root);
+}
+
+ArrowIpcWriter::ArrowIpcWriter() : m_file(nullptr), m_offset(0), m_error(false), m_schema(nullptr)
+{
+}
+
+ArrowIpcWriter::~ArrowIpcWriter()
+{
+   close();
+}
+
+void ArrowIpcWriter::write(const void *data, size_t len)
+{
+   if (!m_error && fwrite(data, 1, len, m_file) != len) {
+      m_error = true;
+   }
+   m_offset += len;
+}
+
+void ArrowIpcWriter::write_padding(size_t len)
+{
+   static const uint8_t zeros[8] = {0};
+   size_t pad = (8 - len % 8) % 8;
+   if (pad) {
+      write(zeros, pad);
+   }
+}
+
+uint32_t ArrowIpcWriter::build_field(FlatBuilder &builder, const ArrowField &field) const
+{
+   std::vector<uint32_t> child_fields;
+   if (field.type == ArrowType::LIST) {
+      child_fields.push_back(build_field(builder, ArrowField("item", field.item_type, field.width, false)));
+   }
+   uint32_t name = builder.create_string(field.name);
+   uint32_t timezone = 0;
+   if (field.type == ArrowType::TIMESTAMP) {
+      timezone = builder.create_string("UTC");
+   }
+
+   uint8_t type_id;
+   builder.start_table();
+   switch (field.type) {
+   case ArrowType::UINT:
+   case ArrowType::INT:
+      builder.add_int32(0, field.width * 8);
+      builder.add_bool(1, field.type == ArrowType::INT);
+      type_id = ARROW_TYPE_INT;
+      break;
+   case ArrowType::TIMESTAMP:
+      builder.add_int16(0, ARROW_TIME_UNIT_USEC);
+      builder.add_offset(1, timezone);
+      type_id = ARROW_TYPE_TIMESTAMP;
+      break;
+   case ArrowType::FIXED_BINARY:
+      builder.add_int32(0, field.width);
+      type_id = ARROW_TYPE_FIXED_BINARY;
+      break;
+   case ArrowType::LIST:
+      type_id = ARROW_TYPE_LIST;
+      break;
+   default:
+      type_id = ARROW_TYPE_BINARY;
+      break;
+   }
+   uint32_t type = builder.end_table();
+   uint32_t children = builder.create_offset_vector(child_fields);
+
+   builder.start_table();
+   builder.add_offset(0, name);
+   builder.add_bool(1, field.nullable);
+   builder.add_uint8(2, type_id);
+   builder.add_offset(3, type);
+   builder.add_offset(5, children);
+   return builder.end_table();
+}
+
+uint32_t ArrowIpcWriter::build_schema(FlatBuilder &builder) const
+{
+   std::vector<uint32_t> fields;
+   for (auto &field : *m_schema) {
+      fields.push_back(build_field(builder, field));
+   }
+   uint32_t fields_vec = builder.create_offset_vector(fields);
+
+   builder.start_table();
+   builder.add_int16(0, ARROW_ENDIAN_LITTLE);
+   builder.add_offset(1, fields_vec);
+   return builder.end_table();
+}
+
+ArrowIpcWriter::Block ArrowIpcWriter::write_message(const FlatBuilder &meta, int64_t body_length)
+{
+   uint32_t continuation = ARROW_CONTINUATION;
+   int32_t meta_length = meta.size(); // Finished builder is 8 byte aligned
+   Block block;
+
+   block.offset = m_offset;
+   block.meta_length = sizeof(continuation) + sizeof(meta_length) + meta_length;
+   block.pad = 0;
+   block.body_length = body_length;
+
+   write(&continuation, sizeof(continuation));
+   write(&meta_length, sizeof(meta_length));
+   write(meta.data(), meta.size());
+   return block;
+}
+
+bool ArrowIpcWriter::open(const std::string &path, const std::vector<ArrowField> &schema)
+{
+   close();
+   m_file = fopen(path.c_str(), "wb");
+   if (m_file == nullptr) {
+      return false;
+   }
+   m_offset = 0;
+   m_error = false;
+   m_schema = &schema;
+   m_batches.clear();
+
+   write(arrow_magic, sizeof(arrow_magic));
+
+   FlatBuilder builder;
+   uint32_t header = build_schema(builder);
+   builder.start_table();
+   builder.add_int16(0, ARROW_METADATA_V5);
+   builder.add_uint8(1, ARROW_HEADER_SCHEMA);
+   builder.add_offset(2, header);
+   builder.add_int64(3, 0);
+   builder.finish(builder.end_table());
+   write_message(builder, 0);
+
+   return !m_error;
+}
+
+bool ArrowIpcWriter::write_batch(const std::vector<ArrowColumn> &columns, uint32_t rows)
+{
+   std::vector<int64_t> nodes;
+   int64_t body = 0;
+
+   m_buffers.clear();
+   auto add_buffer = [this, &body](size_t len) {
+      m_buffers.push_back(body);
+      m_buffers.push_back(len);
+      body += (len + 7) & ~7;
+   };
+   for (auto &col : columns) {
+      nodes.push_back(rows);
+      nodes.push_back(col.m_null_count);
+      add_buffer(col.m_null_count ? col.m_validity.size() : 0);
+      if (has_offsets(col.m_type)) {
+         add_buffer(col.m_offsets.size() * sizeof(int32_t));
+      }
+      if (col.m_type == ArrowType::LIST) {
+         // Child array of items follows its parent, items are never null
+         nodes.push_back(col.m_values.size() / col.m_width);
+         nodes.push_back(0);
+         add_buffer(0);
+      }
+      add_buffer(col.m_values.size());
+   }
+
+   FlatBuilder builder;
+   uint32_t nodes_vec = builder.create_struct_vector(nodes.data(), nodes.size() * sizeof(int64_t), nodes.size() / 2);
+   uint32_t buffers_vec = builder.create_struct_vector(m_buffers.data(), m_buffers.size() * sizeof(int64_t),
+      m_buffers.size() / 2);
+   builder.start_table();
+   builder.add_int64(0, rows);
+   builder.add_offset(1, nodes_vec);
+   builder.add_offset(2, buffers_vec);
+   uint32_t header = builder.end_table();
+
+   builder.start_table();
+   builder.add_int16(0, ARROW_METADATA_V5);
+   builder.add_uint8(1, ARROW_HEADER_BATCH);
+   builder.add_offset(2, header);
+   builder.add_int64(3, body);
+   builder.finish(builder.end_table());
+   Block block = write_message(builder, body);
+
+   for (auto &col : columns) {
+      if (col.m_null_count) {
+         write(col.m_validity.data(), col.m_validity.size());
+         write_padding(col.m_validity.size());
+      }
+      if (has_offsets(col.m_type)) {
+         write(col.m_offsets.data(), col.m_offsets.size() * sizeof(int32_t));
+         write_padding(col.m_offsets.size() * sizeof(int32_t));
+      }
+      write(col.m_values.data(), col.m_values.size());
+      write_padding(col.m_values.size());
+   }
+   m_batches.push_back(block);
+
+   return !m_error;
+}
+
+bool ArrowIpcWriter::close()
+{
+   if (m_file == nullptr) {
+      return true;
+   }
+
+   uint32_t eos[2] = {ARROW_CONTINUATION, 0};
+   write(eos, sizeof(eos));
+
+   FlatBuilder builder;
+   uint32_t schema = build_schema(builder);
+   uint32_t dictionaries = builder.create_struct_vector(nullptr, 0, 0);
+   uint32_t batches = builder.create_struct_vector(m_batches.data(), m_batches.size() * sizeof(Block),
+      m_batches.size());
+   builder.start_table();
+   builder.add_int16(0, ARROW_METADATA_V5);
+   builder.add_offset(1, schema);
+   builder.add_offset(2, dictionaries);
+   builder.add_offset(3, batches);
+   builder.finish(builder.end_table());
+
+   int32_t footer_length = builder.size();
+   write(builder.data(), builder.size());
+   write(&footer_length, sizeof(footer_length));
+   write(arrow_magic, 6);
+
+   bool ok = !m_error;
+   if (fclose(m_file) != 0) {
+      ok = false;
+   }
+   m_file = nullptr;
+   m_batches.clear();
+   return ok;
+}
+
+}
@@ -0,0 +1,215 @@
+/**
+ * \file arrow-ipc.hpp
+ * \brief Minimal writer of the Apache Arrow IPC file format
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+#ifndef IPXP_OUTPUT_ARROW_IPC_HPP
+#define IPXP_OUTPUT_ARROW_IPC_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace ipxp {
+
+/**
+ * \brief Logical type of an Arrow column.
+ */
+enum class ArrowType : uint8_t {
+   UINT,         /**< Unsigned integer of 1, 2, 4 or 8 bytes. */
+   INT,          /**< Signed integer of 1, 2, 4 or 8 bytes. */
+   TIMESTAMP,    /**< Microseconds since epoch in UTC stored as int64. */
+   FIXED_BINARY, /**< Fixed size binary of given width. */
+   BINARY,       /**< Variable length binary with int32 offsets. */
+   LIST          /**< Variable length list of non-null UINT, INT or TIMESTAMP items with int32 offsets. */
+};
+
+/**
+ * \brief Description of a single column of the schema.
+ */
+struct ArrowField {
+   std::string name;
+   ArrowType type;
+   uint32_t width; /**< Size of a value or list item in bytes, unused for BINARY. */
+   bool nullable;
+   ArrowType item_type; /**< Type of list items, used only for LIST. */
+
+   ArrowField(const std::string &name, ArrowType type, uint32_t width, bool nullable,
+      ArrowType item_type = ArrowType::UINT) :
+      name(name), type(type), width(width), nullable(nullable), item_type(item_type)
+   {
+   }
+};
+
+/**
+ * \brief Column builder holding Arrow buffers of a single column of a record batch.
+ *
+ * Values are appended in little endian byte order. Buffers are only cleared between batches,
+ * so their capacity is reused by the following batch. Items of LIST column are stored in
+ * m_values and each list is closed by end_list().
+ */
+class ArrowColumn
+{
+public:
+   ArrowColumn(ArrowType type, uint32_t width);
+
+   void append(const void *data, uint32_t len);
+   void append_null();
+   void append_item(const void *data, uint32_t len);
+   void end_list();
+   void clear();
+
+   template<typename T>
+   void append_uint(T value)
+   {
+      append(&value, sizeof(value));
+   }
+
+   ArrowType m_type;
+   uint32_t m_width;
+   uint32_t m_length;
+   uint32_t m_null_count;
+   std::vector<uint8_t> m_validity;
+   std::vector<uint8_t> m_values; /**< Values of fixed width columns, data of BINARY or items of LIST column. */
+   std::vector<int32_t> m_offsets; /**< Offsets of BINARY or LIST column, has m_length + 1 items. */
+
+private:
+   void set_valid(bool valid);
+};
+
+/**
+ * \brief Minimal flatbuffers builder used to serialize Arrow metadata.
+ *
+ * Buffer is built from the back like in the reference implementation, so all child objects
+ * (strings, vectors, tables) have to be created before the table referencing them.
+ * Offsets returned by create functions are measured from the end of the buffer.
+ */
+class FlatBuilder
+{
+public:
+   FlatBuilder();
+
+   uint32_t create_string(const std::string &str);
+   uint32_t create_offset_vector(const std::vector<uint32_t> &offsets);
+   uint32_t create_struct_vector(const void *data, uint32_t size, uint32_t count);
+
+   void start_table();
+   void add_bool(uint16_t field, bool value) { add_scalar<uint8_t>(field, value); }
+   void add_int16(uint16_t field, int16_t value) { add_scalar<int16_t>(field, value); }
+   void add_int32(uint16_t field, int32_t value) { add_scalar<int32_t>(field, value); }
+   void add_int64(uint16_t field, int64_t value) { add_scalar<int64_t>(field, value); }
+   void add_uint8(uint16_t field, uint8_t value) { add_scalar<uint8_t>(field, value); }
+   void add_offset(uint16_t field, uint32_t offset);
+   uint32_t end_table();
+
+   void finish(uint32_t root);
+   const uint8_t *data() const { return m_buf.data() + m_head; }
+   uint32_t size() const { return m_buf.size() - m_head; }
+
+private:
+   std::vector<uint8_t> m_buf;
+   size_t m_head; /**< Start of written data, buffer grows towards the front. */
+   uint32_t m_table_start;
+   std::vector<std::pair<uint16_t, uint32_t>> m_fields;
+
+   void reserve(size_t len);
+   void align(size_t alignment, size_t additional = 0);
+   void push(const void *data, size_t len);
+   void push_uoffset(uint32_t target);
+
+   template<typename T>
+   void push_scalar(T value)
+   {
+      align(sizeof(T));
+      push(&value, sizeof(T));
+   }
+
+   template<typename T>
+   void add_scalar(uint16_t field, T value)
+   {
+      push_scalar<T>(value);
+      m_fields.push_back(std::make_pair(field, size()));
+   }
+};
+
+/**
+ * \brief Writer of the Arrow IPC file format (also known as Feather V2).
+ *
+ * File consists of the magic, schema message, record batch messages, end-of-stream marker and
+ * a footer listing positions of all record batches. Body buffers are not compressed.
+ */
+class ArrowIpcWriter
+{
+public:
+   ArrowIpcWriter();
+   ~ArrowIpcWriter();
+
+   /**
+    * \brief Create file and write schema.
+    * \return False on error, errno is set.
+    */
+   bool open(const std::string &path, const std::vector<ArrowField> &schema);
+
+   /**
+    * \brief Append record batch to the file.
+    * \param [in] columns Column builders in schema order.
+    * \param [in] rows Number of rows of the batch.
+    * \return False on error, errno is set.
+    */
+   bool write_batch(const std::vector<ArrowColumn> &columns, uint32_t rows);
+
+   /**
+    * \brief Write footer and close the file.
+    * \return False on error, errno is set.
+    */
+   bool close();
+
+   bool is_open() const { return m_file != nullptr; }
+   uint64_t size() const { return m_offset; }
+
+private:
+   struct Block {
+      int64_t offset;
+      int32_t meta_length;
+      int32_t pad;
+      int64_t body_length;
+   };
+
+   FILE *m_file;
+   uint64_t m_offset;
+   bool m_error;
+   const std::vector<ArrowField> *m_schema;
+   std::vector<Block> m_batches;
+   std::vector<int64_t> m_buffers;
+
+   void write(const void *data, size_t len);
+   void write_padding(size_t len);
+   uint32_t build_field(FlatBuilder &builder, const ArrowField &field) const;
+   uint32_t build_schema(FlatBuilder &builder) const;
+   Block write_message(const FlatBuilder &meta, int64_t body_length);
+};
+
+}
+#endif /* IPXP_OUTPUT_ARROW_IPC_HPP */
@@ -0,0 +1,533 @@
+/**
+ * \file arrow.cpp
+ * \brief Output plugin writing flows into Apache Arrow IPC files
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+
+#include <config.h>
+
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <limits.h>
+#include <arpa/inet.h>
+
+#include <ipfixprobe/ipfix-basiclist.hpp>
+#include <ipfixprobe/ipfix-elements.hpp>
+
+#include "arrow.hpp"
+
+namespace ipxp {
+
+__attribute__((constructor)) static void register_this_plugin()
+{
+   static PluginRecord rec = PluginRecord("arrow", [](){return new ArrowExporter();});
+   register_plugin(&rec);
+}
+
+#define ARROW_FIELD_ID(EN, ID, LENGTH, SOURCE) ID
+#define ARROW_FIELD_LENGTH(EN, ID, LENGTH, SOURCE) LENGTH
+#define ARROW_FIELD(FIELD) {#FIELD, FIELD(ARROW_FIELD_ID), FIELD(ARROW_FIELD_LENGTH)},
+
+#define IPFIX_BASIC_LIST_ID 291
+
+/* IDs and lengths of known IPFIX elements, -1 marks variable length. */
+static const struct {
+   const char *name;
+   uint16_t id;
+   int16_t length;
+} arrow_ipfix_fields[] = {
+   IPFIX_ENABLED_TEMPLATES(ARROW_FIELD)
+   {nullptr, 0, 0}
+};
+
+/* Items of IPFIX basic lists, list of a flow is matched to its column by element ID in the list header. */
+static const struct {
+   const char *name;
+   uint16_t item_id;
+   ArrowType type;
+   uint32_t width;
+} arrow_basic_lists[] = {
+   {"STATS_PCKT_SIZES", 1013, ArrowType::UINT, 2},
+   {"STATS_PCKT_TIMESTAMPS", 1014, ArrowType::TIMESTAMP, 8},
+   {"STATS_PCKT_TCPFLGS", 1015, ArrowType::UINT, 1},
+   {"STATS_PCKT_DIRECTIONS", 1016, ArrowType::INT, 1},
+   {"SBI_BRST_PACKETS", 1050, ArrowType::UINT, 4},
+   {"SBI_BRST_BYTES", 1051, ArrowType::UINT, 4},
+   {"SBI_BRST_TIME_START", 1052, ArrowType::TIMESTAMP, 8},
+   {"SBI_BRST_TIME_STOP", 1053, ArrowType::TIMESTAMP, 8},
+   {"DBI_BRST_PACKETS", 1054, ArrowType::UINT, 4},
+   {"DBI_BRST_BYTES", 1055, ArrowType::UINT, 4},
+   {"DBI_BRST_TIME_START", 1056, ArrowType::TIMESTAMP, 8},
+   {"DBI_BRST_TIME_STOP", 1057, ArrowType::TIMESTAMP, 8},
+   {"S_PHISTS_SIZES", 1060, ArrowType::UINT, 4},
+   {"S_PHISTS_IPT", 1061, ArrowType::UINT, 4},
+   {"D_PHISTS_SIZES", 1062, ArrowType::UINT, 4},
+   {"D_PHISTS_IPT", 1063, ArrowType::UINT, 4},
+   {nullptr, 0, ArrowType::UINT, 0}
+};
+
+static bool get_ipfix_field(const char *name, uint16_t &id, int16_t &length)
+{
+   for (size_t i = 0; arrow_ipfix_fields[i].name != nullptr; i++) {
+      if (!strcmp(arrow_ipfix_fields[i].name, name)) {
+         id = arrow_ipfix_fields[i].id;
+         length = arrow_ipfix_fields[i].length;
+         return true;
+      }
+   }
+   return false;
+}
+
+static int get_basic_list(const char *name)
+{
+   for (int i = 0; arrow_basic_lists[i].name != nullptr; i++) {
+      if (!strcmp(arrow_basic_lists[i].name, name)) {
+         return i;
+      }
+   }
+   return -1;
+}
+
+/* IPv4 addresses are stored as IPv4-mapped IPv6 addresses, so both versions share a column. */
+static void ip_to_v6(const ipaddr_t &ip, uint8_t version, uint8_t *out)
+{
+   if (version == IP::v4) {
+      memset(out, 0, 10);
+      out[10] = 0xff;
+      out[11] = 0xff;
+      memcpy(out + 12, &ip.v4, sizeof(ip.v4));
+   } else {
+      memcpy(out, ip.v6, 16);
+   }
+}
+
+ArrowExporter::ArrowExporter() : m_batch_size(DEFAULT_ARROW_BATCH), m_rotate_time(0), m_rotate_size(0),
+   m_buffer(nullptr), m_batch(nullptr), m_rows(0), m_writer(nullptr), m_stop(false), m_write_dropped(0),
+   m_opened(0), m_name_seq(0)
+{
+}
+
+ArrowExporter::~ArrowExporter()
+{
+   close();
+}
+
+void ArrowExporter::add_field(const std::string &name, ArrowType type, uint32_t width, bool nullable,
+   ArrowType item_type)
+{
+   m_schema.push_back(ArrowField(name, type, width, nullable, item_type));
+}
+
+void ArrowExporter::init(const char *params)
+{
+   ArrowOptParser parser;
+   try {
+      parser.parse(params);
+   } catch (ParserError &e) {
+      throw PluginError(e.what());
+   }
+
+   m_file = worker_path(parser.m_file);
+   m_batch_size = parser.m_batch;
+   m_rotate_time = parser.m_rotate_time;
+   m_rotate_size = parser.m_rotate_size << 20;
+   m_buffer = new uint8_t[ARROW_FILL_BUFFER];
+
+   add_field("time_first", ArrowType::TIMESTAMP, 8, false);
+   add_field("time_last", ArrowType::TIMESTAMP, 8, false);
+   add_field("ip_version", ArrowType::UINT, 1, false);
+   add_field("ip_proto", ArrowType::UINT, 1, false);
+   add_field("src_ip", ArrowType::FIXED_BINARY, 16, false);
+   add_field("dst_ip", ArrowType::FIXED_BINARY, 16, false);
+   add_field("src_port", ArrowType::UINT, 2, false);
+   add_field("dst_port", ArrowType::UINT, 2, false);
+   add_field("src_packets", ArrowType::UINT, 4, false);
+   add_field("dst_packets", ArrowType::UINT, 4, false);
+   add_field("src_bytes", ArrowType::UINT, 8, false);
+   add_field("dst_bytes", ArrowType::UINT, 8, false);
+   add_field("src_tcp_flags", ArrowType::UINT, 1, false);
+   add_field("dst_tcp_flags", ArrowType::UINT, 1, false);
+   add_field("src_mac", ArrowType::FIXED_BINARY, 6, false);
+   add_field("dst_mac", ArrowType::FIXED_BINARY, 6, false);
+   add_field("end_reason", ArrowType::UINT, 1, false);
+
+   m_writer = new std::thread(&ArrowExporter::writer_loop, this);
+}
+
+void ArrowExporter::init(const char *params, Plugins &plugins)
+{
+   init(params);
+
+   for (auto &it : plugins) {
+      RecordExt *ext = it.second->get_ext();
+      if (ext == nullptr) {
+         continue;
+      }
+      const char **tmplt = ext->get_ipfix_tmplt();
+      Extension extension;
+      extension.id = ext->m_ext_id;
+      extension.column = m_schema.size();
+      delete ext;
+      if (tmplt == nullptr) {
+         continue;
+      }
+
+      for (; *tmplt != nullptr; tmplt++) {
+         uint16_t id;
+         int16_t length;
+         if (!get_ipfix_field(*tmplt, id, length)) {
+            throw PluginError(std::string("unknown IPFIX element ") + *tmplt + " of plugin " + it.first);
+         }
+         int list = -1;
+         if (id == IPFIX_BASIC_LIST_ID && (list = get_basic_list(*tmplt)) < 0) {
+            throw PluginError(std::string("unknown item type of basic list ") + *tmplt + " of plugin " + it.first);
+         }
+
+         std::string name = *tmplt;
+         for (auto &c : name) {
+            c = tolower(c);
+         }
+         for (auto &field : m_schema) {
+            if (field.name == name) {
+               name = it.first + "_" + name;
+               break;
+            }
+         }
+
+         if (list >= 0) {
+            add_field(name, ArrowType::LIST, arrow_basic_lists[list].width, true, arrow_basic_lists[list].type);
+         } else if (length < 0) {
+            add_field(name, ArrowType::BINARY, 0, true);
+         } else if (length == 1 || length == 2 || length == 4 || length == 8) {
+            add_field(name, ArrowType::UINT, length, true);
+         } else {
+            add_field(name, ArrowType::FIXED_BINARY, length, true);
+         }
+         extension.lengths.push_back(length);
+         extension.list_ids.push_back(list >= 0 ? arrow_basic_lists[list].item_id : 0);
+      }
+      m_extensions.push_back(extension);
+   }
+}
+
+void ArrowExporter::close()
+{
+   if (m_writer != nullptr) {
+      submit();
+      {
+         std::unique_lock<std::mutex> lock(m_mutex);
+         m_stop = true;
+      }
+      m_ready.notify_one();
+      m_writer->join();
+      delete m_writer;
+      m_writer = nullptr;
+   }
+
+   delete m_batch;
+   m_batch = nullptr;
+   for (auto batch : m_free) {
+      delete batch;
+   }
+   m_free.clear();
+   delete [] m_buffer;
+   m_buffer = nullptr;
+   m_flows_dropped += m_write_dropped.exchange(0, std::memory_order_relaxed);
+}
+
+int ArrowExporter::export_flow(const Flow &flow)
+{
+   m_flows_seen++;
+   if (m_batch == nullptr) {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_batch = get_batch();
+   }
+
+   fill_basic(*m_batch, flow);
+   for (auto &ext : m_extensions) {
+      fill_extension(*m_batch, ext.column, ext, flow);
+   }
+   if (++m_rows >= m_batch_size) {
+      submit();
+   }
+   return 0;
+}
+
+void ArrowExporter::flush()
+{
+   submit();
+   m_flows_dropped += m_write_dropped.exchange(0, std::memory_order_relaxed);
+}
+
+void ArrowExporter::fill_basic(Batch &batch, const Flow &flow)
+{
+   uint8_t addr[16];
+   size_t col = 0;
+
+   batch[col++].append_uint<int64_t>(flow.time_first.tv_sec * 1000000LL + flow.time_first.tv_usec);
+   batch[col++].append_uint<int64_t>(flow.time_last.tv_sec * 1000000LL + flow.time_last.tv_usec);
+   batch[col++].append_uint(flow.ip_version);
+   batch[col++].append_uint(flow.ip_proto);
+   ip_to_v6(flow.src_ip, flow.ip_version, addr);
+   batch[col++].append(addr, sizeof(addr));
+   ip_to_v6(flow.dst_ip, flow.ip_version, addr);
+   batch[col++].append(addr, sizeof(addr));
+   batch[col++].append_uint(flow.src_port);
+   batch[col++].append_uint(flow.dst_port);
+   batch[col++].append_uint(flow.src_packets);
+   batch[col++].append_uint(flow.dst_packets);
+   batch[col++].append_uint(flow.src_bytes);
+   batch[col++].append_uint(flow.dst_bytes);
+   batch[col++].append_uint(flow.src_tcp_flags);
+   batch[col++].append_uint(flow.dst_tcp_flags);
+   batch[col++].append(flow.src_mac, sizeof(flow.src_mac));
+   batch[col++].append(flow.dst_mac, sizeof(flow.dst_mac));
+   batch[col++].append_uint(flow.end_reason);
+}
+
+void ArrowExporter::fill_extension(Batch &batch, size_t col, const Extension &ext, const Flow &flow)
+{
+   RecordExt *rec = flow.get_extension(ext.id);
+   int len = rec != nullptr ? rec->fill_ipfix(m_buffer, ARROW_FILL_BUFFER) : -1;
+   size_t cnt = ext.lengths.size();
+   int pos = 0;
+
+   for (size_t i = 0; len >= 0 && i < cnt; i++) {
+      ArrowColumn &column = batch[col + i];
+      int field_len = ext.lengths[i];
+
+      if (field_len < 0) {
+         if (pos >= len) {
+            break;
+         }
+         field_len = m_buffer[pos++];
+         if (field_len == 255) {
+            uint16_t tmp;
+            if (pos + 2 > len) {
+               break;
+            }
+            memcpy(&tmp, m_buffer + pos, sizeof(tmp));
+            field_len = ntohs(tmp);
+            pos += 2;
+         }
+      }
+      if (pos + field_len > len) {
+         break;
+      }
+
+      if (ext.list_ids[i]) {
+         fill_list(batch, col, ext, m_buffer + pos, field_len);
+      } else if (column.m_type == ArrowType::UINT) {
+         uint64_t value = 0;
+         for (int j = 0; j < field_len; j++) {
+            value = (value << 8) | m_buffer[pos + j];
+         }
+         column.append(&value, field_len);
+      } else {
+         column.append(m_buffer + pos, field_len);
+      }
+      pos += field_len;
+   }
+   // Elements missing in the IPFIX representation are null
+   for (size_t i = 0; i < cnt; i++) {
+      if (batch[col + i].m_length == m_rows) {
+         batch[col + i].append_null();
+      }
+   }
+}
+
+void ArrowExporter::fill_list(Batch &batch, size_t col, const Extension &ext, const uint8_t *data, int len)
+{
+   uint16_t tmp;
+   if (len < IpfixBasicList::IpfixBasicListHdrSize) {
+      return;
+   }
+   // Header consists of semantic, element ID with enterprise bit, item length and enterprise number
+   memcpy(&tmp, data + 1, sizeof(tmp));
+   uint16_t item_id = ntohs(tmp) & 0x7FFF;
+   memcpy(&tmp, data + 3, sizeof(tmp));
+   uint16_t item_len = ntohs(tmp);
+
+   size_t i;
+   for (i = 0; i < ext.list_ids.size() && ext.list_ids[i] != item_id; i++) {
+   }
+   if (i == ext.list_ids.size() || item_len == 0 || item_len > sizeof(uint64_t)) {
+      return;
+   }
+   ArrowColumn &column = batch[col + i];
+   ArrowType item_type = m_schema[col + i].item_type;
+   if (column.m_length != m_rows) {
+      return;
+   }
+
+   for (int pos = IpfixBasicList::IpfixBasicListHdrSize; pos + item_len <= len; pos += item_len) {
+      uint64_t value = 0;
+      for (int j = 0; j < item_len; j++) {
+         value = (value << 8) | data[pos + j];
+      }
+      if (item_type == ArrowType::TIMESTAMP) {
+         // Basic lists carry milliseconds since epoch
+         value *= 1000;
+      } else if (item_type == ArrowType::INT && item_len < sizeof(uint64_t)) {
+         uint64_t sign = static_cast<uint64_t>(1) << (item_len * 8 - 1);
+         value = (value ^ sign) - sign;
+      }
+      column.append_item(&value, sizeof(value));
+   }
+   column.end_list();
+}
+
+ArrowExporter::Batch *ArrowExporter::get_batch()
+{
+   if (!m_free.empty()) {
+      Batch *batch = m_free.back();
+      m_free.pop_back();
+      return batch;
+   }
+
+   Batch *batch = new Batch();
+   batch->reserve(m_schema.size());
+   for (auto &field : m_schema) {
+      batch->push_back(ArrowColumn(field.type, field.width));
+   }
+   return batch;
+}
+
+void ArrowExporter::submit()
+{
+   if (m_rows == 0) {
+      return;
+   }
+
+   std::unique_lock<std::mutex> lock(m_mutex);
+   while (m_pending.size() >= ARROW_QUEUE_BATCHES) {
+      m_space.wait(lock);
+   }
+   m_pending.push_back(std::make_pair(m_batch, m_rows));
+   m_batch = get_batch();
+   m_rows = 0;
+   m_ready.notify_one();
+}
+
+void ArrowExporter::writer_loop()
+{
+   std::unique_lock<std::mutex> lock(m_mutex);
+   while (1) {
+      if (m_pending.empty() && !m_stop) {
+         m_ready.wait_for(lock, std::chrono::seconds(1));
+      }
+      if (m_pending.empty()) {
+         if (m_stop) {
+            break;
+         }
+         // Rotate files even when there is no traffic
+         lock.unlock();
+         if (m_ipc.is_open() && rotation_due()) {
+            close_file();
+         }
+         lock.lock();
+         continue;
+      }
+
+      std::pair<Batch *, uint32_t> item = m_pending.front();
+      m_pending.pop_front();
+      lock.unlock();
+      write_batch(item.first, item.second);
+      lock.lock();
+      m_free.push_back(item.first);
+      m_space.notify_one();
+   }
+   lock.unlock();
+   close_file();
+}
+
+void ArrowExporter::write_batch(Batch *batch, uint32_t rows)
+{
+   if (m_ipc.is_open() && rotation_due()) {
+      close_file();
+   }
+   if (!m_ipc.is_open() && !open_file()) {
+      m_write_dropped += rows;
+   } else if (!m_ipc.write_batch(*batch, rows)) {
+      std::cerr << "arrow: unable to write record batch: " << strerror(errno) << std::endl;
+      m_write_dropped += rows;
+      close_file();
+   } else if (m_rotate_size && m_ipc.size() >= m_rotate_size) {
+      close_file();
+   }
+
+   for (auto &column : *batch) {
+      column.clear();
+   }
+}
+
+bool ArrowExporter::rotation_due() const
+{
+   return m_rotate_time && time(nullptr) - m_opened >= m_rotate_time;
+}
+
+std::string ArrowExporter::file_name()
+{
+   char buffer[PATH_MAX];
+   time_t now = time(nullptr);
+   struct tm tm;
+   std::string name = m_file;
+
+   localtime_r(&now, &tm);
+   if (strftime(buffer, sizeof(buffer), m_file.c_str(), &tm) != 0) {
+      name = buffer;
+   }
+   // Do not overwrite previous file when it was rotated within the same second
+   if (name == m_last_name) {
+      return name + "." + std::to_string(++m_name_seq);
+   }
+   m_last_name = name;
+   m_name_seq = 0;
+   return name;
+}
+
+bool ArrowExporter::open_file()
+{
+   std::string name = file_name();
+   if (!m_ipc.open(name, m_schema)) {
+      std::cerr << "arrow: unable to create file " << name << ": " << strerror(errno) << std::endl;
+      m_ipc.close();
+      return false;
+   }
+   m_opened = time(nullptr);
+   return true;
+}
+
+void ArrowExporter::close_file()
+{
+   if (!m_ipc.close()) {
+      std::cerr << "arrow: unable to finish file " << m_last_name << ": " << strerror(errno) << std::endl;
+   }
+}
+
+}
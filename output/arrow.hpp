@@ -0,0 +1,161 @@
+/**
+ * \file arrow.hpp
+ * \brief Output plugin writing flows into Apache Arrow IPC files
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+#ifndef IPXP_OUTPUT_ARROW_HPP
+#define IPXP_OUTPUT_ARROW_HPP
+
+#include <config.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ipfixprobe/output.hpp>
+#include <ipfixprobe/process.hpp>
+#include <ipfixprobe/flowifc.hpp>
+#include <ipfixprobe/utils.hpp>
+#include <ipfixprobe/options.hpp>
+
+#include "arrow-ipc.hpp"
+
+namespace ipxp {
+
+#define DEFAULT_ARROW_FILE "flows-%Y%m%d%H%M%S.arrow"
+#define DEFAULT_ARROW_BATCH 65536
+#define ARROW_QUEUE_BATCHES 4 /**< Number of filled batches waiting for the writer thread. */
+#define ARROW_FILL_BUFFER 65535 /**< Size of buffer for IPFIX representation of an extension. */
+
+class ArrowOptParser : public OptionsParser
+{
+public:
+   std::string m_file;
+   uint32_t m_batch;
+   uint32_t m_rotate_time;
+   uint64_t m_rotate_size;
+
+   ArrowOptParser() : OptionsParser("arrow", "Output plugin writing flows into Apache Arrow IPC (Feather) files"),
+      m_file(DEFAULT_ARROW_FILE), m_batch(DEFAULT_ARROW_BATCH), m_rotate_time(0), m_rotate_size(0)
+   {
+      register_option("f", "file", "PATH", "Output file, strftime(3) conversions are expanded when the file is opened, \".N\" is appended with index of output worker when more workers run (default " DEFAULT_ARROW_FILE ")",
+         [this](const char *arg){m_file = arg; return !m_file.empty();}, OptionFlags::RequiredArgument);
+      register_option("b", "batch", "ROWS", "Number of flows in a record batch (default 65536)",
+         [this](const char *arg){try {m_batch = str2num<decltype(m_batch)>(arg);} catch(std::invalid_argument &e) {return false;} return m_batch > 0;},
+         OptionFlags::RequiredArgument);
+      register_option("r", "rotate", "SECS", "Start a new file every SECS seconds, 0 disables time based rotation (default)",
+         [this](const char *arg){try {m_rotate_time = str2num<decltype(m_rotate_time)>(arg);} catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
+      register_option("s", "size", "MIB", "Start a new file when the current one exceeds MIB MiB, 0 disables size based rotation (default)",
+         [this](const char *arg){try {m_rotate_size = str2num<decltype(m_rotate_size)>(arg);} catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
+   }
+};
+
+/**
+ * \brief Exporter storing flows in columnar Arrow IPC files.
+ *
+ * Schema consists of basic flow fields followed by IPFIX elements of all active process plugins.
+ * Extension columns are nullable, values of flows without the extension are null. Elements of
+ * 1, 2, 4 and 8 bytes are stored as unsigned integers, other fixed size elements as fixed size
+ * binary and variable length elements as binary containing the IPFIX encoded value. IPFIX basic
+ * lists are decoded into lists of integers or timestamps. Timestamps are microseconds in UTC.
+ *
+ * Flows are appended to column builders of the current batch. Full batches are passed to
+ * a writer thread which serializes them and takes care of file rotation.
+ */
+class ArrowExporter : public OutputPlugin
+{
+public:
+   ArrowExporter();
+   ~ArrowExporter();
+   void init(const char *params);
+   void init(const char *params, Plugins &plugins);
+   void close();
+   OptionsParser *get_parser() const { return new ArrowOptParser(); }
+   std::string get_name() const { return "arrow"; }
+   int export_flow(const Flow &flow);
+   void flush();
+
+private:
+   typedef std::vector<ArrowColumn> Batch;
+
+   /**
+    * \brief Extension whose IPFIX elements are stored in consecutive columns.
+    */
+   struct Extension {
+      int id;
+      size_t column; /**< Index of column of the first element. */
+      std::vector<int16_t> lengths; /**< IPFIX lengths of elements, -1 for variable length. */
+      std::vector<uint16_t> list_ids; /**< Item element IDs of basic lists, 0 for other elements. */
+   };
+
+   std::string m_file;
+   uint32_t m_batch_size;
+   uint32_t m_rotate_time;
+   uint64_t m_rotate_size;
+   std::vector<ArrowField> m_schema;
+   std::vector<Extension> m_extensions;
+   uint8_t *m_buffer;
+
+   Batch *m_batch;
+   uint32_t m_rows;
+
+   std::thread *m_writer;
+   std::mutex m_mutex;
+   std::condition_variable m_ready; /**< Signalled when batch is queued or writer should stop. */
+   std::condition_variable m_space; /**< Signalled when writer finished a batch. */
+   std::deque<std::pair<Batch *, uint32_t>> m_pending;
+   std::vector<Batch *> m_free;
+   bool m_stop;
+   std::atomic<uint64_t> m_write_dropped;
+
+   /* Accessed only by the writer thread */
+   ArrowIpcWriter m_ipc;
+   time_t m_opened;
+   std::string m_last_name;
+   uint32_t m_name_seq;
+
+   void add_field(const std::string &name, ArrowType type, uint32_t width, bool nullable,
+      ArrowType item_type = ArrowType::UINT);
+   void fill_basic(Batch &batch, const Flow &flow);
+   void fill_extension(Batch &batch, size_t col, const Extension &ext, const Flow &flow);
+   void fill_list(Batch &batch, size_t col, const Extension &ext, const uint8_t *data, int len);
+   Batch *get_batch();
+   void submit();
+
+   void writer_loop();
+   void write_batch(Batch *batch, uint32_t rows);
+   bool rotation_due() const;
+   std::string file_name();
+   bool open_file();
+   void close_file();
+};
+
+}
+#endif /* IPXP_OUTPUT_ARROW_HPP */
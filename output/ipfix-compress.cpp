@@ -0,0 +1,300 @@
+/**
+ * \file ipfix-compress.cpp
+ * \brief Stream compression of IPFIX messages sent over TCP
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+
+#include <config.h>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef WITH_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include <ipfixprobe/plugin.hpp>
+
+#include "ipfix-compress.hpp"
+
+namespace ipxp {
+
+bool ipfix_compression_parse(const char *name, IpfixCompression &type)
+{
+   if (!strcmp(name, "none")) {
+      type = IpfixCompression::NONE;
+      return true;
+   }
+#ifdef WITH_LZ4
+   if (!strcmp(name, "lz4")) {
+      type = IpfixCompression::LZ4;
+      return true;
+   }
+#endif
+#ifdef WITH_ZSTD
+   if (!strcmp(name, "zstd")) {
+      type = IpfixCompression::ZSTD;
+      return true;
+   }
+#endif
+   return false;
+}
+
+#ifdef WITH_LZ4
+static void lz4_preferences(LZ4F_preferences_t &prefs, int level)
+{
+   memset(&prefs, 0, sizeof(prefs));
+   /* Blocks reference previous blocks, so similar records of consecutive messages are compressed too */
+   prefs.frameInfo.blockMode = LZ4F_blockLinked;
+   prefs.compressionLevel = level;
+   prefs.autoFlush = 1;
+}
+#endif
+
+IpfixCompressor::IpfixCompressor() : m_type(IpfixCompression::NONE), m_level(0), m_started(false),
+   m_ctx(nullptr), m_buffer(nullptr), m_bufferSize(0)
+{
+}
+
+IpfixCompressor::~IpfixCompressor()
+{
+   close();
+}
+
+void IpfixCompressor::init(IpfixCompression type, int level)
+{
+   close();
+   m_type = type;
+   m_level = level;
+   m_started = false;
+
+   switch (type) {
+   case IpfixCompression::NONE:
+      break;
+#ifdef WITH_LZ4
+   case IpfixCompression::LZ4: {
+      LZ4F_cctx *ctx = nullptr;
+      if (LZ4F_isError(LZ4F_createCompressionContext(&ctx, LZ4F_VERSION))) {
+         throw PluginError("unable to create lz4 compression context");
+      }
+      m_ctx = ctx;
+      break;
+   }
+#endif
+#ifdef WITH_ZSTD
+   case IpfixCompression::ZSTD: {
+      ZSTD_CCtx *ctx = ZSTD_createCCtx();
+      if (ctx == nullptr) {
+         throw PluginError("unable to create zstd compression context");
+      }
+      m_ctx = ctx;
+      if (level != 0 && ZSTD_isError(ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, level))) {
+         throw PluginError("invalid zstd compression level");
+      }
+      break;
+   }
+#endif
+   default:
+      throw PluginError("compression algorithm is not supported");
+   }
+}
+
+void IpfixCompressor::close()
+{
+   if (m_ctx != nullptr) {
+#ifdef WITH_LZ4
+      if (m_type == IpfixCompression::LZ4) {
+         LZ4F_freeCompressionContext(static_cast<LZ4F_cctx *>(m_ctx));
+      }
+#endif
+#ifdef WITH_ZSTD
+      if (m_type == IpfixCompression::ZSTD) {
+         ZSTD_freeCCtx(static_cast<ZSTD_CCtx *>(m_ctx));
+      }
+#endif
+      m_ctx = nullptr;
+   }
+   free(m_buffer);
+   m_buffer = nullptr;
+   m_bufferSize = 0;
+   m_type = IpfixCompression::NONE;
+}
+
+void IpfixCompressor::reset()
+{
+#ifdef WITH_ZSTD
+   if (m_type == IpfixCompression::ZSTD) {
+      ZSTD_CCtx_reset(static_cast<ZSTD_CCtx *>(m_ctx), ZSTD_reset_session_only);
+   }
+#endif
+   m_started = false;
+}
+
+bool IpfixCompressor::reserve(size_t size)
+{
+   if (size <= m_bufferSize) {
+      return true;
+   }
+   uint8_t *tmp = static_cast<uint8_t *>(realloc(m_buffer, size));
+   if (tmp == nullptr) {
+      return false;
+   }
+   m_buffer = tmp;
+   m_bufferSize = size;
+   return true;
+}
+
+bool IpfixCompressor::compress(const uint8_t *data, size_t length, const uint8_t *&out, size_t &outLength)
+{
+   switch (m_type) {
+#ifdef WITH_LZ4
+   case IpfixCompression::LZ4: {
+      LZ4F_cctx *ctx = static_cast<LZ4F_cctx *>(m_ctx);
+      LZ4F_preferences_t prefs;
+      lz4_preferences(prefs, m_level);
+      if (!reserve(LZ4F_HEADER_SIZE_MAX + LZ4F_compressBound(length, &prefs))) {
+         return false;
+      }
+
+      size_t pos = 0;
+      if (!m_started) {
+         /* Unfinished frame of previous connection is dropped with the context state */
+         pos = LZ4F_compressBegin(ctx, m_buffer, m_bufferSize, &prefs);
+         if (LZ4F_isError(pos)) {
+            return false;
+         }
+         m_started = true;
+      }
+      size_t ret = LZ4F_compressUpdate(ctx, m_buffer + pos, m_bufferSize - pos, data, length, nullptr);
+      if (LZ4F_isError(ret)) {
+         m_started = false;
+         return false;
+      }
+      outLength = pos + ret;
+      break;
+   }
+#endif
+#ifdef WITH_ZSTD
+   case IpfixCompression::ZSTD: {
+      ZSTD_CCtx *ctx = static_cast<ZSTD_CCtx *>(m_ctx);
+      if (!reserve(ZSTD_compressBound(length) + 64 /* frame and block headers */)) {
+         return false;
+      }
+
+      ZSTD_inBuffer in = {data, length, 0};
+      ZSTD_outBuffer dst = {m_buffer, m_bufferSize, 0};
+      size_t ret;
+      do {
+         ret = ZSTD_compressStream2(ctx, &dst, &in, ZSTD_e_flush);
+         if (ZSTD_isError(ret)) {
+            ZSTD_CCtx_reset(ctx, ZSTD_reset_session_only);
+            return false;
+         }
+         if (ret != 0 && dst.pos == dst.size) {
+            if (!reserve(m_bufferSize * 2)) {
+               return false;
+            }
+            dst.dst = m_buffer;
+            dst.size = m_bufferSize;
+         }
+      } while (ret != 0);
+      m_started = true;
+      outLength = dst.pos;
+      break;
+   }
+#endif
+   default:
+      out = data;
+      outLength = length;
+      return true;
+   }
+
+   out = m_buffer;
+   return true;
+}
+
+bool IpfixCompressor::finish(const uint8_t *&out, size_t &outLength)
+{
+   out = m_buffer;
+   outLength = 0;
+   if (!m_started) {
+      return true;
+   }
+   m_started = false;
+
+   switch (m_type) {
+#ifdef WITH_LZ4
+   case IpfixCompression::LZ4: {
+      LZ4F_preferences_t prefs;
+      lz4_preferences(prefs, m_level);
+      if (!reserve(LZ4F_compressBound(0, &prefs))) {
+         return false;
+      }
+      size_t ret = LZ4F_compressEnd(static_cast<LZ4F_cctx *>(m_ctx), m_buffer, m_bufferSize, nullptr);
+      if (LZ4F_isError(ret)) {
+         return false;
+      }
+      outLength = ret;
+      break;
+   }
+#endif
+#ifdef WITH_ZSTD
+   case IpfixCompression::ZSTD: {
+      ZSTD_CCtx *ctx = static_cast<ZSTD_CCtx *>(m_ctx);
+      if (!reserve(ZSTD_CStreamOutSize())) {
+         return false;
+      }
+
+      ZSTD_inBuffer in = {nullptr, 0, 0};
+      ZSTD_outBuffer dst = {m_buffer, m_bufferSize, 0};
+      size_t ret;
+      do {
+         ret = ZSTD_compressStream2(ctx, &dst, &in, ZSTD_e_end);
+         if (ZSTD_isError(ret)) {
+            ZSTD_CCtx_reset(ctx, ZSTD_reset_session_only);
+            return false;
+         }
+         if (ret != 0 && dst.pos == dst.size) {
+            if (!reserve(m_bufferSize * 2)) {
+               return false;
+            }
+            dst.dst = m_buffer;
+            dst.size = m_bufferSize;
+         }
+      } while (ret != 0);
+      outLength = dst.pos;
+      break;
+   }
+#endif
+   default:
+      break;
+   }
+
+   out = m_buffer;
+   return true;
+}
+
+}
@@ -0,0 +1,116 @@
+/**
+ * \file ipfix-compress.hpp
+ * \brief Stream compression of IPFIX messages sent over TCP
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+#ifndef IPXP_OUTPUT_IPFIX_COMPRESS_HPP
+#define IPXP_OUTPUT_IPFIX_COMPRESS_HPP
+
+#include <config.h>
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace ipxp {
+
+/**
+ * \brief Compression algorithms of IPFIX stream.
+ */
+enum class IpfixCompression {
+   NONE,
+   LZ4, /**< LZ4 frame with linked blocks */
+   ZSTD /**< zstd frame */
+};
+
+/**
+ * \brief Parse name of compression algorithm.
+ * \param [in] name Algorithm name (none, lz4 or zstd).
+ * \param [out] type Parsed algorithm.
+ * \return False when name is unknown or the algorithm is not compiled in.
+ */
+bool ipfix_compression_parse(const char *name, IpfixCompression &type);
+
+/**
+ * \brief Compressor of the IPFIX message stream.
+ *
+ * Whole TCP connection is a single compressed stream. Every message is flushed, so the collector
+ * side can decode it without waiting for more data, while the compression history is kept between
+ * messages. The stream has to be restarted by reset() on every new connection.
+ */
+class IpfixCompressor
+{
+public:
+   IpfixCompressor();
+   ~IpfixCompressor();
+
+   /**
+    * \brief Create compression context.
+    * \param [in] type Compression algorithm.
+    * \param [in] level Compression level, 0 selects the default level of the algorithm.
+    */
+   void init(IpfixCompression type, int level);
+   void close();
+
+   bool enabled() const
+   {
+      return m_type != IpfixCompression::NONE;
+   }
+
+   /**
+    * \brief Start a new compressed stream.
+    */
+   void reset();
+
+   /**
+    * \brief Compress single message.
+    * \param [in] data Message data.
+    * \param [in] length Message length.
+    * \param [out] out Compressed data, valid until the next call.
+    * \param [out] outLength Length of compressed data.
+    * \return False on compression error.
+    */
+   bool compress(const uint8_t *data, size_t length, const uint8_t *&out, size_t &outLength);
+
+   /**
+    * \brief Finish the compressed stream, must be sent before the connection is closed.
+    * \param [out] out Frame epilogue, valid until the next call.
+    * \param [out] outLength Length of the epilogue, 0 when no stream was started.
+    * \return False on compression error.
+    */
+   bool finish(const uint8_t *&out, size_t &outLength);
+
+private:
+   IpfixCompression m_type;
+   int m_level;
+   bool m_started; /**< Stream header was written */
+   void *m_ctx;
+   uint8_t *m_buffer;
+   size_t m_bufferSize;
+
+   bool reserve(size_t size);
+};
+
+}
+#endif /* IPXP_OUTPUT_IPFIX_COMPRESS_HPP */
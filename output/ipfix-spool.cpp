@@ -0,0 +1,135 @@
+/**
+ * \file ipfix-spool.cpp
+ * \brief Memory mapped spool of IPFIX messages waiting for collector
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <ipfixprobe/plugin.hpp>
+
+#include "ipfix-spool.hpp"
+
+namespace ipxp {
+
+IpfixSpool::IpfixSpool() : m_fd(-1), m_data(nullptr), m_size(0), m_head(0), m_tail(0), m_flows(0)
+{
+}
+
+IpfixSpool::~IpfixSpool()
+{
+   close();
+}
+
+void IpfixSpool::open(const std::string &path, uint64_t size)
+{
+   close();
+
+   // Spool file is removed on close, never take over a file which was not created by us
+   m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+   if (m_fd == -1 && errno == EEXIST) {
+      throw PluginError("spool file " + path + " already exists, remove it or choose another path");
+   }
+   if (m_fd == -1) {
+      throw PluginError("unable to create spool file " + path + ": " + strerror(errno));
+   }
+   m_path = path;
+   if (ftruncate(m_fd, size) == -1) {
+      std::string err = strerror(errno);
+      close();
+      throw PluginError("unable to resize spool file " + path + ": " + err);
+   }
+   void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+   if (data == MAP_FAILED) {
+      std::string err = strerror(errno);
+      close();
+      throw PluginError("unable to map spool file " + path + ": " + err);
+   }
+   m_data = static_cast<uint8_t *>(data);
+   m_size = size;
+   m_head = 0;
+   m_tail = 0;
+   m_flows = 0;
+}
+
+void IpfixSpool::close()
+{
+   if (m_data != nullptr) {
+      munmap(m_data, m_size);
+      m_data = nullptr;
+   }
+   if (m_fd != -1) {
+      ::close(m_fd);
+      unlink(m_path.c_str());
+      m_fd = -1;
+   }
+   m_size = 0;
+   m_head = 0;
+   m_tail = 0;
+   m_flows = 0;
+}
+
+bool IpfixSpool::push(const uint8_t *data, uint16_t length, uint16_t flows)
+{
+   if (m_tail + sizeof(Header) + length > m_size) {
+      return false;
+   }
+
+   Header hdr = {length, flows};
+   memcpy(m_data + m_tail, &hdr, sizeof(hdr));
+   memcpy(m_data + m_tail + sizeof(hdr), data, length);
+   m_tail += sizeof(hdr) + length;
+   m_flows += flows;
+   return true;
+}
+
+uint8_t *IpfixSpool::front(uint16_t &length, uint16_t &flows)
+{
+   Header hdr;
+   memcpy(&hdr, m_data + m_head, sizeof(hdr));
+   length = hdr.length;
+   flows = hdr.flows;
+   return m_data + m_head + sizeof(hdr);
+}
+
+void IpfixSpool::pop()
+{
+   Header hdr;
+   memcpy(&hdr, m_data + m_head, sizeof(hdr));
+   m_head += sizeof(hdr) + hdr.length;
+   m_flows -= hdr.flows;
+
+   if (m_head == m_tail) {
+      /* Spool is drained, start from the beginning and release disk blocks of sent messages */
+      fallocate(m_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, m_tail);
+      m_head = 0;
+      m_tail = 0;
+   }
+}
+
+}
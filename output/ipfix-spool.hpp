@@ -0,0 +1,119 @@
+/**
+ * \file ipfix-spool.hpp
+ * \brief Memory mapped spool of IPFIX messages waiting for collector
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+#ifndef IPXP_OUTPUT_IPFIX_SPOOL_HPP
+#define IPXP_OUTPUT_IPFIX_SPOOL_HPP
+
+#include <string>
+#include <cstdint>
+
+namespace ipxp {
+
+/**
+ * \brief Append-only spool of encoded IPFIX messages backed by a memory mapped file.
+ *
+ * Messages are appended to the end of the file and read from the beginning. The file has a fixed
+ * size, when there is no space left new messages are rejected. Space is reclaimed once the spool
+ * is drained completely.
+ *
+ * The file is a scratch file of a single run. It is created by open() and removed by close(),
+ * messages left in it do not survive a restart and an existing file is never reused or overwritten.
+ */
+class IpfixSpool
+{
+public:
+   IpfixSpool();
+   ~IpfixSpool();
+
+   /**
+    * \brief Create spool file and map it to memory.
+    * \param [in] path Path of the spool file, it must not exist.
+    * \param [in] size Size of the spool file in bytes.
+    */
+   void open(const std::string &path, uint64_t size);
+
+   /**
+    * \brief Unmap and remove the spool file.
+    */
+   void close();
+
+   bool enabled() const
+   {
+      return m_data != nullptr;
+   }
+
+   bool empty() const
+   {
+      return m_head == m_tail;
+   }
+
+   /**
+    * \brief Get number of flow records in spooled messages.
+    */
+   uint64_t flows() const
+   {
+      return m_flows;
+   }
+
+   /**
+    * \brief Append message to the end of the spool.
+    * \param [in] data Message data.
+    * \param [in] length Message length.
+    * \param [in] flows Number of flow records in the message.
+    * \return False when the spool is full.
+    */
+   bool push(const uint8_t *data, uint16_t length, uint16_t flows);
+
+   /**
+    * \brief Get the oldest message, spool must not be empty.
+    * \param [out] length Message length.
+    * \param [out] flows Number of flow records in the message.
+    * \return Pointer to the message, it can be modified in place.
+    */
+   uint8_t *front(uint16_t &length, uint16_t &flows);
+
+   /**
+    * \brief Remove the oldest message.
+    */
+   void pop();
+
+private:
+   struct Header {
+      uint16_t length;
+      uint16_t flows;
+   };
+
+   std::string m_path;
+   int m_fd;
+   uint8_t *m_data;
+   uint64_t m_size;
+   uint64_t m_head; /**< Offset of the oldest message */
+   uint64_t m_tail; /**< Offset of the first free byte */
+   uint64_t m_flows;
+};
+
+}
+#endif /* IPXP_OUTPUT_IPFIX_SPOOL_HPP */
@@ -43,6 +43,8 @@
 #include <unistd.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -144,8 +146,12 @@ IPFIXExporter::IPFIXExporter() :
    templateRefreshPackets(TEMPLATE_REFRESH_PACKETS),
    dir_bit_field(0),
    mtu(DEFAULT_MTU), packetDataBuffer(nullptr),
-   tmpltMaxBufferSize(mtu - IPFIX_HEADER_SIZE)
+   tmpltMaxBufferSize(mtu - IPFIX_HEADER_SIZE),
+   sendQueueSize(0), sendQueue(nullptr), sendHead(0), sendTail(0),
+   sendGeneration(0), sendDropped(0), sendStop(false),
+   queueGeneration(0), sender(nullptr)
 {
+   memset(tmpltCache, 0, sizeof(tmpltCache));
 }
 
 IPFIXExporter::~IPFIXExporter()
@@ -177,6 +183,23 @@ void IPFIXExporter::init(const char *params)
       protocol = IPPROTO_UDP;
    }
 
+   if (parser.m_compress != IpfixCompression::NONE) {
+      if (protocol == IPPROTO_UDP) {
+         throw PluginError("compression is supported only with TCP");
+      }
+      if (parser.m_queue != 0) {
+         throw PluginError("compression cannot be combined with background sender queue");
+      }
+      if (!parser.m_mtu_set) {
+         mtu = DEFAULT_COMPRESS_MTU;
+      }
+      compressor.init(parser.m_compress, parser.m_compress_level);
+   }
+
+   if (parser.m_rate != 0) {
+      shaper.init(parser.m_rate / 8, parser.m_burst);
+   }
+
    if (mtu <= IPFIX_HEADER_SIZE) {
       throw PluginError("IPFIX message MTU size should be at least " + std::to_string(IPFIX_HEADER_SIZE));
    }
@@ -186,9 +209,27 @@ void IPFIXExporter::init(const char *params)
       throw PluginError("not enough memory");
    }
 
-   int ret = connect_to_collector();
-   if (ret) {
-      lastReconnect = time(nullptr);
+   if (!parser.m_spool_file.empty()) {
+      if (parser.m_queue != 0) {
+         throw PluginError("spool file cannot be combined with background sender queue");
+      }
+      spool.open(worker_path(parser.m_spool_file), parser.m_spool_size << 20);
+   }
+
+   if (parser.m_queue == 0) {
+      int ret = connect_to_collector();
+      if (ret) {
+         lastReconnect = time(nullptr);
+      }
+   } else {
+      /* Connection is established and maintained by the sender thread */
+      sendQueueSize = 1;
+      while (sendQueueSize < parser.m_queue) {
+         sendQueueSize <<= 1;
+      }
+      sendQueue = new ipfix_queued_packet_t[sendQueueSize];
+      memset(sendQueue, 0, sizeof(ipfix_queued_packet_t) * sendQueueSize);
+      sender = new std::thread(&IPFIXExporter::sender_loop, this);
    }
 
    if (verbose) {
@@ -228,6 +269,50 @@ void IPFIXExporter::close()
 {
    /* Try to flush any remaining data */
    flush();
+   if (spool.enabled()) {
+      drain_spool(UINT32_MAX);
+      m_flows_dropped += spool.flows();
+      spool.close();
+   }
+   if (compressor.enabled() && fd != -1) {
+      /* Finish the compressed stream, so the collector can tell it from a broken connection */
+      const uint8_t *data;
+      size_t length;
+      size_t sent = 0;
+      if (compressor.finish(data, length)) {
+         while (sent < length) {
+            ssize_t ret = send(fd, data + sent, length - sent, 0);
+            if (ret == -1) {
+               if (errno == EINTR) {
+                  continue;
+               }
+               if (verbose) {
+                  perror("VERBOSE: Cannot send end of compressed stream to collector");
+               }
+               break;
+            }
+            sent += ret;
+         }
+      }
+   }
+   compressor.close();
+
+   /* Let the sender thread send queued messages */
+   if (sender != nullptr) {
+      sendStop.store(true, std::memory_order_release);
+      sender->join();
+      delete sender;
+      sender = nullptr;
+      m_flows_dropped += sendDropped.exchange(0, std::memory_order_relaxed);
+   }
+   if (sendQueue != nullptr) {
+      for (uint32_t i = 0; i < sendQueueSize; i++) {
+         free(sendQueue[i].data);
+      }
+      delete [] sendQueue;
+      sendQueue = nullptr;
+      sendQueueSize = 0;
+   }
 
    /* Close the connection */
    if (fd != -1) {
@@ -245,6 +330,10 @@ void IPFIXExporter::close()
       tmp = templates;
    }
    templates = nullptr;
+   for (int i = 0; i < TMPLT_MAP_IDX_CNT; i++) {
+      tmpltMap[i].clear();
+   }
+   memset(tmpltCache, 0, sizeof(tmpltCache));
 
    if (packetDataBuffer != nullptr) {
       free(packetDataBuffer);
@@ -258,14 +347,8 @@ void IPFIXExporter::close()
 
 uint64_t IPFIXExporter::get_template_id(const Record &flow)
 {
-   RecordExt *ext = flow.m_exts;
-   uint64_t tmpltIdx = 0;
-   while (ext != nullptr) {
-      tmpltIdx |= ((uint64_t) 1 << ext->m_ext_id);
-      ext = ext->m_next;
-   }
-
-   return tmpltIdx;
+   // Mask is maintained by Record when extensions are added or removed
+   return flow.m_ext_mask;
 }
 
 template_t *IPFIXExporter::get_template(const Flow &flow)
@@ -273,7 +356,18 @@ template_t *IPFIXExporter::get_template(const Flow &flow)
    int ipTmpltIdx = flow.ip_version == IP::v6 ? TMPLT_IDX_V6 : TMPLT_IDX_V4;
    uint64_t tmpltIdx = get_template_id(flow);
 
-   if (tmpltMap[ipTmpltIdx].find(tmpltIdx) == tmpltMap[ipTmpltIdx].end()) {
+   /* Fibonacci hashing of the mask selects the cache entry. */
+   uint32_t cacheIdx = (tmpltIdx * 0x9E3779B97F4A7C15ULL) >> (64 - __builtin_ctz(TEMPLATE_CACHE_SIZE));
+   if (tmpltCache[ipTmpltIdx][cacheIdx].tmplt != nullptr && tmpltCache[ipTmpltIdx][cacheIdx].id == tmpltIdx) {
+      return tmpltCache[ipTmpltIdx][cacheIdx].tmplt;
+   }
+
+   std::map<uint64_t, template_t *>::iterator it = tmpltMap[ipTmpltIdx].find(tmpltIdx);
+   if (it != tmpltMap[ipTmpltIdx].end()) {
+      tmpltCache[ipTmpltIdx][cacheIdx].id = tmpltIdx;
+      tmpltCache[ipTmpltIdx][cacheIdx].tmplt = it->second;
+      return it->second;
+   } else {
       std::vector<const char *> all_fields;
 
       RecordExt *ext = flow.m_exts;
@@ -302,30 +396,49 @@ template_t *IPFIXExporter::get_template(const Flow &flow)
 
       tmpltMap[TMPLT_IDX_V4][tmpltIdx] = create_template(basic_tmplt_v4, all_fields.data());
       tmpltMap[TMPLT_IDX_V6][tmpltIdx] = create_template(basic_tmplt_v6, all_fields.data());
+      set_template_extensions(tmpltMap[TMPLT_IDX_V4][tmpltIdx], tmpltIdx);
+      set_template_extensions(tmpltMap[TMPLT_IDX_V6][tmpltIdx], tmpltIdx);
    }
 
-   return tmpltMap[ipTmpltIdx][tmpltIdx];
+   tmpltCache[ipTmpltIdx][cacheIdx].id = tmpltIdx;
+   tmpltCache[ipTmpltIdx][cacheIdx].tmplt = tmpltMap[ipTmpltIdx][tmpltIdx];
+   return tmpltCache[ipTmpltIdx][cacheIdx].tmplt;
+}
+
+/**
+ * \brief Store serialization plan of extensions into template.
+ *
+ * Extensions are serialized in order of their IDs, which is the order of their fields in template.
+ * @param tmplt Template
+ * @param extMask Bit mask of extension IDs used by template
+ */
+void IPFIXExporter::set_template_extensions(template_t *tmplt, uint64_t extMask)
+{
+   if (tmplt == nullptr) {
+      return;
+   }
+   tmplt->extCount = 0;
+   while (extMask) {
+      tmplt->extIds[tmplt->extCount++] = __builtin_ctzll(extMask);
+      extMask &= extMask - 1;
+   }
 }
 
-int IPFIXExporter::fill_extensions(RecordExt *ext, uint8_t *buffer, int size)
+int IPFIXExporter::fill_extensions(RecordExt *ext, const template_t *tmplt, uint8_t *buffer, int size)
 {
    int length = 0;
-   int extCnt = 0;
    while (ext != nullptr) {
       extensions[ext->m_ext_id] = ext;
-      extCnt++;
       ext = ext->m_next;
    }
    // TODO: export multiple extension header of same type
-   for (int i = 0; i < extension_cnt; i++) {
-      if (extensions[i] == nullptr) {
-         continue;
-      }
-      int length_ext = extensions[i]->fill_ipfix(buffer + length, size - length);
-      extensions[i] = nullptr;
+   for (int i = 0; i < tmplt->extCount; i++) {
+      int id = tmplt->extIds[i];
+      int length_ext = extensions[id]->fill_ipfix(buffer + length, size - length);
+      extensions[id] = nullptr;
       if (length_ext < 0) {
-         for (int j = i; j < extension_cnt; j++) {
-            extensions[j] = nullptr;
+         for (int j = i + 1; j < tmplt->extCount; j++) {
+            extensions[tmplt->extIds[j]] = nullptr;
          }
          return -1;
       }
@@ -336,21 +449,14 @@ int IPFIXExporter::fill_extensions(RecordExt *ext, uint8_t *buffer, int size)
 
 bool IPFIXExporter::fill_template(const Flow &flow, template_t *tmplt)
 {
-   RecordExt *ext = flow.m_exts;
-   int length = 0;
-
-   if (basic_ifc_num >= 0 && ext == nullptr) {
-      length = fill_basic_flow(flow, tmplt);
-      if (length < 0) {
-         return false;
-      }
-   } else {
-      length = fill_basic_flow(flow, tmplt);
-      if (length < 0) {
-         return false;
-      }
+   /* Single check of fixed part of the record, variable length fields are checked by extensions. */
+   if (tmplt->bufferSize + tmplt->recordMinSize > tmpltMaxBufferSize) {
+      return false;
+   }
 
-      int ext_written = fill_extensions(ext, tmplt->buffer + tmplt->bufferSize + length, tmpltMaxBufferSize - tmplt->bufferSize - length);
+   int length = fill_basic_flow(flow, tmplt);
+   if (tmplt->extCount != 0) {
+      int ext_written = fill_extensions(flow.m_exts, tmplt, tmplt->buffer + tmplt->bufferSize + length, tmpltMaxBufferSize - tmplt->bufferSize - length);
       if (ext_written < 0) {
          return false;
       }
@@ -374,6 +480,10 @@ int IPFIXExporter::export_flow(const Flow &flow)
          return 1;
       }
    }
+   if (!spool.empty()) {
+      /* Spool is drained at the pace of exported flows */
+      drain_spool(1);
+   }
    return 0;
 }
 
@@ -529,6 +639,8 @@ template_t *IPFIXExporter::create_template(const char **tmplt, const char **ext)
 
    newTemplate->fieldCount = 0;
    newTemplate->recordCount = 0;
+   newTemplate->recordMinSize = 0;
+   newTemplate->extCount = 0;
    newTemplate->buffer = (uint8_t *) malloc(sizeof(uint8_t) * tmpltMaxBufferSize);
    if (!newTemplate->buffer) {
       free(newTemplate);
@@ -578,6 +690,7 @@ template_t *IPFIXExporter::create_template(const char **tmplt, const char **ext)
                len = tmpFileRecord->length;
             }
             *((uint16_t *) &newTemplate->templateRecord[newTemplate->templateSize + 2]) = htons(len);
+            newTemplate->recordMinSize += (len == 65535 ? 1 : len);
 
             /* Update template size */
             newTemplate->templateSize += 4;
@@ -762,6 +875,15 @@ void IPFIXExporter::send_templates()
 
    /* Send all new templates */
    if (create_template_packet(&pkt)) {
+      if (sender != nullptr) {
+         /* Queue is full, try to send the templates again with next flush */
+         if (!enqueue_packet(&pkt)) {
+            expire_templates();
+         }
+         free(pkt.data);
+         return;
+      }
+
       /* Send template packet */
       /* After error, the plugin sends all templates after reconnection,
        * so we need not concern about it here */
@@ -781,13 +903,30 @@ void IPFIXExporter::send_data()
 
    /* Send all new templates */
    while (create_data_packet(&pkt)) {
+      if (sender != nullptr) {
+         if (!enqueue_packet(&pkt)) {
+            m_flows_dropped += pkt.flows;
+         }
+         continue;
+      }
+
+      if (!spool.empty()) {
+         /* Keep the order of messages, the packet is sent after spooled ones */
+         spool_packet(&pkt);
+         continue;
+      }
+
       int ret = send_packet(&pkt);
       if (ret == 1) {
          /* Collector reconnected, resend the packet */
          ret = send_packet(&pkt);
       }
       if (ret != 0) {
-         m_flows_dropped += pkt.flows;
+         if (spool.enabled()) {
+            spool_packet(&pkt);
+         } else {
+            m_flows_dropped += pkt.flows;
+         }
       }
    }
 }
@@ -797,11 +936,72 @@ void IPFIXExporter::send_data()
  */
 void IPFIXExporter::flush()
 {
+   if (sender != nullptr) {
+      uint32_t generation = sendGeneration.load(std::memory_order_acquire);
+      if (generation != queueGeneration) {
+         /* Sender lost connection, all templates must be sent again */
+         queueGeneration = generation;
+         expire_templates();
+      }
+      m_flows_dropped += sendDropped.exchange(0, std::memory_order_relaxed);
+   }
+
    /* Send all new templates */
    send_templates();
 
    /* Send the data packet */
    send_data();
+
+   if (!spool.empty()) {
+      drain_spool(SPOOL_DRAIN_BATCH);
+   }
+
+   m_shaping_delay = shaper.delay();
+}
+
+/**
+ * \brief Store data packet to spool, packet is dropped when the spool is full
+ *
+ * \param packet Packet to store
+ */
+void IPFIXExporter::spool_packet(const ipfix_packet_t *packet)
+{
+   if (!spool.push(packet->data, packet->length, packet->flows)) {
+      m_flows_dropped += packet->flows;
+      return;
+   }
+   if (verbose) {
+      fprintf(stderr, "VERBOSE: Packet with %" PRIu16 " flows spooled, %" PRIu64 " flows waiting for collector\n",
+            packet->flows, spool.flows());
+   }
+}
+
+/**
+ * \brief Send spooled data packets while the collector is reachable
+ *
+ * Sequence numbers of the packets are rewritten to match the current connection.
+ *
+ * \param cnt Maximum number of packets to send
+ */
+void IPFIXExporter::drain_spool(uint32_t cnt)
+{
+   ipfix_packet_t pkt;
+
+   while (cnt-- != 0 && !spool.empty()) {
+      pkt.data = spool.front(pkt.length, pkt.flows);
+      ((ipfix_header_t *) pkt.data)->sequenceNumber = htonl(sequenceNum);
+
+      int ret = send_packet(&pkt);
+      if (ret == 1) {
+         /* Collector reconnected, resend the packet */
+         ret = send_packet(&pkt);
+      }
+      if (ret != 0) {
+         /* Collector is still unreachable, keep the packet */
+         return;
+      }
+      spool.pop();
+   }
 }
 
 /**
@@ -815,17 +1015,28 @@ void IPFIXExporter::flush()
 int IPFIXExporter::send_packet(ipfix_packet_t *packet)
 {
    int ret; /* Return value of sendto */
-   int sent = 0; /* Sent data size */
+   size_t sent = 0; /* Sent data size */
+   const uint8_t *data = packet->data; /* Data to send */
+   size_t length = packet->length; /* Size of data to send */
 
    /* Check that connection is OK or drop packet */
    if (reconnect()) {
       return -1;
    }
 
+   if (compressor.enabled() && !compressor.compress(packet->data, packet->length, data, length)) {
+      if (verbose) {
+         fprintf(stderr, "VERBOSE: Cannot compress data\n");
+      }
+      /* State of the compressed stream is unknown, the collector would not decode the rest of it */
+      disconnect();
+      return -1;
+   }
+
    /* sendto() does not guarantee that everything will be send in one piece */
-   while (sent < packet->length) {
+   while (sent < length) {
       /* Send data to collector (TCP and SCTP ignores last two arguments) */
-      ret = sendto(fd, (void *) (packet->data + sent), packet->length - sent, 0,
+      ret = sendto(fd, (void *) (data + sent), length - sent, 0,
             addrinfo->ai_addr, addrinfo->ai_addrlen);
 
       /* Check that the data were sent correctly */
@@ -847,18 +1058,7 @@ int IPFIXExporter::send_packet(ipfix_packet_t *packet)
             if (verbose) {
                fprintf(stderr, "VERBOSE: Collector closed connection\n");
             }
-
-            /* free resources */
-            ::close(fd);
-            fd = -1;
-            freeaddrinfo(addrinfo);
-            addrinfo = nullptr;
-
-            /* Set last connection try time so that we would reconnect immediatelly */
-            lastReconnect = 1;
-
-            /* Reset the sequences number since it is unique per connection */
-            sequenceNum = 0;
+            disconnect();
             ((ipfix_header_t *) packet->data)->sequenceNumber = 0; /* no need to change byteorder of 0 */
 
             /* Say that we should try to connect and send data again */
@@ -868,6 +1068,11 @@ int IPFIXExporter::send_packet(ipfix_packet_t *packet)
             if (verbose) {
                perror("VERBOSE: Cannot send data to collector");
             }
+            if (compressor.enabled() || (sent != 0 && protocol != IPPROTO_UDP)) {
+               /* Compressed stream already contains the message and partially sent message
+                * would desynchronize the stream, so the connection cannot be used anymore */
+               disconnect();
+            }
             return -1;
          }
       }
@@ -882,6 +1087,9 @@ int IPFIXExporter::send_packet(ipfix_packet_t *packet)
    /* Increase packet counter */
    exportedPackets++;
 
+   /* Wait when the rate limit is exceeded, bytes are counted after compression */
+   shaper.consume(length);
+
    if (verbose) {
       fprintf(stderr, "VERBOSE: Packet (%" PRIu64 ") sent to %s on port %" PRIu16 ". Next sequence number is %i\n",
             exportedPackets, host.c_str(), port, sequenceNum);
@@ -968,6 +1176,8 @@ int IPFIXExporter::connect_to_collector()
          if (verbose) {
             fprintf(stderr, "VERBOSE: Successfully connected to collector\n");
          }
+         /* Each connection carries its own compressed stream */
+         compressor.reset();
       }
       break;
    }
@@ -983,6 +1193,25 @@ int IPFIXExporter::connect_to_collector()
    return 0;
 }
 
+/**
+ * \brief Close broken connection
+ *
+ * The connection is established again by reconnect(), which also starts a new compressed stream
+ */
+void IPFIXExporter::disconnect()
+{
+   ::close(fd);
+   fd = -1;
+   freeaddrinfo(addrinfo);
+   addrinfo = nullptr;
+
+   /* Set last connection try time so that we would reconnect immediatelly */
+   lastReconnect = 1;
+
+   /* Reset the sequences number since it is unique per connection */
+   sequenceNum = 0;
+}
+
 /**
  * \brief Checks that connection is OK or tries to reconnect
  *
@@ -1014,7 +1243,286 @@ int IPFIXExporter::reconnect()
    return 0;
 }
 
-#define GEN_FIELDS_SUMLEN_INT(FIELD) FIELD_LEN(FIELD) +
+/**
+ * \brief Copy message to the queue of background sender
+ *
+ * Never blocks, message is not queued when the queue is full.
+ *
+ * @param packet Packet to queue
+ * @return True when packet was queued
+ */
+bool IPFIXExporter::enqueue_packet(const ipfix_packet_t *packet)
+{
+   uint64_t tail = sendTail.load(std::memory_order_relaxed);
+   if (tail - sendHead.load(std::memory_order_acquire) >= sendQueueSize) {
+      return false;
+   }
+
+   ipfix_queued_packet_t *slot = &sendQueue[tail & (sendQueueSize - 1)];
+   if (slot->capacity < packet->length) {
+      uint8_t *data = (uint8_t *) realloc(slot->data, packet->length);
+      if (data == nullptr) {
+         return false;
+      }
+      slot->data = data;
+      slot->capacity = packet->length;
+   }
+   memcpy(slot->data, packet->data, packet->length);
+   slot->length = packet->length;
+   slot->flows = packet->flows;
+   slot->generation = queueGeneration;
+
+   sendTail.store(tail + 1, std::memory_order_release);
+   exportedPackets++;
+   return true;
+}
+
+/**
+ * \brief Drop messages at the head of send queue
+ *
+ * @param head Index of the first queued message, updated
+ * @param cnt Number of messages to drop
+ */
+void IPFIXExporter::sender_drop(uint64_t &head, uint64_t cnt)
+{
+   uint64_t flows = 0;
+   for (uint64_t i = 0; i < cnt; i++) {
+      flows += sendQueue[(head + i) & (sendQueueSize - 1)].flows;
+   }
+   head += cnt;
+   sendHead.store(head, std::memory_order_release);
+   sendDropped.fetch_add(flows, std::memory_order_relaxed);
+}
+
+/**
+ * \brief Close broken connection of the sender thread
+ *
+ * Partially sent message is dropped and the connection generation is changed,
+ * so the output thread sends all templates again.
+ *
+ * @param head Index of the first queued message, updated
+ * @param offset Number of bytes of the first message already sent, reset
+ * @param generation Connection generation, incremented
+ */
+void IPFIXExporter::sender_disconnect(uint64_t &head, uint32_t &offset, uint32_t &generation)
+{
+   if (verbose) {
+      fprintf(stderr, "VERBOSE: Collector closed connection\n");
+   }
+
+   ::close(fd);
+   fd = -1;
+   freeaddrinfo(addrinfo);
+   addrinfo = nullptr;
+
+   /* Set last connection try time so that we would reconnect immediatelly */
+   lastReconnect = 1;
+
+   if (offset != 0) {
+      sender_drop(head, 1);
+      offset = 0;
+   }
+   sendGeneration.store(++generation, std::memory_order_release);
+}
+
+/**
+ * \brief Send batch of queued messages
+ *
+ * Sequence numbers are written to message headers just before sending. UDP messages
+ * are sent using a single sendmmsg call, TCP messages are gathered into a single sendmsg call.
+ * Socket is used in non-blocking mode, partially written TCP message is finished by the next call.
+ *
+ * @param head Index of the first queued message, updated
+ * @param cnt Number of messages to send
+ * @param seq Sequence number of the first message, updated
+ * @param offset Number of bytes of the first message already sent, updated
+ * @return False when connection is broken
+ */
+bool IPFIXExporter::sender_send(uint64_t &head, uint32_t cnt, uint32_t &seq, uint32_t &offset)
+{
+   struct iovec iov[SEND_BATCH_SIZE];
+   uint32_t nextSeq = seq;
+   size_t bytes = 0;
+   int ret;
+
+   for (uint32_t i = 0; i < cnt; i++) {
+      ipfix_queued_packet_t *msg = &sendQueue[(head + i) & (sendQueueSize - 1)];
+      if (i != 0 || offset == 0) {
+         ((ipfix_header_t *) msg->data)->sequenceNumber = htonl(nextSeq);
+      }
+      nextSeq += msg->flows;
+      iov[i].iov_base = msg->data;
+      iov[i].iov_len = msg->length;
+   }
+
+   if (protocol == IPPROTO_UDP) {
+      struct mmsghdr msgs[SEND_BATCH_SIZE];
+      memset(msgs, 0, sizeof(msgs[0]) * cnt);
+      for (uint32_t i = 0; i < cnt; i++) {
+         msgs[i].msg_hdr.msg_name = addrinfo->ai_addr;
+         msgs[i].msg_hdr.msg_namelen = addrinfo->ai_addrlen;
+         msgs[i].msg_hdr.msg_iov = &iov[i];
+         msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+      ret = sendmmsg(fd, msgs, cnt, MSG_DONTWAIT);
+      if (ret > 0) {
+         for (int i = 0; i < ret; i++) {
+            seq += sendQueue[(head + i) & (sendQueueSize - 1)].flows;
+            bytes += iov[i].iov_len;
+         }
+         head += ret;
+         sendHead.store(head, std::memory_order_release);
+      }
+   } else {
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      iov[0].iov_base = (uint8_t *) iov[0].iov_base + offset;
+      iov[0].iov_len -= offset;
+      msg.msg_iov = iov;
+      msg.msg_iovlen = cnt;
+      ret = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (ret > 0) {
+         size_t sent = ret;
+         uint64_t first = head;
+         bytes = ret;
+         for (uint32_t i = 0; i < cnt && sent != 0; i++) {
+            if (sent < iov[i].iov_len) {
+               /* Message was written partially */
+               offset += sent;
+               break;
+            }
+            sent -= iov[i].iov_len;
+            seq += sendQueue[head & (sendQueueSize - 1)].flows;
+            offset = 0;
+            head++;
+         }
+         if (head != first) {
+            sendHead.store(head, std::memory_order_release);
+         }
+      }
+   }
+
+   if (ret == -1) {
+      switch (errno) {
+      case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+      case EWOULDBLOCK:
+#endif
+      {
+         /* Socket buffer is full, wait until the collector reads the data */
+         struct pollfd pfd;
+         pfd.fd = fd;
+         pfd.events = POLLOUT;
+         poll(&pfd, 1, SEND_POLL_TIMEOUT);
+         return true;
+      }
+      case EINTR:
+         return true;
+      case ECONNRESET:
+      case ENOTCONN:
+      case ENOTSOCK:
+      case EPIPE:
+      case EHOSTUNREACH:
+      case ENETDOWN:
+      case ENETUNREACH:
+      case ENOBUFS:
+      case ENOMEM:
+         /* The connection is broken */
+         return false;
+      default:
+         if (verbose) {
+            perror("VERBOSE: Cannot send data to collector");
+         }
+         if (protocol != IPPROTO_UDP) {
+            /* Unknown state of the stream */
+            return false;
+         }
+         sender_drop(head, 1);
+         return true;
+      }
+   }
+
+   /* Sleep per sent batch when the rate limit is exceeded */
+   shaper.consume(bytes);
+
+   if (verbose) {
+      fprintf(stderr, "VERBOSE: Messages sent to %s on port %" PRIu16 ". Next sequence number is %" PRIu32 "\n",
+            host.c_str(), port, seq);
+   }
+   return true;
+}
+
+/**
+ * \brief Main loop of the background sender thread
+ *
+ * Sends messages queued by the output thread and reconnects to the collector after the
+ * connection breaks. Messages queued for a broken connection are dropped, because the
+ * templates they refer to were not sent over the new connection yet.
+ * On stop, remaining messages are sent only while the collector is reachable.
+ */
+void IPFIXExporter::sender_loop()
+{
+   uint32_t generation = 0; /* Connection generation */
+   uint32_t seq = 0; /* Sequence number, unique per connection */
+   uint32_t offset = 0; /* Bytes of the first queued message already sent */
+   uint64_t head = sendHead.load(std::memory_order_relaxed);
+   uint32_t idle = 0; /* Number of empty polls of the queue */
+
+   while (1) {
+      uint64_t tail = sendTail.load(std::memory_order_acquire);
+      bool stop = sendStop.load(std::memory_order_acquire);
+
+      /* Drop messages queued for broken connections */
+      uint64_t stale = 0;
+      while (head + stale != tail && sendQueue[(head + stale) & (sendQueueSize - 1)].generation != generation) {
+         stale++;
+      }
+      if (stale) {
+         sender_drop(head, stale);
+      }
+
+      if (head == tail) {
+         if (stop) {
+            break;
+         }
+         if (++idle < SEND_IDLE_SPIN) {
+            std::this_thread::yield();
+         } else {
+            usleep(SEND_IDLE_SLEEP);
+         }
+         continue;
+      }
+      idle = 0;
+
+      if (fd == -1) {
+         if (lastReconnect == 0 || (time_t) (lastReconnect + reconnectTimeout) <= time(nullptr)) {
+            if (connect_to_collector() == 0) {
+               lastReconnect = 0;
+               seq = 0;
+            } else {
+               lastReconnect = time(nullptr);
+            }
+         }
+         if (fd == -1) {
+            if (stop) {
+               sender_drop(head, tail - head);
+               break;
+            }
+            usleep(SEND_IDLE_SLEEP);
+            continue;
+         }
+      }
+
+      uint64_t cnt = tail - head;
+      if (cnt > SEND_BATCH_SIZE) {
+         cnt = SEND_BATCH_SIZE;
+      }
+      if (!sender_send(head, cnt, seq, offset)) {
+         sender_disconnect(head, offset, generation);
+      }
+   }
+}
+
 #define GEN_FILLFIELDS_INT(TMPLT) IPFIX_FILL_FIELD(p, TMPLT);
 #define GEN_FILLFIELDS_MAXLEN(TMPLT) IPFIX_FILL_FIELD(p, TMPLT);
 
@@ -1027,13 +1535,13 @@ BASIC_TMPLT_V4(GEN_FILLFIELDS_INT) \
 BASIC_TMPLT_V6(GEN_FILLFIELDS_INT) \
 } while (0)
 
-#define GENERATE_FIELDS_SUMLEN(TMPL) TMPL(GEN_FIELDS_SUMLEN_INT) 0
-
 /**
  * \brief Fill template buffer with flow.
+ *
+ * Space for the basic fields is checked by fill_template using recordMinSize of the template.
  * @param flow Flow
  * @param tmplt Template containing buffer
- * @return Number of written bytes or -1 if buffer is not big enough
+ * @return Number of written bytes
  */
 int IPFIXExporter::fill_basic_flow(const Flow &flow, template_t *tmplt)
 {
@@ -1044,10 +1552,6 @@ int IPFIXExporter::fill_basic_flow(const Flow &flow, template_t *tmplt)
    buffer = tmplt->buffer + tmplt->bufferSize;
    p = buffer;
    if (flow.ip_version == IP::v4) {
-      if (tmplt->bufferSize + GENERATE_FIELDS_SUMLEN(BASIC_TMPLT_V4) > tmpltMaxBufferSize) {
-         return -1;
-      }
-
       /* Temporary disable warnings about breaking string-aliasing, since it is produced by
        * if-branches that are never going to be used - generated by C-preprocessor.
        */
@@ -1062,10 +1566,6 @@ int IPFIXExporter::fill_basic_flow(const Flow &flow, template_t *tmplt)
 #endif
 
    } else {
-      if (tmplt->bufferSize + GENERATE_FIELDS_SUMLEN(BASIC_TMPLT_V6) > tmpltMaxBufferSize) {
-         return -1;
-      }
-
       /* Temporary disable warnings about breaking string-aliasing, since it is produced by
        * if-branches that are never going to be used - generated by C-preprocessor.
        */
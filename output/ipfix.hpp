@@ -40,6 +40,8 @@
 
 #include <vector>
 #include <map>
+#include <atomic>
+#include <thread>
 
 #include <ipfixprobe/output.hpp>
 #include <ipfixprobe/process.hpp>
@@ -47,6 +49,10 @@
 #include <ipfixprobe/utils.hpp>
 #include <ipfixprobe/flowifc.hpp>
 #include <ipfixprobe/ipfix-elements.hpp>
+#include <ipfixprobe/token-bucket.hpp>
+
+#include "ipfix-spool.hpp"
+#include "ipfix-compress.hpp"
 
 #define COUNT_IPFIX_TEMPLATES(T) + 1
 
@@ -54,6 +60,7 @@
 #define FIRST_TEMPLATE_ID 258
 #define IPFIX_VERISON 10
 #define DEFAULT_MTU 1458 /* 1500 - (ethernet 14 + ip 20 + udp 8) */
+#define DEFAULT_COMPRESS_MTU 32768 /* Message size used with compression, messages are not bound by link MTU */
 #define PACKET_DATA_SIZE DEFAULT_MTU
 #define IPFIX_HEADER_SIZE 16
 #define IPFIX_SET_HEADER_SIZE 4
@@ -63,6 +70,14 @@
 #define RECONNECT_TIMEOUT 60
 #define TEMPLATE_REFRESH_TIME 600
 #define TEMPLATE_REFRESH_PACKETS 0
+#define TEMPLATE_CACHE_SIZE 64 /* Number of direct mapped template cache entries, power of two */
+#define DEFAULT_SEND_QUEUE 0 /* Number of messages queued for background sender, 0 sends from output thread */
+#define SEND_BATCH_SIZE 32 /* Max number of messages passed to the kernel by a single system call */
+#define SEND_IDLE_SPIN 1024 /* Number of empty polls of the send queue before sender thread starts to sleep */
+#define SEND_IDLE_SLEEP 100 /* Sender thread sleep in microseconds when there is nothing to send */
+#define SEND_POLL_TIMEOUT 100 /* Time in milliseconds to wait for socket to become writable */
+#define DEFAULT_SPOOL_SIZE 256 /* Size of spool file in MiB */
+#define SPOOL_DRAIN_BATCH 16 /* Max number of spooled messages sent by single flush */
 
 namespace ipxp {
 
@@ -72,22 +87,33 @@ public:
    std::string m_host;
    uint16_t m_port;
    uint16_t m_mtu;
+   bool m_mtu_set;
    bool m_udp;
    uint64_t m_id;
    uint32_t m_dir;
    uint32_t m_template_refresh_time;
+   uint32_t m_queue;
+   std::string m_spool_file;
+   uint64_t m_spool_size;
+   IpfixCompression m_compress;
+   int m_compress_level;
+   uint64_t m_rate;
+   uint64_t m_burst;
    bool m_verbose;
 
    IpfixOptParser() : OptionsParser("ipfix", "Output plugin for ipfix export"),
-      m_host("127.0.0.1"), m_port(4739), m_mtu(DEFAULT_MTU), m_udp(false), m_id(DEFAULT_EXPORTER_ID), m_dir(0), 
-      m_template_refresh_time(TEMPLATE_REFRESH_TIME), m_verbose(false)
+      m_host("127.0.0.1"), m_port(4739), m_mtu(DEFAULT_MTU), m_mtu_set(false), m_udp(false), m_id(DEFAULT_EXPORTER_ID), m_dir(0), 
+      m_template_refresh_time(TEMPLATE_REFRESH_TIME), m_queue(DEFAULT_SEND_QUEUE),
+      m_spool_file(""), m_spool_size(DEFAULT_SPOOL_SIZE), m_compress(IpfixCompression::NONE), m_compress_level(0),
+      m_rate(0), m_burst(0), m_verbose(false)
    {
       register_option("h", "host", "ADDR", "Remote collector address", [this](const char *arg){m_host = arg; return true;}, OptionFlags::RequiredArgument);
       register_option("p", "port", "PORT", "Remote collector port",
          [this](const char *arg){try {m_port = str2num<decltype(m_port)>(arg);} catch(std::invalid_argument &e) {return false;} return true;},
          OptionFlags::RequiredArgument);
       register_option("m", "mtu", "SIZE", "Maximum size of ipfix packet payload sent",
-         [this](const char *arg){try {m_mtu = str2num<decltype(m_mtu)>(arg);} catch(std::invalid_argument &e) {return false;} return true;},
+         [this](const char *arg){try {m_mtu = str2num<decltype(m_mtu)>(arg);} catch(std::invalid_argument &e) {return false;}
+         m_mtu_set = true; return true;},
          OptionFlags::RequiredArgument);
       register_option("u", "udp", "", "Use UDP protocol", [this](const char *arg){m_udp = true; return true;}, OptionFlags::NoArgument);
       register_option("I", "id", "NUM", "Exporter identification",
@@ -99,8 +125,49 @@ public:
       register_option("t", "template", "NUM", "Template refresh rate (sec)",
          [this](const char *arg){try {m_template_refresh_time = str2num<decltype(m_template_refresh_time)>(arg);} 
          catch(std::invalid_argument &e) {return false;} return true;}, OptionFlags::RequiredArgument);
+      register_option("q", "queue", "SIZE", "Send messages from background thread using queue of SIZE messages, 0 sends from output thread (default)",
+         [this](const char *arg){try {m_queue = str2num<decltype(m_queue)>(arg);} catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
+      register_option("sf", "spool-file", "PATH", "Store messages to memory mapped file PATH while collector is unreachable, \".N\" is appended with index of output worker when more workers run. The file must not exist, it is removed on exit and spooled messages do not survive a restart",
+         [this](const char *arg){m_spool_file = arg; return true;}, OptionFlags::RequiredArgument);
+      register_option("ss", "spool-size", "MIB", "Size of the spool file in MiB (default 256)",
+         [this](const char *arg){try {m_spool_size = str2num<decltype(m_spool_size)>(arg);} catch(std::invalid_argument &e) {return false;}
+         return m_spool_size > 0;}, OptionFlags::RequiredArgument);
+      register_option("c", "compress", "ALG", "Compress TCP stream using lz4 or zstd (when compiled in), default none",
+         [this](const char *arg){return ipfix_compression_parse(arg, m_compress);}, OptionFlags::RequiredArgument);
+      register_option("cl", "compress-level", "NUM", "Compression level, 0 selects default level of the algorithm",
+         [this](const char *arg){try {m_compress_level = str2num<decltype(m_compress_level)>(arg);} catch(std::invalid_argument &e) {return false;}
+         return true;}, OptionFlags::RequiredArgument);
+      register_option("r", "rate", "RATE", "Limit export to RATE bits per second of IPFIX messages, k, M and G suffixes are accepted",
+         [this](const char *arg){return parse_rate(arg, m_rate) && m_rate >= 8;}, OptionFlags::RequiredArgument);
+      register_option("b", "burst", "BYTES", "Burst size of the rate limit in bytes (default 100 ms of traffic)",
+         [this](const char *arg){try {m_burst = str2num<decltype(m_burst)>(arg);} catch(std::invalid_argument &e) {return false;}
+         return true;}, OptionFlags::RequiredArgument);
       register_option("v", "verbose", "", "Enable verbose mode", [this](const char *arg){m_verbose = true; return true;}, OptionFlags::NoArgument);
    }
+
+private:
+   static bool parse_rate(const char *arg, uint64_t &rate)
+   {
+      std::string str(arg);
+      uint64_t mult = 1;
+      if (!str.empty()) {
+         switch (str.back()) {
+         case 'k': case 'K': mult = 1000; break;
+         case 'm': case 'M': mult = 1000000; break;
+         case 'g': case 'G': mult = 1000000000; break;
+         }
+         if (mult != 1) {
+            str.pop_back();
+         }
+      }
+      try {
+         rate = str2num<uint64_t>(str) * mult;
+      } catch (std::invalid_argument &e) {
+         return false;
+      }
+      return true;
+   }
 };
 
 typedef struct {
@@ -121,6 +188,9 @@ typedef struct template_t {
 	uint16_t bufferSize; /**< Size of data buffer */
 	uint16_t recordCount; /**< Number of records in buffer */
 	uint16_t fieldCount; /**< Number of elements in template */
+	uint16_t recordMinSize; /**< Size of fixed length fields plus 1 byte for each variable length field */
+	uint8_t extCount; /**< Number of extensions serialized by the template */
+	uint8_t extIds[64]; /**< Extension IDs in serialization order */
 	uint8_t exported; /**< 1 indicates that the template was exported to collector*/
 	time_t exportTime; /**< Time when the template was last exported */
 	uint64_t exportPacket; /**< Number of packet when the template was last exported */
@@ -136,6 +206,17 @@ typedef struct {
 	uint16_t flows; /**< Number of flow records in the packet */
 } ipfix_packet_t;
 
+/**
+ * \brief IPFIX message waiting in the queue of background sender
+ */
+typedef struct {
+	uint8_t *data; /**< Buffer for data */
+	uint32_t capacity; /**< Size of allocated buffer */
+	uint16_t length; /**< Length of data */
+	uint16_t flows; /**< Number of flow records in the packet */
+	uint32_t generation; /**< Connection generation the message was created for */
+} ipfix_queued_packet_t;
+
 /**
  * \brief IPFIX header structure
  *
@@ -251,6 +332,10 @@ private:
    RecordExt **extensions;
    int extension_cnt;
    std::map<uint64_t, template_t *> tmpltMap[TMPLT_MAP_IDX_CNT];
+   struct {
+      uint64_t id; /**< Extension bit mask of cached template */
+      template_t *tmplt;
+   } tmpltCache[TMPLT_MAP_IDX_CNT][TEMPLATE_CACHE_SIZE]; /**< Direct mapped cache in front of tmpltMap */
    template_t *templates; /**< Templates in use by plugin */
 	uint16_t templatesDataSize; /**< Total data size stored in templates */
    int basic_ifc_num;
@@ -279,6 +364,21 @@ private:
    uint8_t *packetDataBuffer; /**< Data buffer to store packet */
    uint16_t tmpltMaxBufferSize; /**< Size of template buffer, tmpltBufferSize < packetDataBuffer */
 
+   /* Background sender */
+   uint32_t sendQueueSize; /**< Number of queue slots (power of two), 0 when sender is disabled */
+   ipfix_queued_packet_t *sendQueue; /**< Single producer single consumer queue of messages */
+   std::atomic<uint64_t> sendHead; /**< Number of messages processed by sender thread */
+   std::atomic<uint64_t> sendTail; /**< Number of messages enqueued by output thread */
+   std::atomic<uint32_t> sendGeneration; /**< Incremented by sender thread when connection breaks */
+   std::atomic<uint64_t> sendDropped; /**< Flows dropped by sender thread */
+   std::atomic<bool> sendStop;
+   uint32_t queueGeneration; /**< Generation of connection the templates were queued for */
+   std::thread *sender;
+
+   IpfixSpool spool; /**< Messages waiting for collector to become reachable */
+   IpfixCompressor compressor; /**< Compressor of TCP stream */
+   TokenBucket shaper; /**< Limit of sent bytes per second */
+
    void init_template_buffer(template_t *tmpl);
    int fill_template_set_header(uint8_t *ptr, uint16_t size);
    void check_template_lifetime(template_t *tmpl);
@@ -293,8 +393,17 @@ private:
    int send_packet(ipfix_packet_t *packet);
    int connect_to_collector();
    int reconnect();
+   void disconnect();
+   bool enqueue_packet(const ipfix_packet_t *packet);
+   void sender_loop();
+   bool sender_send(uint64_t &head, uint32_t cnt, uint32_t &seq, uint32_t &offset);
+   void sender_drop(uint64_t &head, uint64_t cnt);
+   void sender_disconnect(uint64_t &head, uint32_t &offset, uint32_t &generation);
+   void spool_packet(const ipfix_packet_t *packet);
+   void drain_spool(uint32_t cnt);
    int fill_basic_flow(const Flow &flow, template_t *tmplt);
-   int fill_extensions(RecordExt *ext, uint8_t *buffer, int size);
+   int fill_extensions(RecordExt *ext, const template_t *tmplt, uint8_t *buffer, int size);
+   void set_template_extensions(template_t *tmplt, uint64_t extMask);
 
    uint64_t get_template_id(const Record &flow);
    template_t *get_template(const Flow &flow);
@@ -29,10 +29,11 @@
 #include <config.h>
 
 #include <string>
-#include <ostream>
-#include <fstream>
-#include <iomanip>
-#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "text.hpp"
 
@@ -44,8 +45,13 @@ __attribute__((constructor)) static void register_this_plugin()
    register_plugin(&rec);
 }
 
-TextExporter::TextExporter() : m_out(&std::cout), m_hide_mac(false)
+TextExporter::TextExporter() : m_fd(STDOUT_FILENO), m_hide_mac(false), m_json(false), m_line_flush(false),
+   m_buffer(nullptr), m_pos(0), m_ext_buffer(nullptr)
 {
+   for (int i = 0; i < 2; i++) {
+      m_time_cache[i].sec = -1;
+      m_time_cache[i].len = 0;
+   }
 }
 
 TextExporter::~TextExporter()
@@ -63,101 +69,307 @@ void TextExporter::init(const char *params)
    }
 
    if (parser.m_to_file) {
-      std::ofstream *file = new std::ofstream(parser.m_file, std::ofstream::out);
-      if (file->fail()) {
+      std::string file = worker_path(parser.m_file);
+      m_fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (m_fd < 0) {
+         m_fd = STDOUT_FILENO;
          throw PluginError("failed to open output file");
       }
-      m_out = file;
+   } else if (m_worker_cnt > 1) {
+      throw PluginError("multiple output workers would interleave records on standard output, use file option");
    }
    m_hide_mac = parser.m_hide_mac;
+   m_json = parser.m_json;
+   m_line_flush = isatty(m_fd);
+   m_buffer = new char[TEXT_BUFFER_SIZE];
+   m_ext_buffer = new char[TEXT_EXT_BUFFER_SIZE];
 
-   if (!m_hide_mac) {
-      *m_out << "mac ";
+   if (!m_json) {
+      if (!m_hide_mac) {
+         append("mac ", 4);
+      }
+      const char *header = "conversation packets bytes tcp-flags time extensions\n";
+      append(header, strlen(header));
+      write_buffer();
    }
-   *m_out << "conversation packets bytes tcp-flags time extensions" << std::endl;
 }
 
 void TextExporter::init(const char *params, Plugins &plugins)
 {
    init(params);
+
+   for (auto &it : plugins) {
+      RecordExt *ext = it.second->get_ext();
+      if (ext == nullptr) {
+         continue;
+      }
+      if (m_ext_names.size() <= static_cast<size_t>(ext->m_ext_id)) {
+         m_ext_names.resize(ext->m_ext_id + 1);
+      }
+      m_ext_names[ext->m_ext_id] = it.first;
+      delete ext;
+   }
 }
 
 void TextExporter::close()
 {
-   if (m_out != &std::cout) {
-      delete m_out;
-      m_out = &std::cout;
+   if (m_buffer != nullptr) {
+      flush();
+      delete [] m_buffer;
+      delete [] m_ext_buffer;
+      m_buffer = nullptr;
+      m_ext_buffer = nullptr;
+   }
+   if (m_fd != STDOUT_FILENO) {
+      ::close(m_fd);
+      m_fd = STDOUT_FILENO;
    }
 }
 
 int TextExporter::export_flow(const Flow &flow)
 {
-   RecordExt *ext = flow.m_exts;
-
    m_flows_seen++;
-   print_basic_flow(flow);
-   while (ext != nullptr) {
-      *m_out << " " << ext->get_text();
-      ext = ext->m_next;
+   if (m_json) {
+      print_json_flow(flow);
+   } else {
+      print_basic_flow(flow);
+      for (RecordExt *ext = flow.m_exts; ext != nullptr; ext = ext->m_next) {
+         append(" ", 1);
+         print_extension(ext);
+      }
    }
-   *m_out << std::endl;
+   append("\n", 1);
 
+   if (m_line_flush) {
+      write_buffer();
+   }
    return 0;
 }
 
+void TextExporter::flush()
+{
+   try {
+      write_buffer();
+   } catch (PluginError &e) {
+      // Output is broken, the error is reported by the next export_flow call
+   }
+}
+
+void TextExporter::write_buffer()
+{
+   size_t done = 0;
+   while (done < m_pos) {
+      ssize_t ret = write(m_fd, m_buffer + done, m_pos - done);
+      if (ret < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         m_pos = 0;
+         throw PluginError(std::string("unable to write output: ") + strerror(errno));
+      }
+      done += ret;
+   }
+   m_pos = 0;
+}
+
+char *TextExporter::reserve(size_t len)
+{
+   if (TEXT_BUFFER_SIZE - m_pos < len) {
+      write_buffer();
+   }
+   return m_buffer + m_pos;
+}
+
+void TextExporter::append(const char *data, size_t len)
+{
+   while (len) {
+      if (m_pos == TEXT_BUFFER_SIZE) {
+         write_buffer();
+      }
+      size_t chunk = TEXT_BUFFER_SIZE - m_pos < len ? TEXT_BUFFER_SIZE - m_pos : len;
+      memcpy(m_buffer + m_pos, data, chunk);
+      m_pos += chunk;
+      data += chunk;
+      len -= chunk;
+   }
+}
+
+void TextExporter::put_time(TextWriter &out, const struct timeval &tv, TimeCache &cache)
+{
+   if (tv.tv_sec != cache.sec) {
+      struct tm tm;
+      time_t sec = tv.tv_sec;
+      localtime_r(&sec, &tm);
+      cache.len = strftime(cache.text, sizeof(cache.text), "%FT%T", &tm);
+      cache.sec = tv.tv_sec;
+   }
+   out.put(cache.text, cache.len);
+   out.put('.');
+   out.put_uint(tv.tv_usec, 6, '0');
+}
+
+static void put_ip(TextWriter &out, const ipaddr_t &ip, uint8_t version)
+{
+   if (version == IP::v4) {
+      out.put_ipv4(ip.v4);
+   } else if (version == IP::v6) {
+      out.put_ipv6(ip.v6);
+   }
+}
+
 void TextExporter::print_basic_flow(const Flow &flow)
 {
-   time_t sec;
-   char time_begin[100];
-   char time_end[100];
-   char src_mac[18];
-   char dst_mac[18];
-   char tmp[50];
-   char src_ip[INET6_ADDRSTRLEN];
-   char dst_ip[INET6_ADDRSTRLEN];
-   std::string lb = "";
-   std::string rb = "";
-
-   sec = flow.time_first.tv_sec;
-   strftime(tmp, sizeof(tmp), "%FT%T", localtime(&sec));
-   snprintf(time_begin, sizeof(time_begin), "%s.%06ld", tmp, flow.time_first.tv_usec);
-   sec = flow.time_last.tv_sec;
-   strftime(tmp, sizeof(tmp), "%FT%T", localtime(&sec));
-   snprintf(time_end, sizeof(time_end), "%s.%06ld", tmp, flow.time_last.tv_usec);
-
-   const uint8_t *p = const_cast<uint8_t *>(flow.src_mac);
-   snprintf(src_mac, sizeof(src_mac), "%02x:%02x:%02x:%02x:%02x:%02x", p[0], p[1], p[2], p[3], p[4], p[5]);
-   p = const_cast<uint8_t *>(flow.dst_mac);
-   snprintf(dst_mac, sizeof(dst_mac), "%02x:%02x:%02x:%02x:%02x:%02x", p[0], p[1], p[2], p[3], p[4], p[5]);
-
-   if (flow.ip_version == IP::v4) {
-      inet_ntop(AF_INET, (const void *) &flow.src_ip.v4, src_ip, INET6_ADDRSTRLEN);
-      inet_ntop(AF_INET, (const void *) &flow.dst_ip.v4, dst_ip, INET6_ADDRSTRLEN);
-   } else if (flow.ip_version == IP::v6) {
-      inet_ntop(AF_INET6, (const void *) &flow.src_ip.v6, src_ip, INET6_ADDRSTRLEN);
-      inet_ntop(AF_INET6, (const void *) &flow.dst_ip.v6, dst_ip, INET6_ADDRSTRLEN);
+   TextWriter out(reserve(TEXT_MAX_BASIC), TEXT_MAX_BASIC);
+   const char *lb = "";
+   const char *rb = "";
+
+   if (flow.ip_version == IP::v6) {
       lb = "[";
       rb = "]";
    }
 
    if (!m_hide_mac) {
-      *m_out << src_mac << "->" << dst_mac << " ";
-   }
-   *m_out <<
-      std::setw(2) << static_cast<unsigned>(flow.ip_proto) <<
-      "@" <<
-      lb << src_ip << rb << ":" << flow.src_port <<
-      "->" <<
-      lb << dst_ip << rb << ":" << flow.dst_port <<
-      " " <<
-      flow.src_packets << "->" << flow.dst_packets <<
-      " " <<
-      flow.src_bytes << "->" << flow.dst_bytes <<
-      " " <<
-      static_cast<unsigned>(flow.src_tcp_flags) << "->" << static_cast<unsigned>(flow.dst_tcp_flags) <<
-      " " <<
-      time_begin << "->" << time_end;
+      out.put_mac(flow.src_mac);
+      out.put("->");
+      out.put_mac(flow.dst_mac);
+      out.put(' ');
+   }
+   out.put_uint(flow.ip_proto, 2);
+   out.put('@');
+   out.put(lb);
+   put_ip(out, flow.src_ip, flow.ip_version);
+   out.put(rb);
+   out.put(':');
+   out.put_uint(flow.src_port);
+   out.put("->");
+   out.put(lb);
+   put_ip(out, flow.dst_ip, flow.ip_version);
+   out.put(rb);
+   out.put(':');
+   out.put_uint(flow.dst_port);
+   out.put(' ');
+   out.put_uint(flow.src_packets);
+   out.put("->");
+   out.put_uint(flow.dst_packets);
+   out.put(' ');
+   out.put_uint(flow.src_bytes);
+   out.put("->");
+   out.put_uint(flow.dst_bytes);
+   out.put(' ');
+   out.put_uint(flow.src_tcp_flags);
+   out.put("->");
+   out.put_uint(flow.dst_tcp_flags);
+   out.put(' ');
+   put_time(out, flow.time_first, m_time_cache[0]);
+   out.put("->");
+   put_time(out, flow.time_last, m_time_cache[1]);
 
+   m_pos += out.result();
+}
+
+void TextExporter::print_extension(const RecordExt *ext)
+{
+   int len = ext->write_text(m_buffer + m_pos, TEXT_BUFFER_SIZE - m_pos);
+   if (len < 0) {
+      write_buffer();
+      len = ext->write_text(m_buffer, TEXT_BUFFER_SIZE);
+   }
+   if (len < 0) {
+      std::string text = ext->get_text();
+      append(text.data(), text.size());
+   } else {
+      m_pos += len;
+   }
+}
+
+void TextExporter::print_json_flow(const Flow &flow)
+{
+   TextWriter out(reserve(TEXT_MAX_BASIC), TEXT_MAX_BASIC);
+
+   out.put("{\"time_first\":\"");
+   put_time(out, flow.time_first, m_time_cache[0]);
+   out.put("\",\"time_last\":\"");
+   put_time(out, flow.time_last, m_time_cache[1]);
+   out.put('"');
+   if (!m_hide_mac) {
+      out.put(",\"src_mac\":\"");
+      out.put_mac(flow.src_mac);
+      out.put("\",\"dst_mac\":\"");
+      out.put_mac(flow.dst_mac);
+      out.put('"');
+   }
+   out.put(",\"ip_version\":");
+   out.put_uint(flow.ip_version);
+   out.put(",\"ip_proto\":");
+   out.put_uint(flow.ip_proto);
+   out.put(",\"src_ip\":\"");
+   put_ip(out, flow.src_ip, flow.ip_version);
+   out.put("\",\"dst_ip\":\"");
+   put_ip(out, flow.dst_ip, flow.ip_version);
+   out.put("\",\"src_port\":");
+   out.put_uint(flow.src_port);
+   out.put(",\"dst_port\":");
+   out.put_uint(flow.dst_port);
+   out.put(",\"src_packets\":");
+   out.put_uint(flow.src_packets);
+   out.put(",\"dst_packets\":");
+   out.put_uint(flow.dst_packets);
+   out.put(",\"src_bytes\":");
+   out.put_uint(flow.src_bytes);
+   out.put(",\"dst_bytes\":");
+   out.put_uint(flow.dst_bytes);
+   out.put(",\"src_tcp_flags\":");
+   out.put_uint(flow.src_tcp_flags);
+   out.put(",\"dst_tcp_flags\":");
+   out.put_uint(flow.dst_tcp_flags);
+   m_pos += out.result();
+
+   for (RecordExt *ext = flow.m_exts; ext != nullptr; ext = ext->m_next) {
+      print_json_extension(ext);
+   }
+   append("}", 1);
+}
+
+void TextExporter::print_json_extension(const RecordExt *ext)
+{
+   static const char hex[] = "0123456789abcdef";
+   std::string text;
+   const char *data = m_ext_buffer;
+   int len = ext->write_text(m_ext_buffer, TEXT_EXT_BUFFER_SIZE);
+   if (len < 0) {
+      text = ext->get_text();
+      data = text.data();
+      len = text.size();
+   }
+
+   append(",\"", 2);
+   if (static_cast<size_t>(ext->m_ext_id) < m_ext_names.size() && !m_ext_names[ext->m_ext_id].empty()) {
+      append(m_ext_names[ext->m_ext_id].data(), m_ext_names[ext->m_ext_id].size());
+   } else {
+      std::string name = "ext" + std::to_string(ext->m_ext_id);
+      append(name.data(), name.size());
+   }
+   append("\":\"", 3);
+
+   // Escape quotes, backslashes and control characters, copy the rest in runs
+   int run = 0;
+   for (int i = 0; i < len; i++) {
+      unsigned char c = data[i];
+      if (c != '"' && c != '\\' && c >= 0x20) {
+         continue;
+      }
+      append(data + run, i - run);
+      run = i + 1;
+      if (c == '"' || c == '\\') {
+         char esc[2] = {'\\', static_cast<char>(c)};
+         append(esc, 2);
+      } else {
+         char esc[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+         append(esc, 6);
+      }
+   }
+   append(data + run, len - run);
+   append("\"", 1);
 }
 
 }
@@ -32,32 +32,47 @@
 #include <config.h>
 
 #include <string>
+#include <vector>
 
 #include <ipfixprobe/output.hpp>
 #include <ipfixprobe/process.hpp>
 #include <ipfixprobe/flowifc.hpp>
 #include <ipfixprobe/utils.hpp>
 #include <ipfixprobe/options.hpp>
+#include <ipfixprobe/text-writer.hpp>
 
 namespace ipxp {
 
+#define TEXT_BUFFER_SIZE (1 << 20) /**< Size of output buffer, it is written by a single write() call. */
+#define TEXT_EXT_BUFFER_SIZE 65536 /**< Size of buffer for text of a single extension in JSON mode. */
+#define TEXT_MAX_BASIC 512 /**< Maximal length of text of basic flow fields. */
+
 class TextOptParser : public OptionsParser
 {
 public:
    std::string m_file;
    bool m_to_file;
    bool m_hide_mac;
+   bool m_json;
 
    TextOptParser() : OptionsParser("text", "Output plugin for text export"),
-      m_file(""), m_to_file(false), m_hide_mac(false)
+      m_file(""), m_to_file(false), m_hide_mac(false), m_json(false)
    {
-      register_option("f", "file", "PATH", "Print output to file",
+      register_option("f", "file", "PATH", "Print output to file, \".N\" is appended with index of output worker when more workers run",
          [this](const char *arg){m_file = arg; m_to_file = true; return true;}, OptionFlags::RequiredArgument);
       register_option("m", "mac", "", "Hide mac addresses",
          [this](const char *arg){m_hide_mac = true; return true;}, OptionFlags::NoArgument);
+      register_option("j", "json", "", "Print flows as JSON objects, one per line",
+         [this](const char *arg){m_json = true; return true;}, OptionFlags::NoArgument);
    }
 };
 
+/**
+ * \brief Exporter printing flows in human readable text or JSON lines.
+ *
+ * Lines are formatted directly into an output buffer which is written when full, when the output
+ * plugin is flushed or, when printing to a terminal, after every flow.
+ */
 class TextExporter : public OutputPlugin
 {
 public:
@@ -69,12 +84,36 @@ public:
    OptionsParser *get_parser() const { return new TextOptParser(); }
    std::string get_name() const { return "text"; }
    int export_flow(const Flow &flow);
+   void flush();
 
 private:
-   std::ostream *m_out;
+   /**
+    * \brief Formatted time of the last flow, localtime() is called only when second changes.
+    */
+   struct TimeCache {
+      time_t sec;
+      char text[32];
+      size_t len;
+   };
+
+   int m_fd;
    bool m_hide_mac;
+   bool m_json;
+   bool m_line_flush;
+   char *m_buffer;
+   size_t m_pos;
+   char *m_ext_buffer;
+   std::vector<std::string> m_ext_names;
+   TimeCache m_time_cache[2];
 
+   void write_buffer();
+   void append(const char *data, size_t len);
+   char *reserve(size_t len);
+   void put_time(TextWriter &out, const struct timeval &tv, TimeCache &cache);
    void print_basic_flow(const Flow &flow);
+   void print_extension(const RecordExt *ext);
+   void print_json_flow(const Flow &flow);
+   void print_json_extension(const RecordExt *ext);
 };
 
 }
@@ -36,6 +36,8 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <cstring>
+#include <iterator>
 #include <libtrap/trap.h>
 #include <unirec/unirec.h>
 
@@ -81,7 +83,7 @@ UR_FIELDS (
  */
 UnirecExporter::UnirecExporter() : m_basic_idx(-1), m_ext_cnt(0),
    m_ifc_map(nullptr), m_tmplts(nullptr), m_records(nullptr), m_ifc_cnt(0),
-   m_ext_id_flgs(nullptr), m_eof(false), m_odid(false), m_link_bit_field(0),
+   m_eof(false), m_odid(false), m_link_bit_field(0),
    m_dir_bit_field(0)
 {
 }
@@ -112,7 +114,7 @@ static int count_trap_interfaces(const char *spec)
    return ifc_cnt;
 }
 
-int UnirecExporter::init_trap(std::string &ifcs, int verbosity)
+int UnirecExporter::init_trap(std::string &ifcs, int verbosity, bool buffer, uint64_t autoflush)
 {
    trap_ifc_spec_t ifc_spec;
    std::vector<char> spec_str(ifcs.c_str(), ifcs.c_str() + ifcs.size() + 1);
@@ -144,6 +146,8 @@ int UnirecExporter::init_trap(std::string &ifcs, int verbosity)
    }
    for (int i = 0; i < ifc_cnt; i++) {
       trap_ifcctl(TRAPIFC_OUTPUT, i, TRAPCTL_SETTIMEOUT, TRAP_HALFWAIT);
+      trap_ifcctl(TRAPIFC_OUTPUT, i, TRAPCTL_BUFFERSWITCH, buffer ? 1 : 0);
+      trap_ifcctl(TRAPIFC_OUTPUT, i, TRAPCTL_AUTOFLUSH_TIMEOUT, autoflush);
    }
    return ifc_cnt;
 }
@@ -164,19 +168,26 @@ void UnirecExporter::init(const char *params)
    if (parser.m_ifc.empty()) {
       throw PluginError("specify libtrap interface specifier");
    }
+   if (m_worker_cnt > 1) {
+      // libtrap is initialized once per process and every instance would open the same interfaces
+      throw PluginError("multiple output workers are not supported");
+   }
    m_odid = parser.m_odid;
    m_eof = parser.m_eof;
    m_link_bit_field = parser.m_id;
    m_dir_bit_field = parser.m_dir;
    m_group_map = parser.m_ifc_map;
-   m_ifc_cnt = init_trap(parser.m_ifc, parser.m_verbose);
+   m_ifc_cnt = init_trap(parser.m_ifc, parser.m_verbose, parser.m_buffer, parser.m_autoflush);
    m_ext_cnt = get_extension_cnt();
+   if (m_ext_cnt > 64 || m_ifc_cnt > 64) {
+      throw PluginError("output plugin operates only with up to 64 running plugins and interfaces");
+   }
 
    try {
       m_tmplts = new ur_template_t*[m_ifc_cnt];
       m_records = new void*[m_ifc_cnt];
       m_ifc_map = new int[m_ext_cnt];
-      m_ext_id_flgs = new int[m_ext_cnt];
+      m_layouts.resize(m_ifc_cnt);
    } catch (std::bad_alloc &e) {
       throw PluginError("not enough memory");
    }
@@ -282,6 +293,7 @@ void UnirecExporter::init(const char *params, Plugins &plugins)
          free_unirec_resources();
          throw PluginError("not enough memory");
       }
+      init_layout(i);
    }
 
    m_group_map.clear();
@@ -289,6 +301,7 @@ void UnirecExporter::init(const char *params, Plugins &plugins)
 
 void UnirecExporter::close()
 {
+   flush();
    if (m_eof) {
       for (size_t i = 0; i < m_ifc_cnt; i++) {
          trap_send(i, "", 1);
@@ -299,7 +312,7 @@ void UnirecExporter::close()
 
    m_basic_idx = -1;
    m_ifc_cnt = 0;
-   delete [] m_ext_id_flgs;
+   m_layouts.clear();
 }
 
 /**
@@ -331,62 +344,140 @@ void UnirecExporter::free_unirec_resources()
    }
 }
 
-int UnirecExporter::export_flow(const Flow &flow)
+/**
+ * \brief Precompute layout of record of given interface.
+ *
+ * Static fields of extensions are remembered, so only they are cleared before the record
+ * is reused. Basic fields are overwritten for every flow.
+ */
+void UnirecExporter::init_layout(int ifc_idx)
 {
-   RecordExt *ext = flow.m_exts;
-   ur_template_t *tmplt_ptr = nullptr;
-   void *record_ptr = nullptr;
+   static const ur_field_id_t basic_fields[] = {
+      F_SRC_IP, F_DST_IP, F_SRC_PORT, F_DST_PORT, F_PROTOCOL, F_PACKETS, F_BYTES, F_PACKETS_REV,
+      F_BYTES_REV, F_TIME_FIRST, F_TIME_LAST, F_TCP_FLAGS, F_TCP_FLAGS_REV, F_DIR_BIT_FIELD,
+      F_SRC_MAC, F_DST_MAC, F_LINK_BIT_FIELD, F_ODID
+   };
+   const ur_template_t *tmplt = m_tmplts[ifc_idx];
+   IfcRecord &layout = m_layouts[ifc_idx];
+   std::vector<std::pair<uint16_t, uint16_t>> fields;
+
+   layout.fixlen = ur_rec_fixlen_size(tmplt);
+   layout.varlen = false;
+   layout.dirty = true;
+   layout.clear.clear();
+
+   for (uint16_t i = 0; i < tmplt->count; i++) {
+      ur_field_id_t id = tmplt->ids[i];
+      if (ur_get_size(id) < 0) {
+         layout.varlen = true;
+         continue;
+      }
+      if (std::find(std::begin(basic_fields), std::end(basic_fields), id) != std::end(basic_fields)) {
+         continue;
+      }
+      fields.push_back(std::make_pair(tmplt->offset[id], ur_get_size(id)));
+   }
 
-   if (m_basic_idx >= 0) { // Process basic flow.
-      tmplt_ptr = m_tmplts[m_basic_idx];
-      record_ptr = m_records[m_basic_idx];
+   // Merge adjacent fields into continuous ranges
+   std::sort(fields.begin(), fields.end());
+   for (auto &f : fields) {
+      if (!layout.clear.empty() && layout.clear.back().first + layout.clear.back().second == f.first) {
+         layout.clear.back().second += f.second;
+      } else {
+         layout.clear.push_back(f);
+      }
+   }
+}
+
+/**
+ * \brief Remove extension data of a previous flow from record and fill basic fields.
+ */
+void UnirecExporter::prepare_record(int ifc_idx, const Flow &flow)
+{
+   IfcRecord &layout = m_layouts[ifc_idx];
+   ur_template_t *tmplt_ptr = m_tmplts[ifc_idx];
+   uint8_t *record_ptr = static_cast<uint8_t *>(m_records[ifc_idx]);
+
+   if (layout.dirty) {
+      if (layout.varlen) {
+         ur_clear_varlen(tmplt_ptr, record_ptr);
+      }
+      for (auto &range : layout.clear) {
+         memset(record_ptr + range.first, 0, range.second);
+      }
+      layout.dirty = false;
+   }
+   fill_basic_flow(flow, tmplt_ptr, record_ptr);
+}
 
-      ur_clear_varlen(tmplt_ptr, record_ptr);
-      fill_basic_flow(flow, tmplt_ptr, record_ptr);
-      trap_send(m_basic_idx, record_ptr, ur_rec_fixlen_size(tmplt_ptr) + ur_rec_varlen_size(tmplt_ptr, record_ptr));
+uint32_t UnirecExporter::record_size(int ifc_idx) const
+{
+   const IfcRecord &layout = m_layouts[ifc_idx];
+   if (!layout.varlen) {
+      return layout.fixlen;
    }
+   return layout.fixlen + ur_rec_varlen_size(m_tmplts[ifc_idx], m_records[ifc_idx]);
+}
 
+int UnirecExporter::export_flow(const Flow &flow)
+{
    m_flows_seen++;
-   uint64_t tmplt_dbits = 0; // templates dirty bits
-   memset(m_ext_id_flgs, 0, sizeof(int) * m_ext_cnt); // in case one flow has multiple extension of same type
-   int ext_processed_cnd = 0;
-   while (ext != nullptr) {
+   if (m_basic_idx >= 0) { // Process basic flow.
+      fill_basic_flow(flow, m_tmplts[m_basic_idx], m_records[m_basic_idx]);
+      trap_send(m_basic_idx, m_records[m_basic_idx], m_layouts[m_basic_idx].fixlen);
+   }
+
+   uint64_t ifc_filled = 0;
+   uint64_t ext_filled = 0; // in case one flow has multiple extension of same type
+   bool has_ext = false;
+   for (RecordExt *ext = flow.m_exts; ext != nullptr; ext = ext->m_next) {
       if (ext->m_ext_id >= static_cast<int>(m_ext_cnt)) {
          throw PluginError("encountered invalid extension id");
       }
-      ext_processed_cnd++;
+      has_ext = true;
       int ifc_num = m_ifc_map[ext->m_ext_id];
-      if (ifc_num >= 0) {
-         tmplt_ptr = m_tmplts[ifc_num];
-         record_ptr = m_records[ifc_num];
-
-         if ((tmplt_dbits & (1 << ifc_num)) == 0) {
-            ur_clear_varlen(tmplt_ptr, record_ptr);
-            memset(record_ptr, 0, ur_rec_fixlen_size(tmplt_ptr));
-            tmplt_dbits |= (1 << ifc_num);
-         }
-
-         if (m_ext_id_flgs[ext->m_ext_id] == 1) {
-            // send the previously filled unirec record
-            trap_send(ifc_num, record_ptr, ur_rec_size(tmplt_ptr, record_ptr));
-         } else {
-            m_ext_id_flgs[ext->m_ext_id] = 1;
-         }
+      if (ifc_num < 0) {
+         continue;
+      }
 
-         fill_basic_flow(flow, tmplt_ptr, record_ptr);
-         ext->fill_unirec(tmplt_ptr, record_ptr); /* Add each extension header into unirec record. */
+      uint64_t ifc_bit = static_cast<uint64_t>(1) << ifc_num;
+      uint64_t ext_bit = static_cast<uint64_t>(1) << ext->m_ext_id;
+      if (!(ifc_filled & ifc_bit)) {
+         prepare_record(ifc_num, flow);
+         ifc_filled |= ifc_bit;
+      } else if (ext_filled & ext_bit) {
+         // send the previously filled unirec record
+         trap_send(ifc_num, m_records[ifc_num], record_size(ifc_num));
       }
-      ext = ext->m_next;
+      ext_filled |= ext_bit;
+
+      ext->fill_unirec(m_tmplts[ifc_num], m_records[ifc_num]); /* Add each extension header into unirec record. */
+      m_layouts[ifc_num].dirty = true;
+   }
+
+   if (!has_ext) {
+      return 0;
    }
-   //send the last record with all plugin data
-   for (size_t ifc_num = 0; ifc_num < m_ifc_cnt && !(m_basic_idx >= 0) && ext_processed_cnd > 0; ifc_num++) {
-      tmplt_ptr = m_tmplts[ifc_num];
-      record_ptr = m_records[ifc_num];
-      trap_send(ifc_num, record_ptr, ur_rec_size(tmplt_ptr, record_ptr));
+   //send the last record with all plugin data, interfaces without extension of the flow get basic fields only
+   for (size_t ifc_num = 0; ifc_num < m_ifc_cnt; ifc_num++) {
+      if (static_cast<int>(ifc_num) == m_basic_idx) {
+         continue;
+      }
+      if (!(ifc_filled & (static_cast<uint64_t>(1) << ifc_num))) {
+         prepare_record(ifc_num, flow);
+      }
+      trap_send(ifc_num, m_records[ifc_num], record_size(ifc_num));
    }
    return 0;
 }
 
+void UnirecExporter::flush()
+{
+   for (size_t i = 0; i < m_ifc_cnt; i++) {
+      trap_send_flush(i);
+   }
+}
+
 /**
  * \brief Fill record with basic flow fields.
  * \param [in] flow Flow record.
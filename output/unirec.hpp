@@ -50,6 +50,8 @@
 
 namespace ipxp {
 
+#define DEFAULT_UNIREC_AUTOFLUSH 500000
+
 class UnirecOptParser : public OptionsParser
 {
 public:
@@ -63,9 +65,12 @@ public:
    uint64_t m_id;
    uint8_t m_dir;
    int m_verbose;
+   bool m_buffer;
+   uint64_t m_autoflush;
 
    UnirecOptParser() : OptionsParser("unirec", "Output plugin for unirec export"),
-      m_ifc(""), m_odid(false), m_eof(false), m_help(false), m_id(DEFAULT_EXPORTER_ID), m_dir(0), m_verbose(0)
+      m_ifc(""), m_odid(false), m_eof(false), m_help(false), m_id(DEFAULT_EXPORTER_ID), m_dir(0), m_verbose(0),
+      m_buffer(true), m_autoflush(DEFAULT_UNIREC_AUTOFLUSH)
    {
       register_option("i", "ifc", "SPEC", "libtrap interface specifier", [this](const char *arg){m_ifc = arg; return true;}, OptionFlags::RequiredArgument);
       register_option("p", "plugins", "PLUGINS", "Specify plugin-interface mapping. Plugins can be grouped like '(p1,p2,p3),p4,(p5,p6)'",
@@ -80,6 +85,10 @@ public:
          OptionFlags::RequiredArgument);
       register_option("h", "help", "", "Print libtrap help", [this](const char *arg){m_help = true; return true;}, OptionFlags::NoArgument);
       register_option("v", "verbose", "", "Increase verbosity", [this](const char *arg){m_verbose++; return true;}, OptionFlags::NoArgument);
+      register_option("nb", "no-buffer", "", "Send every record in a separate libtrap message", [this](const char *arg){m_buffer = false; return true;}, OptionFlags::NoArgument);
+      register_option("af", "autoflush", "USEC", "Flush partially filled libtrap buffers after USEC microseconds (default 500000)",
+         [this](const char *arg){try {m_autoflush = str2num<decltype(m_autoflush)>(arg);} catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
    }
 
 private:
@@ -172,10 +181,24 @@ public:
    OptionsParser *get_parser() const { return new UnirecOptParser(); }
    std::string get_name() const { return "unirec"; }
    int export_flow(const Flow &flow);
+   void flush();
 
 private:
-   int init_trap(std::string &ifcs, int verbosity);
+   /**
+    * \brief Layout of a record of an output interface, computed from its template.
+    */
+   struct IfcRecord {
+      uint32_t fixlen;  /**< Size of static part of the record. */
+      bool varlen;      /**< Template contains variable length fields. */
+      bool dirty;       /**< Record contains extension data of a previous flow. */
+      std::vector<std::pair<uint16_t, uint16_t>> clear; /**< Offset and size of static extension fields. */
+   };
+
+   int init_trap(std::string &ifcs, int verbosity, bool buffer, uint64_t autoflush);
    void create_tmplt(int ifc_idx, const char *tmplt_str);
+   void init_layout(int ifc_idx);
+   void prepare_record(int ifc_idx, const Flow &flow);
+   uint32_t record_size(int ifc_idx) const;
    void fill_basic_flow(const Flow &flow, ur_template_t *tmplt_ptr, void *record_ptr);
    void free_unirec_resources();
 
@@ -187,7 +210,7 @@ private:
    ur_template_t **m_tmplts;    /**< Pointer to unirec templates. */
    void          **m_records;   /**< Pointer to unirec records. */
    size_t m_ifc_cnt;            /**< Number of output interfaces. */
-   int *m_ext_id_flgs;          /** flags of used extension during export*/
+   std::vector<IfcRecord> m_layouts; /**< Record layout of each output interface. */
 
    bool m_eof;                  /**< Send eof when module exits. */
    bool m_odid;            /**< Export ODID field instead of LINK_BIT_FIELD. */
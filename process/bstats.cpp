@@ -45,7 +45,7 @@ const struct timeval BSTATSPlugin::min_packet_in_burst =
 {MAXIMAL_INTERPKT_TIME / 1000, (MAXIMAL_INTERPKT_TIME % 1000) * 1000};
 
 
-BSTATSPlugin::BSTATSPlugin()
+BSTATSPlugin::BSTATSPlugin() : m_arena(nullptr), m_max_bursts(BSTATS_MAXELENCOUNT)
 {
 }
 
@@ -56,6 +56,14 @@ BSTATSPlugin::~BSTATSPlugin()
 
 void BSTATSPlugin::init(const char *params)
 {
+   BSTATSOptParser parser;
+   try {
+      parser.parse(params);
+   } catch (ParserError &e) {
+      throw PluginError(e.what());
+   }
+
+   m_max_bursts = parser.m_count;
 }
 
 void BSTATSPlugin::close()
@@ -64,7 +72,10 @@ void BSTATSPlugin::close()
 
 ProcessPlugin *BSTATSPlugin::copy()
 {
-   return new BSTATSPlugin(*this);
+   BSTATSPlugin *plugin = new BSTATSPlugin(*this);
+   // Each pipeline allocates bursts from its own arena
+   plugin->m_arena = nullptr;
+   return plugin;
 }
 
 int BSTATSPlugin::pre_create(Packet &pkt)
@@ -75,17 +86,26 @@ int BSTATSPlugin::pre_create(Packet &pkt)
 #define BCOUNT burst_count[direction]
 void BSTATSPlugin::initialize_new_burst(RecordExtBSTATS *bstats_record, uint8_t direction, const Packet &pkt)
 {
-   bstats_record->brst_pkts[direction][bstats_record->BCOUNT]  = 1;
-   bstats_record->brst_bytes[direction][bstats_record->BCOUNT] = pkt.payload_len_wire;
-   bstats_record->brst_start[direction][bstats_record->BCOUNT] = pkt.ts;
-   bstats_record->brst_end[direction][bstats_record->BCOUNT]   = pkt.ts;
+   BSTATSBurst burst = {1, pkt.payload_len_wire, pkt.ts, pkt.ts};
+
+   if (bstats_record->BCOUNT < bstats_record->bursts[direction].size()) {
+      // Replace the last record which did not become a burst
+      bstats_record->bursts[direction][bstats_record->BCOUNT] = burst;
+   } else {
+      bstats_record->bursts[direction].push_back(*m_arena, burst);
+   }
+}
+
+bool BSTATSPlugin::hasLastRecord(RecordExtBSTATS *bstats_record, uint8_t direction)
+{
+   return bstats_record->BCOUNT < bstats_record->bursts[direction].size();
 }
 
 bool BSTATSPlugin::belogsToLastRecord(RecordExtBSTATS *bstats_record, uint8_t direction, const Packet &pkt)
 {
    struct timeval timediff;
 
-   timersub(&pkt.ts, &bstats_record->brst_end[direction][bstats_record->BCOUNT], &timediff);
+   timersub(&pkt.ts, &bstats_record->bursts[direction][bstats_record->BCOUNT].end, &timediff);
    if (timercmp(&timediff, &min_packet_in_burst, <)){
       return true;
    }
@@ -94,7 +114,8 @@ bool BSTATSPlugin::belogsToLastRecord(RecordExtBSTATS *bstats_record, uint8_t di
 
 bool BSTATSPlugin::isLastRecordBurst(RecordExtBSTATS *bstats_record, uint8_t direction)
 {
-   if (bstats_record->brst_pkts[direction][bstats_record->BCOUNT] < MINIMAL_PACKETS_IN_BURST){
+   if (!hasLastRecord(bstats_record, direction) ||
+         bstats_record->bursts[direction][bstats_record->BCOUNT].pkts < MINIMAL_PACKETS_IN_BURST){
       return false;
    }
    return true;
@@ -103,16 +124,17 @@ bool BSTATSPlugin::isLastRecordBurst(RecordExtBSTATS *bstats_record, uint8_t dir
 void BSTATSPlugin::process_bursts(RecordExtBSTATS *bstats_record, uint8_t direction, const Packet &pkt)
 {
    if (belogsToLastRecord(bstats_record, direction, pkt)){ // does it belong to previous burst?
-      bstats_record->brst_pkts[direction][bstats_record->BCOUNT]++;
-      bstats_record->brst_bytes[direction][bstats_record->BCOUNT] += pkt.payload_len_wire;
-      bstats_record->brst_end[direction][bstats_record->BCOUNT]    = pkt.ts;
+      BSTATSBurst &burst = bstats_record->bursts[direction][bstats_record->BCOUNT];
+      burst.pkts++;
+      burst.bytes += pkt.payload_len_wire;
+      burst.end    = pkt.ts;
       return;
    }
    // the packet does not belong to previous burst
    if (isLastRecordBurst(bstats_record, direction)){
       bstats_record->BCOUNT++;
    }
-   if (bstats_record->BCOUNT < BSTATS_MAXELENCOUNT){
+   if (bstats_record->BCOUNT < m_max_bursts){
       initialize_new_burst(bstats_record, direction, pkt);
    }
 }
@@ -121,12 +143,12 @@ void BSTATSPlugin::update_record(RecordExtBSTATS *bstats_record, const Packet &p
 {
    uint8_t direction = (uint8_t) !pkt.source_pkt;
 
-   if (pkt.payload_len_wire == 0 || bstats_record->BCOUNT >= BSTATS_MAXELENCOUNT){
+   if (pkt.payload_len_wire == 0 || bstats_record->BCOUNT >= m_max_bursts){
       // zero-payload or burst array is full
       return;
    }
-   if (bstats_record->burst_empty[direction] == 0){
-      bstats_record->burst_empty[direction] = 1;
+   if (!hasLastRecord(bstats_record, direction)){
+      // first packet of the direction or the last record could not be stored
       initialize_new_burst(bstats_record, direction, pkt);
    } else {
       process_bursts(bstats_record, direction, pkt);
@@ -135,7 +157,11 @@ void BSTATSPlugin::update_record(RecordExtBSTATS *bstats_record, const Packet &p
 
 int BSTATSPlugin::post_create(Flow &rec, const Packet &pkt)
 {
-   RecordExtBSTATS *bstats_record = new RecordExtBSTATS();
+   if (m_arena == nullptr) {
+      // Never destroyed, records with bursts from the arena can outlive the plugin
+      m_arena = new BlockArena();
+   }
+   RecordExtBSTATS *bstats_record = new RecordExtBSTATS(m_arena);
 
    rec.add_extension(bstats_record);
    update_record(bstats_record, pkt);
@@ -166,7 +192,7 @@ void BSTATSPlugin::pre_export(Flow &rec)
    RecordExtBSTATS *bstats_record = static_cast<RecordExtBSTATS *>(rec.get_extension(RecordExtBSTATS::REGISTERED_ID));
 
    for (int direction = 0; direction < 2; direction++){
-      if (bstats_record->BCOUNT < BSTATS_MAXELENCOUNT && isLastRecordBurst(bstats_record, direction)){
+      if (isLastRecordBurst(bstats_record, direction)){
          bstats_record->BCOUNT++;
       }
    }
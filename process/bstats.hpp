@@ -41,12 +41,22 @@
 #include <ipfixprobe/process.hpp>
 #include <ipfixprobe/flowifc.hpp>
 #include <ipfixprobe/packet.hpp>
+#include <ipfixprobe/options.hpp>
+#include <ipfixprobe/utils.hpp>
+#include <ipfixprobe/block-arena.hpp>
+#include <ipfixprobe/small-vector.hpp>
+#include <ipfixprobe/byte-utils.hpp>
 #include <ipfixprobe/ipfix-basiclist.hpp>
 #include <ipfixprobe/ipfix-elements.hpp>
 
 namespace ipxp {
 
-#define BSTATS_MAXELENCOUNT 15
+#ifndef BSTATS_MAXELENCOUNT
+# define BSTATS_MAXELENCOUNT 15
+#endif
+#define BSTATS_MAXELENCOUNT_LIMIT 1024
+// Bursts stored inside the extension, more bursts are allocated from the plugin arena
+#define BSTATS_INLINE_COUNT 4
 
 // BURST CHARACTERISTIC
 #define MINIMAL_PACKETS_IN_BURST 3    // in packets
@@ -69,8 +79,38 @@ UR_FIELDS(
    time* DBI_BRST_TIME_STOP
 )
 
+class BSTATSOptParser : public OptionsParser
+{
+public:
+   uint16_t m_count;
+
+   BSTATSOptParser() : OptionsParser("bstats", "Compute packet bursts stats"), m_count(BSTATS_MAXELENCOUNT)
+   {
+      register_option("c", "count", "NUM", "Maximal number of bursts in each direction, default " + std::to_string(BSTATS_MAXELENCOUNT) +
+         ", at most " + std::to_string(BSTATS_MAXELENCOUNT_LIMIT),
+         [this](const char *arg){try {m_count = str2num<decltype(m_count)>(arg);} catch(std::invalid_argument &e) {return false;}
+            return m_count > 0 && m_count <= BSTATS_MAXELENCOUNT_LIMIT;},
+         OptionFlags::RequiredArgument);
+   }
+};
+
+/**
+ * \brief Single burst of packets in one direction.
+ */
+struct BSTATSBurst {
+   uint32_t       pkts;
+   uint32_t       bytes;
+   struct timeval start;
+   struct timeval end;
+};
+
 /**
  * \brief Flow record extension header for storing parsed BSTATS packets.
+ *
+ * Bursts of each direction are stored in a small vector, the first BSTATS_INLINE_COUNT bursts
+ * are kept inside the extension and more bursts are allocated from the arena of the plugin.
+ * The last element is the burst in progress, it is counted in burst_count once it has at least
+ * MINIMAL_PACKETS_IN_BURST packets.
  */
 struct RecordExtBSTATS : public RecordExt {
    typedef enum eHdrFieldID {
@@ -86,20 +126,21 @@ struct RecordExtBSTATS : public RecordExt {
 
    static int REGISTERED_ID;
 
+   BlockArena     *m_arena;
    uint16_t       burst_count[2];
-   uint8_t        burst_empty[2];
+   SmallVector<BSTATSBurst, BSTATS_INLINE_COUNT> bursts[2];
 
-   uint32_t       brst_pkts[2][BSTATS_MAXELENCOUNT];
-   uint32_t       brst_bytes[2][BSTATS_MAXELENCOUNT];
-   struct timeval brst_start[2][BSTATS_MAXELENCOUNT];
-   struct timeval brst_end[2][BSTATS_MAXELENCOUNT];
-
-   RecordExtBSTATS() : RecordExt(REGISTERED_ID)
+   RecordExtBSTATS(BlockArena *arena = nullptr) : RecordExt(REGISTERED_ID), m_arena(arena)
    {
       memset(burst_count, 0, 2 * sizeof(uint16_t));
-      memset(burst_empty, 0, 2 * sizeof(uint8_t));
-      brst_pkts[BSTATS_DEST][0]   = 0;
-      brst_pkts[BSTATS_SOURCE][0] = 0;
+   }
+
+   ~RecordExtBSTATS()
+   {
+      if (m_arena != nullptr) {
+         bursts[BSTATS_SOURCE].release(*m_arena);
+         bursts[BSTATS_DEST].release(*m_arena);
+      }
    }
 
    #ifdef WITH_NEMEA
@@ -118,18 +159,20 @@ struct RecordExtBSTATS : public RecordExt {
       ur_array_allocate(tmplt, record, F_DBI_BRST_TIME_STOP, burst_count[BSTATS_DEST]);
 
       for (int i = 0; i < burst_count[BSTATS_SOURCE]; i++){
-         ts_start = ur_time_from_sec_usec(brst_start[BSTATS_SOURCE][i].tv_sec, brst_start[BSTATS_SOURCE][i].tv_usec);
-         ts_stop  = ur_time_from_sec_usec(brst_end[BSTATS_SOURCE][i].tv_sec, brst_end[BSTATS_SOURCE][i].tv_usec);
-         ur_array_set(tmplt, record, F_SBI_BRST_PACKETS, i, brst_pkts[BSTATS_SOURCE][i]);
-         ur_array_set(tmplt, record, F_SBI_BRST_BYTES, i, brst_bytes[BSTATS_SOURCE][i]);
+         const BSTATSBurst &burst = bursts[BSTATS_SOURCE][i];
+         ts_start = ur_time_from_sec_usec(burst.start.tv_sec, burst.start.tv_usec);
+         ts_stop  = ur_time_from_sec_usec(burst.end.tv_sec, burst.end.tv_usec);
+         ur_array_set(tmplt, record, F_SBI_BRST_PACKETS, i, burst.pkts);
+         ur_array_set(tmplt, record, F_SBI_BRST_BYTES, i, burst.bytes);
          ur_array_set(tmplt, record, F_SBI_BRST_TIME_START, i, ts_start);
          ur_array_set(tmplt, record, F_SBI_BRST_TIME_STOP, i, ts_stop);
       }
       for (int i = 0; i < burst_count[BSTATS_DEST]; i++){
-         ts_start = ur_time_from_sec_usec(brst_start[BSTATS_DEST][i].tv_sec, brst_start[BSTATS_DEST][i].tv_usec);
-         ts_stop  = ur_time_from_sec_usec(brst_end[BSTATS_DEST][i].tv_sec, brst_end[BSTATS_DEST][i].tv_usec);
-         ur_array_set(tmplt, record, F_DBI_BRST_PACKETS, i, brst_pkts[BSTATS_DEST][i]);
-         ur_array_set(tmplt, record, F_DBI_BRST_BYTES, i, brst_bytes[BSTATS_DEST][i]);
+         const BSTATSBurst &burst = bursts[BSTATS_DEST][i];
+         ts_start = ur_time_from_sec_usec(burst.start.tv_sec, burst.start.tv_usec);
+         ts_stop  = ur_time_from_sec_usec(burst.end.tv_sec, burst.end.tv_usec);
+         ur_array_set(tmplt, record, F_DBI_BRST_PACKETS, i, burst.pkts);
+         ur_array_set(tmplt, record, F_DBI_BRST_BYTES, i, burst.bytes);
          ur_array_set(tmplt, record, F_DBI_BRST_TIME_START, i, ts_start);
          ur_array_set(tmplt, record, F_DBI_BRST_TIME_STOP, i, ts_stop);
       }
@@ -158,24 +201,36 @@ struct RecordExtBSTATS : public RecordExt {
          return -1;
       }
       // Fill buffer
-      bufferPtr  = basiclist.FillBuffer(buffer, brst_pkts[BSTATS_SOURCE], burst_count[BSTATS_SOURCE], (uint16_t) SPkts);
-      bufferPtr +=
-        basiclist.FillBuffer(buffer + bufferPtr, brst_bytes[BSTATS_SOURCE], burst_count[BSTATS_SOURCE],
-          (uint16_t) SBytes);
-      bufferPtr +=
-        basiclist.FillBuffer(buffer + bufferPtr, brst_start[BSTATS_SOURCE], burst_count[BSTATS_SOURCE],
-          (uint16_t) SStart);
-      bufferPtr +=
-        basiclist.FillBuffer(buffer + bufferPtr, brst_end[BSTATS_SOURCE], burst_count[BSTATS_SOURCE], (uint16_t) SStop);
-
-      bufferPtr += basiclist.FillBuffer(buffer + bufferPtr, brst_pkts[BSTATS_DEST], burst_count[BSTATS_DEST],
-          (uint16_t) DPkts);
-      bufferPtr += basiclist.FillBuffer(buffer + bufferPtr, brst_bytes[BSTATS_DEST], burst_count[BSTATS_DEST],
-          (uint16_t) DBytes);
-      bufferPtr += basiclist.FillBuffer(buffer + bufferPtr, brst_start[BSTATS_DEST], burst_count[BSTATS_DEST],
-          (uint16_t) DStart);
-      bufferPtr += basiclist.FillBuffer(buffer + bufferPtr, brst_end[BSTATS_DEST], burst_count[BSTATS_DEST],
-          (uint16_t) DStop);
+      static const uint16_t fields[2][4] = {
+         {SPkts, SBytes, SStart, SStop},
+         {DPkts, DBytes, DStart, DStop}
+      };
+      bufferPtr = 0;
+      for (int dir = 0; dir < 2; dir++) {
+         const BSTATSBurst *burst = bursts[dir].data();
+         uint16_t count = burst_count[dir];
+
+         bufferPtr += basiclist.FillBufferHdr(buffer + bufferPtr, count, sizeof(uint32_t), fields[dir][0]);
+         for (int i = 0; i < count; i++) {
+            *reinterpret_cast<uint32_t *>(buffer + bufferPtr) = htonl(burst[i].pkts);
+            bufferPtr += sizeof(uint32_t);
+         }
+         bufferPtr += basiclist.FillBufferHdr(buffer + bufferPtr, count, sizeof(uint32_t), fields[dir][1]);
+         for (int i = 0; i < count; i++) {
+            *reinterpret_cast<uint32_t *>(buffer + bufferPtr) = htonl(burst[i].bytes);
+            bufferPtr += sizeof(uint32_t);
+         }
+         bufferPtr += basiclist.FillBufferHdr(buffer + bufferPtr, count, sizeof(uint64_t), fields[dir][2]);
+         for (int i = 0; i < count; i++) {
+            *reinterpret_cast<uint64_t *>(buffer + bufferPtr) = swap_uint64(IpfixBasicList::Tv2Ts(burst[i].start));
+            bufferPtr += sizeof(uint64_t);
+         }
+         bufferPtr += basiclist.FillBufferHdr(buffer + bufferPtr, count, sizeof(uint64_t), fields[dir][3]);
+         for (int i = 0; i < count; i++) {
+            *reinterpret_cast<uint64_t *>(buffer + bufferPtr) = swap_uint64(IpfixBasicList::Tv2Ts(burst[i].end));
+            bufferPtr += sizeof(uint64_t);
+         }
+      }
 
       return bufferPtr;
    }
@@ -199,22 +254,22 @@ struct RecordExtBSTATS : public RecordExt {
          int dir = dirs[j];
          out << dirs_c[j] << "burstpkts=(";
          for (int i = 0; i < burst_count[dir]; i++) {
-            out << brst_pkts[dir][i];
+            out << bursts[dir][i].pkts;
             if (i != burst_count[dir] - 1) {
                out << ",";
             }
          }
          out << ")," << dirs_c[j] << "burstbytes=(";
          for (int i = 0; i < burst_count[dir]; i++) {
-            out << brst_bytes[dir][i];
+            out << bursts[dir][i].bytes;
             if (i != burst_count[dir] - 1) {
                out << ",";
             }
          }
          out << ")," << dirs_c[j] << "bursttime=(";
          for (int i = 0; i < burst_count[dir]; i++) {
-            struct timeval start = brst_start[dir][i];
-            struct timeval end = brst_end[dir][i];
+            struct timeval start = bursts[dir][i].start;
+            struct timeval end = bursts[dir][i].end;
             out << start.tv_sec << "." << start.tv_usec << "-" << end.tv_sec << "." << end.tv_usec;
             if (i != burst_count[dir] - 1) {
                out << ",";
@@ -237,7 +292,7 @@ public:
    ~BSTATSPlugin();
    void init(const char *params);
    void close();
-   OptionsParser *get_parser() const { return new OptionsParser("bstats", "Compute packet bursts stats"); }
+   OptionsParser *get_parser() const { return new BSTATSOptParser(); }
    std::string get_name() const { return "bstats"; }
    RecordExt *get_ext() const { return new RecordExtBSTATS(); }
    ProcessPlugin *copy();
@@ -251,9 +306,13 @@ public:
    static const struct timeval min_packet_in_burst;
 
 private:
+   BlockArena *m_arena; /**< Never freed, records can release their bursts after the plugin is destroyed. */
+   uint16_t m_max_bursts;
+
    void initialize_new_burst(RecordExtBSTATS *bstats_record, uint8_t direction, const Packet &pkt);
    void process_bursts(RecordExtBSTATS *bstats_record, uint8_t direction, const Packet &pkt);
    void update_record(RecordExtBSTATS *bstats_record, const Packet &pkt);
+   bool hasLastRecord(RecordExtBSTATS *bstats_record, uint8_t direction);
    bool isLastRecordBurst(RecordExtBSTATS *bstats_record, uint8_t direction);
    bool belogsToLastRecord(RecordExtBSTATS *bstats_record, uint8_t direction, const Packet &pkt);
 };
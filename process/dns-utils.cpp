@@ -0,0 +1,254 @@
+/**
+ * \file dns-utils.cpp
+ * \brief Decoder of DNS messages shared by DNS plugins
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+
+#include <arpa/inet.h>
+
+#include "dns-utils.hpp"
+
+namespace ipxp {
+
+/**
+ * \brief Check for label pointer in DNS name.
+ */
+#define IS_POINTER(ch) (((ch) & 0xC0) == 0xC0)
+
+/**
+ * \brief Get offset from 2 byte pointer.
+ */
+#define GET_OFFSET(half1, half2) ((((uint8_t)(half1) & 0x3F) << 8) | (uint8_t)(half2))
+
+/**
+ * \brief Last walked message of the thread.
+ */
+struct DnsCache {
+   DnsMessage msg;
+   bool is_dns;
+   bool tcp;
+   uint32_t len;
+   const uint8_t *payload;
+   uint64_t seq; /**< Sequence number of the walked packet, 0 when nothing is cached. */
+};
+
+static bool dns_walk(DnsMessage &msg, const uint8_t *payload, uint32_t len, bool tcp)
+{
+   const char *data = reinterpret_cast<const char *>(payload);
+   if (tcp) {
+      if (len < 2 || ntohs(*(uint16_t *) data) != len - 2) {
+         return false; // Fragmented tcp packet
+      }
+      data += 2;
+      len -= 2;
+   }
+   if (len < sizeof(struct dns_hdr) || len > UINT16_MAX) {
+      return false;
+   }
+
+   const struct dns_hdr *dns = (const struct dns_hdr *) data;
+   msg.data = data;
+   msg.len = len;
+   msg.id = ntohs(dns->id);
+   msg.flags = ntohs(dns->flags);
+   msg.qd_cnt = ntohs(dns->question_rec_cnt);
+   msg.an_cnt = ntohs(dns->answer_rec_cnt);
+   msg.ns_cnt = ntohs(dns->name_server_rec_cnt);
+   msg.ar_cnt = ntohs(dns->additional_rec_cnt);
+   msg.qd_parsed = 0;
+   msg.an_parsed = 0;
+   msg.ns_parsed = 0;
+   msg.ar_parsed = 0;
+   msg.end = DNS_PARSE_OK;
+   msg.qtype = 0;
+   msg.qclass = 0;
+   msg.opt = false;
+   msg.opt_psize = 0;
+   msg.opt_do = 0;
+   msg.rr_cnt = 0;
+
+   uint32_t offset = sizeof(struct dns_hdr);
+   for (uint16_t i = 0; i < msg.qd_cnt; i++) {
+      if (!dns_skip_name(msg, offset)) {
+         msg.end = DNS_PARSE_MALFORMED;
+         return true;
+      }
+      if (offset + sizeof(struct dns_question) > len) {
+         msg.end = DNS_PARSE_TRUNCATED;
+         return true;
+      }
+      if (i == 0) {
+         const struct dns_question *question = (const struct dns_question *) (data + offset);
+         msg.qtype = ntohs(question->qtype);
+         msg.qclass = ntohs(question->qclass);
+      }
+      offset += sizeof(struct dns_question);
+      msg.qd_parsed++;
+   }
+
+   uint16_t *parsed[] = {&msg.an_parsed, &msg.ns_parsed, &msg.ar_parsed};
+   uint16_t counts[] = {msg.an_cnt, msg.ns_cnt, msg.ar_cnt};
+   for (int section = 0; section < 3; section++) {
+      for (uint16_t i = 0; i < counts[section]; i++) {
+         DnsRR tmp;
+         DnsRR &rr = msg.rr_cnt < DNS_MAX_RR ? msg.rr[msg.rr_cnt] : tmp;
+         msg.end = dns_read_rr(msg, offset, rr);
+         if (msg.end != DNS_PARSE_OK) {
+            return true;
+         }
+
+         if (section == 2 && rr.type == DNS_TYPE_OPT) {
+            msg.opt = true;
+            msg.opt_psize = rr.rclass; // Requested UDP payload size, RFC 6891
+            msg.opt_do = (rr.ttl & 0x8000) >> 15;
+         }
+         if (msg.rr_cnt < DNS_MAX_RR) {
+            msg.rr_cnt++;
+         }
+         (*parsed[section])++;
+      }
+   }
+
+   return true;
+}
+
+const DnsMessage *dns_parse(const uint8_t *payload, uint32_t len, bool tcp, uint64_t seq)
+{
+   static thread_local DnsCache cache;
+
+   if (len < sizeof(struct dns_hdr)) {
+      return nullptr;
+   }
+   // Packet buffers are reused, the pointer identifies the packet only together with its sequence number
+   if (seq != 0 && cache.seq == seq && cache.payload == payload && cache.len == len && cache.tcp == tcp) {
+      return cache.is_dns ? &cache.msg : nullptr;
+   }
+
+   cache.is_dns = dns_walk(cache.msg, payload, len, tcp);
+   cache.seq = seq;
+   cache.payload = payload;
+   cache.len = len;
+   cache.tcp = tcp;
+   return cache.is_dns ? &cache.msg : nullptr;
+}
+
+uint8_t dns_read_rr(const DnsMessage &msg, uint32_t &offset, DnsRR &rr)
+{
+   rr.name = offset;
+   if (!dns_skip_name(msg, offset)) {
+      return DNS_PARSE_MALFORMED;
+   }
+
+   const struct dns_answer *answer = (const struct dns_answer *) (msg.data + offset);
+   offset += sizeof(struct dns_answer);
+   if (offset > msg.len || offset + ntohs(answer->rdlength) > msg.len) {
+      return DNS_PARSE_TRUNCATED;
+   }
+
+   rr.type = ntohs(answer->atype);
+   rr.rclass = ntohs(answer->aclass);
+   rr.ttl = ntohl(answer->ttl);
+   rr.rdlength = ntohs(answer->rdlength);
+   rr.rdata = offset;
+   offset += rr.rdlength;
+   return DNS_PARSE_OK;
+}
+
+bool dns_skip_name(const DnsMessage &msg, uint32_t &offset)
+{
+   uint32_t pos = offset;
+   while (pos < msg.len) {
+      uint8_t label = msg.data[pos];
+      if (!label) {
+         offset = pos + 1;
+         return true;
+      }
+      if (IS_POINTER(label)) {
+         if (pos + 1 >= msg.len) {
+            return false;
+         }
+         offset = pos + 2;
+         return true;
+      }
+      if (label > 63) {
+         return false;
+      }
+      pos += label + 1;
+   }
+   return false;
+}
+
+bool dns_put_name(TextWriter &out, const DnsMessage &msg, uint32_t offset)
+{
+   uint32_t pos = offset;
+   uint32_t limit = offset;
+   int label_cnt = 0;
+   bool first = true;
+
+   while (pos < msg.len) {
+      uint8_t label = msg.data[pos];
+      if (!label) {
+         return true;
+      }
+      if (++label_cnt > DNS_MAX_LABEL_CNT) {
+         return false;
+      }
+
+      if (IS_POINTER(label)) {
+         if (pos + 1 >= msg.len) {
+            return false;
+         }
+         pos = GET_OFFSET(label, msg.data[pos + 1]);
+         if (pos >= limit) {
+            return false;
+         }
+         limit = pos;
+         continue;
+      }
+
+      if (label > 63 || pos + label + 2 > msg.len) {
+         return false;
+      }
+      if (!first) {
+         out.put('.');
+      }
+      out.put(msg.data + pos + 1, label);
+      first = false;
+      pos += label + 1;
+   }
+   return false;
+}
+
+int dns_get_name(const DnsMessage &msg, uint32_t offset, char *buffer, size_t size)
+{
+   TextWriter out(buffer, size - 1, true);
+   if (!dns_put_name(out, msg, offset)) {
+      buffer[0] = 0;
+      return -1;
+   }
+   buffer[out.length()] = 0;
+   return out.length();
+}
+
+}
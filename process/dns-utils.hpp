@@ -1,6 +1,6 @@
 /**
  * \file dns-utils.hpp
- * \brief DNS structs and macros.
+ * \brief DNS structs, macros and message decoder shared by DNS plugins.
  * \author Jiri Havranek <havranek@cesnet.cz>
  * \date 2017
  */
@@ -30,8 +30,11 @@
 #define IPXP_PROCESS_DNS_UTILS_HPP
 
 #include <stdint.h>
+#include <stddef.h>
 #include <endian.h>
 
+#include <ipfixprobe/text-writer.hpp>
+
 namespace ipxp {
 
 #define DNS_TYPE_A      1
@@ -187,5 +190,110 @@ struct __attribute__ ((packed)) dns_dnskey {
    /* public key */
 };
 
+#define DNS_MAX_LABEL_CNT 127 /**< Maximal number of labels and pointers in a name. */
+#define DNS_MAX_NAME_LEN  255 /**< Maximal length of decompressed name, longer names are truncated. */
+#define DNS_MAX_RR        256 /**< Maximal number of resource records stored in DnsMessage. */
+
+#define DNS_PARSE_OK        0 /**< Whole message was walked. */
+#define DNS_PARSE_TRUNCATED 1 /**< Fixed part or data of a question or record exceed the message. */
+#define DNS_PARSE_MALFORMED 2 /**< Name of a question or record exceeds the message. */
+
+/**
+ * \brief Resource record located in a DNS message, offsets are relative to the message begin.
+ */
+struct DnsRR {
+   uint16_t name;      /**< Offset of owner name. */
+   uint16_t type;
+   uint16_t rclass;
+   uint16_t rdlength;
+   uint32_t ttl;
+   uint16_t rdata;     /**< Offset of RDATA. */
+};
+
+/**
+ * \brief Layout of a DNS message.
+ *
+ * Names are not decoded while the message is walked, use dns_get_name() or dns_put_name()
+ * to decompress the names which are actually needed.
+ */
+struct DnsMessage {
+   const char *data;   /**< Begin of the message (without TCP length prefix). */
+   uint32_t len;       /**< Length of the message. */
+
+   uint16_t id;
+   uint16_t flags;
+   uint16_t qd_cnt;    /**< Number of questions in header. */
+   uint16_t an_cnt;    /**< Number of answer RRs in header. */
+   uint16_t ns_cnt;    /**< Number of authority RRs in header. */
+   uint16_t ar_cnt;    /**< Number of additional RRs in header. */
+
+   uint16_t qd_parsed; /**< Number of questions which fit into the message. */
+   uint16_t an_parsed; /**< Number of answer RRs which fit into the message. */
+   uint16_t ns_parsed; /**< Number of authority RRs which fit into the message. */
+   uint16_t ar_parsed; /**< Number of additional RRs which fit into the message. */
+   uint8_t end;        /**< How the walk ended, one of DNS_PARSE_*. */
+
+   uint16_t qtype;     /**< Type of the first question. */
+   uint16_t qclass;    /**< Class of the first question. */
+
+   bool opt;           /**< OPT record was found in additional section. */
+   uint16_t opt_psize; /**< Requested UDP payload size of the last OPT record. */
+   uint8_t opt_do;     /**< DO bit of the last OPT record. */
+
+   uint16_t rr_cnt;    /**< Number of stored RRs in wire order, use dns_read_rr() to get the rest. */
+   DnsRR rr[DNS_MAX_RR];
+};
+
+/**
+ * \brief Walk DNS message and locate its questions and resource records.
+ *
+ * Result of the last walk is kept per thread and keyed by payload pointer and packet sequence
+ * number, so plugins processing the same packet (e.g. dns and passivedns) walk the message only once.
+ * \param [in] payload Pointer to packet payload.
+ * \param [in] len Payload length.
+ * \param [in] tcp DNS over tcp, payload starts with message length.
+ * \param [in] seq Sequence number of the packet (Packet::seq), 0 disables reuse of the last walk.
+ * \return Message layout valid until the next call in the thread or nullptr when payload is not DNS message.
+ */
+const DnsMessage *dns_parse(const uint8_t *payload, uint32_t len, bool tcp, uint64_t seq);
+
+/**
+ * \brief Read resource record.
+ * \param [in] msg DNS message.
+ * \param [in,out] offset Offset of the record, set to offset of the next record.
+ * \param [out] rr Located record.
+ * \return DNS_PARSE_OK or reason why the record cannot be read.
+ */
+uint8_t dns_read_rr(const DnsMessage &msg, uint32_t &offset, DnsRR &rr);
+
+/**
+ * \brief Skip (possibly compressed) name.
+ * \param [in] msg DNS message.
+ * \param [in,out] offset Offset of the name, set to offset following the name.
+ * \return False when the name exceeds the message or contains label longer than 63 bytes.
+ */
+bool dns_skip_name(const DnsMessage &msg, uint32_t &offset);
+
+/**
+ * \brief Decompress name and write labels separated by dots.
+ *
+ * Compression pointers have to point before the previous pointer target, which rules out loops.
+ * \param [out] out Output writer.
+ * \param [in] msg DNS message.
+ * \param [in] offset Offset of the name.
+ * \return False when the name is malformed.
+ */
+bool dns_put_name(TextWriter &out, const DnsMessage &msg, uint32_t offset);
+
+/**
+ * \brief Decompress name into buffer, names longer than size - 1 are truncated.
+ * \param [in] msg DNS message.
+ * \param [in] offset Offset of the name.
+ * \param [out] buffer Destination buffer, the name is null terminated.
+ * \param [in] size Size of the buffer.
+ * \return Length of the name in buffer or -1 when the name is malformed.
+ */
+int dns_get_name(const DnsMessage &msg, uint32_t offset, char *buffer, size_t size);
+
 }
 #endif /* IPXP_PROCESS_DNS_UTILS_HPP */
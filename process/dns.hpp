@@ -197,16 +197,10 @@ private:
    uint32_t responses;     /**< Total number of parsed DNS responses. */
    uint32_t total;         /**< Total number of parsed DNS packets. */
 
-   const char *data_begin; /**< Pointer to begin of payload. */
-   uint32_t data_len;      /**< Length of packet payload. */
-
-   bool parse_dns(const char *data, unsigned int payload_len, bool tcp, RecordExtDNS *rec);
-   int  add_ext_dns(const char *data, unsigned int payload_len, bool tcp, Flow &rec);
-   void process_srv(std::string &str) const;
-   void process_rdata(const char *record_begin, const char *data, std::ostringstream &rdata, uint16_t type, size_t length) const;
-
-   std::string get_name(const char *data) const;
-   size_t get_name_length(const char *data) const;
+   bool parse_dns(const uint8_t *data, unsigned int payload_len, bool tcp, uint64_t seq, RecordExtDNS *rec);
+   int  add_ext_dns(const uint8_t *data, unsigned int payload_len, bool tcp, uint64_t seq, Flow &rec);
+   void process_srv(char *str, int &length) const;
+   bool process_rdata(TextWriter &out, const DnsMessage &msg, const DnsRR &rr) const;
 };
 
 }
@@ -0,0 +1,167 @@
+/**
+ * \file header-scanner.cpp
+ * \brief Vectorized line and header name scanner for text based protocols
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "header-scanner.hpp"
+
+namespace ipxp {
+
+HeaderScanner::HeaderScanner(const char *data, size_t len)
+   : m_data(data), m_len(len), m_line(0), m_block(0), m_next(0), m_lf(0), m_colon(0),
+   m_first_colon(nullptr)
+{
+}
+
+void HeaderScanner::find_block(const char *block, uint32_t &lf, uint32_t &colon)
+{
+#if defined(__AVX2__)
+   __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
+   lf = _mm256_movemask_epi8(_mm256_cmpeq_epi8(data, _mm256_set1_epi8('\n')));
+   colon = _mm256_movemask_epi8(_mm256_cmpeq_epi8(data, _mm256_set1_epi8(':')));
+#elif defined(__SSE2__)
+   const __m128i lf_vec = _mm_set1_epi8('\n');
+   const __m128i colon_vec = _mm_set1_epi8(':');
+   __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block));
+   __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 16));
+   lf = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(lo, lf_vec)))
+      | static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(hi, lf_vec))) << 16;
+   colon = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(lo, colon_vec)))
+      | static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(hi, colon_vec))) << 16;
+#else
+   find_block_scalar(block, lf, colon);
+#endif
+}
+
+void HeaderScanner::find_block_scalar(const char *block, uint32_t &lf, uint32_t &colon)
+{
+   lf = 0;
+   colon = 0;
+   for (size_t i = 0; i < BLOCK_SIZE; i++) {
+      lf |= static_cast<uint32_t>(block[i] == '\n') << i;
+      colon |= static_cast<uint32_t>(block[i] == ':') << i;
+   }
+}
+
+void HeaderScanner::scan_block()
+{
+   const char *block = m_data + m_next;
+   char tmp[BLOCK_SIZE];
+
+   if (m_len - m_next < BLOCK_SIZE) {
+      // Zero padding contains neither line feeds nor colons
+      memset(tmp, 0, sizeof(tmp));
+      memcpy(tmp, block, m_len - m_next);
+      block = tmp;
+   }
+
+   find_block(block, m_lf, m_colon);
+   m_block = m_next;
+   m_next += BLOCK_SIZE;
+}
+
+bool HeaderScanner::next(HeaderLine &line)
+{
+   while (m_lf == 0) {
+      // Remaining colons belong to the current line which continues in the next block
+      if (m_first_colon == nullptr && m_colon != 0) {
+         m_first_colon = m_data + m_block + __builtin_ctz(m_colon);
+      }
+      if (m_next >= m_len) {
+         m_colon = 0;
+         return false;
+      }
+      scan_block();
+   }
+
+   unsigned bit = __builtin_ctz(m_lf);
+   uint32_t consumed = static_cast<uint32_t>((static_cast<uint64_t>(2) << bit) - 1);
+
+   line.begin = m_data + m_line;
+   line.end = m_data + m_block + bit;
+   line.colon = m_first_colon;
+   if (line.colon == nullptr && (m_colon & consumed) != 0) {
+      line.colon = m_data + m_block + __builtin_ctz(m_colon);
+   }
+
+   m_lf &= ~consumed;
+   m_colon &= ~consumed;
+   m_first_colon = nullptr;
+   m_line = m_block + bit + 1;
+   return true;
+}
+
+bool HeaderScanner::tail(HeaderLine &line)
+{
+   if (m_line >= m_len) {
+      return false;
+   }
+
+   line.begin = m_data + m_line;
+   line.end = m_data + m_len;
+   line.colon = static_cast<const char *>(memchr(line.begin, ':', m_len - m_line));
+   m_line = m_len;
+   return true;
+}
+
+/**
+ * \brief Perfect hash table of header_name(), indexed by (length ^ last character) & 7.
+ */
+static const struct {
+   const char *name;
+   size_t len;
+   HeaderName id;
+} header_names[8] = {
+   {"Host", 4, HeaderName::HOST},
+   {"Content-Type", 12, HeaderName::CONTENT_TYPE},
+   {nullptr, 0, HeaderName::OTHER},
+   {nullptr, 0, HeaderName::OTHER},
+   {"Server", 6, HeaderName::SERVER},
+   {"Referer", 7, HeaderName::REFERER},
+   {"User-Agent", 10, HeaderName::USER_AGENT},
+   {"Set-Cookie", 10, HeaderName::SET_COOKIE},
+};
+
+HeaderName header_name(const char *name, size_t len)
+{
+   if (len == 0) {
+      return HeaderName::OTHER;
+   }
+   const auto &entry = header_names[(len ^ static_cast<uint8_t>(name[len - 1])) & 7];
+   if (entry.len != len || memcmp(entry.name, name, len)) {
+      return HeaderName::OTHER;
+   }
+   return entry.id;
+}
+
+}
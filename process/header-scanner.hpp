@@ -0,0 +1,136 @@
+/**
+ * \file header-scanner.hpp
+ * \brief Vectorized line and header name scanner for text based protocols
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+
+#ifndef IPXP_PROCESS_HEADER_SCANNER_HPP
+#define IPXP_PROCESS_HEADER_SCANNER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ipxp {
+
+/**
+ * \brief Single line returned by HeaderScanner.
+ */
+struct HeaderLine {
+   const char *begin; /**< First character of the line. */
+   const char *end; /**< Terminating line feed, or end of data for an unterminated line. */
+   const char *colon; /**< First colon in the line or nullptr. */
+
+   /**
+    * \brief Get line length without the line feed.
+    */
+   size_t length() const
+   {
+      return end - begin;
+   }
+};
+
+/**
+ * \brief Splits payload of HTTP-like protocols (HTTP, RTSP, SIP) into lines.
+ *
+ * Payload is processed in 32 byte blocks. Line feeds and colons of a whole block are found at
+ * once using SIMD compares (AVX2 or SSE2, scalar loop otherwise) and kept as bit masks, so
+ * returning a line and its key/value delimiter costs only a few bit operations. Blocks are
+ * scanned lazily, parsers which stop at the end of a header section do not touch the body.
+ */
+class HeaderScanner
+{
+public:
+   static const size_t BLOCK_SIZE = 32;
+
+   /**
+    * \brief Constructor.
+    * \param [in] data Data to scan.
+    * \param [in] len Length of data.
+    */
+   HeaderScanner(const char *data, size_t len);
+
+   /**
+    * \brief Get next line terminated by line feed.
+    * \param [out] line Found line, carriage return (if any) is part of the line.
+    * \return False when there is no complete line left.
+    */
+   bool next(HeaderLine &line);
+
+   /**
+    * \brief Get the rest of data not terminated by line feed.
+    * Call after next() returned false.
+    * \param [out] line Unterminated rest of data.
+    * \return False when the data ended with line feed or the rest was already returned.
+    */
+   bool tail(HeaderLine &line);
+
+   /**
+    * \brief Find line feeds and colons of a block.
+    * \param [in] block BLOCK_SIZE bytes of data.
+    * \param [out] lf Bit i is set when byte i is line feed.
+    * \param [out] colon Bit i is set when byte i is colon.
+    */
+   static void find_block(const char *block, uint32_t &lf, uint32_t &colon);
+
+   /**
+    * \brief Portable version of find_block() used when SIMD is not available.
+    */
+   static void find_block_scalar(const char *block, uint32_t &lf, uint32_t &colon);
+
+private:
+   const char *m_data;
+   size_t m_len;
+   size_t m_line; /**< Offset of the current line. */
+   size_t m_block; /**< Offset of the last scanned block. */
+   size_t m_next; /**< Offset of the next block to scan. */
+   uint32_t m_lf; /**< Unconsumed line feeds of the last scanned block. */
+   uint32_t m_colon; /**< Unconsumed colons of the last scanned block. */
+   const char *m_first_colon; /**< Colon of the current line found in previous blocks. */
+
+   void scan_block();
+};
+
+/**
+ * \brief Header fields recognized by header_name().
+ */
+enum class HeaderName : uint8_t {
+   OTHER,
+   HOST,
+   USER_AGENT,
+   REFERER,
+   CONTENT_TYPE,
+   SERVER,
+   SET_COOKIE
+};
+
+/**
+ * \brief Identify header field name using perfect hash.
+ * \param [in] name Field name (case sensitive).
+ * \param [in] len Length of the name.
+ * \return Identified header field or HeaderName::OTHER.
+ */
+HeaderName header_name(const char *name, size_t len);
+
+}
+#endif /* IPXP_PROCESS_HEADER_SCANNER_HPP */
@@ -27,6 +27,7 @@
  *
  */
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
@@ -36,6 +37,7 @@
 #endif
 
 #include "common.hpp"
+#include "header-scanner.hpp"
 #include "http.hpp"
 
 namespace ipxp {
@@ -65,9 +67,8 @@ __attribute__((constructor)) static void register_this_plugin()
 #define DEBUG_CODE(code)
 #endif
 
-#define HTTP_LINE_DELIMITER "\r\n"
 #define HTTP_KEYVAL_DELIMITER ':'
-#define HTTP_SETCOOKIE_NAME_DELIMITER "="
+#define HTTP_SETCOOKIE_NAME_DELIMITER '='
 #define STRING_DELIMITER ";"
 
 HTTPPlugin::HTTPPlugin()
@@ -267,7 +268,7 @@ bool HTTPPlugin::parse_http_request(const char* data, int payload_len, RecordExt
 {
 	char buffer[64];
 	size_t remaining;
-	const char *begin, *end, *keyval_delimiter;
+	const char *begin, *end, *value;
 
 	total++;
 
@@ -331,69 +332,63 @@ bool HTTPPlugin::parse_http_request(const char* data, int payload_len, RecordExt
 	DEBUG_MSG("\tURI: %s\n", rec->uri);
 
 	/* Find begin of next line after request line. */
-	if (check_payload_len(payload_len, end - data)) {
-		DEBUG_MSG("Parser quits:\tpayload end\n");
-		return false;
-	}
-	remaining = payload_len - (end - data);
-	begin = ipxp::strnstr(end, HTTP_LINE_DELIMITER, remaining);
-	if (begin == nullptr) {
+	HeaderScanner scanner(end, payload_len - (end - data));
+	HeaderLine line;
+	if (!scanner.next(line)) {
 		DEBUG_MSG("Parser quits:\tNo line delim after request line\n");
 		return false;
 	}
-	begin += 2;
 
 	/* Header:
 	 *
 	 * REQ-FIELD: VALUE
 	 * |        |      |
-	 * |        |      ----- end
-	 * |        ------------ keyval_delimiter
-	 * --------------------- begin
+	 * |        |      ----- line.end
+	 * |        ------------ line.colon
+	 * --------------------- line.begin
 	 */
 
 	rec->host[0] = 0;
 	rec->user_agent[0] = 0;
 	rec->referer[0] = 0;
 	/* Process headers. */
-	while (begin - data < payload_len) {
-		remaining = payload_len - (begin - data);
-		end = ipxp::strnstr(begin, HTTP_LINE_DELIMITER, remaining);
-		keyval_delimiter
-			= static_cast<const char*>(memchr(begin, HTTP_KEYVAL_DELIMITER, remaining));
-
-		if (end == nullptr) {
-			DEBUG_MSG("Parser quits:\theader is fragmented\n");
-			return false;
+	while (true) {
+		if (!scanner.next(line)) {
+			if (scanner.tail(line)) {
+				DEBUG_MSG("Parser quits:\theader is fragmented\n");
+				return false;
+			}
+			break; /* Payload ends with the last header. */
 		}
 
-		end += 1;
-		int tmp = end - begin;
-		if (tmp == 0 || tmp == 1) { /* Check for blank line with \r\n or \n ending. */
+		if (line.length() <= 1) { /* Check for blank line with \r\n or \n ending. */
 			break; /* Double LF found - end of header section. */
-		} else if (keyval_delimiter == nullptr) {
-			DEBUG_MSG("Parser quits:\theader is fragmented\n");
-			return false;
+		} else if (line.colon == nullptr) {
+			/* Skip line without delimiter unless it is the last field. */
+			remaining = payload_len - (line.end - data);
+			if (memchr(line.end, HTTP_KEYVAL_DELIMITER, remaining) == nullptr) {
+				DEBUG_MSG("Parser quits:\theader is fragmented\n");
+				return false;
+			}
+			continue;
 		}
 
-		/* Copy field name. */
-		copy_str(buffer, sizeof(buffer), begin, keyval_delimiter);
+		value = std::min(line.colon + 2, line.end);
 
 		DEBUG_CODE(char debug_buffer[4096]);
-		DEBUG_CODE(copy_str(debug_buffer, sizeof(debug_buffer), keyval_delimiter + 2, end));
+		DEBUG_CODE(copy_str(buffer, sizeof(buffer), line.begin, line.colon));
+		DEBUG_CODE(copy_str(debug_buffer, sizeof(debug_buffer), value, line.end));
 		DEBUG_MSG("\t%s: %s\n", buffer, debug_buffer);
 
 		/* Copy interesting field values. */
-		if (!strcmp(buffer, "Host")) {
-			copy_str(rec->host, sizeof(rec->host), keyval_delimiter + 2, end);
-		} else if (!strcmp(buffer, "User-Agent")) {
-			copy_str(rec->user_agent, sizeof(rec->user_agent), keyval_delimiter + 2, end);
-		} else if (!strcmp(buffer, "Referer")) {
-			copy_str(rec->referer, sizeof(rec->referer), keyval_delimiter + 2, end);
+		HeaderName name = header_name(line.begin, line.colon - line.begin);
+		if (name == HeaderName::HOST) {
+			copy_str(rec->host, sizeof(rec->host), value, line.end);
+		} else if (name == HeaderName::USER_AGENT) {
+			copy_str(rec->user_agent, sizeof(rec->user_agent), value, line.end);
+		} else if (name == HeaderName::REFERER) {
+			copy_str(rec->referer, sizeof(rec->referer), value, line.end);
 		}
-
-		/* Go to next line. */
-		begin = end + 1;
 	}
 
 	DEBUG_MSG("Parser quits:\tend of header section\n");
@@ -412,7 +407,7 @@ bool HTTPPlugin::parse_http_request(const char* data, int payload_len, RecordExt
 bool HTTPPlugin::parse_http_response(const char* data, int payload_len, RecordExtHTTP* rec)
 {
 	char buffer[64];
-	const char *begin, *end, *keyval_delimiter, *cookie_name_end;
+	const char *begin, *end, *value, *cookie_name_end;
 	size_t remaining;
 	int code;
 
@@ -479,25 +474,20 @@ bool HTTPPlugin::parse_http_response(const char* data, int payload_len, RecordEx
 	rec->code = code;
 
 	/* Find begin of next line after request line. */
-	if (check_payload_len(payload_len, end - data)) {
-		DEBUG_MSG("Parser quits:\tpayload end\n");
-		return false;
-	}
-	remaining = payload_len - (end - data);
-	begin = ipxp::strnstr(end, HTTP_LINE_DELIMITER, remaining);
-	if (begin == nullptr) {
+	HeaderScanner scanner(end, payload_len - (end - data));
+	HeaderLine line;
+	if (!scanner.next(line)) {
 		DEBUG_MSG("Parser quits:\tNo line delim after request line\n");
 		return false;
 	}
-	begin += 2;
 
 	/* Header:
 	 *
 	 * REQ-FIELD: VALUE
 	 * |        |      |
-	 * |        |      ----- end
-	 * |        ------------ keyval_delimiter
-	 * --------------------- begin
+	 * |        |      ----- line.end
+	 * |        ------------ line.colon
+	 * --------------------- line.begin
 	 */
 
 	rec->content_type[0] = 0;
@@ -505,54 +495,53 @@ bool HTTPPlugin::parse_http_response(const char* data, int payload_len, RecordEx
 	rec->set_cookie[0] = 0;
 
 	/* Process headers. */
-	while (begin - data < payload_len) {
-		remaining = payload_len - (begin - data);
-		end = ipxp::strnstr(begin, HTTP_LINE_DELIMITER, remaining);
-		keyval_delimiter
-			= static_cast<const char*>(memchr(begin, HTTP_KEYVAL_DELIMITER, remaining));
-
-		if (end == nullptr) {
-			DEBUG_MSG("Parser quits:\theader is fragmented\n");
-			return false;
+	while (true) {
+		if (!scanner.next(line)) {
+			if (scanner.tail(line)) {
+				DEBUG_MSG("Parser quits:\theader is fragmented\n");
+				return false;
+			}
+			break; /* Payload ends with the last header. */
 		}
 
-		end += 1;
-		int tmp = end - begin;
-		if (tmp == 0 || tmp == 1) { /* Check for blank line with \r\n or \n ending. */
+		if (line.length() <= 1) { /* Check for blank line with \r\n or \n ending. */
 			break; /* Double LF found - end of header section. */
-		} else if (keyval_delimiter == nullptr) {
-			DEBUG_MSG("Parser quits:\theader is fragmented\n");
-			return false;
+		} else if (line.colon == nullptr) {
+			/* Skip line without delimiter unless it is the last field. */
+			remaining = payload_len - (line.end - data);
+			if (memchr(line.end, HTTP_KEYVAL_DELIMITER, remaining) == nullptr) {
+				DEBUG_MSG("Parser quits:\theader is fragmented\n");
+				return false;
+			}
+			continue;
 		}
 
-		/* Copy field name. */
-		copy_str(buffer, sizeof(buffer), begin, keyval_delimiter);
+		value = std::min(line.colon + 2, line.end);
 
 		DEBUG_CODE(char debug_buffer[4096]);
-		DEBUG_CODE(copy_str(debug_buffer, sizeof(debug_buffer), keyval_delimiter + 2, end));
+		DEBUG_CODE(copy_str(buffer, sizeof(buffer), line.begin, line.colon));
+		DEBUG_CODE(copy_str(debug_buffer, sizeof(debug_buffer), value, line.end));
 		DEBUG_MSG("\t%s: %s\n", buffer, debug_buffer);
 
 		/* Copy interesting field values. */
-		if (!strcmp(buffer, "Content-Type")) {
-			copy_str(rec->content_type, sizeof(rec->content_type), keyval_delimiter + 2, end);
-		} else if (!strcmp(buffer, "Server")) {
-			copy_str(rec->server, sizeof(rec->server), keyval_delimiter + 2, end);
-		} else if (!strcmp(buffer, "Set-Cookie")) {
-			cookie_name_end
-				= ipxp::strnstr(begin, HTTP_SETCOOKIE_NAME_DELIMITER, size_t(end - begin));
+		HeaderName name = header_name(line.begin, line.colon - line.begin);
+		if (name == HeaderName::CONTENT_TYPE) {
+			copy_str(rec->content_type, sizeof(rec->content_type), value, line.end);
+		} else if (name == HeaderName::SERVER) {
+			copy_str(rec->server, sizeof(rec->server), value, line.end);
+		} else if (name == HeaderName::SET_COOKIE) {
+			cookie_name_end = static_cast<const char*>(
+				memchr(value, HTTP_SETCOOKIE_NAME_DELIMITER, line.end - value));
 			if (cookie_name_end == nullptr) {
 				break;
 			}
 			add_str(
 				rec->set_cookie,
 				sizeof(rec->set_cookie),
-				keyval_delimiter + 2,
+				value,
 				cookie_name_end,
 				STRING_DELIMITER);
 		}
-
-		/* Go to next line. */
-		begin = end + 1;
 	}
 
 	DEBUG_MSG("Parser quits:\tend of header section\n");
@@ -28,14 +28,15 @@
  */
 
 #include <iostream>
-#include <iomanip>
 #include <sstream>
 #include <cstring>
 #include <cstdio>
+#include <climits>
+#include <dirent.h>
+#include <pwd.h>
 
 #include "osquery.hpp"
-
-#define HEX(x) std::setw(2) << std::setfill('0') << std::hex << (int) (x)
+#include <ipfixprobe/hash.hpp>
 
 namespace ipxp {
 
@@ -48,13 +49,13 @@ __attribute__((constructor)) static void register_this_plugin()
    RecordExtOSQUERY::REGISTERED_ID = register_extension();
 }
 
-OSQUERYPlugin::OSQUERYPlugin() : manager(nullptr), numberOfSuccessfullyRequests(0)
+OSQUERYPlugin::OSQUERYPlugin() : snapshotGeneration(0), numberOfSuccessfullyRequests(0), numberOfLateResults(0)
 {
 }
 
-OSQUERYPlugin::OSQUERYPlugin(const OSQUERYPlugin &p)
+OSQUERYPlugin::OSQUERYPlugin(const OSQUERYPlugin &p) : resolver(p.resolver), snapshotGeneration(0),
+   numberOfSuccessfullyRequests(0), numberOfLateResults(0)
 {
-   init(nullptr);
 }
 
 OSQUERYPlugin::~OSQUERYPlugin()
@@ -64,16 +65,20 @@ OSQUERYPlugin::~OSQUERYPlugin()
 
 void OSQUERYPlugin::init(const char *params)
 {
-   manager = new OsqueryRequestManager();
-   manager->readInfoAboutOS();
+   OSQUERYOptParser parser;
+   try {
+      parser.parse(params);
+   } catch (ParserError &e) {
+      throw PluginError(e.what());
+   }
+
+   resolver = std::make_shared<OsqueryResolver>(parser.m_cmd, parser.m_interval, parser.m_timeout);
 }
 
 void OSQUERYPlugin::close()
 {
-   if (manager != nullptr) {
-      delete manager;
-      manager = nullptr;
-   }
+   snapshot.reset();
+   resolver.reset();
 }
 
 ProcessPlugin *OSQUERYPlugin::copy()
@@ -81,92 +86,401 @@ ProcessPlugin *OSQUERYPlugin::copy()
    return new OSQUERYPlugin(*this);
 }
 
-int OSQUERYPlugin::post_create(Flow &rec, const Packet &pkt)
+bool OSQUERYPlugin::addRecord(Flow &rec)
 {
-   ConvertedFlowData flowDataIPv4(rec.src_ip.v4, rec.dst_ip.v4, rec.src_port, rec.dst_port);
+   if (snapshotGeneration != resolver->getGeneration()) {
+      snapshot = resolver->getSnapshot(snapshotGeneration);
+   }
 
-   if (manager->readInfoAboutProgram(flowDataIPv4)) {
-      RecordExtOSQUERY *record = new RecordExtOSQUERY(manager->getRecord());
-      rec.add_extension(record);
+   const OsqueryProgram *program = snapshot ? snapshot->find(rec) : nullptr;
+   if (program == nullptr) {
+      return false;
+   }
 
+   RecordExtOSQUERY *record = new RecordExtOSQUERY(resolver->getOSRecord());
+   record->program_name = program->program_name;
+   record->username     = program->username;
+   rec.add_extension(record);
+   return true;
+}
+
+int OSQUERYPlugin::post_create(Flow &rec, const Packet &pkt)
+{
+   if (addRecord(rec)) {
       numberOfSuccessfullyRequests++;
+   } else {
+      // The socket may be too new for the cache, try again before export
+      resolver->requestRefresh();
    }
 
    return 0;
 }
 
+void OSQUERYPlugin::pre_export(Flow &rec)
+{
+   if (rec.get_extension(RecordExtOSQUERY::REGISTERED_ID) == nullptr && addRecord(rec)) {
+      numberOfSuccessfullyRequests++;
+      numberOfLateResults++;
+   }
+}
+
 void OSQUERYPlugin::finish(bool print_stats)
 {
    if (print_stats) {
       std::cout << "OSQUERY plugin stats:" << std::endl;
       std::cout << "Number of successfully processed requests: " << numberOfSuccessfullyRequests << std::endl;
+      std::cout << "Number of requests resolved before export: " << numberOfLateResults << std::endl;
    }
 }
 
-ConvertedFlowData::ConvertedFlowData(uint32_t sourceIPv4, uint32_t destinationIPv4, uint16_t sourcePort,
-  uint16_t destinationPort)
+size_t OsquerySocketHash::operator()(const OsquerySocket &socket) const
 {
-   convertIPv4(sourceIPv4, true);
-   convertIPv4(destinationIPv4, false);
-   convertPort(sourcePort, true);
-   convertPort(destinationPort, false);
+   return hash_bytes(&socket, sizeof(socket));
 }
 
-ConvertedFlowData::ConvertedFlowData(const uint8_t *sourceIPv6, const uint8_t *destinationIPv6, uint16_t sourcePort,
-  uint16_t destinationPort)
+const OsqueryProgram *OsquerySnapshot::find(const Flow &rec) const
 {
-   convertIPv6(sourceIPv6, true);
-   convertIPv6(destinationIPv6, false);
-   convertPort(sourcePort, true);
-   convertPort(destinationPort, false);
+   OsquerySocket socket;
+
+   socket.ip_version = rec.ip_version;
+   if (rec.ip_version == IP::v4) {
+      socket.local_ip.v4  = rec.src_ip.v4;
+      socket.remote_ip.v4 = rec.dst_ip.v4;
+   } else {
+      memcpy(socket.local_ip.v6, rec.src_ip.v6, sizeof(socket.local_ip.v6));
+      memcpy(socket.remote_ip.v6, rec.dst_ip.v6, sizeof(socket.remote_ip.v6));
+   }
+   socket.local_port  = rec.src_port;
+   socket.remote_port = rec.dst_port;
+
+   auto it = sockets.find(socket);
+   if (it != sockets.end()) {
+      return it->second.get();
+   }
+
+   // Flow can be started by the remote side
+   std::swap(socket.local_ip, socket.remote_ip);
+   std::swap(socket.local_port, socket.remote_port);
+   it = sockets.find(socket);
+   if (it != sockets.end()) {
+      return it->second.get();
+   }
+   return nullptr;
 }
 
-void ConvertedFlowData::convertIPv4(uint32_t addr, bool isSourceIP)
+OsqueryResolver::OsqueryResolver(const std::string &command, uint32_t interval, uint32_t timeout,
+   const std::string &procPath) :
+   manager(nullptr),
+   procPath(procPath),
+   interval(interval),
+   timeout(timeout),
+   stop(false),
+   refreshRequested(false),
+   generation(0),
+   thread(nullptr)
+{
+   manager = new OsqueryRequestManager(command);
+   manager->readInfoAboutOS();
+   osRecord = RecordExtOSQUERY(manager->getRecord());
+
+   refresh();
+   thread = new std::thread(&OsqueryResolver::run, this);
+}
+
+OsqueryResolver::~OsqueryResolver()
 {
-   std::stringstream ss;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      stop = true;
+   }
+   cv.notify_one();
+   thread->join();
+   delete thread;
+   delete manager;
+}
 
-   ss << ((addr) & 0x000000ff) << "."
-      << ((addr >> 8) & 0x000000ff) << "."
-      << ((addr >> 16) & 0x000000ff) << "."
-      << ((addr >> 24) & 0x000000ff);
+std::shared_ptr<const OsquerySnapshot> OsqueryResolver::getSnapshot(uint64_t &gen)
+{
+   std::lock_guard<std::mutex> guard(lock);
+   gen = generation.load(std::memory_order_relaxed);
+   return snapshot;
+}
 
-   if (isSourceIP) {
-      this->src_ip = ss.str();
-   } else {
-      this->dst_ip = ss.str();
+void OsqueryResolver::requestRefresh()
+{
+   if (refreshRequested.load(std::memory_order_relaxed) || refreshRequested.exchange(true)) {
+      return;
+   }
+   // Taking the lock makes sure the thread is either waiting or has not checked the flag yet
+   {
+      std::lock_guard<std::mutex> guard(lock);
    }
+   cv.notify_one();
 }
 
-void ConvertedFlowData::convertIPv6(const uint8_t *addr, bool isSourceIP)
+void OsqueryResolver::run()
 {
-   std::stringstream ss;
+   std::unique_lock<std::mutex> guard(lock);
+   while (!stop) {
+      // Limit the rate of refreshes requested by cache misses
+      auto last = std::chrono::steady_clock::now();
+      cv.wait_for(guard, std::chrono::milliseconds(MIN_REFRESH_INTERVAL), [this]() { return stop; });
+      cv.wait_until(guard, last + interval, [this]() { return stop || refreshRequested.load(); });
+      if (stop) {
+         break;
+      }
+      refreshRequested = false;
 
-   ss << HEX(addr[0]);
-   for (int i = 1; i < 16; i++) {
-      ss << ":" << HEX(addr[i]);
+      guard.unlock();
+      refresh();
+      guard.lock();
    }
+}
 
-   if (isSourceIP) {
-      this->src_ip = ss.str();
-   } else {
-      this->dst_ip = ss.str();
+void OsqueryResolver::refresh()
+{
+   std::vector<ProcSocket> current;
+   readProcNet((procPath + "/net/tcp").c_str(), current);
+   readProcNet((procPath + "/net/tcp6").c_str(), current);
+   readProcNet((procPath + "/net/udp").c_str(), current);
+   readProcNet((procPath + "/net/udp6").c_str(), current);
+
+   auto now = std::chrono::steady_clock::now();
+   bool changed = false;
+
+   // Find owners of new sockets and of sockets whose program was not found yet
+   std::unordered_map<uint64_t, pid_t> inodes;
+   for (const auto &it : current) {
+      auto cached = sockets.find(it.socket);
+      if (cached == sockets.end() || cached->second.inode != it.inode || cached->second.retry()) {
+         inodes.emplace(it.inode, 0);
+      }
+   }
+   if (!inodes.empty()) {
+      findOwners(inodes);
+   }
+
+   for (const auto &it : current) {
+      auto cached = sockets.find(it.socket);
+      if (cached == sockets.end() || cached->second.inode != it.inode) {
+         CachedSocket &socket = sockets[it.socket];
+         socket.inode   = it.inode;
+         socket.pid     = inodes[it.inode];
+         socket.program = socket.pid > 0 ? getProgram(socket.pid, it.uid) : nullptr;
+         socket.retries = 0;
+         socket.lastSeen = now;
+         changed = true;
+      } else if (cached->second.retry()) {
+         CachedSocket &socket = cached->second;
+         socket.pid     = inodes[it.inode];
+         socket.program = socket.pid > 0 ? getProgram(socket.pid, it.uid) : nullptr;
+         socket.retries++;
+         socket.lastSeen = now;
+         // Only sockets with a program are published
+         changed = changed || socket.program;
+      } else {
+         cached->second.lastSeen = now;
+      }
+   }
+
+   // Remove sockets closed before timeout and programs without sockets
+   std::unordered_map<pid_t, std::shared_ptr<const OsqueryProgram>> live;
+   for (auto it = sockets.begin(); it != sockets.end();) {
+      if (now - it->second.lastSeen > timeout) {
+         it = sockets.erase(it);
+         changed = true;
+         continue;
+      }
+      if (it->second.program) {
+         live.emplace(it->second.pid, it->second.program);
+      }
+      ++it;
+   }
+   programs.swap(live);
+
+   if (changed) {
+      publish();
+   }
+}
+
+void OsqueryResolver::publish()
+{
+   auto next = std::make_shared<OsquerySnapshot>();
+   next->sockets.reserve(sockets.size());
+   for (const auto &it : sockets) {
+      if (it.second.program) {
+         next->sockets.emplace(it.first, it.second.program);
+      }
    }
+
+   std::lock_guard<std::mutex> guard(lock);
+   snapshot = next;
+   generation.fetch_add(1, std::memory_order_release);
 }
 
-void ConvertedFlowData::convertPort(uint16_t port, bool isSourcePort)
+/**
+ * Parses address printed by /proc/net/{tcp,udp}{,6}, i.e. 32-bit words of the address in hexadecimal.
+ * IPv4-mapped IPv6 addresses are converted to IPv4 to match flows.
+ */
+static bool parseProcAddress(const char *hex, ipaddr_t &addr, uint8_t &ipVersion)
 {
-   std::stringstream ss;
+   size_t len = strlen(hex);
+   if (len != 8 && len != 32) {
+      return false;
+   }
 
-   ss << port;
+   for (size_t i = 0; i < len / 8; i++) {
+      char word[9];
+      memcpy(word, hex + i * 8, 8);
+      word[8] = 0;
+      uint32_t value = strtoul(word, nullptr, 16);
+      memcpy(addr.v6 + i * 4, &value, 4);
+   }
 
-   if (isSourcePort) {
-      this->src_port = ss.str();
+   ipVersion = IP::v6;
+   if (len == 8) {
+      ipVersion = IP::v4;
+   } else if (!memcmp(addr.v6, "\0\0\0\0\0\0\0\0\0\0\xff\xff", 12)) {
+      uint32_t v4;
+      memcpy(&v4, addr.v6 + 12, 4);
+      memset(addr.v6, 0, sizeof(addr.v6));
+      addr.v4 = v4;
+      ipVersion = IP::v4;
+   }
+   return true;
+}
+
+void OsqueryResolver::readProcNet(const char *path, std::vector<ProcSocket> &out) const
+{
+   FILE *file = fopen(path, "r");
+   if (file == nullptr) {
+      return;
+   }
+
+   char line[512];
+   char local[33];
+   char remote[33];
+   unsigned long inode;
+   unsigned uid;
+   ProcSocket item;
+
+   // Skip header
+   if (fgets(line, sizeof(line), file) == nullptr) {
+      fclose(file);
+      return;
+   }
+   while (fgets(line, sizeof(line), file) != nullptr) {
+      item.socket = OsquerySocket();
+      if (sscanf(line, " %*d: %32[0-9A-Fa-f]:%hx %32[0-9A-Fa-f]:%hx %*x %*x:%*x %*x:%*x %*x %u %*d %lu",
+            local, &item.socket.local_port, remote, &item.socket.remote_port, &uid, &inode) != 6) {
+         continue;
+      }
+      // Listening, unbound and TIME_WAIT sockets cannot be matched with a flow
+      if (inode == 0 || item.socket.remote_port == 0) {
+         continue;
+      }
+      uint8_t remoteVersion;
+      if (!parseProcAddress(local, item.socket.local_ip, item.socket.ip_version)
+         || !parseProcAddress(remote, item.socket.remote_ip, remoteVersion)
+         || item.socket.ip_version != remoteVersion) {
+         continue;
+      }
+      item.inode = inode;
+      item.uid   = uid;
+      out.push_back(item);
+   }
+   fclose(file);
+}
+
+void OsqueryResolver::findOwners(std::unordered_map<uint64_t, pid_t> &inodes) const
+{
+   DIR *proc = opendir(procPath.c_str());
+   if (proc == nullptr) {
+      return;
+   }
+
+   size_t remaining = inodes.size();
+   struct dirent *process;
+   while (remaining > 0 && (process = readdir(proc)) != nullptr) {
+      char *end;
+      pid_t pid = strtol(process->d_name, &end, 10);
+      if (*end != 0 || pid <= 0) {
+         continue;
+      }
+
+      char path[PATH_MAX];
+      snprintf(path, sizeof(path), "%s/%d/fd", procPath.c_str(), pid);
+      DIR *fds = opendir(path);
+      if (fds == nullptr) {
+         continue;
+      }
+
+      struct dirent *fd;
+      while (remaining > 0 && (fd = readdir(fds)) != nullptr) {
+         char link[PATH_MAX + sizeof(fd->d_name)];
+         char target[64];
+         snprintf(link, sizeof(link), "%s/%s", path, fd->d_name);
+         ssize_t len = readlink(link, target, sizeof(target) - 1);
+         if (len <= 9 || memcmp(target, "socket:[", 8)) {
+            continue;
+         }
+         target[len] = 0;
+
+         auto it = inodes.find(strtoull(target + 8, nullptr, 10));
+         if (it != inodes.end() && it->second == 0) {
+            it->second = pid;
+            remaining--;
+         }
+      }
+      closedir(fds);
+   }
+   closedir(proc);
+}
+
+std::shared_ptr<const OsqueryProgram> OsqueryResolver::getProgram(pid_t pid, uid_t uid)
+{
+   auto it = programs.find(pid);
+   if (it != programs.end()) {
+      return it->second;
+   }
+
+   auto program = std::make_shared<OsqueryProgram>();
+   if (manager->readInfoAboutProgram(pid)) {
+      program->program_name = manager->getRecord()->program_name;
+      program->username     = manager->getRecord()->username;
    } else {
-      this->dst_port = ss.str();
+      // Osquery is not available, read the same information directly
+      char path[PATH_MAX];
+      char name[64];
+      snprintf(path, sizeof(path), "%s/%d/comm", procPath.c_str(), pid);
+      FILE *file = fopen(path, "r");
+      if (file == nullptr) {
+         return nullptr;
+      }
+      if (fgets(name, sizeof(name), file) == nullptr) {
+         fclose(file);
+         return nullptr;
+      }
+      fclose(file);
+      name[strcspn(name, "\n")] = 0;
+      program->program_name = name;
+
+      struct passwd pwd;
+      struct passwd *result = nullptr;
+      char buffer[1024];
+      if (getpwuid_r(uid, &pwd, buffer, sizeof(buffer), &result) == 0 && result != nullptr) {
+         program->username = pwd.pw_name;
+      } else {
+         program->username = std::to_string(uid);
+      }
    }
+
+   programs[pid] = program;
+   return program;
 }
 
-OsqueryRequestManager::OsqueryRequestManager() :
+OsqueryRequestManager::OsqueryRequestManager(const std::string &command) :
+   command(command),
    inputFD(0),
    outputFD(0),
    buffer(nullptr),
@@ -213,7 +527,7 @@ void OsqueryRequestManager::readInfoAboutOS()
    }
 }
 
-bool OsqueryRequestManager::readInfoAboutProgram(const ConvertedFlowData &flowData)
+bool OsqueryRequestManager::readInfoAboutProgram(pid_t pid)
 {
    if (handler.isFatalError()) {
       return false;
@@ -222,14 +536,8 @@ bool OsqueryRequestManager::readInfoAboutProgram(const ConvertedFlowData &flowDa
    recOsquery->program_name = DEFAULT_FILL_TEXT;
    recOsquery->username     = DEFAULT_FILL_TEXT;
 
-   std::string pid;
-
-   if (!getPID(pid, flowData)) {
-      return false;
-   }
-
    std::string query = "SELECT p.name, u.username FROM processes AS p INNER JOIN users AS u ON p.uid=u.uid "
-     "WHERE p.pid='" + pid + "';\r\n";
+     "WHERE p.pid='" + std::to_string(pid) + "';\r\n";
 
    if (executeQuery(query) > 0) {
       if (parseJsonAboutProgram()) {
@@ -374,7 +682,7 @@ void OsqueryRequestManager::openOsqueryFD()
    handler.reset();
    numberOfAttempts++;
 
-   osqueryProcessId = popen2("osqueryi --json 2>/dev/null", &inputFD, &outputFD);
+   osqueryProcessId = popen2(command.c_str(), &inputFD, &outputFD);
 
    if (osqueryProcessId <= 0) {
       handler.setOpenFDError();
@@ -406,57 +714,6 @@ void OsqueryRequestManager::killPreviousProcesses(bool useWhonangOption) const
    }
 }
 
-bool OsqueryRequestManager::getPID(std::string &pid, const ConvertedFlowData &flowData)
-{
-   std::string query = "SELECT pid FROM process_open_sockets WHERE "
-     "(local_address='" + flowData.src_ip + "' AND "
-     "remote_address='" + flowData.dst_ip + "' AND "
-     "local_port='" + flowData.src_port + "' AND "
-     "remote_port='" + flowData.dst_port + "') OR "
-     "(local_address='" + flowData.dst_ip + "' AND "
-     "remote_address='" + flowData.src_ip + "' AND "
-     "local_port='" + flowData.dst_port + "' AND "
-     "remote_port='" + flowData.src_port + "') LIMIT 1;\r\n";
-
-   if (executeQuery(query) > 0) {
-      if (parseJsonSingleItem("pid", pid)) {
-         return true;
-      }
-   }
-
-   return false;
-}
-
-bool OsqueryRequestManager::parseJsonSingleItem(const std::string &singleKey, std::string &singleValue)
-{
-   int pos = getPositionForParseJson();
-
-   if (pos == -1) {
-      return false;
-   }
-
-   int count = 0;
-   std::string key, value;
-   while (true) {
-      key.clear();
-      value.clear();
-      pos = parseJsonItem(pos, key, value);
-      if (pos < 0) {
-         return false;
-      }
-      if (pos == 0) {
-         return count == 1;
-      }
-
-      if (key == singleKey) {
-         singleValue = value;
-         count++;
-      } else {
-         return false;
-      }
-   }
-}
-
 bool OsqueryRequestManager::parseJsonOSVersion()
 {
    int pos = getPositionForParseJson();
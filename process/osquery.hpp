@@ -30,8 +30,16 @@
 #ifndef IPXP_PROCESS_OSQUERY_HPP
 #define IPXP_PROCESS_OSQUERY_HPP
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include <poll.h>
 #include <unistd.h>
 #include <sys/wait.h>
@@ -44,6 +52,9 @@
 #include <ipfixprobe/flowifc.hpp>
 #include <ipfixprobe/packet.hpp>
 #include <ipfixprobe/ipfix-elements.hpp>
+#include <ipfixprobe/options.hpp>
+#include <ipfixprobe/utils.hpp>
+#include <ipfixprobe/ipaddr.hpp>
 
 #define DEFAULT_FILL_TEXT "UNDEFINED"
 
@@ -60,6 +71,13 @@
 #define READ_FD                0
 #define WRITE_FD               1
 #define MAX_NUMBER_OF_ATTEMPTS 2 // Max number of osquery error correction attempts
+#define DEFAULT_OSQUERY_CMD    "osqueryi --json 2>/dev/null"
+
+// OsqueryResolver
+#define DEFAULT_REFRESH_INTERVAL 1000 // millis, period of socket cache refresh
+#define MIN_REFRESH_INTERVAL     50 // millis, minimal delay of refresh requested by cache miss
+#define DEFAULT_SOCKET_TIMEOUT   60 // seconds, closed sockets are kept in the cache for late lookups
+#define MAX_OWNER_RETRIES        10 // refreshes which look for the program of a socket again when it was not found
 
 #define OSQUERY_UNIREC_TEMPLATE \
    "OSQUERY_PROGRAM_NAME,OSQUERY_USERNAME,OSQUERY_OS_NAME,OSQUERY_OS_MAJOR,OSQUERY_OS_MINOR,OSQUERY_OS_BUILD,OSQUERY_OS_PLATFORM,OSQUERY_OS_PLATFORM_LIKE,OSQUERY_OS_ARCH,OSQUERY_KERNEL_VERSION,OSQUERY_SYSTEM_HOSTNAME"
@@ -313,64 +331,15 @@ private:
 };
 
 
-/**
- * \brief Additional structure for store and convert data from flow (src_ip, dst_ip, src_port, dst_port) to string.
- */
-struct ConvertedFlowData {
-   /**
-    * Constructor for IPv4-based flow.
-    * @param sourceIPv4 source IPv4 address.
-    * @param destinationIPv4 destination IPv4 address.
-    * @param sourcePort source port.
-    * @param destinationPort destination port.
-    */
-   ConvertedFlowData(uint32_t sourceIPv4, uint32_t destinationIPv4, uint16_t sourcePort, uint16_t destinationPort);
-
-   /**
-    * Constructor for IPv6-based flow.
-    * @param sourceIPv6 source IPv6 address.
-    * @param destinationIPv6 destination IPv6 address.
-    * @param sourcePort source port.
-    * @param destinationPort destination port.
-    */
-   ConvertedFlowData(const uint8_t *sourceIPv6, const uint8_t *destinationIPv6, uint16_t sourcePort,
-     uint16_t destinationPort);
-
-   std::string src_ip;
-   std::string dst_ip;
-   std::string src_port;
-   std::string dst_port;
-
-private:
-
-   /**
-    * Converts an IPv4 numeric value to a string.
-    * @param addr IPv4 address.
-    * @param isSourceIP if true - source IP conversion mode, if false - destination IP conversion mode.
-    */
-   void convertIPv4(uint32_t addr, bool isSourceIP);
-
-   /**
-    * Converts an IPv6 numeric value to a string.
-    * @param addr IPv6 address.
-    * @param isSourceIP if true - source IP conversion mode, if false - destination IP conversion mode.
-    */
-   void convertIPv6(const uint8_t *addr, bool isSourceIP);
-
-   /**
-    * Converts the numeric port value to a string.
-    * @param port
-    * @param isSourcePort if true - source port conversion mode, if false - destination port conversion mode.
-    */
-   void convertPort(uint16_t port, bool isSourcePort);
-};
-
-
 /**
  * \brief Manager for communication with osquery
  */
 struct OsqueryRequestManager {
-   OsqueryRequestManager();
+   /**
+    * Starts osquery.
+    * @param command command starting osquery interactive shell in json mode.
+    */
+   OsqueryRequestManager(const std::string &command = DEFAULT_OSQUERY_CMD);
 
    ~OsqueryRequestManager();
 
@@ -383,10 +352,10 @@ struct OsqueryRequestManager {
 
    /**
     * Fills the record with program values from osquery.
-    * @param flowData flow data converted to string.
+    * @param pid process id.
     * @return true if success or false.
     */
-   bool readInfoAboutProgram(const ConvertedFlowData &flowData);
+   bool readInfoAboutProgram(pid_t pid);
 
 private:
 
@@ -438,22 +407,6 @@ private:
     */
    void killPreviousProcesses(bool useWhonangOption = true) const;
 
-   /**
-    * Tries to get the process id from table "process_open_sockets".
-    * @param[out] pid      process id.
-    * @param[in]  flowData flow data converted to string.
-    * @return true true if success or false.
-    */
-   bool getPID(std::string &pid, const ConvertedFlowData &flowData);
-
-   /**
-    * Parses json string with only one element.
-    * @param[in]  singleKey    key.
-    * @param[out] singleValue  value.
-    * @return true if success or false.
-    */
-   bool parseJsonSingleItem(const std::string &singleKey, std::string &singleValue);
-
    /**
     * Parses json by template.
     * @return true if success or false.
@@ -503,6 +456,7 @@ private:
     */
    int getPositionForParseJson();
 
+   std::string         command;
    int                 inputFD;
    int                 outputFD;
    char *              buffer;
@@ -516,6 +470,162 @@ private:
 };
 
 
+/**
+ * \brief Local socket as listed in /proc/net/{tcp,udp}{,6}.
+ */
+struct OsquerySocket {
+   ipaddr_t local_ip;
+   ipaddr_t remote_ip;
+   uint16_t local_port;
+   uint16_t remote_port;
+   uint8_t  ip_version;
+   uint8_t  padding[3];
+
+   OsquerySocket() { memset(this, 0, sizeof(*this)); }
+
+   bool operator==(const OsquerySocket &other) const { return !memcmp(this, &other, sizeof(*this)); }
+};
+
+struct OsquerySocketHash {
+   size_t operator()(const OsquerySocket &socket) const;
+};
+
+/**
+ * \brief Program owning a local socket.
+ */
+struct OsqueryProgram {
+   std::string program_name;
+   std::string username;
+};
+
+/**
+ * \brief Immutable map of local sockets to their programs, published by OsqueryResolver.
+ */
+struct OsquerySnapshot {
+   std::unordered_map<OsquerySocket, std::shared_ptr<const OsqueryProgram>, OsquerySocketHash> sockets;
+
+   /**
+    * Finds program owning a local end of the flow.
+    * @param rec flow record.
+    * @return program or nullptr if the flow does not belong to a known local socket.
+    */
+   const OsqueryProgram *find(const Flow &rec) const;
+};
+
+/**
+ * \brief Resolves flows to local programs without blocking the flow cache.
+ *
+ * Background thread periodically reads sockets from /proc/net, finds owning processes of new
+ * sockets in /proc/<pid>/fd and asks osquery for their program and user names (/proc/<pid>/comm
+ * and passwd database are used when osquery is not available). Results are published as an
+ * immutable snapshot, so lookups only compare a generation counter and search a hash map. A cache
+ * miss wakes the thread up earlier, closed sockets stay in the cache for late lookups from pre_export.
+ * Sockets whose program was not found (e.g. its process could not be read from /proc or osquery did
+ * not answer) are looked up again by the next MAX_OWNER_RETRIES refreshes.
+ */
+class OsqueryResolver
+{
+public:
+   /**
+    * Reads information about OS and starts the background thread.
+    * @param command command starting osquery interactive shell in json mode.
+    * @param interval cache refresh period in milliseconds.
+    * @param timeout number of seconds closed sockets stay in the cache.
+    * @param procPath mount point of procfs.
+    */
+   OsqueryResolver(const std::string &command, uint32_t interval, uint32_t timeout,
+      const std::string &procPath = "/proc");
+
+   ~OsqueryResolver();
+
+   const RecordExtOSQUERY *getOSRecord() const { return &osRecord; }
+
+   uint64_t getGeneration() const { return generation.load(std::memory_order_acquire); }
+
+   /**
+    * Gets the latest snapshot of the cache.
+    * @param[out] gen generation of the snapshot.
+    * @return current snapshot.
+    */
+   std::shared_ptr<const OsquerySnapshot> getSnapshot(uint64_t &gen);
+
+   /**
+    * Asks the background thread for an early refresh, does not block.
+    */
+   void requestRefresh();
+
+private:
+   /**
+    * \brief Socket read from /proc/net.
+    */
+   struct ProcSocket {
+      OsquerySocket socket;
+      uint64_t inode;
+      uid_t uid;
+   };
+
+   /**
+    * \brief Cached socket owned by the background thread.
+    */
+   struct CachedSocket {
+      std::shared_ptr<const OsqueryProgram> program; // nullptr when the owner was not found
+      uint64_t inode;
+      pid_t pid;
+      uint8_t retries; // refreshes which did not find the program
+      std::chrono::steady_clock::time_point lastSeen;
+
+      bool retry() const { return !program && retries < MAX_OWNER_RETRIES; }
+   };
+
+   void run();
+   void refresh();
+   void publish();
+   void readProcNet(const char *path, std::vector<ProcSocket> &out) const;
+   void findOwners(std::unordered_map<uint64_t, pid_t> &inodes) const;
+   std::shared_ptr<const OsqueryProgram> getProgram(pid_t pid, uid_t uid);
+
+   OsqueryRequestManager *manager;
+   RecordExtOSQUERY osRecord;
+   std::string procPath;
+   std::chrono::milliseconds interval;
+   std::chrono::seconds timeout;
+
+   // Owned by the background thread
+   std::unordered_map<OsquerySocket, CachedSocket, OsquerySocketHash> sockets;
+   std::unordered_map<pid_t, std::shared_ptr<const OsqueryProgram>> programs;
+
+   // Shared with lookups
+   std::mutex lock;
+   std::condition_variable cv;
+   bool stop;
+   std::atomic<bool> refreshRequested;
+   std::atomic<uint64_t> generation;
+   std::shared_ptr<const OsquerySnapshot> snapshot;
+   std::thread *thread;
+};
+
+
+class OSQUERYOptParser : public OptionsParser
+{
+public:
+   std::string m_cmd;
+   uint32_t m_interval;
+   uint32_t m_timeout;
+
+   OSQUERYOptParser() : OptionsParser("osquery", "Collect information about locally outbound flows from OS"),
+      m_cmd(DEFAULT_OSQUERY_CMD), m_interval(DEFAULT_REFRESH_INTERVAL), m_timeout(DEFAULT_SOCKET_TIMEOUT)
+   {
+      register_option("c", "cmd", "CMD", "Command starting osquery interactive shell in json mode",
+         [this](const char *arg){m_cmd = arg; return true;}, OptionFlags::RequiredArgument);
+      register_option("i", "interval", "MS", "Period of socket cache refresh in milliseconds",
+         [this](const char *arg){try {m_interval = str2num<decltype(m_interval)>(arg);} catch(std::invalid_argument &e) {return false;} return m_interval > 0;},
+         OptionFlags::RequiredArgument);
+      register_option("t", "timeout", "SECS", "Time closed sockets are kept in the cache",
+         [this](const char *arg){try {m_timeout = str2num<decltype(m_timeout)>(arg);} catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
+   }
+};
+
 /**
  * \brief Flow cache plugin for parsing OSQUERY packets.
  */
@@ -528,16 +638,27 @@ public:
    void init(const char *params);
    void close();
    RecordExt *get_ext() const { return new RecordExtOSQUERY(); }
-   OptionsParser *get_parser() const { return new OptionsParser("osquery", "Collect information about locally outbound flows from OS"); }
+   OptionsParser *get_parser() const { return new OSQUERYOptParser(); }
    std::string get_name() const { return "osquery"; }
    ProcessPlugin *copy();
 
    int post_create(Flow &rec, const Packet &pkt);
+   void pre_export(Flow &rec);
    void finish(bool print_stats);
 
 private:
-   OsqueryRequestManager *manager;
+   /**
+    * Adds extension when the flow belongs to a known local socket.
+    * @param rec flow record.
+    * @return true if extension was added.
+    */
+   bool addRecord(Flow &rec);
+
+   std::shared_ptr<OsqueryResolver> resolver;
+   std::shared_ptr<const OsquerySnapshot> snapshot;
+   uint64_t snapshotGeneration;
    int numberOfSuccessfullyRequests;
+   int numberOfLateResults;
 };
 
 }
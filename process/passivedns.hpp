@@ -178,16 +178,10 @@ private:
    uint32_t parsed_aaaa;   /**< Number of parsed AAAA records. */
    uint32_t parsed_ptr;    /**< Number of parsed PTR records. */
 
-   const char *data_begin; /**< Pointer to begin of payload. */
-   uint32_t data_len;      /**< Length of packet payload. */
+   RecordExtPassiveDNS *parse_dns(const uint8_t *data, unsigned int payload_len, bool tcp, uint64_t seq);
+   int add_ext_dns(const uint8_t *data, unsigned int payload_len, bool tcp, uint64_t seq, Flow &rec);
 
-   RecordExtPassiveDNS *parse_dns(const char *data, unsigned int payload_len, bool tcp);
-   int add_ext_dns(const char *data, unsigned int payload_len, bool tcp, Flow &rec);
-
-   std::string get_name(const char *data) const;
-   size_t get_name_length(const char *data) const;
-   bool process_ptr_record(std::string name, RecordExtPassiveDNS *rec);
-   bool str_to_uint4(std::string str, uint8_t &dst);
+   bool process_ptr_record(const char *name, size_t length, RecordExtPassiveDNS *rec);
 };
 
 }
@@ -55,11 +55,6 @@ __attribute__((constructor)) static void register_this_plugin()
 #define DEBUG_MSG(format, ...)
 #endif
 
-const uint32_t PHISTSPlugin::log2_lookup32[32] = { 0,  9,  1,  10, 13, 21, 2,  29,
-                                                   11, 14, 16, 18, 22, 25, 3,  30,
-                                                   8,  12, 20, 28, 15, 17, 24, 7,
-                                                   19, 27, 23, 6,  26, 5,  4,  31 };
-
 PHISTSPlugin::PHISTSPlugin() : use_zeros(false)
 {
 }
@@ -90,57 +85,23 @@ ProcessPlugin *PHISTSPlugin::copy()
    return new PHISTSPlugin(*this);
 }
 
-/*
- * 0-15     1. bin
- * 16-31    2. bin
- * 32-63    3. bin
- * 64-127   4. bin
- * 128-255  5. bin
- * 256-511  6. bin
- * 512-1023 7. bin
- * 1024 >   8. bin
- */
-void PHISTSPlugin::update_hist(RecordExtPHISTS *phists_data, uint32_t value, uint32_t *histogram)
-{
-   if (value < 16) {
-      histogram[0] = no_overflow_increment(histogram[0]);
-   } else if (value > 1023) {
-      histogram[HISTOGRAM_SIZE - 1] = no_overflow_increment(histogram[HISTOGRAM_SIZE - 1]);
-   } else {
-      histogram[fastlog2_32(value) - 2 - 1] = no_overflow_increment(histogram[fastlog2_32(value) - 2 -1]);// -2 means shift cause first bin corresponds to 2^4
-   }
-   return;
-}
-
-uint64_t PHISTSPlugin::calculate_ipt(RecordExtPHISTS *phists_data, const struct timeval tv, uint8_t direction)
-{
-   int64_t ts = IpfixBasicList::Tv2Ts(tv);
-
-   if (phists_data->last_ts[direction] == 0) {
-      phists_data->last_ts[direction] = ts;
-      return -1;
-   }
-   int64_t diff = ts - phists_data->last_ts[direction];
-
-   phists_data->last_ts[direction] = ts;
-   return diff;
-}
-
 void PHISTSPlugin::update_record(RecordExtPHISTS *phists_data, const Packet &pkt)
 {
    if (pkt.payload_len_wire == 0 && use_zeros == false){
       return;
    }
    uint8_t direction = (uint8_t) !pkt.source_pkt;
-   update_hist(phists_data, (uint32_t) pkt.payload_len_wire, phists_data->size_hist[direction]);
-   int32_t ipt_diff = (uint32_t) calculate_ipt(phists_data, pkt.ts, direction);
-   if (ipt_diff != -1) {
-      update_hist(phists_data, (uint32_t) ipt_diff, phists_data->ipt_hist[direction]);
+   // Timestamps are compared in milliseconds truncated to 32 bits, zero means no packet yet
+   uint32_t ts = IpfixBasicList::Tv2Ts(pkt.ts);
+   uint32_t last_ts = phists_data->last_ts[direction];
+
+   update_hist(pkt.payload_len_wire, phists_data->size_hist[direction]);
+   if (last_ts != 0) {
+      update_hist(ts - last_ts, phists_data->ipt_hist[direction]);
    }
+   phists_data->last_ts[direction] = ts;
 }
 
-
-
 void PHISTSPlugin::pre_export(Flow &rec)
 {
    //do not export phists for single packets flows, usually port scans
@@ -42,6 +42,7 @@
 #include <ipfixprobe/packet.hpp>
 #include <ipfixprobe/ipfix-basiclist.hpp>
 #include <ipfixprobe/ipfix-elements.hpp>
+#include <ipfixprobe/text-writer.hpp>
 
 namespace ipxp {
 
@@ -176,6 +177,34 @@ struct RecordExtPHISTS : public RecordExt {
       }
       return out.str();
    }
+
+   int write_text(char *buffer, int size) const
+   {
+      TextWriter out(buffer, size);
+      char dirs_c[2] = {'s', 'd'};
+
+      for (int dir = 0; dir < 2; dir++) {
+         out.put(dirs_c[dir]);
+         out.put("phistsize=(");
+         for (int i = 0; i < HISTOGRAM_SIZE; i++) {
+            out.put_uint(size_hist[dir][i]);
+            if (i != HISTOGRAM_SIZE - 1) {
+               out.put(',');
+            }
+         }
+         out.put("),");
+         out.put(dirs_c[dir]);
+         out.put("phistipt=(");
+         for (int i = 0; i < HISTOGRAM_SIZE; i++) {
+            out.put_uint(ipt_hist[dir][i]);
+            if (i != HISTOGRAM_SIZE - 1) {
+               out.put(',');
+            }
+         }
+         out.put("),");
+      }
+      return out.result();
+   }
 };
 
 /**
@@ -200,30 +229,31 @@ private:
    bool use_zeros;
 
    void update_record(RecordExtPHISTS *phists_data, const Packet &pkt);
-   void update_hist(RecordExtPHISTS *phists_data, uint32_t value, uint32_t *histogram);
    void pre_export(Flow &rec);
-   uint64_t calculate_ipt(RecordExtPHISTS *phists_data, const struct timeval tv, uint8_t direction);
-
-   static const uint32_t log2_lookup32[32];
 
-   static inline uint32_t fastlog2_32(uint32_t value)
+   /*
+    * 0-15     1. bin
+    * 16-31    2. bin
+    * 32-63    3. bin
+    * 64-127   4. bin
+    * 128-255  5. bin
+    * 256-511  6. bin
+    * 512-1023 7. bin
+    * 1024 >   8. bin
+    */
+   static inline uint32_t hist_bin(uint32_t value)
    {
-      value |= value >> 1;
-      value |= value >> 2;
-      value |= value >> 4;
-      value |= value >> 8;
-      value |= value >> 16;
-      return log2_lookup32[(uint32_t) (value * 0x07C4ACDD) >> 27];
+      // floor(log2(value)) - 3, values below 16 are mapped to the first bin by setting the low bits
+      uint32_t bin = 28 - __builtin_clz(value | 15);
+      return bin < HISTOGRAM_SIZE - 1 ? bin : HISTOGRAM_SIZE - 1;
    }
 
-   static inline uint32_t no_overflow_increment(uint32_t value)
+   static inline void update_hist(uint32_t value, uint32_t *histogram)
    {
-      if (value == std::numeric_limits<uint32_t>::max()) {
-         return value;
-      }
-      return value + 1;
+      uint32_t &bin = histogram[hist_bin(value)];
+      // Saturating increment
+      bin += bin != std::numeric_limits<uint32_t>::max();
    }
-
 };
 
 }
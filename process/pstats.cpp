@@ -56,7 +56,7 @@ __attribute__((constructor)) static void register_this_plugin()
 #define DEBUG_MSG(format, ...)
 #endif
 
-PSTATSPlugin::PSTATSPlugin() : use_zeros(false), skip_dup_pkts(false)
+PSTATSPlugin::PSTATSPlugin() : use_zeros(false), skip_dup_pkts(false), max_count(PSTATS_MAXELEMCOUNT)
 {
 }
 
@@ -76,6 +76,7 @@ void PSTATSPlugin::init(const char *params)
 
    use_zeros = parser.m_include_zeroes;
    skip_dup_pkts = parser.m_skipdup;
+   max_count = parser.m_count;
 }
 
 void PSTATSPlugin::close()
@@ -87,9 +88,14 @@ ProcessPlugin *PSTATSPlugin::copy()
    return new PSTATSPlugin(*this);
 }
 
-inline bool seq_overflowed(uint32_t curr, uint32_t prev)
+/**
+ * \brief Check whether TCP sequence or acknowledgement number did not advance.
+ *
+ * Numbers that decreased by more than 4252017623 are considered as wrapped around and advanced.
+ */
+static inline bool seq_not_advanced(uint32_t curr, uint32_t prev)
 {
-   return (int64_t) curr - (int64_t) prev < -4252017623LL;
+   return curr <= prev && prev - curr <= 4252017623U;
 }
 
 void PSTATSPlugin::update_record(RecordExtPSTATS *pstats_data, const Packet &pkt)
@@ -98,18 +104,14 @@ void PSTATSPlugin::update_record(RecordExtPSTATS *pstats_data, const Packet &pkt
     * 0 - client -> server
     * 1 - server -> client
     */
-   int8_t dir = pkt.source_pkt ? 0 : 1;
+   unsigned dir = !pkt.source_pkt;
    if (skip_dup_pkts && pkt.ip_proto == IPPROTO_TCP) {
-      // Current seq <= previous ack?
-      bool seq_susp = (pkt.tcp_seq <= pstats_data->tcp_seq[dir] && !seq_overflowed(pkt.tcp_seq, pstats_data->tcp_seq[dir])) ||
-                      (pkt.tcp_seq > pstats_data->tcp_seq[dir] && seq_overflowed(pkt.tcp_seq, pstats_data->tcp_seq[dir]));
-      // Current ack <= previous ack?
-      bool ack_susp = (pkt.tcp_ack <= pstats_data->tcp_ack[dir] && !seq_overflowed(pkt.tcp_ack, pstats_data->tcp_ack[dir])) ||
-                      (pkt.tcp_ack > pstats_data->tcp_ack[dir] && seq_overflowed(pkt.tcp_ack, pstats_data->tcp_ack[dir]));
-      if (seq_susp && ack_susp &&
+      // Same length and flags and both seq and ack did not advance in this direction
+      if (pstats_data->pkt_count != 0 &&
             pkt.payload_len == pstats_data->tcp_len[dir] &&
             pkt.tcp_flags == pstats_data->tcp_flg[dir] &&
-            pstats_data->pkt_count != 0) {
+            seq_not_advanced(pkt.tcp_seq, pstats_data->tcp_seq[dir]) &&
+            seq_not_advanced(pkt.tcp_ack, pstats_data->tcp_ack[dir])) {
          return;
       }
    }
@@ -118,37 +120,24 @@ void PSTATSPlugin::update_record(RecordExtPSTATS *pstats_data, const Packet &pkt
    pstats_data->tcp_len[dir] = pkt.payload_len;
    pstats_data->tcp_flg[dir] = pkt.tcp_flags;
 
-   if (pkt.payload_len_wire == 0 && use_zeros == false) {
+   if ((pkt.payload_len_wire == 0 && use_zeros == false) || pstats_data->pkt_count >= max_count) {
+      /* Do not count more than max_count packets */
       return;
    }
 
+   DEBUG_MSG("PSTATS processed packet %d: Size: %d Timestamp: %ld.%ld\n", pstats_data->pkt_count,
+         pkt.payload_len_wire, pkt.ts.tv_sec, pkt.ts.tv_usec);
+
    /*
     * dir =  1 iff client -> server
     * dir = -1 iff server -> client
     */
-   dir = pkt.source_pkt ? 1 : -1;
-   if (pstats_data->pkt_count < PSTATS_MAXELEMCOUNT) {
-      uint16_t pkt_cnt = pstats_data->pkt_count;
-      pstats_data->pkt_sizes[pkt_cnt] = pkt.payload_len_wire;
-      pstats_data->pkt_tcp_flgs[pkt_cnt] = pkt.tcp_flags;
-
-      pstats_data->pkt_timestamps[pkt_cnt] = pkt.ts;
-
-      DEBUG_MSG("PSTATS processed packet %d: Size: %d Timestamp: %ld.%ld\n", pkt_cnt,
-            pstats_data->pkt_sizes[pkt_cnt],
-            pstats_data->pkt_timestamps[pkt_cnt].tv_sec,
-            pstats_data->pkt_timestamps[pkt_cnt].tv_usec);
-
-      pstats_data->pkt_dirs[pkt_cnt] = dir;
-      pstats_data->pkt_count++;
-   } else {
-      /* Do not count more than PSTATS_MAXELEMCOUNT packets */
-   }
+   pstats_data->add_packet(pkt.ts, pkt.payload_len_wire, pkt.tcp_flags, pkt.source_pkt ? 1 : -1);
 }
 
 int PSTATSPlugin::post_create(Flow &rec, const Packet &pkt)
 {
-   RecordExtPSTATS *pstats_data = new RecordExtPSTATS();
+   RecordExtPSTATS *pstats_data = new RecordExtPSTATS(&rec.m_arena);
    rec.add_extension(pstats_data);
 
    update_record(pstats_data, pkt);
@@ -42,16 +42,19 @@
 #include <ipfixprobe/flowifc.hpp>
 #include <ipfixprobe/packet.hpp>
 #include <ipfixprobe/options.hpp>
+#include <ipfixprobe/utils.hpp>
 
 #include <ipfixprobe/byte-utils.hpp>
 #include <ipfixprobe/ipfix-basiclist.hpp>
 #include <ipfixprobe/ipfix-elements.hpp>
+#include <ipfixprobe/text-writer.hpp>
 
 namespace ipxp {
 
 #ifndef PSTATS_MAXELEMCOUNT
 # define PSTATS_MAXELEMCOUNT 30
 #endif
+#define PSTATS_MAXELEMCOUNT_LIMIT 1024
 
 #ifndef PSTATS_MINLEN
 # define PSTATS_MINLEN 1
@@ -71,28 +74,51 @@ class PSTATSOptParser : public OptionsParser
 public:
    bool m_include_zeroes;
    bool m_skipdup;
+   uint16_t m_count;
 
-   PSTATSOptParser() : OptionsParser("pstats", "Processing plugin for packet stats"), m_include_zeroes(false), m_skipdup(false)
+   PSTATSOptParser() : OptionsParser("pstats", "Processing plugin for packet stats"), m_include_zeroes(false), m_skipdup(false),
+      m_count(PSTATS_MAXELEMCOUNT)
    {
       register_option("i", "includezeroes", "", "Include zero payload packets", [this](const char *arg){m_include_zeroes = true; return true;}, OptionFlags::NoArgument);
       register_option("s", "skipdup", "", "Skip duplicated TCP packets", [this](const char *arg){m_skipdup = true; return true;}, OptionFlags::NoArgument);
+      register_option("c", "count", "NUM", "Maximal number of packets, default " + std::to_string(PSTATS_MAXELEMCOUNT) +
+         ", at most " + std::to_string(PSTATS_MAXELEMCOUNT_LIMIT),
+         [this](const char *arg){try {m_count = str2num<decltype(m_count)>(arg);} catch(std::invalid_argument &e) {return false;}
+            return m_count > 0 && m_count <= PSTATS_MAXELEMCOUNT_LIMIT;},
+         OptionFlags::RequiredArgument);
    }
 };
 
+/**
+ * \brief Raw observation of a single packet stored in the record arena.
+ *
+ * Timestamp is stored as a signed offset in microseconds from the first observation of the flow,
+ * which covers +-35 minutes and keeps the observation in 8 bytes.
+ */
+struct PSTATSObservation {
+   int32_t  ts_delta;
+   uint16_t size;
+   uint8_t  tcp_flgs;
+   int8_t   dir;
+};
+
 /**
  * \brief Flow record extension header for storing parsed PSTATS packets.
+ *
+ * Packet observations are kept in the arena of the flow record and they are converted to arrays
+ * only when the flow is exported. The extension cannot be copied, a copy would refer to the arena
+ * of another record.
  */
 struct RecordExtPSTATS : public RecordExt {
    static int REGISTERED_ID;
 
-   uint16_t       pkt_sizes[PSTATS_MAXELEMCOUNT];
-   uint8_t        pkt_tcp_flgs[PSTATS_MAXELEMCOUNT];
-   struct timeval pkt_timestamps[PSTATS_MAXELEMCOUNT];
-   int8_t         pkt_dirs[PSTATS_MAXELEMCOUNT];
-   uint16_t       pkt_count;
+   RecordArena    *const m_arena;
+   uint32_t       ts_sec; /**< Timestamp of the first observation. */
+   uint32_t       ts_usec;
    uint32_t       tcp_seq[2];
    uint32_t       tcp_ack[2];
    uint16_t       tcp_len[2];
+   uint16_t       pkt_count;
    uint8_t        tcp_flg[2];
 
    typedef enum eHdrFieldID {
@@ -105,11 +131,71 @@ struct RecordExtPSTATS : public RecordExt {
    static const uint32_t CesnetPem = 8057;
 
 
-   RecordExtPSTATS() : RecordExt(REGISTERED_ID)
+   RecordExtPSTATS(RecordArena *arena = nullptr) : RecordExt(REGISTERED_ID), m_arena(arena)
    {
+      ts_sec = 0;
+      ts_usec = 0;
       pkt_count = 0;
    }
 
+   RecordExtPSTATS(const RecordExtPSTATS &other) = delete;
+   RecordExtPSTATS &operator=(const RecordExtPSTATS &other) = delete;
+
+   /**
+    * \brief Store packet observation.
+    * \return True on success, false when observation cannot be stored or its timestamp
+    * is too far from the first observation.
+    */
+   bool add_packet(const struct timeval &ts, uint16_t size, uint8_t tcp_flgs, int8_t dir)
+   {
+      if (pkt_count == 0) {
+         ts_sec = ts.tv_sec;
+         ts_usec = ts.tv_usec;
+      }
+      int64_t delta = (static_cast<int64_t>(ts.tv_sec) - ts_sec) * 1000000 + (static_cast<int64_t>(ts.tv_usec) - ts_usec);
+      if (delta != static_cast<int32_t>(delta)) {
+         return false;
+      }
+
+      PSTATSObservation *obs = static_cast<PSTATSObservation *>(m_arena->append(REGISTERED_ID, sizeof(PSTATSObservation)));
+      if (obs == nullptr) {
+         return false;
+      }
+      obs->ts_delta = delta;
+      obs->size = size;
+      obs->tcp_flgs = tcp_flgs;
+      obs->dir = dir;
+      pkt_count++;
+      return true;
+   }
+
+   /**
+    * \brief Get next stored packet observation.
+    * \param [in,out] pos Iterator position, start with 0.
+    */
+   const PSTATSObservation *next_packet(uint32_t &pos) const
+   {
+      return static_cast<const PSTATSObservation *>(m_arena->next(REGISTERED_ID, pos));
+   }
+
+   /**
+    * \brief Get absolute timestamp of stored packet observation.
+    */
+   struct timeval packet_time(const PSTATSObservation *obs) const
+   {
+      int64_t usec = static_cast<int64_t>(ts_usec) + obs->ts_delta;
+      int64_t sec = usec / 1000000;
+      usec %= 1000000;
+      if (usec < 0) {
+         usec += 1000000;
+         sec--;
+      }
+      struct timeval tv;
+      tv.tv_sec = ts_sec + sec;
+      tv.tv_usec = usec;
+      return tv;
+   }
+
    #ifdef WITH_NEMEA
    virtual void fill_unirec(ur_template_t *tmplt, void *record)
    {
@@ -118,12 +204,15 @@ struct RecordExtPSTATS : public RecordExt {
       ur_array_allocate(tmplt, record, F_PPI_PKT_FLAGS, pkt_count);
       ur_array_allocate(tmplt, record, F_PPI_PKT_DIRECTIONS, pkt_count);
 
-      for (int i = 0; i < pkt_count; i++) {
-         ur_time_t ts = ur_time_from_sec_usec(pkt_timestamps[i].tv_sec, pkt_timestamps[i].tv_usec);
+      uint32_t pos = 0;
+      const PSTATSObservation *obs;
+      for (int i = 0; (obs = next_packet(pos)) != nullptr; i++) {
+         struct timeval tv = packet_time(obs);
+         ur_time_t ts = ur_time_from_sec_usec(tv.tv_sec, tv.tv_usec);
          ur_array_set(tmplt, record, F_PPI_PKT_TIMES, i, ts);
-         ur_array_set(tmplt, record, F_PPI_PKT_LENGTHS, i, pkt_sizes[i]);
-         ur_array_set(tmplt, record, F_PPI_PKT_FLAGS, i, pkt_tcp_flgs[i]);
-         ur_array_set(tmplt, record, F_PPI_PKT_DIRECTIONS, i, pkt_dirs[i]);
+         ur_array_set(tmplt, record, F_PPI_PKT_LENGTHS, i, obs->size);
+         ur_array_set(tmplt, record, F_PPI_PKT_FLAGS, i, obs->tcp_flgs);
+         ur_array_set(tmplt, record, F_PPI_PKT_DIRECTIONS, i, obs->dir);
       }
    }
 
@@ -148,14 +237,30 @@ struct RecordExtPSTATS : public RecordExt {
       if (req_size > size) {
          return -1;
       }
+
+      uint32_t pos;
+      const PSTATSObservation *obs;
+
       // Fill packet sizes
-      bufferPtr = basiclist.FillBuffer(buffer, pkt_sizes, pkt_count, (uint16_t) PktSize);
+      bufferPtr = basiclist.FillBufferHdr(buffer, pkt_count, sizeof(uint16_t), (uint16_t) PktSize);
+      for (pos = 0; (obs = next_packet(pos)) != nullptr; bufferPtr += sizeof(uint16_t)) {
+         *reinterpret_cast<uint16_t *>(buffer + bufferPtr) = htons(obs->size);
+      }
       // Fill timestamps
-      bufferPtr += basiclist.FillBuffer(buffer + bufferPtr, pkt_timestamps, pkt_count,(uint16_t) PktTmstp);
+      bufferPtr += basiclist.FillBufferHdr(buffer + bufferPtr, pkt_count, sizeof(uint64_t), (uint16_t) PktTmstp);
+      for (pos = 0; (obs = next_packet(pos)) != nullptr; bufferPtr += sizeof(uint64_t)) {
+         *reinterpret_cast<uint64_t *>(buffer + bufferPtr) = swap_uint64(IpfixBasicList::Tv2Ts(packet_time(obs)));
+      }
       // Fill tcp flags
-      bufferPtr += basiclist.FillBuffer(buffer + bufferPtr, pkt_tcp_flgs, pkt_count, (uint16_t) PktFlags);
+      bufferPtr += basiclist.FillBufferHdr(buffer + bufferPtr, pkt_count, sizeof(uint8_t), (uint16_t) PktFlags);
+      for (pos = 0; (obs = next_packet(pos)) != nullptr; bufferPtr += sizeof(uint8_t)) {
+         buffer[bufferPtr] = obs->tcp_flgs;
+      }
       // Fill directions
-      bufferPtr += basiclist.FillBuffer(buffer + bufferPtr, pkt_dirs, pkt_count,(uint16_t) PktDir);
+      bufferPtr += basiclist.FillBufferHdr(buffer + bufferPtr, pkt_count, sizeof(int8_t), (uint16_t) PktDir);
+      for (pos = 0; (obs = next_packet(pos)) != nullptr; bufferPtr += sizeof(int8_t)) {
+         buffer[bufferPtr] = obs->dir;
+      }
 
       return bufferPtr;
    } // fill_ipfix
@@ -171,37 +276,64 @@ struct RecordExtPSTATS : public RecordExt {
    std::string get_text() const
    {
       std::ostringstream out;
+      uint32_t pos;
+      const PSTATSObservation *obs;
+      const char *delim;
+
       out << "ppisizes=(";
-      for (int i = 0; i < pkt_count; i++) {
-         out << pkt_sizes[i];
-         if (i != pkt_count - 1) {
-            out << ",";
-         }
+      for (pos = 0, delim = ""; (obs = next_packet(pos)) != nullptr; delim = ",") {
+         out << delim << obs->size;
       }
       out << "),ppitimes=(";
-      for (int i = 0; i < pkt_count; i++) {
-         out << pkt_timestamps[i].tv_sec << "." << pkt_timestamps[i].tv_usec;
-         if (i != pkt_count - 1) {
-            out << ",";
-         }
+      for (pos = 0, delim = ""; (obs = next_packet(pos)) != nullptr; delim = ",") {
+         struct timeval tv = packet_time(obs);
+         out << delim << tv.tv_sec << "." << tv.tv_usec;
       }
       out << "),ppiflags=(";
-      for (int i = 0; i < pkt_count; i++) {
-         out << (uint16_t) pkt_tcp_flgs[i];
-         if (i != pkt_count - 1) {
-            out << ",";
-         }
+      for (pos = 0, delim = ""; (obs = next_packet(pos)) != nullptr; delim = ",") {
+         out << delim << (uint16_t) obs->tcp_flgs;
       }
       out << "),ppidirs=(";
-      for (int i = 0; i < pkt_count; i++) {
-         out << (int16_t) pkt_dirs[i];
-         if (i != pkt_count - 1) {
-            out << ",";
-         }
+      for (pos = 0, delim = ""; (obs = next_packet(pos)) != nullptr; delim = ",") {
+         out << delim << (int16_t) obs->dir;
       }
       out << ")";
       return out.str();
    }
+
+   int write_text(char *buffer, int size) const
+   {
+      TextWriter out(buffer, size);
+      uint32_t pos;
+      const PSTATSObservation *obs;
+      const char *delim;
+
+      out.put("ppisizes=(");
+      for (pos = 0, delim = ""; (obs = next_packet(pos)) != nullptr; delim = ",") {
+         out.put(delim);
+         out.put_uint(obs->size);
+      }
+      out.put("),ppitimes=(");
+      for (pos = 0, delim = ""; (obs = next_packet(pos)) != nullptr; delim = ",") {
+         struct timeval tv = packet_time(obs);
+         out.put(delim);
+         out.put_uint(tv.tv_sec);
+         out.put('.');
+         out.put_uint(tv.tv_usec);
+      }
+      out.put("),ppiflags=(");
+      for (pos = 0, delim = ""; (obs = next_packet(pos)) != nullptr; delim = ",") {
+         out.put(delim);
+         out.put_uint(obs->tcp_flgs);
+      }
+      out.put("),ppidirs=(");
+      for (pos = 0, delim = ""; (obs = next_packet(pos)) != nullptr; delim = ",") {
+         out.put(delim);
+         out.put_int(obs->dir);
+      }
+      out.put(')');
+      return out.result();
+   }
 };
 
 /**
@@ -226,6 +358,7 @@ public:
 private:
    bool use_zeros;
    bool skip_dup_pkts;
+   uint16_t max_count;
 };
 
 }
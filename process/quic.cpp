@@ -34,6 +34,8 @@ __attribute__((constructor)) static void register_this_plugin()
 QUICPlugin::QUICPlugin()
 {
    quic_ptr = nullptr;
+   pending_ptr = nullptr;
+   parser = nullptr;
 }
 
 QUICPlugin::~QUICPlugin()
@@ -50,27 +52,49 @@ void QUICPlugin::close()
       delete quic_ptr;
    }
    quic_ptr = nullptr;
+   delete pending_ptr;
+   pending_ptr = nullptr;
+   for (auto &it : pending) {
+      delete it.second;
+   }
+   pending.clear();
+   if (parser != nullptr) {
+      delete parser;
+   }
+   parser = nullptr;
 }
 
 ProcessPlugin *QUICPlugin::copy()
 {
-   return new QUICPlugin(*this);
+   // Parser state is not shared, every copy creates its own parser
+   return new QUICPlugin();
 }
 
-bool QUICPlugin::process_quic(RecordExtQUIC *quic_data, const Packet &pkt)
+bool QUICPlugin::process_quic(RecordExtQUIC *quic_data, QUICCryptoStream &crypto, const Packet &pkt)
 {
-   QUICParser process_quic;
+   if (parser == nullptr) {
+      parser = new QUICParser();
+   }
 
-   if (!process_quic.quic_start(pkt)) {
+   if (!parser->quic_start(pkt, crypto)) {
       return false;
    } else   {
-      process_quic.quic_get_sni(quic_data->sni);
-      process_quic.quic_get_user_agent(quic_data->user_agent);
-      process_quic.quic_get_version(quic_data->quic_version);
+      parser->quic_get_sni(quic_data->sni);
+      parser->quic_get_user_agent(quic_data->user_agent);
+      parser->quic_get_version(quic_data->quic_version);
       return true;
    }
 } // QUICPlugin::process_quic
 
+void QUICPlugin::drop_pending(const Flow &rec)
+{
+   auto it = pending.find(&rec);
+   if (it != pending.end()) {
+      delete it->second;
+      pending.erase(it);
+   }
+}
+
 int QUICPlugin::pre_create(Packet &pkt)
 {
    return 0;
@@ -89,25 +113,68 @@ int QUICPlugin::pre_update(Flow &rec, Packet &pkt)
 
 int QUICPlugin::post_update(Flow &rec, const Packet &pkt)
 {
-   RecordExtQUIC *ext = (RecordExtQUIC *) rec.get_extension(RecordExtQUIC::REGISTERED_ID);
-
-   if (ext == nullptr) {
+   // Continue reassembly of the ClientHello, finished flows are not parsed again
+   if (pending.empty()) {
+      return 0;
+   }
+   auto it = pending.find(&rec);
+   if (it == pending.end()) {
+      return 0;
+   }
+   QUICPendingFlow *state = it->second;
+   if (state->flow_hash != rec.flow_hash || state->time_first.tv_sec != rec.time_first.tv_sec ||
+      state->time_first.tv_usec != rec.time_first.tv_usec) {
+      // Flow was exported without pre_export (e.g. flushed by other plugin) and the record was reused
+      drop_pending(rec);
       return 0;
    }
 
-   add_quic(rec, pkt);
+   if (quic_ptr == nullptr) {
+      quic_ptr = new RecordExtQUIC();
+   }
+   if (process_quic(quic_ptr, state->crypto, pkt)) {
+      rec.add_extension(quic_ptr);
+      quic_ptr = nullptr;
+      drop_pending(rec);
+   } else if (state->crypto.done()) {
+      drop_pending(rec);
+   }
    return 0;
 }
 
+void QUICPlugin::pre_export(Flow &rec)
+{
+   // ClientHello was not received completely
+   if (!pending.empty()) {
+      drop_pending(rec);
+   }
+}
+
 void QUICPlugin::add_quic(Flow &rec, const Packet &pkt)
 {
+   if (!pending.empty()) {
+      // State of a previous flow of the record exported without pre_export
+      drop_pending(rec);
+   }
    if (quic_ptr == nullptr) {
       quic_ptr = new RecordExtQUIC();
    }
+   if (pending_ptr == nullptr) {
+      pending_ptr = new QUICPendingFlow();
+   }
 
-   if (process_quic(quic_ptr, pkt)) {
+   if (process_quic(quic_ptr, pending_ptr->crypto, pkt)) {
       rec.add_extension(quic_ptr);
       quic_ptr = nullptr;
+      pending_ptr->crypto.reset();
+   } else if (pending_ptr->crypto.started() && !pending_ptr->crypto.done()) {
+      // ClientHello continues in the next Initial packets
+      pending_ptr->flow_hash = rec.flow_hash;
+      pending_ptr->time_first = rec.time_first;
+      pending[&rec] = pending_ptr;
+      pending_ptr = nullptr;
+   } else {
+      pending_ptr->crypto.reset();
    }
 }
 
@@ -24,6 +24,7 @@
 #include <ipfixprobe/utils.hpp>
 #include <ipfixprobe/ipfix-elements.hpp>
 #include <sstream>
+#include <unordered_map>
 
 
 namespace ipxp {
@@ -103,8 +104,21 @@ struct RecordExtQUIC : public RecordExt {
    }
 };
 
+/**
+ * \brief ClientHello of a flow which does not fit into its first Initial packet.
+ */
+struct QUICPendingFlow {
+   uint64_t flow_hash; /**< Identity of the flow, the flow record is reused by other flows. */
+   struct timeval time_first;
+   QUICCryptoStream crypto; /**< CRYPTO stream of client Initial packets. */
+};
+
 /**
  * \brief Flow cache plugin for parsing QUIC packets.
+ *
+ * Extension is added only when the ClientHello is parsed. Reassembly state of flows with
+ * the ClientHello split into more packets is kept by the plugin, so flows exported before
+ * the ClientHello is complete carry no QUIC data.
  */
 class QUICPlugin : public ProcessPlugin
 {
@@ -125,13 +139,18 @@ public:
    int post_create(Flow &rec, const Packet &pkt);
    int pre_update(Flow &rec, Packet &pkt);
    int post_update(Flow &rec, const Packet &pkt);
+   void pre_export(Flow &rec);
    void add_quic(Flow &rec, const Packet &pkt);
    void finish(bool print_stats);
 
 private:
-   bool     process_quic(RecordExtQUIC *, const Packet&);
+   bool     process_quic(RecordExtQUIC *, QUICCryptoStream &, const Packet&);
+   void     drop_pending(const Flow &rec);
    int parsed_initial;
    RecordExtQUIC *quic_ptr;
+   QUICPendingFlow *pending_ptr; /**< Unused reassembly state reused for the next flow. */
+   std::unordered_map<const Flow *, QUICPendingFlow *> pending; /**< Flows with incomplete ClientHello. */
+   QUICParser *parser; /**< Parser with OpenSSL contexts and Initial secrets reused for all packets. */
 };
 }
 #endif /* IPXP_PROCESS_QUIC_HPP */
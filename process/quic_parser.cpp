@@ -28,6 +28,94 @@
 #endif
 
 namespace ipxp {
+QUICCryptoStream::QUICCryptoStream()
+{
+    buffer = nullptr;
+    contiguous_len = 0;
+    range_cnt = 0;
+    finished = false;
+}
+
+QUICCryptoStream::~QUICCryptoStream()
+{
+    free(buffer);
+}
+
+bool QUICCryptoStream::add(uint64_t offset, const uint8_t* data, uint64_t length)
+{
+    if (finished || offset >= CRYPTO_STREAM_SIZE) {
+        return false;
+    }
+    if (length > CRYPTO_STREAM_SIZE - offset) {
+        length = CRYPTO_STREAM_SIZE - offset;
+    }
+    if (length == 0 || offset + length <= contiguous_len) {
+        // Nothing new, e.g. retransmission
+        return false;
+    }
+    if (buffer == nullptr) {
+        buffer = (uint8_t*) malloc(CRYPTO_STREAM_SIZE);
+        if (buffer == nullptr) {
+            finished = true;
+            return false;
+        }
+    }
+
+    uint16_t start = offset;
+    uint16_t end = offset + length;
+
+    // Merge with overlapping and adjacent ranges
+    for (uint8_t i = 0; i < range_cnt;) {
+        if (ranges[i].start <= end && start <= ranges[i].end) {
+            start = std::min(start, ranges[i].start);
+            end = std::max(end, ranges[i].end);
+            ranges[i] = ranges[--range_cnt];
+        } else {
+            i++;
+        }
+    }
+
+    if (start > contiguous_len) {
+        if (range_cnt == CRYPTO_STREAM_MAX_RANGES) {
+            DEBUG_MSG("Too many CRYPTO stream ranges\n");
+            return false;
+        }
+        ranges[range_cnt].start = start;
+        ranges[range_cnt].end = end;
+        range_cnt++;
+    } else {
+        contiguous_len = std::max(contiguous_len, end);
+    }
+    memcpy(buffer + offset, data, length);
+    return true;
+}
+
+bool QUICCryptoStream::ready() const
+{
+    // Length of handshake message is known once its header is received
+    if (finished || contiguous_len < 4) {
+        return false;
+    }
+    uint32_t msg_len = 4 + ((buffer[1] << 16) | (buffer[2] << 8) | buffer[3]);
+    return contiguous_len >= std::min(msg_len, (uint32_t) CRYPTO_STREAM_SIZE);
+}
+
+void QUICCryptoStream::release()
+{
+    free(buffer);
+    buffer = nullptr;
+    finished = true;
+}
+
+void QUICCryptoStream::reset()
+{
+    free(buffer);
+    buffer = nullptr;
+    contiguous_len = 0;
+    range_cnt = 0;
+    finished = false;
+}
+
 QUICParser::QUICParser()
 {
     quic_h1 = nullptr;
@@ -44,6 +132,30 @@ QUICParser::QUICParser()
     final_payload = nullptr;
     parsed_initial = 0;
     is_version2 = false;
+
+    memset(secrets_cache, 0, sizeof(secrets_cache));
+    hkdf_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+    hp_ctx = EVP_CIPHER_CTX_new();
+    aead_ctx = EVP_CIPHER_CTX_new();
+    // Cipher of AEAD context is set only once, key and nonce are set for every packet
+    if (aead_ctx != nullptr
+        && (!EVP_DecryptInit_ex(aead_ctx, EVP_aes_128_gcm(), NULL, NULL, NULL)
+            || !EVP_CIPHER_CTX_ctrl(
+                aead_ctx,
+                EVP_CTRL_AEAD_SET_IVLEN,
+                TLS13_AEAD_NONCE_LENGTH,
+                NULL))) {
+        DEBUG_MSG("Payload decryption error, context initialization failed\n");
+        EVP_CIPHER_CTX_free(aead_ctx);
+        aead_ctx = nullptr;
+    }
+}
+
+QUICParser::~QUICParser()
+{
+    EVP_PKEY_CTX_free(hkdf_ctx);
+    EVP_CIPHER_CTX_free(hp_ctx);
+    EVP_CIPHER_CTX_free(aead_ctx);
 }
 
 void QUICParser::quic_get_version(uint32_t& version_toset)
@@ -330,47 +442,39 @@ bool expand_label(
     return true;
 }
 
-bool quic_derive_n_set(
+bool QUICParser::quic_derive_n_set(
     uint8_t* secret,
     uint8_t* expanded_label,
     uint8_t size,
     size_t output_len,
     uint8_t* store_data)
 {
-    EVP_PKEY_CTX* pctx;
+    EVP_PKEY_CTX* pctx = hkdf_ctx;
 
-    pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
     if (1 != EVP_PKEY_derive_init(pctx)) {
         DEBUG_MSG("Error, context initialization failed %s\n", (char*) expanded_label);
-        EVP_PKEY_CTX_free(pctx);
         return false;
     }
     if (1 != EVP_PKEY_CTX_hkdf_mode(pctx, EVP_PKEY_HKDEF_MODE_EXPAND_ONLY)) {
         DEBUG_MSG("Error, mode initialization failed %s\n", (char*) expanded_label);
-        EVP_PKEY_CTX_free(pctx);
         return false;
     }
     if (1 != EVP_PKEY_CTX_set_hkdf_md(pctx, EVP_sha256())) {
         DEBUG_MSG("Error, message digest initialization failed %s\n", (char*) expanded_label);
-        EVP_PKEY_CTX_free(pctx);
         return false;
     }
     if (1 != EVP_PKEY_CTX_add1_hkdf_info(pctx, expanded_label, size)) {
         DEBUG_MSG("Error, info initialization failed %s\n", (char*) expanded_label);
-        EVP_PKEY_CTX_free(pctx);
         return false;
     }
     if (1 != EVP_PKEY_CTX_set1_hkdf_key(pctx, secret, HASH_SHA2_256_LENGTH)) {
         DEBUG_MSG("Error, key initialization failed %s\n", (char*) expanded_label);
-        EVP_PKEY_CTX_free(pctx);
         return false;
     }
     if (1 != EVP_PKEY_derive(pctx, store_data, &output_len)) {
         DEBUG_MSG("Error, HKDF-Expand derivation failed %s\n", (char*) expanded_label);
-        EVP_PKEY_CTX_free(pctx);
         return false;
     }
-    EVP_PKEY_CTX_free(pctx);
     return true;
 } // QUICPlugin::quic_derive_n_set
 
@@ -445,6 +549,29 @@ bool QUICParser::quic_derive_secrets(uint8_t* secret)
     return true;
 } // QUICPlugin::quic_derive_secrets
 
+Initial_Secrets_Entry* QUICParser::quic_get_cached_secrets()
+{
+    uint8_t dcid_len = quic_h1->dcid_len;
+    if (dcid == nullptr || dcid_len > MAX_CID_LEN) {
+        return nullptr;
+    }
+
+    // FNV-1a of version and DCID
+    uint32_t hash = 2166136261U ^ version;
+    for (uint8_t i = 0; i < dcid_len; i++) {
+        hash = (hash ^ dcid[i]) * 16777619U;
+    }
+    Initial_Secrets_Entry* entry = &secrets_cache[hash & (INITIAL_SECRETS_CACHE_SIZE - 1)];
+
+    if (entry->valid
+        && (entry->version != version || entry->is_version2 != is_version2
+            || entry->dcid_len != dcid_len || memcmp(entry->dcid, dcid, dcid_len) != 0)) {
+        // Replace older entry
+        entry->valid = false;
+    }
+    return entry;
+}
+
 bool QUICParser::quic_create_initial_secrets()
 {
     uint8_t extracted_secret[HASH_SHA2_256_LENGTH] = {0};
@@ -456,38 +583,37 @@ bool QUICParser::quic_create_initial_secrets()
     uint8_t expand_label_buffer[quic_clientin_hkdf];
     uint8_t expand_label_len;
 
+    Initial_Secrets_Entry* entry = quic_get_cached_secrets();
+    if (entry != nullptr && entry->valid) {
+        initial_secrets = entry->secrets;
+        return true;
+    }
+
     // HKDF-Extract
-    EVP_PKEY_CTX* pctx;
+    EVP_PKEY_CTX* pctx = hkdf_ctx;
 
-    pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
     if (1 != EVP_PKEY_derive_init(pctx)) {
         DEBUG_MSG("Error, context initialization failed(Extract)\n");
-        EVP_PKEY_CTX_free(pctx);
         return false;
     }
     if (1 != EVP_PKEY_CTX_hkdf_mode(pctx, EVP_PKEY_HKDEF_MODE_EXTRACT_ONLY)) {
         DEBUG_MSG("Error, mode initialization failed(Extract)\n");
-        EVP_PKEY_CTX_free(pctx);
         return false;
     }
     if (1 != EVP_PKEY_CTX_set_hkdf_md(pctx, EVP_sha256())) {
         DEBUG_MSG("Error, message digest initialization failed(Extract)\n");
-        EVP_PKEY_CTX_free(pctx);
         return false;
     }
     if (1 != EVP_PKEY_CTX_set1_hkdf_salt(pctx, salt, SALT_LENGTH)) {
         DEBUG_MSG("Error, salt initialization failed(Extract)\n");
-        EVP_PKEY_CTX_free(pctx);
         return false;
     }
     if (1 != EVP_PKEY_CTX_set1_hkdf_key(pctx, dcid, quic_h1->dcid_len)) {
         DEBUG_MSG("Error, key initialization failed(Extract)\n");
-        EVP_PKEY_CTX_free(pctx);
         return false;
     }
     if (1 != EVP_PKEY_derive(pctx, extracted_secret, &extr_len)) {
         DEBUG_MSG("Error, HKDF-Extract derivation failed\n");
-        EVP_PKEY_CTX_free(pctx);
         return false;
     }
     // Expand-Label
@@ -502,69 +628,63 @@ bool QUICParser::quic_create_initial_secrets()
     // HKDF-Expand
     if (!EVP_PKEY_derive_init(pctx)) {
         DEBUG_MSG("Error, context initialization failed(Expand)\n");
-        EVP_PKEY_CTX_free(pctx);
         return false;
     }
     if (1 != EVP_PKEY_CTX_hkdf_mode(pctx, EVP_PKEY_HKDEF_MODE_EXPAND_ONLY)) {
         DEBUG_MSG("Error, mode initialization failed(Expand)\n");
-        EVP_PKEY_CTX_free(pctx);
         return false;
     }
     if (1 != EVP_PKEY_CTX_set_hkdf_md(pctx, EVP_sha256())) {
         DEBUG_MSG("Error, message digest initialization failed(Expand)\n");
-        EVP_PKEY_CTX_free(pctx);
         return false;
     }
     if (1 != EVP_PKEY_CTX_add1_hkdf_info(pctx, expand_label_buffer, expand_label_len)) {
         DEBUG_MSG("Error, info initialization failed(Expand)\n");
-        EVP_PKEY_CTX_free(pctx);
         return false;
     }
     if (1 != EVP_PKEY_CTX_set1_hkdf_key(pctx, extracted_secret, HASH_SHA2_256_LENGTH)) {
         DEBUG_MSG("Error, key initialization failed(Expand)\n");
-        EVP_PKEY_CTX_free(pctx);
         return false;
     }
     if (1 != EVP_PKEY_derive(pctx, expanded_secret, &expd_len)) {
         DEBUG_MSG("Error, HKDF-Expand derivation failed\n");
-        EVP_PKEY_CTX_free(pctx);
         return false;
     }
-    EVP_PKEY_CTX_free(pctx);
     if (!quic_derive_secrets(expanded_secret)) {
         DEBUG_MSG("Error, Derivation of initial secrets failed\n");
         return false;
     }
+
+    if (entry != nullptr) {
+        entry->version = version;
+        entry->is_version2 = is_version2;
+        entry->dcid_len = quic_h1->dcid_len;
+        memcpy(entry->dcid, dcid, quic_h1->dcid_len);
+        entry->secrets = initial_secrets;
+        entry->valid = true;
+    }
     return true;
 } // QUICPlugin::quic_create_initial_secrets
 
 bool QUICParser::quic_encrypt_sample(uint8_t* plaintext)
 {
     int len = 0;
-    EVP_CIPHER_CTX* ctx;
+    EVP_CIPHER_CTX* ctx = hp_ctx;
 
-    if (!(ctx = EVP_CIPHER_CTX_new())) {
-        DEBUG_MSG("Sample encryption, creating context failed\n");
-        return false;
-    }
     if (!(EVP_EncryptInit_ex(ctx, EVP_aes_128_ecb(), NULL, initial_secrets.hp, NULL))) {
         DEBUG_MSG("Sample encryption, context initialization failed\n");
-        EVP_CIPHER_CTX_free(ctx);
         return false;
     }
     // we need to disable padding so we can use EncryptFinal
     EVP_CIPHER_CTX_set_padding(ctx, 0);
     if (!(EVP_EncryptUpdate(ctx, plaintext, &len, sample, SAMPLE_LENGTH))) {
         DEBUG_MSG("Sample encryption, decrypting header failed\n");
-        EVP_CIPHER_CTX_free(ctx);
         return false;
     }
     if (!(EVP_EncryptFinal_ex(ctx, plaintext + len, &len))) {
         DEBUG_MSG("Sample encryption, final header decryption failed\n");
-        EVP_CIPHER_CTX_free(ctx);
         return false;
     }
-    EVP_CIPHER_CTX_free(ctx);
     return true;
 }
 
@@ -648,50 +768,30 @@ bool QUICParser::quic_decrypt_payload()
     // than their input." adjust length because last 16 bytes are authentication tag
     payload_len -= 16;
     memcpy(&atag, &payload[payload_len], 16);
-    EVP_CIPHER_CTX* ctx;
+    EVP_CIPHER_CTX* ctx = aead_ctx;
 
-    if (!(ctx = EVP_CIPHER_CTX_new())) {
-        DEBUG_MSG("Payload decryption error, creating context failed\n");
-        return false;
-    }
-    if (!EVP_DecryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL)) {
-        DEBUG_MSG("Payload decryption error, context initialization failed\n");
-        EVP_CIPHER_CTX_free(ctx);
-        return false;
-    }
-    if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, TLS13_AEAD_NONCE_LENGTH, NULL)) {
-        DEBUG_MSG("Payload decryption error, setting NONCE length failed\n");
-        EVP_CIPHER_CTX_free(ctx);
-        return false;
-    }
     // SET NONCE and KEY
     if (!EVP_DecryptInit_ex(ctx, NULL, NULL, initial_secrets.key, initial_secrets.iv)) {
         DEBUG_MSG("Payload decryption error, setting KEY and NONCE failed\n");
-        EVP_CIPHER_CTX_free(ctx);
         return false;
     }
     // SET ASSOCIATED DATA (HEADER with unprotected PKN)
     if (!EVP_DecryptUpdate(ctx, NULL, &len, header, header_len)) {
         DEBUG_MSG("Payload decryption error, initializing authenticated data failed\n");
-        EVP_CIPHER_CTX_free(ctx);
         return false;
     }
     if (!EVP_DecryptUpdate(ctx, decrypted_payload, &len, payload, payload_len)) {
         DEBUG_MSG("Payload decryption error, decrypting payload failed\n");
-        EVP_CIPHER_CTX_free(ctx);
         return false;
     }
     if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, 16, atag)) {
         DEBUG_MSG("Payload decryption error, TAG check failed\n");
-        EVP_CIPHER_CTX_free(ctx);
         return false;
     }
     if (!EVP_DecryptFinal_ex(ctx, decrypted_payload + len, &len)) {
         DEBUG_MSG("Payload decryption error, final payload decryption failed\n");
-        EVP_CIPHER_CTX_free(ctx);
         return false;
     }
-    EVP_CIPHER_CTX_free(ctx);
     final_payload = decrypted_payload;
     return true;
 } // QUICPlugin::quic_decrypt_payload
@@ -761,28 +861,26 @@ inline void QUICParser::quic_skip_connection_close2(uint8_t* start, uint64_t& of
     return;
 }
 
-inline void QUICParser::quic_copy_crypto(uint8_t* start, uint64_t& offset)
+inline void QUICParser::quic_copy_crypto(uint8_t* start, uint64_t& offset, QUICCryptoStream& crypto)
 {
     offset += 1;
-    uint16_t frame_offset = quic_get_variable_length(start, offset);
-    uint16_t frame_length = quic_get_variable_length(start, offset);
-
-    frame_offset = std::min(frame_offset, (uint16_t) (CURRENT_BUFFER_SIZE - 1));
-    frame_length = std::min((uint16_t) (CURRENT_BUFFER_SIZE - 1 - frame_offset), frame_length);
+    uint64_t frame_offset = quic_get_variable_length(start, offset);
+    uint64_t frame_length = quic_get_variable_length(start, offset);
 
-    memcpy(assembled_payload + frame_offset, start + offset, frame_length);
-    if (frame_offset < quic_crypto_start) {
-        quic_crypto_start = frame_offset;
+    if (offset >= payload_len) {
+        offset = payload_len;
+        return;
     }
-    quic_crypto_len += frame_length;
+    frame_length = std::min(payload_len - offset, frame_length);
+
+    crypto.add(frame_offset, start + offset, frame_length);
     offset += frame_length;
     return;
 }
 
-bool QUICParser::quic_reassemble_frames()
+bool QUICParser::quic_reassemble_frames(QUICCryptoStream& crypto)
 {
-    quic_crypto_start = UINT16_MAX;
-    quic_crypto_len = 0;
+    bool has_crypto = false;
 
     uint64_t offset = 0;
     uint8_t* payload_end = decrypted_payload + payload_len;
@@ -797,7 +895,8 @@ bool QUICParser::quic_reassemble_frames()
         // https://www.rfc-editor.org/rfc/rfc9000.html#name-frames-and-frame-types
         // only those frames can occure in initial packets
         if (quic_check_frame_type(current, CRYPTO)) {
-            quic_copy_crypto(decrypted_payload, offset);
+            quic_copy_crypto(decrypted_payload, offset, crypto);
+            has_crypto = true;
         } else if (quic_check_frame_type(current, ACK1)) {
             quic_skip_ack1(decrypted_payload, offset);
         } else if (quic_check_frame_type(current, ACK2)) {
@@ -816,10 +915,17 @@ bool QUICParser::quic_reassemble_frames()
         current = decrypted_payload + offset;
     }
 
-    if (quic_crypto_start == UINT16_MAX)
+    if (!has_crypto)
         return false;
 
-    final_payload = assembled_payload;
+    if (!crypto.ready()) {
+        DEBUG_MSG("Waiting for rest of CRYPTO stream\n");
+        return false;
+    }
+
+    final_payload = crypto.get_data();
+    quic_crypto_start = 0;
+    quic_crypto_len = crypto.get_length();
     return true;
 } // QUICParser::quic_reassemble_frames
 
@@ -827,8 +933,6 @@ void QUICParser::quic_initialze_arrays()
 {
     // buffer for decrypted payload
     memset(decrypted_payload, 0, CURRENT_BUFFER_SIZE);
-    // buffer for reassembled payload
-    memset(assembled_payload, 0, CURRENT_BUFFER_SIZE);
     // buffer for quic header
     memset(tmp_header_mem, 0, MAX_HEADER_LEN);
 }
@@ -941,11 +1045,20 @@ bool QUICParser::quic_parse_header(const Packet& pkt)
     return true;
 } // QUICPlugin::quic_parse_data
 
-bool QUICParser::quic_start(const Packet& pkt)
+bool QUICParser::quic_start(const Packet& pkt, QUICCryptoStream& crypto)
 {
     if (!quic_initial_checks(pkt)) {
         return false;
     }
+    if (hkdf_ctx == nullptr || hp_ctx == nullptr || aead_ctx == nullptr) {
+        DEBUG_MSG("Error, OpenSSL contexts are not available\n");
+        return false;
+    }
+
+    // Parser is reused for all packets, reset results of the previous one
+    dcid = nullptr;
+    sni[0] = 0;
+    user_agent[0] = 0;
 
     quic_initialze_arrays();
     if (!quic_parse_header(pkt)) {
@@ -964,11 +1077,15 @@ bool QUICParser::quic_start(const Packet& pkt)
         DEBUG_MSG("Error, payload decryption failed (client side)\n");
         return false;
     }
-    if (!quic_reassemble_frames()) {
+    if (!quic_reassemble_frames(crypto)) {
         DEBUG_MSG("Error, reassembling of crypto frames failed (client side)\n");
         return false;
     }
-    if (!quic_parse_tls()) {
+
+    // ClientHello is complete, it is parsed only once
+    bool parsed = quic_parse_tls();
+    crypto.release();
+    if (!parsed) {
         DEBUG_MSG("SNI and User Agent Extraction failed\n");
         return false;
     }
@@ -40,6 +40,14 @@
 #define MAX_HEADER_LEN 67 + 100
 #define BUFF_SIZE 255
 #define CURRENT_BUFFER_SIZE 1500
+// Maximal connection ID length of QUIC v1 and v2
+#define MAX_CID_LEN 20
+// Number of cached Initial secrets, power of two
+#define INITIAL_SECRETS_CACHE_SIZE 64
+// Max length of CRYPTO stream reassembled from client Initial packets of a flow
+#define CRYPTO_STREAM_SIZE 8192
+// Max number of CRYPTO stream ranges received after a gap
+#define CRYPTO_STREAM_MAX_RANGES 8
 
 namespace ipxp {
 typedef struct __attribute__((packed)) quic_first_ver_dcidlen {
@@ -58,6 +66,52 @@ typedef struct Initial_Secrets {
     uint8_t hp[AES_128_KEY_LENGTH];
 } Initial_Secrets;
 
+// Initial secrets derived from given version and DCID
+typedef struct Initial_Secrets_Entry {
+    uint32_t version;
+    bool is_version2;
+    bool valid;
+    uint8_t dcid_len;
+    uint8_t dcid[MAX_CID_LEN];
+    Initial_Secrets secrets;
+} Initial_Secrets_Entry;
+
+/**
+ * \brief CRYPTO stream of client Initial packets reassembled across packets of a flow.
+ *
+ * Buffer is allocated when the first CRYPTO frame arrives and released after the ClientHello
+ * was parsed, so the memory is held only by flows waiting for the rest of the handshake.
+ */
+class QUICCryptoStream {
+public:
+    QUICCryptoStream();
+    ~QUICCryptoStream();
+    QUICCryptoStream(const QUICCryptoStream&) = delete;
+    QUICCryptoStream& operator=(const QUICCryptoStream&) = delete;
+
+    bool add(uint64_t offset, const uint8_t* data, uint64_t length);
+    bool ready() const;
+    void release();
+    void reset();
+
+    const uint8_t* get_data() const { return buffer; }
+    uint16_t get_length() const { return contiguous_len; }
+    bool started() const { return buffer != nullptr || finished; }
+    bool done() const { return finished; }
+
+private:
+    struct Range {
+        uint16_t start;
+        uint16_t end;
+    };
+
+    uint8_t* buffer;
+    uint16_t contiguous_len; // Bytes received from offset 0 without gaps
+    uint8_t range_cnt;
+    Range ranges[CRYPTO_STREAM_MAX_RANGES]; // Received data after the contiguous part
+    bool finished;
+};
+
 class QUICParser {
 private:
     enum FRAME_TYPE {
@@ -104,16 +158,18 @@ private:
     bool quic_create_initial_secrets();
     bool quic_decrypt_header(const Packet&);
     bool quic_decrypt_payload();
-    bool quic_reassemble_frames();
+    bool quic_reassemble_frames(QUICCryptoStream&);
     bool quic_parse_tls();
     bool quic_obtain_version();
     bool quic_derive_secrets(uint8_t*);
+    bool quic_derive_n_set(uint8_t*, uint8_t*, uint8_t, size_t, uint8_t*);
+    Initial_Secrets_Entry* quic_get_cached_secrets();
     bool quic_check_frame_type(uint8_t*, FRAME_TYPE);
     void quic_skip_ack1(uint8_t*, uint64_t&);
     void quic_skip_ack2(uint8_t*, uint64_t&);
     void quic_skip_connection_close1(uint8_t*, uint64_t&);
     void quic_skip_connection_close2(uint8_t*, uint64_t&);
-    void quic_copy_crypto(uint8_t*, uint64_t&);
+    void quic_copy_crypto(uint8_t*, uint64_t&, QUICCryptoStream&);
     bool quic_encrypt_sample(uint8_t*);
     uint8_t quic_draft_version(uint32_t);
     uint64_t quic_get_variable_length(const uint8_t*, uint64_t&);
@@ -123,6 +179,14 @@ private:
 
     Initial_Secrets initial_secrets;
 
+    // OpenSSL contexts reused for all packets
+    EVP_PKEY_CTX* hkdf_ctx;
+    EVP_CIPHER_CTX* hp_ctx;
+    EVP_CIPHER_CTX* aead_ctx;
+
+    // Retransmitted and coalesced Initials of a connection share DCID, so they share keys
+    Initial_Secrets_Entry secrets_cache[INITIAL_SECRETS_CACHE_SIZE];
+
     quic_first_ver_dcidlen* quic_h1;
     quic_scidlen* quic_h2;
 
@@ -140,9 +204,8 @@ private:
     uint32_t version;
 
     uint8_t decrypted_payload[CURRENT_BUFFER_SIZE];
-    uint8_t assembled_payload[CURRENT_BUFFER_SIZE];
     uint8_t tmp_header_mem[MAX_HEADER_LEN];
-    uint8_t* final_payload;
+    const uint8_t* final_payload;
     int parsed_initial;
 
     bool is_version2;
@@ -156,7 +219,10 @@ private:
 
 public:
     QUICParser();
-    bool quic_start(const Packet&);
+    ~QUICParser();
+    QUICParser(const QUICParser&) = delete;
+    QUICParser& operator=(const QUICParser&) = delete;
+    bool quic_start(const Packet&, QUICCryptoStream&);
     void quic_get_sni(char* in);
     void quic_get_user_agent(char* in);
     void quic_get_version(uint32_t&);
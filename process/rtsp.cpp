@@ -27,6 +27,7 @@
  */
 
 #include <iostream>
+#include <algorithm>
 #include <cstring>
 #include <cstdlib>
 
@@ -35,6 +36,7 @@
 #endif
 
 #include "common.hpp"
+#include "header-scanner.hpp"
 #include "rtsp.hpp"
 
 namespace ipxp {
@@ -64,7 +66,6 @@ __attribute__((constructor)) static void register_this_plugin()
 #define DEBUG_CODE(code)
 #endif
 
-#define RTSP_LINE_DELIMITER   '\n'
 #define RTSP_KEYVAL_DELIMITER ':'
 
 RTSPPlugin::RTSPPlugin() : recPrealloc(nullptr), flow_flush(false),
@@ -189,7 +190,8 @@ bool RTSPPlugin::parse_rtsp_request(const char *data, int payload_len, RecordExt
    char buffer[64];
    const char *begin;
    const char *end;
-   const char *keyval_delimiter;
+   const char *value;
+   HeaderName name;
    size_t remaining;
 
    total++;
@@ -253,56 +255,57 @@ bool RTSPPlugin::parse_rtsp_request(const char *data, int payload_len, RecordExt
    DEBUG_MSG("\tURI: %s\n",      rec->uri);
 
    /* Find begin of next line after request line. */
-   if (check_payload_len(payload_len, end - data)) {
-      DEBUG_MSG("Parser quits:\tpayload end\n");
-      return false;
-   }
-   remaining = payload_len - (end - data);
-   begin = static_cast<const char *>(memchr(end, RTSP_LINE_DELIMITER, remaining));
-   if (begin == nullptr) {
+   HeaderScanner scanner(end, payload_len - (end - data));
+   HeaderLine line;
+   if (!scanner.next(line)) {
       DEBUG_MSG("Parser quits:\tNo line delim after request line\n");
       return false;
    }
-   begin++;
 
    /* Header:
     *
     * REQ-FIELD: VALUE
     * |        |      |
-    * |        |      ----- end
-    * |        ------------ keyval_delimiter
-    * --------------------- begin
+    * |        |      ----- line.end
+    * |        ------------ line.colon
+    * --------------------- line.begin
     */
 
    rec->user_agent[0] = 0;
    /* Process headers. */
-   while (begin - data < payload_len) {
-      remaining = payload_len - (begin - data);
-      end = static_cast<const char *>(memchr(begin, RTSP_LINE_DELIMITER, remaining));
-      keyval_delimiter = static_cast<const char *>(memchr(begin, RTSP_KEYVAL_DELIMITER, remaining));
+   while (true) {
+      if (!scanner.next(line)) {
+         if (scanner.tail(line)) {
+            DEBUG_MSG("Parser quits:\theader is fragmented\n");
+            return false;
+         }
+         break; /* Payload ends with the last header. */
+      }
 
-      int tmp = end - begin;
-      if (tmp == 0 || tmp == 1) { /* Check for blank line with \r\n or \n ending. */
+      if (line.length() <= 1) { /* Check for blank line with \r\n or \n ending. */
          break; /* Double LF found - end of header section. */
-      } else if (end == nullptr || keyval_delimiter == NULL) {
-         DEBUG_MSG("Parser quits:\theader is fragmented\n");
-         return  false;
+      } else if (line.colon == nullptr) {
+         /* Skip line without delimiter unless it is the last field. */
+         remaining = payload_len - (line.end - data);
+         if (memchr(line.end, RTSP_KEYVAL_DELIMITER, remaining) == nullptr) {
+            DEBUG_MSG("Parser quits:\theader is fragmented\n");
+            return false;
+         }
+         continue;
       }
 
-      /* Copy field name. */
-      copy_str(buffer, sizeof(buffer), begin, keyval_delimiter);
+      value = std::min(line.colon + 2, line.end);
+      name = header_name(line.begin, line.colon - line.begin);
 
       DEBUG_CODE(char debug_buffer[4096]);
-      DEBUG_CODE(copy_str(debug_buffer, sizeof(debug_buffer), keyval_delimiter + 2, end));
+      DEBUG_CODE(copy_str(buffer, sizeof(buffer), line.begin, line.colon));
+      DEBUG_CODE(copy_str(debug_buffer, sizeof(debug_buffer), value, line.end));
       DEBUG_MSG("\t%s: %s\n", buffer, debug_buffer);
 
       /* Copy interesting field values. */
-      if (!strcmp(buffer, "User-Agent")) {
-         copy_str(rec->user_agent, sizeof(rec->user_agent), keyval_delimiter + 2, end);
+      if (name == HeaderName::USER_AGENT) {
+         copy_str(rec->user_agent, sizeof(rec->user_agent), value, line.end);
       }
-
-      /* Go to next line. */
-      begin = end + 1 ;
    }
 
    DEBUG_MSG("Parser quits:\tend of header section\n");
@@ -323,7 +326,8 @@ bool RTSPPlugin::parse_rtsp_response(const char *data, int payload_len, RecordEx
    char buffer[64];
    const char *begin;
    const char *end;
-   const char *keyval_delimiter;
+   const char *value;
+   HeaderName name;
    size_t remaining;
    int code;
 
@@ -390,58 +394,59 @@ bool RTSPPlugin::parse_rtsp_response(const char *data, int payload_len, RecordEx
    rec->code = code;
 
    /* Find begin of next line after request line. */
-   if (check_payload_len(payload_len, end - data)) {
-      DEBUG_MSG("Parser quits:\tpayload end\n");
-      return false;
-   }
-   remaining = payload_len - (end - data);
-   begin = static_cast<const char *>(memchr(end, RTSP_LINE_DELIMITER, remaining));
-   if (begin == nullptr) {
+   HeaderScanner scanner(end, payload_len - (end - data));
+   HeaderLine line;
+   if (!scanner.next(line)) {
       DEBUG_MSG("Parser quits:\tNo line delim after request line\n");
       return false;
    }
-   begin++;
 
    /* Header:
     *
     * REQ-FIELD: VALUE
     * |        |      |
-    * |        |      ----- end
-    * |        ------------ keyval_delimiter
-    * --------------------- begin
+    * |        |      ----- line.end
+    * |        ------------ line.colon
+    * --------------------- line.begin
     */
 
    rec->content_type[0] = 0;
    /* Process headers. */
-   while (begin - data < payload_len) {
-      remaining = payload_len - (begin - data);
-      end = static_cast<const char *>(memchr(begin, RTSP_LINE_DELIMITER, remaining));
-      keyval_delimiter = static_cast<const char *>(memchr(begin, RTSP_KEYVAL_DELIMITER, remaining));
+   while (true) {
+      if (!scanner.next(line)) {
+         if (scanner.tail(line)) {
+            DEBUG_MSG("Parser quits:\theader is fragmented\n");
+            return false;
+         }
+         break; /* Payload ends with the last header. */
+      }
 
-      int tmp = end - begin;
-      if (tmp == 0 || tmp == 1) { /* Check for blank line with \r\n or \n ending. */
+      if (line.length() <= 1) { /* Check for blank line with \r\n or \n ending. */
          break; /* Double LF found - end of header section. */
-      } else if (end == nullptr || keyval_delimiter == NULL) {
-         DEBUG_MSG("Parser quits:\theader is fragmented\n");
-         return  false;
+      } else if (line.colon == nullptr) {
+         /* Skip line without delimiter unless it is the last field. */
+         remaining = payload_len - (line.end - data);
+         if (memchr(line.end, RTSP_KEYVAL_DELIMITER, remaining) == nullptr) {
+            DEBUG_MSG("Parser quits:\theader is fragmented\n");
+            return false;
+         }
+         continue;
       }
 
-      /* Copy field name. */
-      copy_str(buffer, sizeof(buffer), begin, keyval_delimiter);
+      value = std::min(line.colon + 2, line.end);
+      name = header_name(line.begin, line.colon - line.begin);
 
       DEBUG_CODE(char debug_buffer[4096]);
-      DEBUG_CODE(copy_str(debug_buffer, sizeof(debug_buffer), keyval_delimiter + 2, end));
+      DEBUG_CODE(copy_str(buffer, sizeof(buffer), line.begin, line.colon));
+      DEBUG_CODE(copy_str(debug_buffer, sizeof(debug_buffer), value, line.end));
       DEBUG_MSG("\t%s: %s\n", buffer, debug_buffer);
 
       /* Copy interesting field values. */
-      if (!strcmp(buffer, "Content-Type")) {
-         copy_str(rec->content_type, sizeof(rec->content_type), keyval_delimiter + 2, end);
-      } else if (!strcmp(buffer, "Server")) {
-         copy_str(rec->server, sizeof(rec->server), keyval_delimiter + 2, end);
+      if (name == HeaderName::CONTENT_TYPE) {
+         copy_str(rec->content_type, sizeof(rec->content_type), value, line.end);
+      } else if (name == HeaderName::SERVER) {
+         copy_str(rec->server, sizeof(rec->server), value, line.end);
       }
-
-      /* Go to next line. */
-      begin = end + 1 ;
    }
 
    DEBUG_MSG("Parser quits:\tend of header section\n");
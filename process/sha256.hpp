@@ -0,0 +1,68 @@
+/**
+ * \file sha256.hpp
+ * \brief Streaming SHA-256 used for TLS fingerprints
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+
+#ifndef IPXP_PROCESS_SHA256_HPP
+#define IPXP_PROCESS_SHA256_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ipxp {
+
+/**
+ * \brief Small streaming SHA-256 (FIPS 180-4) without memory allocations.
+ *
+ * Built-in implementation of HashSHA256 used when OpenSSL is not available, plugins should use
+ * HashSHA256. Usage: feed data with update(), then call finalize() and read binary_digest().
+ */
+class SHA256
+{
+public:
+   static const size_t DIGEST_SIZE = 32;
+
+   SHA256();
+   void init();
+   void update(const uint8_t *data, size_t length);
+   void update(const char *data, size_t length);
+   SHA256 &finalize();
+   const uint8_t *binary_digest() const
+   {
+      return m_digest;
+   }
+
+private:
+   void transform(const uint8_t *block);
+
+   uint32_t m_state[8];
+   uint64_t m_length;
+   uint8_t m_buffer[64];
+   uint32_t m_buffer_len;
+   uint8_t m_digest[DIGEST_SIZE];
+};
+
+}
+#endif /* IPXP_PROCESS_SHA256_HPP */
@@ -34,6 +34,7 @@
 #include <unirec/unirec.h>
 #endif
 
+#include "header-scanner.hpp"
 #include "sip.hpp"
 
 namespace ipxp {
@@ -433,6 +434,19 @@ void SIPPlugin::parser_field_uri(const unsigned char *line, int linelen, int ski
    dst[final_len] = 0;
 }
 
+static bool parser_next_line(HeaderScanner &lines, const unsigned char **line, unsigned int *line_len)
+{
+   HeaderLine hdr;
+
+   /* The last line does not need to be terminated: */
+   if (!lines.next(hdr) && !lines.tail(hdr)) {
+      return false;
+   }
+   *line = reinterpret_cast<const unsigned char *>(hdr.begin);
+   *line_len = hdr.length();
+   return true;
+}
+
 int SIPPlugin::parser_process_sip(const Packet &pkt, RecordExtSIP *sip_data)
 {
    const unsigned char *payload;
@@ -440,7 +454,6 @@ int SIPPlugin::parser_process_sip(const Packet &pkt, RecordExtSIP *sip_data)
    int caplen;
    unsigned int line_len = 0;
    int field_len;
-   parser_strtok_t line_parser;
    uint32_t first_bytes4;
    uint32_t first_bytes3;
    uint32_t first_bytes2;
@@ -450,7 +463,10 @@ int SIPPlugin::parser_process_sip(const Packet &pkt, RecordExtSIP *sip_data)
    caplen = pkt.payload_len;
 
    /* Grab the first line of the payload: */
-   line = parser_strtok(payload, caplen, '\n', &line_len, &line_parser);
+   HeaderScanner lines(reinterpret_cast<const char *>(payload), caplen);
+   if (!parser_next_line(lines, &line, &line_len)) {
+      return 0;
+   }
 
 
    /* Get Request-URI for SIP requests from first line of the payload: */
@@ -489,13 +505,10 @@ int SIPPlugin::parser_process_sip(const Packet &pkt, RecordExtSIP *sip_data)
    }
 
    total++;
-   /* Go to the next line. Divide the packet payload by line breaks and process them one by one: */
-   line = parser_strtok(nullptr, 0, ' ', &line_len, &line_parser);
-
    /*
-    * Process all the remaining attributes:
+    * Process all the remaining attributes. Divide the packet payload by line breaks and process them one by one:
     */
-   while (line != nullptr && line_len > 1) {
+   while (parser_next_line(lines, &line, &line_len) && line_len > 1) {
       /* Get first 4, 3 and 2 bytes and compare them with searched SIP fields: */
       first_bytes4 = SIP_UCFOUR(*((uint32_t *) line));
       first_bytes3 = SIP_UCTHREE(*((uint32_t *) line));
@@ -553,9 +566,6 @@ int SIPPlugin::parser_process_sip(const Packet &pkt, RecordExtSIP *sip_data)
          /* Save CSeq: */
          parser_field_value(line, line_len, 5, sip_data->cseq, sizeof(sip_data->cseq));
       }
-
-      /* Go to the next line: */
-      line = parser_strtok(nullptr, 0, ' ', &line_len, &line_parser);
    }
 
    return 0;
@@ -13,13 +13,14 @@
  */
 
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 
+#include <ctype.h>
 #include <stdio.h>
 
 #include "tls.hpp"
-#include "md5.hpp"
 
 namespace ipxp {
 int RecordExtTLS::REGISTERED_ID = -1;
@@ -74,7 +75,7 @@ ProcessPlugin *TLSPlugin::copy()
 
 int TLSPlugin::post_create(Flow &rec, const Packet &pkt)
 {
-   add_tls_record(rec, pkt);
+   add_tls_record(rec, pkt.payload, pkt.payload_len);
    return 0;
 }
 
@@ -89,16 +90,258 @@ int TLSPlugin::pre_update(Flow &rec, Packet &pkt)
       }
       return 0;
    }
-   add_tls_record(rec, pkt);
+   add_tls_record(rec, pkt.payload, pkt.payload_len);
 
    return 0;
 }
 
-bool TLSPlugin::obtain_tls_data(TLSData &payload, RecordExtTLS *rec, std::string &ja3, uint8_t hs_type)
+/**
+ * \brief Formats fingerprint text into a small stack buffer, full buffer is fed into the hash.
+ */
+template<typename Hash>
+class HashWriter
+{
+public:
+   HashWriter(Hash &hash) : m_hash(hash), m_len(0)
+   {
+   }
+
+   void put(char c)
+   {
+      reserve(1);
+      m_buf[m_len++] = c;
+   }
+
+   void put_dec(uint16_t val)
+   {
+      char tmp[5];
+      int len = 0;
+
+      do {
+         tmp[len++] = '0' + val % 10;
+         val /= 10;
+      } while (val);
+      reserve(len);
+      while (len) {
+         m_buf[m_len++] = tmp[--len];
+      }
+   }
+
+   void put_hex(uint16_t val)
+   {
+      static const char hex[] = "0123456789abcdef";
+
+      reserve(4);
+      for (int shift = 12; shift >= 0; shift -= 4) {
+         m_buf[m_len++] = hex[(val >> shift) & 0xF];
+      }
+   }
+
+   void flush()
+   {
+      if (m_len) {
+         m_hash.update(m_buf, m_len);
+         m_len = 0;
+      }
+   }
+
+private:
+   Hash &m_hash;
+   char m_buf[128];
+   uint32_t m_len;
+
+   void reserve(uint32_t len)
+   {
+      if (m_len + len > sizeof(m_buf)) {
+         flush();
+      }
+   }
+};
+
+// JA3 list of 16-bit values, GREASE values are skipped but a separator is written whenever next value follows
+static void ja3_put_list16(HashWriter<HashMD5> &ja3, const TLSData &list)
+{
+   for (const uint8_t *ptr = list.start; ptr + sizeof(uint16_t) <= list.end; ptr += sizeof(uint16_t)) {
+      uint16_t val = ntohs(*(uint16_t *) ptr);
+      if (!TLSParser::tls_is_grease_value(val)) {
+         ja3.put_dec(val);
+         if (ptr + 2 * sizeof(uint16_t) <= list.end) {
+            ja3.put('-');
+         }
+      }
+   }
+}
+
+static void ja3_put_list8(HashWriter<HashMD5> &ja3, const TLSData &list)
+{
+   for (const uint8_t *ptr = list.start; ptr < list.end; ptr++) {
+      ja3.put_dec(*ptr);
+      if (ptr + 1 < list.end) {
+         ja3.put('-');
+      }
+   }
+}
+
+static const char *ja4_version(uint16_t version)
+{
+   switch (version) {
+   case 0x0304:
+      return "13";
+   case 0x0303:
+      return "12";
+   case 0x0302:
+      return "11";
+   case 0x0301:
+      return "10";
+   case 0x0300:
+      return "s3";
+   default:
+      return "00";
+   }
+}
+
+static char *ja4_put_count(char *out, uint16_t cnt)
+{
+   if (cnt > 99) {
+      cnt = 99;
+   }
+   *out++ = '0' + cnt / 10;
+   *out++ = '0' + cnt % 10;
+   return out;
+}
+
+// First and last character of the first ALPN value, hex digits are used for non-alphanumeric values
+static char *ja4_put_alpn(char *out, const TLSData &alpn)
+{
+   static const char hex[] = "0123456789abcdef";
+
+   if (alpn.start == alpn.end) {
+      *out++ = '0';
+      *out++ = '0';
+      return out;
+   }
+   uint8_t first = *alpn.start;
+   uint8_t last  = *(alpn.end - 1);
+   if (isalnum(first) && isalnum(last)) {
+      *out++ = first;
+      *out++ = last;
+   } else {
+      *out++ = hex[first >> 4];
+      *out++ = hex[last & 0xF];
+   }
+   return out;
+}
+
+// Hash truncated to 12 hex characters, zeros are used when nothing was hashed
+static char *ja4_put_hash(char *out, HashSHA256 &sha, bool empty)
 {
-   std::string ecliptic_curves;
-   std::string ec_point_formats;
+   static const char hex[] = "0123456789abcdef";
+
+   if (empty) {
+      memset(out, '0', 12);
+      return out + 12;
+   }
+   const uint8_t *digest = sha.finalize();
+   for (int i = 0; i < 6; i++) {
+      *out++ = hex[digest[i] >> 4];
+      *out++ = hex[digest[i] & 0xF];
+   }
+   return out;
+}
+
+static void ja4_client(const TLSFingerprint &fp, HashSHA256 &sha, char *out)
+{
+   uint16_t ciphers[TLS_FP_MAX_VALUES];
+   uint16_t exts[TLS_FP_MAX_VALUES];
+   uint16_t cipher_stored = 0;
+   uint16_t cipher_cnt = 0;
+
+   for (const uint8_t *ptr = fp.ciphers.start; ptr + sizeof(uint16_t) <= fp.ciphers.end; ptr += sizeof(uint16_t)) {
+      uint16_t val = ntohs(*(uint16_t *) ptr);
+      if (!TLSParser::tls_is_grease_value(val)) {
+         if (cipher_stored < TLS_FP_MAX_VALUES) {
+            ciphers[cipher_stored++] = val;
+         }
+         cipher_cnt++;
+      }
+   }
+   std::sort(ciphers, ciphers + cipher_stored);
+   memcpy(exts, fp.exts, fp.ext_stored * sizeof(uint16_t));
+   std::sort(exts, exts + fp.ext_stored);
+
+   *out++ = 't';
+   memcpy(out, ja4_version(fp.version), 2);
+   out += 2;
+   *out++ = fp.sni ? 'd' : 'i';
+   out = ja4_put_count(out, cipher_cnt);
+   out = ja4_put_count(out, fp.ext_cnt);
+   out = ja4_put_alpn(out, fp.alpn);
+   *out++ = '_';
+
+   sha.reset();
+   HashWriter<HashSHA256> writer(sha);
+   for (uint16_t i = 0; i < cipher_stored; i++) {
+      if (i) {
+         writer.put(',');
+      }
+      writer.put_hex(ciphers[i]);
+   }
+   writer.flush();
+   out = ja4_put_hash(out, sha, cipher_stored == 0);
+   *out++ = '_';
+
+   sha.reset();
+   for (uint16_t i = 0; i < fp.ext_stored; i++) {
+      if (i) {
+         writer.put(',');
+      }
+      writer.put_hex(exts[i]);
+   }
+   bool first = true;
+   for (const uint8_t *ptr = fp.sig_algs.start; ptr + sizeof(uint16_t) <= fp.sig_algs.end; ptr += sizeof(uint16_t)) {
+      uint16_t val = ntohs(*(uint16_t *) ptr);
+      if (!TLSParser::tls_is_grease_value(val)) {
+         writer.put(first ? '_' : ',');
+         writer.put_hex(val);
+         first = false;
+      }
+   }
+   writer.flush();
+   out = ja4_put_hash(out, sha, fp.ext_stored == 0);
+   *out = 0;
+}
 
+static void ja4_server(const TLSFingerprint &fp, HashSHA256 &sha, char *out)
+{
+   static const char hex[] = "0123456789abcdef";
+
+   *out++ = 't';
+   memcpy(out, ja4_version(fp.version), 2);
+   out += 2;
+   out = ja4_put_count(out, fp.ext_cnt);
+   out = ja4_put_alpn(out, fp.alpn);
+   *out++ = '_';
+   for (int shift = 12; shift >= 0; shift -= 4) {
+      *out++ = hex[(fp.cipher >> shift) & 0xF];
+   }
+   *out++ = '_';
+
+   sha.reset();
+   HashWriter<HashSHA256> writer(sha);
+   for (uint16_t i = 0; i < fp.ext_stored; i++) {
+      if (i) {
+         writer.put(',');
+      }
+      writer.put_hex(fp.exts[i]);
+   }
+   writer.flush();
+   out = ja4_put_hash(out, sha, fp.ext_stored == 0);
+   *out = 0;
+}
+
+bool TLSPlugin::obtain_tls_data(TLSData &payload, RecordExtTLS *rec, TLSFingerprint &fp, uint8_t hs_type)
+{
+   HashWriter<HashMD5> ja3(ja3_md5);
 
    while (payload.start + sizeof(tls_ext) <= payload.end) {
       tls_ext *ext    = (tls_ext *) payload.start;
@@ -109,40 +352,75 @@ bool TLSPlugin::obtain_tls_data(TLSData &payload, RecordExtTLS *rec, std::string
       if (payload.start + length > payload.end) {
          break;
       }
+      TLSData ext_data = { payload.start, payload.start + length, 0 };
 
       if (hs_type == TLS_HANDSHAKE_CLIENT_HELLO) {
          if (type == TLS_EXT_SERVER_NAME) {
             tls_parser.tls_get_server_name(payload, rec->sni, sizeof(rec->sni));
+            fp.sni = true;
          } else if (type == TLS_EXT_ECLIPTIC_CURVES) {
-            ecliptic_curves = tls_parser.tls_get_ja3_ecpliptic_curves(payload);
+            tls_parser.tls_get_list(ext_data, fp.curves, sizeof(uint16_t));
          } else if (type == TLS_EXT_EC_POINT_FORMATS) {
-            ec_point_formats = tls_parser.tls_get_ja3_ec_point_formats(payload);
+            tls_parser.tls_get_list(ext_data, fp.point_formats, sizeof(uint8_t));
+         } else if (type == TLS_EXT_SIGNATURE_ALGS) {
+            tls_parser.tls_get_list(ext_data, fp.sig_algs, sizeof(uint16_t));
+         } else if (type == TLS_EXT_ALPN) {
+            TLSData list;
+            if (tls_parser.tls_get_list(ext_data, list, sizeof(uint16_t))) {
+               tls_parser.tls_get_list(list, fp.alpn, sizeof(uint8_t));
+            }
+         } else if (type == TLS_EXT_SUPPORTED_VER) {
+            TLSData list;
+            uint16_t max_version = 0;
+            tls_parser.tls_get_list(ext_data, list, sizeof(uint8_t));
+            for (const uint8_t *ptr = list.start; ptr + sizeof(uint16_t) <= list.end; ptr += sizeof(uint16_t)) {
+               uint16_t version = ntohs(*(uint16_t *) ptr);
+               if (!tls_parser.tls_is_grease_value(version) && version > max_version) {
+                  max_version = version;
+               }
+            }
+            if (max_version != 0) {
+               fp.version = max_version;
+            }
          }
       } else if (hs_type == TLS_HANDSHAKE_SERVER_HELLO) {
          rec->server_hello_parsed = true;
          if (type == TLS_EXT_ALPN) {
             tls_parser.tls_get_alpn(payload, rec->alpn, BUFF_SIZE);
-            // not sure, but probably don`t return yet, as 
-            // this is not only field we want to parse
-            //return true;
+            TLSData list;
+            if (tls_parser.tls_get_list(ext_data, list, sizeof(uint16_t))) {
+               tls_parser.tls_get_list(list, fp.alpn, sizeof(uint8_t));
+            }
          } else if (type == TLS_EXT_SUPPORTED_VER){
             tls_parser.tls_get_supp_ver(payload, rec->version);
+            fp.version = rec->version;
          }
       }
       payload.start += length;
       if (!tls_parser.tls_is_grease_value(type)) {
-         ja3 += std::to_string(type);
-
-         if (payload.start + sizeof(tls_ext) <= payload.end) {
-            ja3 += '-';
+         fp.ext_cnt++;
+         if (fp.ext_stored < TLS_FP_MAX_VALUES &&
+            (hs_type == TLS_HANDSHAKE_SERVER_HELLO || (type != TLS_EXT_SERVER_NAME && type != TLS_EXT_ALPN))) {
+            fp.exts[fp.ext_stored++] = type;
+         }
+         if (hs_type == TLS_HANDSHAKE_CLIENT_HELLO) {
+            ja3.put_dec(type);
+            if (payload.start + sizeof(tls_ext) <= payload.end) {
+               ja3.put('-');
+            }
          }
       }
    }
    if (hs_type == TLS_HANDSHAKE_SERVER_HELLO) {
+      ja4_server(fp, ja4_sha, rec->ja4s);
       return false;
    }
-   ja3 += ',' + ecliptic_curves + ',' + ec_point_formats;
-   md5_get_bin(ja3, rec->ja3_hash_bin);
+   ja3.put(',');
+   ja3_put_list16(ja3, fp.curves);
+   ja3.put(',');
+   ja3_put_list8(ja3, fp.point_formats);
+   ja3.flush();
+   ja4_client(fp, ja4_sha, rec->ja4);
    return true;
 } // TLSPlugin::obtain_tls_data
 
@@ -153,7 +431,9 @@ bool TLSPlugin::parse_tls(const uint8_t *data, uint16_t payload_len, RecordExtTL
       payload.end   = data + payload_len,
       payload.obejcts_parsed = 0,
    };
-   std::string ja3;
+   ja3_md5.reset();
+   HashWriter<HashMD5> ja3(ja3_md5);
+   TLSFingerprint fp;
 
 
    if (!tls_parser.tls_check_rec(payload)) {
@@ -165,7 +445,9 @@ bool TLSPlugin::parse_tls(const uint8_t *data, uint16_t payload_len, RecordExtTL
    tls_handshake tls_hs = tls_parser.tls_get_handshake();
 
    rec->version = (rec->version == 0)?(((uint16_t) tls_hs.version.major << 8) | tls_hs.version.minor) : rec->version;
-   ja3 += std::to_string((uint16_t) tls_hs.version.version) + ',';
+   fp.version = ((uint16_t) tls_hs.version.major << 8) | tls_hs.version.minor;
+   ja3.put_dec((uint16_t) tls_hs.version.version);
+   ja3.put(',');
 
    if (!tls_parser.tls_skip_random(payload)) {
       return false;
@@ -175,13 +457,20 @@ bool TLSPlugin::parse_tls(const uint8_t *data, uint16_t payload_len, RecordExtTL
    }
 
    if (tls_hs.type == TLS_HANDSHAKE_CLIENT_HELLO) {
-      if (!tls_parser.tls_get_ja3_cipher_suites(ja3, payload)) {
+      if (!tls_parser.tls_get_cipher_suites(payload, fp.ciphers)) {
          return false;
       }
+      ja3_put_list16(ja3, fp.ciphers);
+      ja3.put(',');
+      ja3.flush();
       if (!tls_parser.tls_skip_compression_met(payload)) {
          return false;
       }
    } else if (tls_hs.type == TLS_HANDSHAKE_SERVER_HELLO) {
+      if (payload.start + 3 > payload.end) {
+         return false;
+      }
+      fp.cipher = ntohs(*(uint16_t *) payload.start);
       payload.start += 2; // Skip cipher suite
       payload.start += 1; // Skip compression method
    } else   {
@@ -190,20 +479,45 @@ bool TLSPlugin::parse_tls(const uint8_t *data, uint16_t payload_len, RecordExtTL
    if (!tls_parser.tls_check_ext_len(payload)) {
       return false;
    }
-   if (!obtain_tls_data(payload, rec, ja3, tls_hs.type)) {
+   if (!obtain_tls_data(payload, rec, fp, tls_hs.type)) {
       return false;
    }
+   memcpy(rec->ja3_hash_bin, ja3_md5.finalize(), HashMD5::DIGEST_SIZE);
    parsed_sni = payload.obejcts_parsed;
-   return payload.obejcts_parsed != 0 || !ja3.empty();
+   return true;
 } // TLSPlugin::parse_sni
 
-void TLSPlugin::add_tls_record(Flow &rec, const Packet &pkt)
+int TLSPlugin::stream_data(Flow &rec, const Packet &pkt, const TCPStreamData &stream)
+{
+   // Hellos contained in a single segment are parsed from packets by post_create and pre_update,
+   // stream data are needed only when the handshake record is split into more segments.
+   const uint8_t *data = stream.data;
+   if (data[0] != TLS_HANDSHAKE) {
+      return STREAM_DONE;
+   }
+   if (stream.length < sizeof(tls_rec) + 1 ||
+      (stream.length < sizeof(tls_rec) + ntohs(((tls_rec *) data)->length) && stream.length < TLS_STREAM_BYTES)) {
+      return 0;
+   }
+
+   RecordExtTLS *ext = static_cast<RecordExtTLS *>(rec.get_extension(RecordExtTLS::REGISTERED_ID));
+   uint8_t hs_type = data[sizeof(tls_rec)];
+   uint16_t length = stream.length > UINT16_MAX ? UINT16_MAX : stream.length;
+   if (hs_type == TLS_HANDSHAKE_CLIENT_HELLO && ext == nullptr) {
+      add_tls_record(rec, data, length);
+   } else if (hs_type == TLS_HANDSHAKE_SERVER_HELLO && ext != nullptr && !ext->server_hello_parsed) {
+      parse_tls(data, length, ext);
+   }
+   return STREAM_DONE;
+}
+
+void TLSPlugin::add_tls_record(Flow &rec, const uint8_t *data, uint16_t len)
 {
    if (ext_ptr == nullptr) {
       ext_ptr = new RecordExtTLS();
    }
 
-   if (parse_tls(pkt.payload, pkt.payload_len, ext_ptr)) {
+   if (parse_tls(data, len, ext_ptr)) {
       DEBUG_CODE(for (int i = 0; i < 16; i++) {
             DEBUG_MSG("%02x", ext_ptr->ja3_hash_bin[i]);
          }
@@ -213,6 +527,10 @@ void TLSPlugin::add_tls_record(Flow &rec, const Packet &pkt)
       DEBUG_MSG("%s\n", ext_ptr->alpn);
       rec.add_extension(ext_ptr);
       ext_ptr = nullptr;
+   } else if (ext_ptr->server_hello_parsed) {
+      // ServerHello without ClientHello is not exported, do not reuse its values for the next flow
+      delete ext_ptr;
+      ext_ptr = nullptr;
    }
 }
 
@@ -31,19 +31,29 @@
 #include <ipfixprobe/packet.hpp>
 #include <ipfixprobe/ipfix-elements.hpp>
 #include <ipfixprobe/utils.hpp>
+#include <ipfixprobe/tcp-stream.hpp>
+#include <ipfixprobe/hash.hpp>
 #include <process/tls_parser.hpp>
 
 
 #define BUFF_SIZE 255
 
+#define TLS_JA4_SIZE  37 // "t13d1516h2_8daaf6152771_e5627efa2ab1"
+#define TLS_JA4S_SIZE 26 // "t130200_1301_234ea6891581"
+#define TLS_FP_MAX_VALUES 256 // Maximum number of ciphers/extensions sorted for JA4
+#define TLS_STREAM_BYTES 4096 // Reassembled bytes of TCP streams, hellos split into several segments fit
+
 namespace ipxp {
-#define TLS_UNIREC_TEMPLATE "TLS_SNI,TLS_JA3,TLS_ALPN,TLS_VERSION"
+
+#define TLS_UNIREC_TEMPLATE "TLS_SNI,TLS_JA3,TLS_ALPN,TLS_VERSION,TLS_JA4,TLS_JA4S"
 
 UR_FIELDS(
    string TLS_SNI,
    string TLS_ALPN,
    uint16 TLS_VERSION,
-   bytes TLS_JA3
+   bytes TLS_JA3,
+   string TLS_JA4,
+   string TLS_JA4S
 )
 
 /**
@@ -57,7 +67,8 @@ struct RecordExtTLS : public RecordExt {
    char        sni[BUFF_SIZE]   = { 0 };
    char        ja3_hash[33]     = { 0 };
    uint8_t     ja3_hash_bin[16] = { 0 };
-   std::string ja3;
+   char        ja4[TLS_JA4_SIZE]   = { 0 };
+   char        ja4s[TLS_JA4S_SIZE] = { 0 };
    bool        server_hello_parsed;
 
    /**
@@ -68,6 +79,8 @@ struct RecordExtTLS : public RecordExt {
       alpn[0]     = 0;
       sni[0]      = 0;
       ja3_hash[0] = 0;
+      ja4[0]      = 0;
+      ja4s[0]     = 0;
       server_hello_parsed = false;
    }
 
@@ -78,6 +91,8 @@ struct RecordExtTLS : public RecordExt {
       ur_set_string(tmplt, record, F_TLS_SNI, sni);
       ur_set_string(tmplt, record, F_TLS_ALPN, alpn);
       ur_set_var(tmplt, record, F_TLS_JA3, ja3_hash_bin, 16);
+      ur_set_string(tmplt, record, F_TLS_JA4, ja4);
+      ur_set_string(tmplt, record, F_TLS_JA4S, ja4s);
    }
 
    const char *get_unirec_tmplt() const
@@ -133,6 +148,8 @@ struct RecordExtTLS : public RecordExt {
       for (int i = 0; i < 16; i++) {
          out << std::hex << std::setw(2) << std::setfill('0') << (unsigned) ja3_hash_bin[i];
       }
+      out << ",tlsja4=" << ja4
+          << ",tlsja4s=" << ja4s;
       return out.str();
    }
 };
@@ -145,9 +162,35 @@ struct RecordExtTLS : public RecordExt {
 #define TLS_EXT_SERVER_NAME      0
 #define TLS_EXT_ECLIPTIC_CURVES  10 // AKA supported_groups
 #define TLS_EXT_EC_POINT_FORMATS 11
+#define TLS_EXT_SIGNATURE_ALGS   13
 #define TLS_EXT_ALPN             16
 #define TLS_EXT_SUPPORTED_VER    43
 
+/**
+ * \brief Values of a hello message collected for JA3/JA4 fingerprints in a single pass.
+ *
+ * Lists point into the packet payload, GREASE values are not stored in the arrays.
+ */
+struct TLSFingerprint {
+   TLSData  ciphers;        /**< Raw cipher suites list (ClientHello). */
+   TLSData  curves;         /**< Raw supported groups list. */
+   TLSData  point_formats;  /**< Raw EC point formats list. */
+   TLSData  sig_algs;       /**< Raw signature algorithms list. */
+   TLSData  alpn;           /**< First ALPN protocol. */
+   uint16_t cipher;         /**< Selected cipher suite (ServerHello). */
+   uint16_t version;        /**< Highest supported version or handshake version. */
+   bool     sni;            /**< SNI extension is present. */
+   uint16_t ext_cnt;        /**< Number of non-GREASE extensions. */
+   uint16_t ext_stored;     /**< Number of extension types stored in exts. */
+   uint16_t exts[TLS_FP_MAX_VALUES]; /**< Extension types, without SNI and ALPN for ClientHello. */
+
+   TLSFingerprint() : cipher(0), version(0), sni(false), ext_cnt(0), ext_stored(0)
+   {
+      TLSData empty = { nullptr, nullptr, 0 };
+      ciphers = curves = point_formats = sig_algs = alpn = empty;
+   }
+};
+
 
 /**
  * \brief Flow cache plugin for parsing HTTPS packets.
@@ -169,15 +212,19 @@ public:
 
    int post_create(Flow &rec, const Packet &pkt);
    int pre_update(Flow &rec, Packet &pkt);
+   uint32_t stream_bytes() const { return TLS_STREAM_BYTES; }
+   int stream_data(Flow &rec, const Packet &pkt, const TCPStreamData &stream);
    void finish(bool print_stats);
 
 private:
-   void add_tls_record(Flow&, const Packet&);
+   void add_tls_record(Flow&, const uint8_t *, uint16_t);
    bool parse_tls(const uint8_t *, uint16_t, RecordExtTLS *);
-   bool obtain_tls_data(TLSData&, RecordExtTLS *, std::string&, uint8_t);
+   bool obtain_tls_data(TLSData&, RecordExtTLS *, TLSFingerprint&, uint8_t);
 
    RecordExtTLS *ext_ptr;
    TLSParser tls_parser;
+   HashMD5 ja3_md5; /**< Reused for all JA3 digests of the plugin. */
+   HashSHA256 ja4_sha; /**< Reused for all JA4 and JA4S digests of the plugin. */
    uint32_t parsed_sni;
    bool flow_flush;
 };
@@ -266,79 +266,37 @@ bool TLSParser::tls_check_ext_len(TLSData& payload)
    return true;
 }
 
-bool TLSParser::tls_get_ja3_cipher_suites(std::string &ja3, TLSData &data)
+bool TLSParser::tls_get_cipher_suites(TLSData &payload, TLSData &list)
 {
-   uint16_t cipher_suites_length = ntohs(*(uint16_t *) data.start);
-   uint16_t type_id = 0;
-   const uint8_t *section_end = data.start + cipher_suites_length;
+   uint16_t cipher_suites_length = ntohs(*(uint16_t *) payload.start);
 
-   if (data.start + cipher_suites_length + 1 > data.end) {
-      // data.valid = false;
+   if (payload.start + sizeof(cipher_suites_length) + cipher_suites_length > payload.end) {
       return false;
    }
-   data.start += sizeof(cipher_suites_length);
-
-   for (; data.start <= section_end; data.start += sizeof(uint16_t)) {
-      type_id = ntohs(*(uint16_t *) (data.start));
-      if (!tls_is_grease_value(type_id)) {
-         ja3 += std::to_string(type_id);
-         if (data.start < section_end) {
-            ja3 += '-';
-         }
-      }
-   }
-   ja3 += ',';
+   list.start = payload.start + sizeof(cipher_suites_length);
+   list.end   = list.start + (cipher_suites_length & ~1);
+   list.obejcts_parsed = 0;
+   payload.start += sizeof(cipher_suites_length) + cipher_suites_length;
    return true;
 }
 
-std::string TLSParser::tls_get_ja3_ecpliptic_curves(TLSData &data)
+bool TLSParser::tls_get_list(const TLSData &data, TLSData &list, size_t len_size)
 {
-   std::string collected_types;
-   uint16_t type_id        = 0;
-   uint16_t list_len       = ntohs(*(uint16_t *) data.start);
-   const uint8_t *list_end = data.start + list_len + sizeof(list_len);
-   uint16_t offset         = sizeof(list_len);
-
-   if (list_end > data.end) {
-      // data.valid = false;
-      return "";
-   }
-
-   while (data.start + sizeof(uint16_t) + offset <= list_end) {
-      type_id = ntohs(*(uint16_t *) (data.start + offset));
-      offset += sizeof(uint16_t);
-      if (!tls_is_grease_value(type_id)) {
-         collected_types += std::to_string(type_id);
-
-         if (data.start + sizeof(uint16_t) + offset <= list_end) {
-            collected_types += '-';
-         }
-      }
+   list.start = data.start;
+   list.end   = data.start;
+   list.obejcts_parsed = 0;
+   if (data.start + len_size > data.end) {
+      return false;
    }
-   return collected_types;
-}
 
-std::string TLSParser::tls_get_ja3_ec_point_formats(TLSData &data)
-{
-   std::string collected_formats;
-   uint8_t list_len        = *data.start;
-   uint16_t offset         = sizeof(list_len);
-   const uint8_t *list_end = data.start + list_len + offset;
-   uint8_t format;
+   size_t list_len = len_size == sizeof(uint8_t) ? *data.start : ntohs(*(uint16_t *) data.start);
 
-   if (list_end > data.end) {
-      // data.valid = false;
-      return "";
-   }
-
-   while (data.start + sizeof(uint8_t) + offset <= list_end) {
-      format = *(data.start + offset);
-      collected_formats += std::to_string((int) format);
-      offset += sizeof(uint8_t);
-      if (data.start + sizeof(uint8_t) + offset <= list_end) {
-         collected_formats += '-';
-      }
+   list.start = data.start + len_size;
+   list.end   = list.start + list_len;
+   if (list.end > data.end) {
+      list.end = list.start;
+      return false;
    }
-   return collected_formats;
+   return true;
 }
 }
@@ -90,14 +90,12 @@ public:
 
    void tls_get_quic_user_agent(TLSData &, char *, size_t);
    bool tls_check_handshake(TLSData&);
-   bool tls_get_ja3_cipher_suites(std::string&, TLSData&);
+   bool tls_get_cipher_suites(TLSData&, TLSData&);
 
-   bool tls_is_grease_value(uint16_t);
+   static bool tls_is_grease_value(uint16_t);
 
    tls_handshake tls_get_handshake();
    uint8_t tls_get_hstype();
-   std::string tls_get_version_ja3();
-   std::string tls_get_ja3_ecpliptic_curves(TLSData &data);
-   std::string tls_get_ja3_ec_point_formats(TLSData &data);
+   bool tls_get_list(const TLSData &, TLSData &, size_t);
 };
 }
@@ -53,6 +53,7 @@ struct OutputStats {
    uint64_t bytes;
    uint64_t packets;
    uint64_t dropped;
+   uint64_t delay; /**< Time spent waiting for rate limits in microseconds. */
 };
 
 typedef struct msg_header_s
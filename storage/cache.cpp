@@ -30,6 +30,7 @@
  *
  */
 
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
 #include <cstring>
@@ -37,14 +38,17 @@
 
 #include <ipfixprobe/ring.h>
 #include "cache.hpp"
-#include "xxhash.h"
+#include <ipfixprobe/hash.hpp>
 
 namespace ipxp {
 
+int RecordExtSampling::REGISTERED_ID = -1;
+
 __attribute__((constructor)) static void register_this_plugin()
 {
    static PluginRecord rec = PluginRecord("cache", [](){return new NHTFlowCache();});
    register_plugin(&rec);
+   RecordExtSampling::REGISTERED_ID = register_extension();
 }
 
 FlowRecord::FlowRecord()
@@ -55,12 +59,18 @@ FlowRecord::FlowRecord()
 FlowRecord::~FlowRecord()
 {
    erase();
+   for (auto &it : m_deferred) {
+      delete it;
+   }
 };
 
 void FlowRecord::erase()
 {
    m_flow.remove_extensions();
    m_hash = 0;
+   m_ticket = 0;
+   m_flush = 0;
+   m_ref = 0;
 
    memset(&m_flow.time_first, 0, sizeof(m_flow.time_first));
    memset(&m_flow.time_last, 0, sizeof(m_flow.time_last));
@@ -76,6 +86,7 @@ void FlowRecord::erase()
    m_flow.dst_bytes = 0;
    m_flow.src_tcp_flags = 0;
    m_flow.dst_tcp_flags = 0;
+   memset(&m_counters, 0, sizeof(m_counters));
 }
 void FlowRecord::reuse()
 {
@@ -87,16 +98,10 @@ void FlowRecord::reuse()
    m_flow.dst_bytes = 0;
    m_flow.src_tcp_flags = 0;
    m_flow.dst_tcp_flags = 0;
-}
 
-inline __attribute__((always_inline)) bool FlowRecord::is_empty() const
-{
-   return m_hash == 0;
-}
-
-inline __attribute__((always_inline)) bool FlowRecord::belongs(uint64_t hash) const
-{
-   return hash == m_hash;
+   memset(&m_counters, 0, sizeof(m_counters));
+   m_counters.time_first = m_flow.time_first;
+   m_counters.time_last = m_flow.time_last;
 }
 
 void FlowRecord::create(const Packet &pkt, uint64_t hash)
@@ -138,9 +143,44 @@ void FlowRecord::create(const Packet &pkt, uint64_t hash)
       m_flow.src_port = pkt.src_port;
       m_flow.dst_port = pkt.dst_port;
    }
+
+   m_counters.time_first = m_flow.time_first;
+   m_counters.time_last = m_flow.time_last;
+   m_counters.src_bytes = m_flow.src_bytes;
+   m_counters.dst_bytes = 0;
+   m_counters.src_packets = 1;
+   m_counters.dst_packets = 0;
+   m_counters.src_tcp_flags = m_flow.src_tcp_flags;
+   m_counters.dst_tcp_flags = 0;
 }
 
 void FlowRecord::update(const Packet &pkt, bool src)
+{
+   update_counters(pkt, src);
+   update_flow(pkt, src);
+}
+
+void FlowRecord::update_counters(const Packet &pkt, bool src)
+{
+   m_counters.time_last = pkt.ts;
+   if (src) {
+      m_counters.src_packets++;
+      m_counters.src_bytes += pkt.ip_len;
+
+      if (pkt.ip_proto == IPPROTO_TCP) {
+         m_counters.src_tcp_flags |= pkt.tcp_flags;
+      }
+   } else {
+      m_counters.dst_packets++;
+      m_counters.dst_bytes += pkt.ip_len;
+
+      if (pkt.ip_proto == IPPROTO_TCP) {
+         m_counters.dst_tcp_flags |= pkt.tcp_flags;
+      }
+   }
+}
+
+void FlowRecord::update_flow(const Packet &pkt, bool src)
 {
    m_flow.time_last = pkt.ts;
    if (src) {
@@ -166,8 +206,13 @@ NHTFlowCache::NHTFlowCache() :
    m_qsize(0), m_qidx(0), m_timeout_idx(0), m_active(0), m_inactive(0),
    m_split_biflow(false), m_enable_fragmentation_cache(true), m_keylen(0),
    m_key(), m_key_inv(), m_flow_table(nullptr), m_flow_records(nullptr),
-   m_fragmentation_cache(0, 0)
+   m_fragmentation_cache(0, 0), m_plugin_workers_cnt(0), m_plugin_workers_queue(0),
+   m_sample_flows(1), m_sample_after(0), m_sample_packets(1), m_elephant_packets(0), m_elephant_bytes(0),
+   m_policy(ReplacementPolicy::SLRU), m_clock_hands(nullptr), m_replaying(false)
 {
+#ifdef FLOW_CACHE_STATS
+   m_ghosts = nullptr;
+#endif /* FLOW_CACHE_STATS */
 }
 
 NHTFlowCache::~NHTFlowCache()
@@ -210,12 +255,21 @@ void NHTFlowCache::init(const char *params)
       for (decltype(m_cache_size + m_qsize) i = 0; i < m_cache_size + m_qsize; i++) {
          m_flow_table[i] = m_flow_records + i;
       }
+      m_clock_hands = new uint32_t[m_cache_size / m_line_size]();
    } catch (std::bad_alloc &e) {
       throw PluginError("not enough memory for flow cache allocation");
    }
 
    m_split_biflow = parser.m_split_biflow;
    m_enable_fragmentation_cache = parser.m_enable_fragmentation_cache;
+   m_plugin_workers_cnt = parser.m_plugin_workers;
+   m_plugin_workers_queue = parser.m_plugin_workers_queue;
+   m_sample_flows = parser.m_sample_flows;
+   m_sample_after = parser.m_sample_after;
+   m_sample_packets = parser.m_sample_packets;
+   m_elephant_packets = parser.m_elephant_packets;
+   m_elephant_bytes = parser.m_elephant_bytes;
+   m_policy = parser.m_policy;
 
    if (m_enable_fragmentation_cache) {
       try {
@@ -233,11 +287,23 @@ void NHTFlowCache::init(const char *params)
    m_flushed = 0;
    m_lookups = 0;
    m_lookups2 = 0;
+   m_sampled = 0;
+   m_suppressed = 0;
+   m_evicted = 0;
+   m_premature = 0;
+   // Remember a quarter of cache size evictions, at least one (cache size is a power of two)
+   m_ghosts_mask = m_cache_size >= 4 ? m_cache_size / 4 - 1 : 0;
+   m_ghosts = new uint64_t[m_ghosts_mask + 1]();
 #endif /* FLOW_CACHE_STATS */
 }
 
 void NHTFlowCache::close()
 {
+   m_plugin_workers.stop();
+   for (auto &it : m_replay) {
+      delete it;
+   }
+   m_replay.clear();
    if (m_flow_records != nullptr) {
       delete [] m_flow_records;
       m_flow_records = nullptr;
@@ -246,6 +312,16 @@ void NHTFlowCache::close()
       delete [] m_flow_table;
       m_flow_table = nullptr;
    }
+   if (m_clock_hands != nullptr) {
+      delete [] m_clock_hands;
+      m_clock_hands = nullptr;
+   }
+#ifdef FLOW_CACHE_STATS
+   if (m_ghosts != nullptr) {
+      delete [] m_ghosts;
+      m_ghosts = nullptr;
+   }
+#endif /* FLOW_CACHE_STATS */
 }
 
 void NHTFlowCache::set_queue(ipx_ring_t *queue)
@@ -254,8 +330,238 @@ void NHTFlowCache::set_queue(ipx_ring_t *queue)
    m_qsize = ipx_ring_size(queue);
 }
 
+bool NHTFlowCache::wait_for_plugins(size_t index, const Packet *pkt)
+{
+   size_t replay_pos = 0;
+   FlowRecord *flow = m_flow_table[index];
+   while (flow->m_ticket != 0) {
+      m_plugin_workers.wait(m_plugin_workers.shard(flow->m_flow.flow_hash), flow->m_ticket);
+      flow->m_ticket = 0;
+      if (!flow->m_flush) {
+         break;
+      }
+
+      // Flush requested by plugin running in plugin worker, reinsert enqueues a new ticket
+      int ret = flow->m_flush;
+      uint64_t hash = flow->m_flow.flow_hash;
+      std::vector<PluginWorkItem *> deferred;
+      size_t i = 0;
+      flow->m_flush = 0;
+      deferred.swap(flow->m_deferred);
+      if (ret == FLOW_FLUSH_WITH_REINSERT) {
+         flush(deferred[0]->pkt, index, ret, deferred[0]->pkt.source_pkt);
+         i++;
+      } else {
+         flow->m_flow.end_reason = FLOW_END_FORCED;
+         export_flow(index);
+#ifdef FLOW_CACHE_STATS
+         m_flushed++;
+#endif /* FLOW_CACHE_STATS */
+         if (!deferred.empty() && deferred[0]->pkt.source_pkt) {
+            // Next flow has the same key, create it in place
+            m_flow_table[index]->create(deferred[0]->pkt, hash);
+            post_create(m_flow_table[index], deferred[0]->pkt);
+            i++;
+         }
+      }
+
+      /* Packets which reached the worker after the flush belong to the next flow, they are accounted
+       * to it as if the flush was handled immediately. */
+      flow = m_flow_table[index];
+      if (!flow->is_empty()) {
+         for (; i < deferred.size(); i++) {
+            update(flow, deferred[i]->pkt, deferred[i]->pkt.source_pkt);
+         }
+      } else if (i < deferred.size()) {
+         // Next flow starts with the opposite direction, which can belong to another flow line
+         m_replay.insert(m_replay.begin() + replay_pos, deferred.begin() + i, deferred.end());
+         replay_pos += deferred.size() - i;
+         deferred.resize(i);
+      }
+      for (auto &it : deferred) {
+         delete it;
+      }
+   }
+
+   if (replay_pos == 0 || pkt == nullptr) {
+      return false;
+   }
+   // Packet being processed follows the deferred packets
+   PluginWorkItem *item = new PluginWorkItem();
+   item->snapshot(*pkt);
+   m_replay.insert(m_replay.begin() + replay_pos, item);
+   return true;
+}
+
+void NHTFlowCache::replay_deferred()
+{
+   if (m_replaying) {
+      return;
+   }
+   m_replaying = true;
+   while (!m_replay.empty()) {
+      PluginWorkItem *item = m_replay.front();
+      m_replay.pop_front();
+      put_pkt(item->pkt);
+      delete item;
+   }
+   m_replaying = false;
+}
+
+bool NHTFlowCache::flow_sampled(uint64_t hashval, uint64_t hashval_inv) const
+{
+   if (m_sample_flows <= 1) {
+      return true;
+   }
+   uint64_t hash = hashval;
+   if (!m_split_biflow) {
+      // Hash both directions in a fixed order, so packets of a biflow share the decision. Unlike XOR,
+      // this does not cancel out for symmetric keys (same address and port in both directions).
+      uint64_t pair[2] = {std::min(hashval, hashval_inv), std::max(hashval, hashval_inv)};
+      hash = hash_bytes(pair, sizeof(pair));
+   }
+   return (hash >> 32) < SAMPLING_HASH_RANGE / m_sample_flows;
+}
+
+bool NHTFlowCache::packet_sampled(const FlowCounters &counters) const
+{
+   uint32_t packets = counters.src_packets + counters.dst_packets;
+   return packets < m_sample_after || (packets - m_sample_after) % m_sample_packets == 0;
+}
+
+bool NHTFlowCache::flow_ends(const FlowRecord *flow, const Packet &pkt, bool source_flow) const
+{
+   const FlowCounters &counters = flow->m_counters;
+   uint8_t flw_flags = source_flow ? counters.src_tcp_flags : counters.dst_tcp_flags;
+   return ((pkt.tcp_flags & 0x02) && (flw_flags & (0x01 | 0x04))) ||
+      pkt.ts.tv_sec - counters.time_last.tv_sec >= m_inactive ||
+      pkt.ts.tv_sec - counters.time_first.tv_sec >= m_active;
+}
+
+bool NHTFlowCache::export_suppressed(const Flow &flow) const
+{
+   if (m_elephant_packets == 0 && m_elephant_bytes == 0) {
+      return false;
+   }
+   if (m_elephant_packets != 0 && flow.src_packets + flow.dst_packets >= m_elephant_packets) {
+      return false;
+   }
+   if (m_elephant_bytes != 0 && flow.src_bytes + flow.dst_bytes >= m_elephant_bytes) {
+      return false;
+   }
+   return true;
+}
+
+void NHTFlowCache::add_sampling_ext(Flow &flow)
+{
+   if (m_sample_flows > 1 || m_sample_packets > 1) {
+      flow.add_extension(new RecordExtSampling(SAMPLING_HASH_RANGE / m_sample_flows - 1, m_sample_after,
+         m_sample_packets));
+   }
+}
+
+uint32_t NHTFlowCache::find_victim(uint32_t line_index, uint32_t next_line)
+{
+   if (m_policy == ReplacementPolicy::CLOCK) {
+      uint32_t &hand = m_clock_hands[line_index / m_line_size];
+      while (1) {
+         FlowRecord *flow = m_flow_table[line_index + hand];
+         uint32_t index = line_index + hand;
+         hand = (hand + 1) & (m_line_size - 1);
+         if (!flow->m_ref) {
+            return index;
+         }
+         flow->m_ref = 0;
+      }
+   } else if (m_policy == ReplacementPolicy::BYTES) {
+      // Protect heavy flows by evicting the lightest record of the probation segment
+      uint32_t victim = next_line - 1;
+      const FlowCounters *counters = &m_flow_table[victim]->m_counters;
+      uint64_t victim_bytes = counters->src_bytes + counters->dst_bytes;
+      for (uint32_t i = line_index + m_line_new_idx; i < next_line - 1; i++) {
+         counters = &m_flow_table[i]->m_counters;
+         uint64_t bytes = counters->src_bytes + counters->dst_bytes;
+         if (bytes < victim_bytes) {
+            victim = i;
+            victim_bytes = bytes;
+         }
+      }
+      return victim;
+   }
+   return next_line - 1;
+}
+
+void NHTFlowCache::pre_export(size_t index)
+{
+   wait_for_plugins(index);
+   FlowRecord *flow = m_flow_table[index];
+   if (flow->is_empty() || export_suppressed(flow->m_flow)) {
+      return;
+   }
+   if (m_plugin_workers_cnt == 0) {
+      plugins_pre_export(flow->m_flow);
+      return;
+   }
+
+   // Run pre_export on the plugin copies which processed the flow
+   uint32_t shard = m_plugin_workers.shard(flow->m_flow.flow_hash);
+   m_plugin_workers.wait(shard, m_plugin_workers.enqueue(shard, flow, PluginHook::EXPORT, nullptr));
+}
+
+int NHTFlowCache::post_create(FlowRecord *flow, const Packet &pkt)
+{
+   add_sampling_ext(flow->m_flow);
+   if (m_plugin_workers_cnt == 0) {
+      return plugins_post_create(flow->m_flow, pkt);
+   }
+
+   if (!m_plugin_workers.running()) {
+      // Plugins are added after init, start workers when the first flow is created
+      m_plugin_workers.start(m_plugin_workers_cnt, m_plugin_workers_queue, get_plugins(), get_plugin_cnt());
+   }
+   flow->m_ticket = m_plugin_workers.enqueue(m_plugin_workers.shard(flow->m_flow.flow_hash), flow,
+      PluginHook::CREATE, &pkt);
+   return 0;
+}
+
+int NHTFlowCache::update(FlowRecord *flow, Packet &pkt, bool source_flow)
+{
+   bool sampled = packet_sampled(flow->m_counters);
+   if (m_plugin_workers_cnt == 0) {
+      if (!sampled) {
+         flow->update(pkt, source_flow);
+         return 0;
+      }
+      int ret = plugins_pre_update(flow->m_flow, pkt);
+      if (ret & FLOW_FLUSH) {
+         return ret;
+      }
+      flow->update(pkt, source_flow);
+      return plugins_post_update(flow->m_flow, pkt);
+   }
+
+   /* Worker updates flow counters between pre_update and post_update, the cache updates only its
+    * own copy. Flush requests are handled by wait_for_plugins when the flow is exported or when
+    * a later packet finds the work done. */
+   flow->update_counters(pkt, source_flow);
+   flow->m_ticket = m_plugin_workers.enqueue(m_plugin_workers.shard(flow->m_flow.flow_hash), flow,
+      sampled ? PluginHook::UPDATE : PluginHook::ACCOUNT, &pkt);
+   return 0;
+}
+
 void NHTFlowCache::export_flow(size_t index)
 {
+   wait_for_plugins(index);
+   if (m_flow_table[index]->is_empty()) {
+      return;
+   }
+   if (export_suppressed(m_flow_table[index]->m_flow)) {
+      m_flow_table[index]->erase();
+#ifdef FLOW_CACHE_STATS
+      m_suppressed++;
+#endif /* FLOW_CACHE_STATS */
+      return;
+   }
    ipx_ring_push(m_export_queue, &m_flow_table[index]->m_flow);
    std::swap(m_flow_table[index], m_flow_table[m_cache_size + m_qidx]);
    m_flow_table[index]->erase();
@@ -264,16 +570,27 @@ void NHTFlowCache::export_flow(size_t index)
 
 void NHTFlowCache::finish()
 {
-   for (decltype(m_cache_size) i = 0; i < m_cache_size; i++) {
-      if (!m_flow_table[i]->is_empty()) {
-         plugins_pre_export(m_flow_table[i]->m_flow);
-         m_flow_table[i]->m_flow.end_reason = FLOW_END_FORCED;
-         export_flow(i);
+   // Flushes handled during export can defer packets which create new flows
+   do {
+      replay_deferred();
+      for (decltype(m_cache_size) i = 0; i < m_cache_size; i++) {
+         if (!m_flow_table[i]->is_empty()) {
+            pre_export(i);
+            if (m_flow_table[i]->is_empty()) {
+               continue;
+            }
+            m_flow_table[i]->m_flow.end_reason = FLOW_END_FORCED;
+            export_flow(i);
 #ifdef FLOW_CACHE_STATS
-         m_expired++;
+            m_expired++;
 #endif /* FLOW_CACHE_STATS */
+         }
       }
-   }
+   } while (!m_replay.empty());
+   m_plugin_workers.stop();
+#ifdef FLOW_CACHE_STATS
+   print_report();
+#endif /* FLOW_CACHE_STATS */
 }
 
 void NHTFlowCache::flush(Packet &pkt, size_t flow_index, int ret, bool source_flow)
@@ -285,20 +602,29 @@ void NHTFlowCache::flush(Packet &pkt, size_t flow_index, int ret, bool source_fl
    if (ret == FLOW_FLUSH_WITH_REINSERT) {
       FlowRecord *flow = m_flow_table[flow_index];
       flow->m_flow.end_reason = FLOW_END_FORCED;
-      ipx_ring_push(m_export_queue, &flow->m_flow);
-
-      std::swap(m_flow_table[flow_index], m_flow_table[m_cache_size + m_qidx]);
+      if (export_suppressed(flow->m_flow)) {
+#ifdef FLOW_CACHE_STATS
+         m_suppressed++;
+#endif /* FLOW_CACHE_STATS */
+      } else {
+         ipx_ring_push(m_export_queue, &flow->m_flow);
 
-      flow = m_flow_table[flow_index];
-      flow->m_flow.remove_extensions();
-      *flow = *m_flow_table[m_cache_size + m_qidx];
-      m_qidx = (m_qidx + 1) % m_qsize;
+         std::swap(m_flow_table[flow_index], m_flow_table[m_cache_size + m_qidx]);
 
-      flow->m_flow.m_exts = nullptr;
+         flow = m_flow_table[flow_index];
+         flow->m_flow.remove_extensions();
+         std::vector<PluginWorkItem *> deferred;
+         deferred.swap(flow->m_deferred);
+         *flow = *m_flow_table[m_cache_size + m_qidx];
+         m_qidx = (m_qidx + 1) % m_qsize;
+
+         flow->m_flow.m_exts = nullptr;
+         flow->m_deferred.swap(deferred);
+      }
       flow->reuse(); // Clean counters, set time first to last
       flow->update(pkt, source_flow); // Set new counters from packet
 
-      ret = plugins_post_create(flow->m_flow, pkt);
+      ret = post_create(flow, pkt);
       if (ret & FLOW_FLUSH) {
          flush(pkt, flow_index, ret, source_flow);
       }
@@ -310,17 +636,36 @@ void NHTFlowCache::flush(Packet &pkt, size_t flow_index, int ret, bool source_fl
 
 int NHTFlowCache::put_pkt(Packet &pkt)
 {
-   int ret = plugins_pre_create(pkt);
+   // Packets deferred by plugin workers are older than the new packet
+   replay_deferred();
 
    if (m_enable_fragmentation_cache) {
       try_to_fill_ports_to_fragmented_packet(pkt);
    }
 
    if (!create_hash_key(pkt)) { // saves key value and key length into attributes NHTFlowCache::key and NHTFlowCache::m_keylen
+      plugins_pre_create(pkt);
       return 0;
    }
 
-   uint64_t hashval = XXH64(m_key, m_keylen, 0); /* Calculates hash value from key created before. */
+   uint64_t hashval = hash_bytes(m_key, m_keylen); /* Calculates hash value from key created before. */
+   uint64_t hashval_inv = 0;
+   bool sampling = m_sample_flows > 1;
+   if (sampling && !m_split_biflow) {
+      hashval_inv = hash_bytes(m_key_inv, m_keylen);
+   }
+
+   /* Drop packets of flows not selected by flow sampling before they reach plugins or any record is touched.
+    * The decision depends only on the flow key, so sampled out flows never have a record. */
+   if (!flow_sampled(hashval, hashval_inv)) {
+#ifdef FLOW_CACHE_STATS
+      m_sampled++;
+#endif /* FLOW_CACHE_STATS */
+      export_expired(pkt.ts.tv_sec);
+      return 0;
+   }
+
+   int ret = plugins_pre_create(pkt);
 
    FlowRecord *flow; /* Pointer to flow we will be working with. */
    bool found = false;
@@ -339,7 +684,9 @@ int NHTFlowCache::put_pkt(Packet &pkt)
 
    /* Find inversed flow. */
    if (!found && !m_split_biflow) {
-      uint64_t hashval_inv = XXH64(m_key_inv, m_keylen, 0);
+      if (!sampling) {
+         hashval_inv = hash_bytes(m_key_inv, m_keylen);
+      }
       uint64_t line_index_inv = hashval_inv & m_line_mask;
       uint64_t next_line_inv = line_index_inv + m_line_size;
       for (flow_index = line_index_inv; flow_index < next_line_inv; flow_index++) {
@@ -361,16 +708,27 @@ int NHTFlowCache::put_pkt(Packet &pkt)
 #endif /* FLOW_CACHE_STATS */
 
       flow = m_flow_table[flow_index];
-      for (decltype(flow_index) j = flow_index; j > line_index; j--) {
-         m_flow_table[j] = m_flow_table[j - 1];
-      }
+      if (m_policy == ReplacementPolicy::CLOCK) {
+         flow->m_ref = 1;
+      } else {
+         for (decltype(flow_index) j = flow_index; j > line_index; j--) {
+            m_flow_table[j] = m_flow_table[j - 1];
+         }
 
-      m_flow_table[line_index] = flow;
-      flow_index = line_index;
+         m_flow_table[line_index] = flow;
+         flow_index = line_index;
+      }
 #ifdef FLOW_CACHE_STATS
       m_hits++;
 #endif /* FLOW_CACHE_STATS */
    } else {
+#ifdef FLOW_CACHE_STATS
+      if (m_ghosts[hashval & m_ghosts_mask] == hashval ||
+         (!m_split_biflow && m_ghosts[hashval_inv & m_ghosts_mask] == hashval_inv)) {
+         m_premature++;
+      }
+#endif /* FLOW_CACHE_STATS */
+
       /* Existing flow record was not found. Find free place in flow line. */
       for (flow_index = line_index; flow_index < next_line; flow_index++) {
          if (m_flow_table[flow_index]->is_empty()) {
@@ -381,17 +739,29 @@ int NHTFlowCache::put_pkt(Packet &pkt)
       if (!found) {
          /* If free place was not found (flow line is full), find
           * record which will be replaced by new record. */
-         flow_index = next_line - 1;
+         flow_index = find_victim(line_index, next_line);
 
-         // Export flow
-         plugins_pre_export(m_flow_table[flow_index]->m_flow);
-         m_flow_table[flow_index]->m_flow.end_reason = FLOW_END_NO_RES;
-         export_flow(flow_index);
+         // Export flow, unless a flush requested by plugin worker has already freed the record
+         pre_export(flow_index);
+         if (!m_flow_table[flow_index]->is_empty()) {
+            m_flow_table[flow_index]->m_flow.end_reason = FLOW_END_NO_RES;
+#ifdef FLOW_CACHE_STATS
+            uint64_t evicted_hash = m_flow_table[flow_index]->m_flow.flow_hash;
+            m_ghosts[evicted_hash & m_ghosts_mask] = evicted_hash;
+            m_evicted++;
+#endif /* FLOW_CACHE_STATS */
+            export_flow(flow_index);
 
 #ifdef FLOW_CACHE_STATS
-         m_expired++;
+            m_expired++;
 #endif /* FLOW_CACHE_STATS */
-         uint32_t flow_new_index = line_index + m_line_new_idx;
+         }
+         uint32_t flow_new_index = flow_index;
+         if (m_policy == ReplacementPolicy::LRU) {
+            flow_new_index = line_index;
+         } else if (m_policy != ReplacementPolicy::CLOCK) {
+            flow_new_index = line_index + m_line_new_idx;
+         }
          flow = m_flow_table[flow_index];
          for (decltype(flow_index) j = flow_index; j > flow_new_index; j--) {
             m_flow_table[j] = m_flow_table[j - 1];
@@ -409,7 +779,19 @@ int NHTFlowCache::put_pkt(Packet &pkt)
    pkt.source_pkt = source_flow;
    flow = m_flow_table[flow_index];
 
-   uint8_t flw_flags = source_flow ? flow->m_flow.src_tcp_flags : flow->m_flow.dst_tcp_flags;
+   /* Plugin workers are waited for only when the packet ends the flow, otherwise a flush requested
+    * by them is handled once their work is done. */
+   if (flow->m_ticket != 0 && (flow_ends(flow, pkt, source_flow) ||
+      m_plugin_workers.done(m_plugin_workers.shard(flow->m_flow.flow_hash), flow->m_ticket))) {
+      if (wait_for_plugins(flow_index, &pkt)) {
+         // Packet is replayed after packets deferred by the flush
+         replay_deferred();
+         return 0;
+      }
+      flow = m_flow_table[flow_index];
+   }
+
+   uint8_t flw_flags = source_flow ? flow->m_counters.src_tcp_flags : flow->m_counters.dst_tcp_flags;
    if ((pkt.tcp_flags & 0x02) && (flw_flags & (0x01 | 0x04))) {
       // Flows with FIN or RST TCP flags are exported when new SYN packet arrives
       m_flow_table[flow_index]->m_flow.end_reason = FLOW_END_EOF;
@@ -420,9 +802,10 @@ int NHTFlowCache::put_pkt(Packet &pkt)
 
    if (flow->is_empty()) {
       flow->create(pkt, hashval);
-      ret = plugins_post_create(flow->m_flow, pkt);
+      ret = post_create(flow, pkt);
 
       if (ret & FLOW_FLUSH) {
+         flow->m_flow.end_reason = FLOW_END_FORCED;
          export_flow(flow_index);
 #ifdef FLOW_CACHE_STATS
          m_flushed++;
@@ -430,9 +813,9 @@ int NHTFlowCache::put_pkt(Packet &pkt)
       }
    } else {
       /* Check if flow record is expired (inactive timeout). */
-      if (pkt.ts.tv_sec - flow->m_flow.time_last.tv_sec >= m_inactive) {
+      if (pkt.ts.tv_sec - flow->m_counters.time_last.tv_sec >= m_inactive) {
          m_flow_table[flow_index]->m_flow.end_reason = get_export_reason(flow->m_flow);
-         plugins_pre_export(flow->m_flow);
+         pre_export(flow_index);
          export_flow(flow_index);
    #ifdef FLOW_CACHE_STATS
          m_expired++;
@@ -441,9 +824,9 @@ int NHTFlowCache::put_pkt(Packet &pkt)
       }
 
       /* Check if flow record is expired (active timeout). */
-      if (pkt.ts.tv_sec - flow->m_flow.time_first.tv_sec >= m_active) {
+      if (pkt.ts.tv_sec - flow->m_counters.time_first.tv_sec >= m_active) {
          m_flow_table[flow_index]->m_flow.end_reason = FLOW_END_ACTIVE;
-         plugins_pre_export(flow->m_flow);
+         pre_export(flow_index);
          export_flow(flow_index);
 #ifdef FLOW_CACHE_STATS
          m_expired++;
@@ -451,18 +834,10 @@ int NHTFlowCache::put_pkt(Packet &pkt)
          return put_pkt(pkt);
       }
 
-      ret = plugins_pre_update(flow->m_flow, pkt);
+      ret = update(flow, pkt, source_flow);
       if (ret & FLOW_FLUSH) {
          flush(pkt, flow_index, ret, source_flow);
          return 0;
-      } else {
-         flow->update(pkt, source_flow);
-         ret = plugins_post_update(flow->m_flow, pkt);
-
-         if (ret & FLOW_FLUSH) {
-            flush(pkt, flow_index, ret, source_flow);
-            return 0;
-         }
       }
    }
 
@@ -488,9 +863,20 @@ uint8_t NHTFlowCache::get_export_reason(Flow &flow)
 void NHTFlowCache::export_expired(time_t ts)
 {
    for (decltype(m_timeout_idx) i = m_timeout_idx; i < m_timeout_idx + m_line_new_idx; i++) {
-      if (!m_flow_table[i]->is_empty() && ts - m_flow_table[i]->m_flow.time_last.tv_sec >= m_inactive) {
+      FlowRecord *flow = m_flow_table[i];
+      if (flow->m_ticket != 0) {
+         // Flow with pending work has just received a packet, check it again later
+         if (!m_plugin_workers.done(m_plugin_workers.shard(flow->m_flow.flow_hash), flow->m_ticket)) {
+            continue;
+         }
+         wait_for_plugins(i);
+      }
+      if (m_flow_table[i]->is_empty()) {
+         continue;
+      }
+      if (ts - m_flow_table[i]->m_counters.time_last.tv_sec >= m_inactive) {
          m_flow_table[i]->m_flow.end_reason = get_export_reason(m_flow_table[i]->m_flow);
-         plugins_pre_export(m_flow_table[i]->m_flow);
+         pre_export(i);
          export_flow(i);
 #ifdef FLOW_CACHE_STATS
          m_expired++;
@@ -501,11 +887,11 @@ void NHTFlowCache::export_expired(time_t ts)
    m_timeout_idx = (m_timeout_idx + m_line_new_idx) & (m_cache_size - 1);
 }
 
-bool NHTFlowCache::create_hash_key(Packet &pkt)
+bool create_flow_key(const Packet &pkt, char *key, char *key_inv, uint8_t &keylen)
 {
    if (pkt.ip_version == IP::v4) {
-      struct flow_key_v4_t *key_v4 = reinterpret_cast<struct flow_key_v4_t *>(m_key);
-      struct flow_key_v4_t *key_v4_inv = reinterpret_cast<struct flow_key_v4_t *>(m_key_inv);
+      struct flow_key_v4_t *key_v4 = reinterpret_cast<struct flow_key_v4_t *>(key);
+      struct flow_key_v4_t *key_v4_inv = reinterpret_cast<struct flow_key_v4_t *>(key_inv);
 
       key_v4->proto = pkt.ip_proto;
       key_v4->ip_version = IP::v4;
@@ -523,11 +909,11 @@ bool NHTFlowCache::create_hash_key(Packet &pkt)
       key_v4_inv->dst_ip = pkt.src_ip.v4;
       key_v4_inv->vlan_id = pkt.vlan_id;
 
-      m_keylen = sizeof(flow_key_v4_t);
+      keylen = sizeof(flow_key_v4_t);
       return true;
    } else if (pkt.ip_version == IP::v6) {
-      struct flow_key_v6_t *key_v6 = reinterpret_cast<struct flow_key_v6_t *>(m_key);
-      struct flow_key_v6_t *key_v6_inv = reinterpret_cast<struct flow_key_v6_t *>(m_key_inv);
+      struct flow_key_v6_t *key_v6 = reinterpret_cast<struct flow_key_v6_t *>(key);
+      struct flow_key_v6_t *key_v6_inv = reinterpret_cast<struct flow_key_v6_t *>(key_inv);
 
       key_v6->proto = pkt.ip_proto;
       key_v6->ip_version = IP::v6;
@@ -545,25 +931,34 @@ bool NHTFlowCache::create_hash_key(Packet &pkt)
       memcpy(key_v6_inv->dst_ip, pkt.src_ip.v6, sizeof(pkt.src_ip.v6));
       key_v6_inv->vlan_id = pkt.vlan_id;
 
-      m_keylen = sizeof(flow_key_v6_t);
+      keylen = sizeof(flow_key_v6_t);
       return true;
    }
 
    return false;
 }
 
+bool NHTFlowCache::create_hash_key(Packet &pkt)
+{
+   return create_flow_key(pkt, m_key, m_key_inv, m_keylen);
+}
+
 #ifdef FLOW_CACHE_STATS
 void NHTFlowCache::print_report()
 {
    float tmp = float(m_lookups) / m_hits;
 
-   cout << "Hits: " << m_hits << endl;
-   cout << "Empty: " << m_empty << endl;
-   cout << "Not empty: " << m_not_empty << endl;
-   cout << "Expired: " << m_expired << endl;
-   cout << "Flushed: " << m_flushed << endl;
-   cout << "Average Lookup:  " << tmp << endl;
-   cout << "Variance Lookup: " << float(m_lookups2) / m_hits - tmp * tmp << endl;
+   std::cout << "Hits: " << m_hits << std::endl;
+   std::cout << "Empty: " << m_empty << std::endl;
+   std::cout << "Not empty: " << m_not_empty << std::endl;
+   std::cout << "Expired: " << m_expired << std::endl;
+   std::cout << "Flushed: " << m_flushed << std::endl;
+   std::cout << "Sampled out packets: " << m_sampled << std::endl;
+   std::cout << "Suppressed: " << m_suppressed << std::endl;
+   std::cout << "Evicted: " << m_evicted << std::endl;
+   std::cout << "Premature evictions: " << m_premature << std::endl;
+   std::cout << "Average Lookup:  " << tmp << std::endl;
+   std::cout << "Variance Lookup: " << float(m_lookups2) / m_hits - tmp * tmp << std::endl;
 }
 #endif /* FLOW_CACHE_STATS */
 
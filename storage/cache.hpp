@@ -32,14 +32,19 @@
 #ifndef IPXP_STORAGE_CACHE_HPP
 #define IPXP_STORAGE_CACHE_HPP
 
+#include <deque>
 #include <string>
+#include <sstream>
 
 #include <ipfixprobe/storage.hpp>
 #include <ipfixprobe/options.hpp>
 #include <ipfixprobe/flowifc.hpp>
 #include <ipfixprobe/utils.hpp>
+#include <ipfixprobe/ipfix-elements.hpp>
+#include <ipfixprobe/byte-utils.hpp>
 
 #include "fragmentationCache/fragmentationCache.hpp"
+#include "plugin-workers.hpp"
 
 namespace ipxp {
 
@@ -87,6 +92,72 @@ static_assert(bitcount<decltype(DEFAULT_FLOW_LINE_SIZE)>(-1) > DEFAULT_FLOW_LINE
 static_assert(DEFAULT_FLOW_LINE_SIZE >= 1, "Flow cache line size must be at least 1!");
 static_assert(DEFAULT_FLOW_CACHE_SIZE >= DEFAULT_FLOW_LINE_SIZE, "Flow cache size must be at least cache line size!");
 
+/**
+ * \brief Policies used to choose a flow record evicted from a full flow line.
+ */
+enum class ReplacementPolicy : uint8_t {
+   SLRU,  /**< Hits move to the line start, new flows are inserted into the middle, the last record is evicted. */
+   LRU,   /**< Hits move to the line start, new flows are inserted at the line start, the last record is evicted. */
+   CLOCK, /**< Records stay in place, hits set a reference bit, a per-line hand evicts the first unreferenced record. */
+   BYTES  /**< As SLRU, but the record with the fewest bytes in the second half of the line is evicted. */
+};
+
+#define SAMPLING_HASH_RANGE 0x100000000ULL // Flows are selected by the upper 32 bits of the flow hash
+
+/**
+ * \brief Flow record extension describing sampling applied by the flow cache.
+ *
+ * Flow sampling is a hash-based selection (RFC 5475), a flow is kept when the upper 32 bits of
+ * the hash of its key fall into the selected range [0, hash_selected_max]. Both directions of
+ * a biflow share the hash, the whole biflow is kept or dropped. Packet counters of kept flows
+ * are exact, only plugin extensions are computed from the first sample_after packets and every
+ * sample_interval-th packet after them, which is described by CESNET elements because no standard
+ * element is scoped to data of process plugins.
+ */
+struct RecordExtSampling : public RecordExt {
+   static int REGISTERED_ID;
+
+   uint64_t hash_selected_max;
+   uint32_t sample_after;
+   uint32_t sample_interval;
+
+   RecordExtSampling(uint64_t selected_max, uint32_t after, uint32_t interval) : RecordExt(REGISTERED_ID),
+      hash_selected_max(selected_max), sample_after(after), sample_interval(interval)
+   {
+   }
+
+   int fill_ipfix(uint8_t *buffer, int size)
+   {
+      if (size < 40) {
+         return -1;
+      }
+      *reinterpret_cast<uint64_t *>(buffer) = 0;
+      *reinterpret_cast<uint64_t *>(buffer + 8) = swap_uint64(SAMPLING_HASH_RANGE - 1);
+      *reinterpret_cast<uint64_t *>(buffer + 16) = 0;
+      *reinterpret_cast<uint64_t *>(buffer + 24) = swap_uint64(hash_selected_max);
+      *reinterpret_cast<uint32_t *>(buffer + 32) = htonl(sample_after);
+      *reinterpret_cast<uint32_t *>(buffer + 36) = htonl(sample_interval);
+      return 40;
+   }
+
+   const char **get_ipfix_tmplt() const
+   {
+      static const char *ipfix_template[] = {
+         IPFIX_SAMPLING_TEMPLATE(IPFIX_FIELD_NAMES)
+         nullptr
+      };
+      return ipfix_template;
+   }
+
+   std::string get_text() const
+   {
+      std::ostringstream out;
+      out << "hashselectedmax=" << hash_selected_max << ",pluginsampleafter=" << sample_after
+          << ",pluginsampleinterval=" << sample_interval;
+      return out.str();
+   }
+};
+
 class CacheOptParser : public OptionsParser
 {
 public:
@@ -98,12 +169,22 @@ public:
    bool m_enable_fragmentation_cache;
    std::size_t m_frag_cache_size;
    time_t m_frag_cache_timeout;
+   uint32_t m_plugin_workers;
+   uint32_t m_plugin_workers_queue;
+   uint32_t m_sample_flows;
+   uint32_t m_sample_after;
+   uint32_t m_sample_packets;
+   uint64_t m_elephant_packets;
+   uint64_t m_elephant_bytes;
+   ReplacementPolicy m_policy;
 
    CacheOptParser() : OptionsParser("cache", "Storage plugin implemented as a hash table"),
       m_cache_size(1 << DEFAULT_FLOW_CACHE_SIZE), m_line_size(1 << DEFAULT_FLOW_LINE_SIZE),
       m_active(DEFAULT_ACTIVE_TIMEOUT), m_inactive(DEFAULT_INACTIVE_TIMEOUT), m_split_biflow(false),
       m_enable_fragmentation_cache(true), m_frag_cache_size(10007), // Prime for better distribution in hash table
-      m_frag_cache_timeout(3)
+      m_frag_cache_timeout(3), m_plugin_workers(0), m_plugin_workers_queue(DEFAULT_PLUGIN_WORKER_QUEUE),
+      m_sample_flows(1), m_sample_after(0), m_sample_packets(1), m_elephant_packets(0), m_elephant_bytes(0),
+      m_policy(ReplacementPolicy::SLRU)
    {
       register_option("s", "size", "EXPONENT", "Cache size exponent to the power of two",
          [this](const char *arg){try {unsigned exp = str2num<decltype(exp)>(arg);
@@ -155,15 +236,107 @@ public:
          }
          return true;
       });
+      register_option("w", "workers", "NUM", "Number of threads running process plugins asynchronously. Default value is 0 (plugins run in the cache thread).", [this](const char *arg) {
+         try {
+            m_plugin_workers = str2num<decltype(m_plugin_workers)>(arg);
+         } catch(std::invalid_argument &e) {
+            return false;
+         }
+         return true;
+      }, OptionFlags::RequiredArgument);
+      register_option("wq", "workers-queue", "SIZE", "Size of queue of each plugin worker. Default value is 1024.", [this](const char *arg) {
+         try {
+            m_plugin_workers_queue = str2num<decltype(m_plugin_workers_queue)>(arg);
+         } catch(std::invalid_argument &e) {
+            return false;
+         }
+         return m_plugin_workers_queue > 0;
+      }, OptionFlags::RequiredArgument);
+      register_option("sf", "sample-flows", "NUM", "Keep only 1 out of NUM flows selected by hash of the flow key, other packets are dropped before reaching process plugins. Default value is 1 (no sampling).", [this](const char *arg) {
+         try {
+            m_sample_flows = str2num<decltype(m_sample_flows)>(arg);
+         } catch(std::invalid_argument &e) {
+            return false;
+         }
+         return m_sample_flows > 0;
+      }, OptionFlags::RequiredArgument);
+      register_option("sa", "sample-after", "NUM", "Start packet sampling after first NUM packets of a flow. Default value is 0.", [this](const char *arg) {
+         try {
+            m_sample_after = str2num<decltype(m_sample_after)>(arg);
+         } catch(std::invalid_argument &e) {
+            return false;
+         }
+         return true;
+      }, OptionFlags::RequiredArgument);
+      register_option("sp", "sample-packets", "NUM", "Pass only every NUM-th packet of a flow to process plugins, flow counters are updated by all packets. Default value is 1 (no sampling).", [this](const char *arg) {
+         try {
+            m_sample_packets = str2num<decltype(m_sample_packets)>(arg);
+         } catch(std::invalid_argument &e) {
+            return false;
+         }
+         return m_sample_packets > 0;
+      }, OptionFlags::RequiredArgument);
+      register_option("ep", "elephant-packets", "NUM", "Export only flows with at least NUM packets (or reaching elephant-bytes).", [this](const char *arg) {
+         try {
+            m_elephant_packets = str2num<decltype(m_elephant_packets)>(arg);
+         } catch(std::invalid_argument &e) {
+            return false;
+         }
+         return true;
+      }, OptionFlags::RequiredArgument);
+      register_option("eb", "elephant-bytes", "NUM", "Export only flows with at least NUM bytes (or reaching elephant-packets).", [this](const char *arg) {
+         try {
+            m_elephant_bytes = str2num<decltype(m_elephant_bytes)>(arg);
+         } catch(std::invalid_argument &e) {
+            return false;
+         }
+         return true;
+      }, OptionFlags::RequiredArgument);
+      register_option("r", "replacement", "slru|lru|clock|bytes", "Policy used to replace records in a full cache line. Default value is slru.", [this](const char *arg) {
+         if (strcmp(arg, "slru") == 0) {
+            m_policy = ReplacementPolicy::SLRU;
+         } else if (strcmp(arg, "lru") == 0) {
+            m_policy = ReplacementPolicy::LRU;
+         } else if (strcmp(arg, "clock") == 0) {
+            m_policy = ReplacementPolicy::CLOCK;
+         } else if (strcmp(arg, "bytes") == 0) {
+            m_policy = ReplacementPolicy::BYTES;
+         } else {
+            return false;
+         }
+         return true;
+      }, OptionFlags::RequiredArgument);
    }
 };
 
+/**
+ * \brief Flow counters used by the flow cache for timeouts, replacement and sampling decisions.
+ *
+ * Counters of Flow are updated by plugin workers when they are enabled. The cache keeps its own
+ * copy updated synchronously, so it does not wait for plugin workers to process every packet.
+ */
+struct FlowCounters {
+   struct timeval time_first;
+   struct timeval time_last;
+   uint64_t src_bytes;
+   uint64_t dst_bytes;
+   uint32_t src_packets;
+   uint32_t dst_packets;
+   uint8_t src_tcp_flags;
+   uint8_t dst_tcp_flags;
+};
+
 class FlowRecord
 {
    uint64_t m_hash;
 
 public:
    Flow m_flow;
+   FlowCounters m_counters; /**< Counters owned by the flow cache thread. */
+   uint64_t m_ticket; /**< Ticket of the last work item handed to plugin workers, 0 when none. */
+   std::vector<PluginWorkItem *> m_deferred; /**< Packets of the flow received by plugin worker after it requested a flush. */
+   uint8_t m_flush; /**< Flush requested by plugin running in plugin worker, valid after m_ticket is done. */
+   uint8_t m_ref; /**< Reference bit used by CLOCK replacement policy. */
 
    FlowRecord();
    ~FlowRecord();
@@ -171,12 +344,30 @@ public:
    void erase();
    void reuse();
 
-   inline bool is_empty() const;
-   inline bool belongs(uint64_t pkt_hash) const;
+   inline __attribute__((always_inline)) bool is_empty() const
+   {
+      return m_hash == 0;
+   }
+   inline __attribute__((always_inline)) bool belongs(uint64_t pkt_hash) const
+   {
+      return pkt_hash == m_hash;
+   }
    void create(const Packet &pkt, uint64_t pkt_hash);
    void update(const Packet &pkt, bool src);
+   void update_counters(const Packet &pkt, bool src);
+   void update_flow(const Packet &pkt, bool src);
 };
 
+/**
+ * \brief Fill flow key of the packet and flow key of the opposite direction.
+ * \param [in] pkt Parsed packet.
+ * \param [out] key Buffer of MAX_KEY_LENGTH bytes for key.
+ * \param [out] key_inv Buffer of MAX_KEY_LENGTH bytes for inversed key.
+ * \param [out] keylen Length of both keys.
+ * \return False when packet is neither IPv4 nor IPv6.
+ */
+bool create_flow_key(const Packet &pkt, char *key, char *key_inv, uint8_t &keylen);
+
 class NHTFlowCache : public StoragePlugin
 {
 public:
@@ -207,6 +398,12 @@ private:
    uint64_t m_flushed;
    uint64_t m_lookups;
    uint64_t m_lookups2;
+   uint64_t m_sampled;
+   uint64_t m_suppressed;
+   uint64_t m_evicted; /**< Records exported because the flow line was full. */
+   uint64_t m_premature; /**< Evicted flows which came back while still remembered in m_ghosts. */
+   uint64_t *m_ghosts; /**< Hashes of recently evicted flows. */
+   uint32_t m_ghosts_mask;
 #endif /* FLOW_CACHE_STATS */
    uint32_t m_active;
    uint32_t m_inactive;
@@ -220,9 +417,36 @@ private:
 
    FragmentationCache m_fragmentation_cache;
 
+   uint32_t m_plugin_workers_cnt;
+   uint32_t m_plugin_workers_queue;
+   PluginWorkers m_plugin_workers;
+
+   uint32_t m_sample_flows;
+   uint32_t m_sample_after;
+   uint32_t m_sample_packets;
+   uint64_t m_elephant_packets;
+   uint64_t m_elephant_bytes;
+
+   ReplacementPolicy m_policy;
+   uint32_t *m_clock_hands; /**< Position of CLOCK hand in each flow line. */
+
+   std::deque<PluginWorkItem *> m_replay; /**< Packets deferred by flushes requested in plugin workers. */
+   bool m_replaying;
+
    void try_to_fill_ports_to_fragmented_packet(Packet& packet);
    void flush(Packet &pkt, size_t flow_index, int ret, bool source_flow);
    bool create_hash_key(Packet &pkt);
+   bool flow_sampled(uint64_t hashval, uint64_t hashval_inv) const;
+   bool packet_sampled(const FlowCounters &counters) const;
+   bool flow_ends(const FlowRecord *flow, const Packet &pkt, bool source_flow) const;
+   bool export_suppressed(const Flow &flow) const;
+   void add_sampling_ext(Flow &flow);
+   uint32_t find_victim(uint32_t line_index, uint32_t next_line);
+   int post_create(FlowRecord *flow, const Packet &pkt);
+   int update(FlowRecord *flow, Packet &pkt, bool source_flow);
+   bool wait_for_plugins(size_t index, const Packet *pkt = nullptr);
+   void replay_deferred();
+   void pre_export(size_t index);
    void export_flow(size_t index);
    static uint8_t get_export_reason(Flow &flow);
    void finish();
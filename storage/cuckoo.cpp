@@ -0,0 +1,510 @@
+/**
+ * \file cuckoo.cpp
+ * \brief Flow cache implemented as a bucketized cuckoo hash table
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+
+#include <cstring>
+#include <sys/time.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <ipfixprobe/ring.h>
+#include "cuckoo.hpp"
+#include <ipfixprobe/hash.hpp>
+
+namespace ipxp {
+
+__attribute__((constructor)) static void register_this_plugin()
+{
+   static PluginRecord rec = PluginRecord("cuckoo", [](){return new CuckooFlowCache();});
+   register_plugin(&rec);
+}
+
+static uint8_t get_export_reason(const Flow &flow)
+{
+   if ((flow.src_tcp_flags | flow.dst_tcp_flags) & (0x01 | 0x04)) {
+      // When FIN or RST is set, TCP connection ended naturally
+      return FLOW_END_EOF;
+   } else {
+      return FLOW_END_INACTIVE;
+   }
+}
+
+CuckooFlowCache::CuckooFlowCache() :
+   m_cache_size(0), m_bucket_mask(0), m_stash_bucket(0), m_stash_cnt(0), m_qsize(0), m_qidx(0), m_timeout_idx(0), m_active(0),
+   m_inactive(0), m_split_biflow(false), m_enable_fragmentation_cache(true), m_keylen(0),
+   m_key(), m_key_inv(), m_rand(0x9e3779b97f4a7c15ULL), m_tags(nullptr), m_flow_table(nullptr),
+   m_flow_records(nullptr), m_path(), m_fragmentation_cache(0, 0)
+{
+}
+
+CuckooFlowCache::~CuckooFlowCache()
+{
+   close();
+}
+
+void CuckooFlowCache::init(const char *params)
+{
+   CuckooOptParser parser;
+   try {
+      parser.parse(params);
+   } catch (ParserError &e) {
+      throw PluginError(e.what());
+   }
+
+   m_cache_size = parser.m_cache_size;
+   m_bucket_mask = m_cache_size / CUCKOO_BUCKET_SIZE - 1;
+   m_stash_bucket = m_cache_size / CUCKOO_BUCKET_SIZE;
+   m_stash_cnt = 0;
+   m_active = parser.m_active;
+   m_inactive = parser.m_inactive;
+   m_split_biflow = parser.m_split_biflow;
+   m_enable_fragmentation_cache = parser.m_enable_fragmentation_cache;
+   m_qidx = 0;
+   m_timeout_idx = 0;
+
+   if (m_export_queue == nullptr) {
+      throw PluginError("output queue must be set before init");
+   }
+
+   try {
+      m_tags = new uint16_t[m_cache_size + CUCKOO_STASH_SIZE]();
+      m_flow_table = new FlowRecord*[m_cache_size + CUCKOO_STASH_SIZE + m_qsize];
+      m_flow_records = new FlowRecord[m_cache_size + CUCKOO_STASH_SIZE + m_qsize];
+      for (decltype(m_cache_size + m_qsize) i = 0; i < m_cache_size + CUCKOO_STASH_SIZE + m_qsize; i++) {
+         m_flow_table[i] = m_flow_records + i;
+      }
+   } catch (std::bad_alloc &e) {
+      throw PluginError("not enough memory for flow cache allocation");
+   }
+
+   if (m_enable_fragmentation_cache) {
+      try {
+         m_fragmentation_cache = FragmentationCache(parser.m_frag_cache_size, parser.m_frag_cache_timeout);
+      } catch (std::bad_alloc &e) {
+         throw PluginError("not enough memory for fragment cache allocation");
+      }
+   }
+
+#ifdef FLOW_CACHE_STATS
+   m_hits = 0;
+   m_kicks = 0;
+   m_stashed = 0;
+   m_evicted = 0;
+   m_flushed = 0;
+#endif /* FLOW_CACHE_STATS */
+}
+
+void CuckooFlowCache::close()
+{
+   if (m_flow_records != nullptr) {
+      delete [] m_flow_records;
+      m_flow_records = nullptr;
+   }
+   if (m_flow_table != nullptr) {
+      delete [] m_flow_table;
+      m_flow_table = nullptr;
+   }
+   if (m_tags != nullptr) {
+      delete [] m_tags;
+      m_tags = nullptr;
+   }
+}
+
+void CuckooFlowCache::set_queue(ipx_ring_t *queue)
+{
+   m_export_queue = queue;
+   m_qsize = ipx_ring_size(queue);
+}
+
+inline uint16_t CuckooFlowCache::get_tag(uint64_t hash)
+{
+   uint16_t tag = hash >> 16;
+   return tag != 0 ? tag : 1;
+}
+
+inline uint32_t CuckooFlowCache::get_bucket(uint64_t hash) const
+{
+   return hash & m_bucket_mask;
+}
+
+inline uint32_t CuckooFlowCache::get_alt_bucket(uint64_t hash, uint32_t bucket) const
+{
+   // Xor with odd value gives distinct bucket and is its own inverse
+   return (bucket ^ ((hash >> 32) | 1)) & m_bucket_mask;
+}
+
+/**
+ * \brief Get slots of bucket with given tag.
+ * \return Bit mask with bit 2*i set when slot i matches.
+ */
+inline uint32_t CuckooFlowCache::match(uint32_t bucket, uint16_t tag) const
+{
+   const uint16_t *tags = m_tags + bucket * CUCKOO_BUCKET_SIZE;
+#ifdef __SSE2__
+   __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tags));
+   __m128i cmp = _mm_cmpeq_epi16(v, _mm_set1_epi16(static_cast<short>(tag)));
+   return static_cast<uint32_t>(_mm_movemask_epi8(cmp)) & 0x5555;
+#else
+   uint32_t mask = 0;
+   for (uint32_t i = 0; i < CUCKOO_BUCKET_SIZE; i++) {
+      if (tags[i] == tag) {
+         mask |= 1 << (2 * i);
+      }
+   }
+   return mask;
+#endif
+}
+
+bool CuckooFlowCache::find(uint64_t hash, uint32_t &index) const
+{
+   uint16_t tag = get_tag(hash);
+   uint32_t bucket = get_bucket(hash);
+
+   for (int i = 0; i < 2; i++) {
+      uint32_t mask = match(bucket, tag);
+      while (mask) {
+         uint32_t idx = bucket * CUCKOO_BUCKET_SIZE + (__builtin_ctz(mask) >> 1);
+         if (m_flow_table[idx]->belongs(hash)) {
+            index = idx;
+            return true;
+         }
+         mask &= mask - 1;
+      }
+      bucket = get_alt_bucket(hash, bucket);
+   }
+
+   if (m_stash_cnt != 0) {
+      uint32_t mask = match(m_stash_bucket, tag);
+      while (mask) {
+         uint32_t idx = m_stash_bucket * CUCKOO_BUCKET_SIZE + (__builtin_ctz(mask) >> 1);
+         if (m_flow_table[idx]->belongs(hash)) {
+            index = idx;
+            return true;
+         }
+         mask &= mask - 1;
+      }
+   }
+   return false;
+}
+
+/**
+ * \brief Search for a path of records which can be moved to their alternate buckets and free a slot.
+ * \param [in] bucket Full bucket where the slot is needed.
+ * \param [out] index Freed slot in bucket.
+ * \return True when slot was freed.
+ */
+bool CuckooFlowCache::displace(uint32_t bucket, uint32_t &index)
+{
+   uint32_t cur = bucket;
+
+   for (uint32_t k = 0; k < CUCKOO_MAX_KICKS; k++) {
+      m_rand ^= m_rand << 13;
+      m_rand ^= m_rand >> 7;
+      m_rand ^= m_rand << 17;
+
+      // Pick a slot which is not on the path yet, so records are moved only once
+      uint32_t slot = 0;
+      uint32_t start = (m_rand >> 32) % CUCKOO_BUCKET_SIZE;
+      uint32_t tries;
+      for (tries = 0; tries < CUCKOO_BUCKET_SIZE; tries++) {
+         slot = cur * CUCKOO_BUCKET_SIZE + (start + tries) % CUCKOO_BUCKET_SIZE;
+         uint32_t j;
+         for (j = 0; j < k && m_path[j] != slot; j++) {
+         }
+         if (j == k) {
+            break;
+         }
+      }
+      if (tries == CUCKOO_BUCKET_SIZE) {
+         return false;
+      }
+      m_path[k] = slot;
+
+      uint32_t alt = get_alt_bucket(m_flow_table[slot]->m_flow.flow_hash, cur);
+      uint32_t mask = match(alt, 0);
+      if (mask) {
+         // Move records along the path, the empty record ends up in the first slot of the path
+         uint32_t free = alt * CUCKOO_BUCKET_SIZE + (__builtin_ctz(mask) >> 1);
+         for (uint32_t j = k + 1; j-- > 0;) {
+            std::swap(m_flow_table[free], m_flow_table[m_path[j]]);
+            m_tags[free] = m_tags[m_path[j]];
+            m_tags[m_path[j]] = 0;
+            free = m_path[j];
+         }
+#ifdef FLOW_CACHE_STATS
+         m_kicks += k + 1;
+#endif /* FLOW_CACHE_STATS */
+         index = m_path[0];
+         return true;
+      }
+      cur = alt;
+   }
+   return false;
+}
+
+/**
+ * \brief Reserve slot for new flow.
+ * \return Index of slot with empty record.
+ */
+uint32_t CuckooFlowCache::insert(uint64_t hash)
+{
+   uint16_t tag = get_tag(hash);
+   uint32_t buckets[2] = {get_bucket(hash), get_alt_bucket(hash, get_bucket(hash))};
+   uint32_t index;
+
+   for (int i = 0; i < 2; i++) {
+      uint32_t mask = match(buckets[i], 0);
+      if (mask) {
+         index = buckets[i] * CUCKOO_BUCKET_SIZE + (__builtin_ctz(mask) >> 1);
+         m_tags[index] = tag;
+         return index;
+      }
+   }
+
+   if (displace(buckets[m_rand & 1], index)) {
+      m_tags[index] = tag;
+      return index;
+   }
+
+   uint32_t mask = match(m_stash_bucket, 0);
+   if (mask) {
+      index = m_stash_bucket * CUCKOO_BUCKET_SIZE + (__builtin_ctz(mask) >> 1);
+      m_tags[index] = tag;
+      m_stash_cnt++;
+#ifdef FLOW_CACHE_STATS
+      m_stashed++;
+#endif /* FLOW_CACHE_STATS */
+      return index;
+   }
+
+   // No free slot found, export least recently updated record of both buckets
+   index = buckets[0] * CUCKOO_BUCKET_SIZE;
+   for (int i = 0; i < 2; i++) {
+      for (uint32_t j = buckets[i] * CUCKOO_BUCKET_SIZE; j < (buckets[i] + 1) * CUCKOO_BUCKET_SIZE; j++) {
+         if (timercmp(&m_flow_table[j]->m_flow.time_last, &m_flow_table[index]->m_flow.time_last, <)) {
+            index = j;
+         }
+      }
+   }
+   plugins_pre_export(m_flow_table[index]->m_flow);
+   m_flow_table[index]->m_flow.end_reason = FLOW_END_NO_RES;
+   export_flow(index);
+#ifdef FLOW_CACHE_STATS
+   m_evicted++;
+#endif /* FLOW_CACHE_STATS */
+
+   m_tags[index] = tag;
+   return index;
+}
+
+void CuckooFlowCache::export_flow(size_t index)
+{
+   ipx_ring_push(m_export_queue, &m_flow_table[index]->m_flow);
+   std::swap(m_flow_table[index], m_flow_table[m_cache_size + CUCKOO_STASH_SIZE + m_qidx]);
+   m_flow_table[index]->erase();
+   if (index >= m_cache_size) {
+      m_stash_cnt--;
+   }
+   m_tags[index] = 0;
+   m_qidx = (m_qidx + 1) % m_qsize;
+}
+
+void CuckooFlowCache::finish()
+{
+   for (decltype(m_cache_size) i = 0; i < m_cache_size + CUCKOO_STASH_SIZE; i++) {
+      if (!m_flow_table[i]->is_empty()) {
+         plugins_pre_export(m_flow_table[i]->m_flow);
+         m_flow_table[i]->m_flow.end_reason = FLOW_END_FORCED;
+         export_flow(i);
+      }
+   }
+#ifdef FLOW_CACHE_STATS
+   print_report();
+#endif /* FLOW_CACHE_STATS */
+}
+
+void CuckooFlowCache::flush(Packet &pkt, size_t flow_index, int ret, bool source_flow)
+{
+#ifdef FLOW_CACHE_STATS
+   m_flushed++;
+#endif /* FLOW_CACHE_STATS */
+
+   if (ret == FLOW_FLUSH_WITH_REINSERT) {
+      FlowRecord *flow = m_flow_table[flow_index];
+      flow->m_flow.end_reason = FLOW_END_FORCED;
+      ipx_ring_push(m_export_queue, &flow->m_flow);
+
+      std::swap(m_flow_table[flow_index], m_flow_table[m_cache_size + CUCKOO_STASH_SIZE + m_qidx]);
+
+      flow = m_flow_table[flow_index];
+      flow->m_flow.remove_extensions();
+      *flow = *m_flow_table[m_cache_size + CUCKOO_STASH_SIZE + m_qidx];
+      m_qidx = (m_qidx + 1) % m_qsize;
+
+      flow->m_flow.m_exts = nullptr;
+      flow->reuse(); // Clean counters, set time first to last
+      flow->update(pkt, source_flow); // Set new counters from packet
+
+      ret = plugins_post_create(flow->m_flow, pkt);
+      if (ret & FLOW_FLUSH) {
+         flush(pkt, flow_index, ret, source_flow);
+      }
+   } else {
+      m_flow_table[flow_index]->m_flow.end_reason = FLOW_END_FORCED;
+      export_flow(flow_index);
+   }
+}
+
+int CuckooFlowCache::put_pkt(Packet &pkt)
+{
+   if (m_enable_fragmentation_cache) {
+      m_fragmentation_cache.process_packet(pkt);
+   }
+
+   if (!create_flow_key(pkt, m_key, m_key_inv, m_keylen)) {
+      plugins_pre_create(pkt);
+      return 0;
+   }
+
+   int ret = plugins_pre_create(pkt);
+
+   uint64_t hashval = hash_bytes(m_key, m_keylen);
+   uint32_t flow_index = 0;
+   bool source_flow = true;
+
+   if (!find(hashval, flow_index)) {
+      uint64_t hashval_inv = 0;
+      if (!m_split_biflow) {
+         hashval_inv = hash_bytes(m_key_inv, m_keylen);
+      }
+      if (!m_split_biflow && find(hashval_inv, flow_index)) {
+         source_flow = false;
+         hashval = hashval_inv;
+      } else {
+         flow_index = insert(hashval);
+      }
+   }
+#ifdef FLOW_CACHE_STATS
+   if (!m_flow_table[flow_index]->is_empty()) {
+      m_hits++;
+   }
+#endif /* FLOW_CACHE_STATS */
+
+   pkt.source_pkt = source_flow;
+   FlowRecord *flow = m_flow_table[flow_index];
+
+   uint8_t flw_flags = source_flow ? flow->m_flow.src_tcp_flags : flow->m_flow.dst_tcp_flags;
+   if ((pkt.tcp_flags & 0x02) && (flw_flags & (0x01 | 0x04))) {
+      // Flows with FIN or RST TCP flags are exported when new SYN packet arrives
+      flow->m_flow.end_reason = FLOW_END_EOF;
+      export_flow(flow_index);
+      put_pkt(pkt);
+      return 0;
+   }
+
+   if (flow->is_empty()) {
+      flow->create(pkt, hashval);
+      ret = plugins_post_create(flow->m_flow, pkt);
+
+      if (ret & FLOW_FLUSH) {
+         flow->m_flow.end_reason = FLOW_END_FORCED;
+         export_flow(flow_index);
+#ifdef FLOW_CACHE_STATS
+         m_flushed++;
+#endif /* FLOW_CACHE_STATS */
+      }
+   } else {
+      /* Check if flow record is expired (inactive timeout). */
+      if (pkt.ts.tv_sec - flow->m_flow.time_last.tv_sec >= m_inactive) {
+         flow->m_flow.end_reason = get_export_reason(flow->m_flow);
+         plugins_pre_export(flow->m_flow);
+         export_flow(flow_index);
+         return put_pkt(pkt);
+      }
+
+      /* Check if flow record is expired (active timeout). */
+      if (pkt.ts.tv_sec - flow->m_flow.time_first.tv_sec >= m_active) {
+         flow->m_flow.end_reason = FLOW_END_ACTIVE;
+         plugins_pre_export(flow->m_flow);
+         export_flow(flow_index);
+         return put_pkt(pkt);
+      }
+
+      ret = plugins_pre_update(flow->m_flow, pkt);
+      if (ret & FLOW_FLUSH) {
+         flush(pkt, flow_index, ret, source_flow);
+         return 0;
+      }
+
+      flow->update(pkt, source_flow);
+
+      ret = plugins_post_update(flow->m_flow, pkt);
+      if (ret & FLOW_FLUSH) {
+         flush(pkt, flow_index, ret, source_flow);
+         return 0;
+      }
+   }
+
+   export_expired(pkt.ts.tv_sec);
+   return 0;
+}
+
+void CuckooFlowCache::export_expired(time_t ts)
+{
+   for (decltype(m_timeout_idx) i = m_timeout_idx; i < m_timeout_idx + CUCKOO_BUCKET_SIZE; i++) {
+      if (!m_flow_table[i]->is_empty() && ts - m_flow_table[i]->m_flow.time_last.tv_sec >= m_inactive) {
+         m_flow_table[i]->m_flow.end_reason = get_export_reason(m_flow_table[i]->m_flow);
+         plugins_pre_export(m_flow_table[i]->m_flow);
+         export_flow(i);
+      }
+   }
+
+   m_timeout_idx = (m_timeout_idx + CUCKOO_BUCKET_SIZE) & (m_cache_size - 1);
+
+   // Stash is small, check it with every bucket
+   for (uint32_t i = m_cache_size; m_stash_cnt != 0 && i < m_cache_size + CUCKOO_STASH_SIZE; i++) {
+      if (!m_flow_table[i]->is_empty() && ts - m_flow_table[i]->m_flow.time_last.tv_sec >= m_inactive) {
+         m_flow_table[i]->m_flow.end_reason = get_export_reason(m_flow_table[i]->m_flow);
+         plugins_pre_export(m_flow_table[i]->m_flow);
+         export_flow(i);
+      }
+   }
+}
+
+#ifdef FLOW_CACHE_STATS
+void CuckooFlowCache::print_report()
+{
+   std::cout << "Hits: " << m_hits << std::endl;
+   std::cout << "Kicks: " << m_kicks << std::endl;
+   std::cout << "Stashed: " << m_stashed << std::endl;
+   std::cout << "Evicted: " << m_evicted << std::endl;
+   std::cout << "Flushed: " << m_flushed << std::endl;
+}
+#endif /* FLOW_CACHE_STATS */
+
+}
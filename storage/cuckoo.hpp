@@ -0,0 +1,189 @@
+/**
+ * \file cuckoo.hpp
+ * \brief Flow cache implemented as a bucketized cuckoo hash table
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+#ifndef IPXP_STORAGE_CUCKOO_HPP
+#define IPXP_STORAGE_CUCKOO_HPP
+
+#include <string>
+
+#include <ipfixprobe/storage.hpp>
+#include <ipfixprobe/options.hpp>
+#include <ipfixprobe/flowifc.hpp>
+#include <ipfixprobe/utils.hpp>
+
+#include "cache.hpp"
+#include "fragmentationCache/fragmentationCache.hpp"
+
+namespace ipxp {
+
+/**
+ * \brief Number of slots in a bucket, tags of a bucket are compared by a single SIMD instruction.
+ */
+static const uint32_t CUCKOO_BUCKET_SIZE = 8;
+
+/**
+ * \brief Maximal length of a displacement path searched when both candidate buckets are full.
+ */
+static const uint32_t CUCKOO_MAX_KICKS = 64;
+
+/**
+ * \brief Number of stash slots for flows without a displacement path, the stash is matched as one more bucket.
+ */
+static const uint32_t CUCKOO_STASH_SIZE = CUCKOO_BUCKET_SIZE;
+
+class CuckooOptParser : public OptionsParser
+{
+public:
+   uint32_t m_cache_size;
+   uint32_t m_active;
+   uint32_t m_inactive;
+   bool m_split_biflow;
+   bool m_enable_fragmentation_cache;
+   std::size_t m_frag_cache_size;
+   time_t m_frag_cache_timeout;
+
+   CuckooOptParser() : OptionsParser("cuckoo", "Storage plugin implemented as a bucketized cuckoo hash table"),
+      m_cache_size(1 << DEFAULT_FLOW_CACHE_SIZE), m_active(DEFAULT_ACTIVE_TIMEOUT),
+      m_inactive(DEFAULT_INACTIVE_TIMEOUT), m_split_biflow(false), m_enable_fragmentation_cache(true),
+      m_frag_cache_size(10007), m_frag_cache_timeout(3)
+   {
+      register_option("s", "size", "EXPONENT", "Cache size exponent to the power of two",
+         [this](const char *arg){try {unsigned exp = str2num<decltype(exp)>(arg);
+               if (exp < 4 || exp > 30) {
+                  throw PluginError("Flow cache size must be between 4 and 30");
+               }
+               m_cache_size = static_cast<uint32_t>(1) << exp;
+            } catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
+      register_option("a", "active", "TIME", "Active timeout in seconds",
+         [this](const char *arg){try {m_active = str2num<decltype(m_active)>(arg);} catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
+      register_option("i", "inactive", "TIME", "Inactive timeout in seconds",
+         [this](const char *arg){try {m_inactive = str2num<decltype(m_inactive)>(arg);} catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
+      register_option("S", "split", "", "Split biflows into uniflows",
+         [this](const char *arg){ m_split_biflow = true; return true;}, OptionFlags::NoArgument);
+      register_option("fe", "frag-enable", "true|false", "Enable/disable fragmentation cache. Enabled (true) by default.",
+         [this](const char *arg){
+            if (strcmp(arg, "true") == 0) {
+               m_enable_fragmentation_cache = true;
+            } else if (strcmp(arg, "false") == 0) {
+               m_enable_fragmentation_cache = false;
+            } else {
+               return false;
+            }
+            return true;
+         }, OptionFlags::RequiredArgument);
+      register_option("fs", "frag-size", "size", "Size of fragmentation cache, must be at least 1. Default value is 10007.", [this](const char *arg) {
+         try {
+            m_frag_cache_size = str2num<decltype(m_frag_cache_size)>(arg);
+         } catch(std::invalid_argument &e) {
+            return false;
+         }
+         return m_frag_cache_size > 0;
+      });
+      register_option("ft", "frag-timeout", "TIME", "Timeout of fragments in fragmentation cache in seconds. Default value is 3.", [this](const char *arg) {
+         try {
+            m_frag_cache_timeout = str2num<decltype(m_frag_cache_timeout)>(arg);
+         } catch(std::invalid_argument &e) {
+            return false;
+         }
+         return true;
+      });
+   }
+};
+
+/**
+ * \brief Flow cache storing records in a bucketized cuckoo hash table.
+ *
+ * Every flow can be stored in one of two buckets of CUCKOO_BUCKET_SIZE slots. Each slot has a 16 bit tag
+ * derived from the flow hash, so a lookup compares tags of a bucket at once and touches only records with
+ * matching tag. Records are never moved on hits. When both buckets of a new flow are full, records are
+ * displaced to their alternate buckets. A flow without displacement path is stored in a small stash, which
+ * is searched only when it is not empty. The least recently updated record of the two buckets is exported
+ * only when the stash is full too. This keeps the table usable at load factors above 90%.
+ */
+class CuckooFlowCache : public StoragePlugin
+{
+public:
+   CuckooFlowCache();
+   ~CuckooFlowCache();
+   void init(const char *params);
+   void close();
+   void set_queue(ipx_ring_t *queue);
+   OptionsParser *get_parser() const { return new CuckooOptParser(); }
+   std::string get_name() const { return "cuckoo"; }
+
+   int put_pkt(Packet &pkt);
+   void export_expired(time_t ts);
+   void finish();
+
+private:
+   uint32_t m_cache_size;
+   uint32_t m_bucket_mask;
+   uint32_t m_stash_bucket; /**< Index of the stash, it follows the last bucket of the table. */
+   uint32_t m_stash_cnt; /**< Number of flows in the stash. */
+   uint32_t m_qsize;
+   uint32_t m_qidx;
+   uint32_t m_timeout_idx;
+   uint32_t m_active;
+   uint32_t m_inactive;
+   bool m_split_biflow;
+   bool m_enable_fragmentation_cache;
+   uint8_t m_keylen;
+   char m_key[MAX_KEY_LENGTH];
+   char m_key_inv[MAX_KEY_LENGTH];
+   uint64_t m_rand;
+   uint16_t *m_tags; /**< Tags of slots, 0 marks empty slot. */
+   FlowRecord **m_flow_table; /**< Slots followed by stash slots and records owned by the export queue. */
+   FlowRecord *m_flow_records;
+   uint32_t m_path[CUCKOO_MAX_KICKS];
+
+   FragmentationCache m_fragmentation_cache;
+
+#ifdef FLOW_CACHE_STATS
+   uint64_t m_hits;
+   uint64_t m_kicks; /**< Records moved to their alternate bucket. */
+   uint64_t m_stashed; /**< Flows stored in the stash. */
+   uint64_t m_evicted; /**< Records exported because both buckets and the stash were full. */
+   uint64_t m_flushed;
+
+   void print_report();
+#endif /* FLOW_CACHE_STATS */
+
+   static inline uint16_t get_tag(uint64_t hash);
+   inline uint32_t get_bucket(uint64_t hash) const;
+   inline uint32_t get_alt_bucket(uint64_t hash, uint32_t bucket) const;
+   inline uint32_t match(uint32_t bucket, uint16_t tag) const;
+   bool find(uint64_t hash, uint32_t &index) const;
+   uint32_t insert(uint64_t hash);
+   bool displace(uint32_t bucket, uint32_t &index);
+   void flush(Packet &pkt, size_t flow_index, int ret, bool source_flow);
+   void export_flow(size_t index);
+};
+
+}
+#endif /* IPXP_STORAGE_CUCKOO_HPP */
@@ -28,7 +28,6 @@
  *    software without specific prior written permission.
  */
 
-#include "../xxhash.h"
 #include "fragmentationCache.hpp"
 #include "timevalUtils.hpp"
 
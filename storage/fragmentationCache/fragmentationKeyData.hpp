@@ -29,7 +29,7 @@
 
 #pragma once
 
-#include "../xxhash.h"
+#include <ipfixprobe/hash.hpp>
 
 #include <cstring>
 #include <ctime>
@@ -127,10 +127,7 @@ struct hash<ipxp::FragmentationKey> {
      */
     std::size_t operator()(const ipxp::FragmentationKey& fragmentation_key) const
     {
-        return XXH64(
-            reinterpret_cast<const void*>(&fragmentation_key),
-            sizeof(fragmentation_key),
-            0);
+        return ipxp::hash_bytes(&fragmentation_key, sizeof(fragmentation_key));
     }
 };
 
@@ -0,0 +1,280 @@
+/**
+ * \file plugin-workers.cpp
+ * \brief Pool of threads running process plugins outside of the flow cache thread
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+
+#include <cstring>
+#include <unistd.h>
+
+#include "plugin-workers.hpp"
+#include "cache.hpp"
+
+namespace ipxp {
+
+// Number of empty polls before worker starts to sleep
+#define PLUGIN_WORKER_SPIN 1024
+
+void PluginWorkItem::snapshot(const Packet &src)
+{
+   pkt = src;
+   pkt.m_exts = nullptr;
+   pkt.m_ext_mask = 0;
+   pkt.buffer = nullptr;
+   pkt.buffer_size = 0;
+   pkt.custom = nullptr;
+   pkt.custom_len = 0;
+
+   if (src.packet == nullptr) {
+      pkt.packet = nullptr;
+      pkt.packet_len = 0;
+      pkt.payload = nullptr;
+      pkt.payload_len = 0;
+      return;
+   }
+
+   // Payload is usually part of the packet, only separately stored payload needs its own copy
+   bool inside = src.payload == nullptr ||
+      (src.payload >= src.packet && src.payload + src.payload_len <= src.packet + src.packet_len);
+   size_t len = src.packet_len + (inside ? 0 : src.payload_len);
+   if (data.size() < len) {
+      data.resize(len);
+   }
+
+   memcpy(data.data(), src.packet, src.packet_len);
+   pkt.packet = data.data();
+   if (src.payload == nullptr) {
+      pkt.payload = nullptr;
+   } else if (inside) {
+      pkt.payload = data.data() + (src.payload - src.packet);
+   } else {
+      memcpy(data.data() + src.packet_len, src.payload, src.payload_len);
+      pkt.payload = data.data() + src.packet_len;
+   }
+}
+
+PluginWorkers::PluginWorkers() : m_shards(nullptr), m_shard_cnt(0)
+{
+}
+
+PluginWorkers::~PluginWorkers()
+{
+   stop();
+}
+
+void PluginWorkers::start(uint32_t workers, uint32_t queue_size, ProcessPlugin **plugins, uint32_t plugin_cnt)
+{
+   uint64_t size = 1;
+   while (size < queue_size) {
+      size <<= 1;
+   }
+
+   m_shard_cnt = workers;
+   m_shards = new Shard[workers];
+   for (uint32_t i = 0; i < workers; i++) {
+      Shard &shard = m_shards[i];
+      shard.head = 0;
+      shard.tail = 0;
+      shard.stop = false;
+      shard.error = false;
+      shard.items = new PluginWorkItem[size];
+      shard.mask = size - 1;
+      for (uint32_t j = 0; j < plugin_cnt; j++) {
+         shard.plugins.push_back(plugins[j]->copy());
+         shard.streams.add_plugin(shard.plugins.back());
+      }
+      shard.thread = new std::thread(run, &shard);
+   }
+}
+
+void PluginWorkers::stop()
+{
+   if (m_shards == nullptr) {
+      return;
+   }
+
+   for (uint32_t i = 0; i < m_shard_cnt; i++) {
+      m_shards[i].stop.store(true, std::memory_order_release);
+   }
+   for (uint32_t i = 0; i < m_shard_cnt; i++) {
+      Shard &shard = m_shards[i];
+      shard.thread->join();
+      delete shard.thread;
+      for (auto &it : shard.plugins) {
+         it->close();
+         delete it;
+      }
+      delete [] shard.items;
+   }
+
+   delete [] m_shards;
+   m_shards = nullptr;
+   m_shard_cnt = 0;
+}
+
+void PluginWorkers::check_error(Shard &shard)
+{
+   if (shard.error.load(std::memory_order_acquire)) {
+      throw PluginError(shard.error_msg);
+   }
+}
+
+uint64_t PluginWorkers::enqueue(uint32_t idx, FlowRecord *flow, PluginHook hook, const Packet *pkt)
+{
+   Shard &shard = m_shards[idx];
+   uint64_t tail = shard.tail.load(std::memory_order_relaxed);
+
+   while (tail - shard.head.load(std::memory_order_acquire) > shard.mask) {
+      check_error(shard);
+      std::this_thread::yield();
+   }
+
+   PluginWorkItem &item = shard.items[tail & shard.mask];
+   item.flow = flow;
+   item.hook = hook;
+   if (pkt != nullptr) {
+      item.snapshot(*pkt);
+   }
+
+   shard.tail.store(tail + 1, std::memory_order_release);
+   return tail + 1;
+}
+
+void PluginWorkers::wait(uint32_t idx, uint64_t ticket)
+{
+   Shard &shard = m_shards[idx];
+   while (shard.head.load(std::memory_order_acquire) < ticket) {
+      check_error(shard);
+      std::this_thread::yield();
+   }
+}
+
+bool PluginWorkers::done(uint32_t idx, uint64_t ticket)
+{
+   Shard &shard = m_shards[idx];
+   check_error(shard);
+   return shard.head.load(std::memory_order_acquire) >= ticket;
+}
+
+int PluginWorkers::process(Shard *shard, PluginWorkItem &item)
+{
+   size_t plugin_cnt = shard->plugins.size();
+   ProcessPlugin **plugins = shard->plugins.data();
+   Flow &rec = item.flow->m_flow;
+   int ret = 0;
+
+   if (item.hook == PluginHook::ACCOUNT) {
+      item.flow->update_flow(item.pkt, item.pkt.source_pkt);
+      return 0;
+   }
+   if (item.hook == PluginHook::EXPORT) {
+      for (size_t i = 0; i < plugin_cnt; i++) {
+         plugins[i]->pre_export(rec);
+      }
+      rec.m_streams.clear();
+      return 0;
+   }
+
+   if (item.hook == PluginHook::CREATE) {
+      for (size_t i = 0; i < plugin_cnt; i++) {
+         ret |= plugins[i]->post_create(rec, item.pkt);
+      }
+   } else {
+      for (size_t i = 0; i < plugin_cnt; i++) {
+         ret |= plugins[i]->pre_update(rec, item.pkt);
+      }
+      if (ret & FLOW_FLUSH) {
+         // Packet is accounted by the flow cache after the flow is flushed
+         return ret;
+      }
+      item.flow->update_flow(item.pkt, item.pkt.source_pkt);
+      for (size_t i = 0; i < plugin_cnt; i++) {
+         ret |= plugins[i]->post_update(rec, item.pkt);
+      }
+   }
+   if (shard->streams.enabled()) {
+      ret |= shard->streams.process(rec, item.pkt);
+   }
+   return ret;
+}
+
+void PluginWorkers::defer(PluginWorkItem &item)
+{
+   PluginWorkItem *deferred = new PluginWorkItem();
+   deferred->hook = item.hook;
+   std::swap(deferred->pkt, item.pkt);
+   deferred->data.swap(item.data);
+   item.flow->m_deferred.push_back(deferred);
+}
+
+void PluginWorkers::run(Shard *shard)
+{
+   uint32_t idle = 0;
+
+   while (1) {
+      uint64_t head = shard->head.load(std::memory_order_relaxed);
+      if (head == shard->tail.load(std::memory_order_acquire)) {
+         if (shard->stop.load(std::memory_order_acquire)) {
+            break;
+         }
+         if (++idle < PLUGIN_WORKER_SPIN) {
+            std::this_thread::yield();
+         } else {
+            usleep(1);
+         }
+         continue;
+      }
+      idle = 0;
+
+      PluginWorkItem &item = shard->items[head & shard->mask];
+      if (item.flow->m_flush) {
+         // Flush requested by an earlier item was not handled by the cache yet, packet belongs to the next flow
+         defer(item);
+         shard->head.store(head + 1, std::memory_order_release);
+         continue;
+      }
+      int ret = 0;
+      try {
+         ret = process(shard, item);
+      } catch (PluginError &e) {
+         shard->error_msg = e.what();
+         shard->error.store(true, std::memory_order_release);
+      }
+
+      if (ret & FLOW_FLUSH) {
+         FlowRecord *flow = item.flow;
+         if (item.hook == PluginHook::CREATE) {
+            // Flush requested by post_create never reinserts the flow
+            ret = FLOW_FLUSH;
+         } else if (ret == FLOW_FLUSH_WITH_REINSERT) {
+            // Keep packet for the new flow, the cache can read it after the ticket is done
+            defer(item);
+         }
+         flow->m_flush = ret & FLOW_FLUSH_WITH_REINSERT;
+      }
+      shard->head.store(head + 1, std::memory_order_release);
+   }
+}
+
+}
@@ -0,0 +1,173 @@
+/**
+ * \file plugin-workers.hpp
+ * \brief Pool of threads running process plugins outside of the flow cache thread
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+#ifndef IPXP_STORAGE_PLUGIN_WORKERS_HPP
+#define IPXP_STORAGE_PLUGIN_WORKERS_HPP
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ipfixprobe/process.hpp>
+#include <ipfixprobe/packet.hpp>
+#include <ipfixprobe/flowifc.hpp>
+#include <ipfixprobe/tcp-stream.hpp>
+
+namespace ipxp {
+
+class FlowRecord;
+
+static const uint32_t DEFAULT_PLUGIN_WORKER_QUEUE = 1024;
+
+/**
+ * \brief Plugin hooks which can be deferred to a plugin worker.
+ */
+enum class PluginHook : uint8_t {
+   CREATE, /**< post_create */
+   UPDATE, /**< pre_update, flow counters update and post_update */
+   ACCOUNT, /**< Flow counters update of packet skipped by packet sampling */
+   EXPORT  /**< pre_export */
+};
+
+/**
+ * \brief Single unit of work handed from the flow cache to a plugin worker.
+ */
+struct PluginWorkItem {
+   FlowRecord *flow; /**< Flow record the packet belongs to. */
+   PluginHook hook;
+   Packet pkt; /**< Packet snapshot, pointers refer to data. */
+   std::vector<uint8_t> data; /**< Copy of the packet and of the payload when it is stored separately. */
+
+   PluginWorkItem() : flow(nullptr), hook(PluginHook::CREATE)
+   {
+   }
+
+   ~PluginWorkItem()
+   {
+      // Extensions are owned by the original packet
+      pkt.m_exts = nullptr;
+   }
+
+   void snapshot(const Packet &src);
+};
+
+/**
+ * \brief Pool of threads executing process plugin hooks asynchronously.
+ *
+ * Each worker owns its own copies of the process plugins and a single-producer single-consumer queue.
+ * Work items are sharded by flow hash, so all hooks of a flow are run by the same worker and plugin
+ * instance in the order they were enqueued. Every enqueued item is identified by a ticket. Flow and
+ * extensions of the record belong to the worker until its last ticket is processed, the flow cache
+ * keeps its own FlowRecord::m_counters and must wait() for the ticket only before export.
+ *
+ * UPDATE items also update flow counters after pre_update hooks, so a flush requested by pre_update
+ * is evaluated before the packet is accounted. Flush requests are stored in FlowRecord::m_flush.
+ * Packet which triggered FLOW_FLUSH_WITH_REINSERT and packets of the flow enqueued before the cache
+ * handled the flush are not processed, they are kept in FlowRecord::m_deferred and the cache replays
+ * them after the flushed flow is exported.
+ */
+class PluginWorkers
+{
+public:
+   PluginWorkers();
+   ~PluginWorkers();
+
+   /**
+    * \brief Create plugin copies and start worker threads.
+    * \param [in] workers Number of worker threads.
+    * \param [in] queue_size Number of work items per worker, rounded up to power of two.
+    * \param [in] plugins Plugins to copy into each worker.
+    * \param [in] plugin_cnt Number of plugins.
+    */
+   void start(uint32_t workers, uint32_t queue_size, ProcessPlugin **plugins, uint32_t plugin_cnt);
+
+   /**
+    * \brief Process remaining work, stop worker threads and destroy plugin copies.
+    */
+   void stop();
+
+   bool running() const
+   {
+      return m_shards != nullptr;
+   }
+
+   /**
+    * \brief Get worker responsible for given flow hash.
+    */
+   uint32_t shard(uint64_t hash) const
+   {
+      return hash % m_shard_cnt;
+   }
+
+   /**
+    * \brief Hand flow record to a worker. Blocks while the worker queue is full.
+    * \param [in] shard Worker index obtained from shard().
+    * \param [in,out] flow Flow record processed by plugins.
+    * \param [in] hook Plugin hook to run.
+    * \param [in] pkt Packet to process, it is copied into the work item. Not used by EXPORT.
+    * \return Ticket which can be passed to wait().
+    */
+   uint64_t enqueue(uint32_t shard, FlowRecord *flow, PluginHook hook, const Packet *pkt);
+
+   /**
+    * \brief Wait until work item identified by ticket (and everything enqueued before it) is processed.
+    */
+   void wait(uint32_t shard, uint64_t ticket);
+
+   /**
+    * \brief Check whether work item identified by ticket was processed without blocking.
+    */
+   bool done(uint32_t shard, uint64_t ticket);
+
+private:
+   struct Shard {
+      std::atomic<uint64_t> head; /**< Number of processed items, written by worker. */
+      char pad1[64 - sizeof(std::atomic<uint64_t>)];
+      std::atomic<uint64_t> tail; /**< Number of enqueued items, written by flow cache. */
+      char pad2[64 - sizeof(std::atomic<uint64_t>)];
+      std::atomic<bool> stop;
+      std::atomic<bool> error;
+      std::string error_msg;
+
+      PluginWorkItem *items;
+      uint64_t mask;
+      std::vector<ProcessPlugin *> plugins;
+      TCPReassembly streams; /**< Reassembly for plugin copies of the worker. */
+      std::thread *thread;
+   };
+
+   Shard *m_shards;
+   uint32_t m_shard_cnt;
+
+   static void run(Shard *shard);
+   static int process(Shard *shard, PluginWorkItem &item);
+   static void defer(PluginWorkItem &item);
+   static void check_error(Shard &shard);
+};
+
+}
+#endif /* IPXP_STORAGE_PLUGIN_WORKERS_HPP */
@@ -0,0 +1,291 @@
+/**
+ * \file tcp-stream.cpp
+ * \brief Bounded reassembly of TCP streams shared by process plugins
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+
+#include <ipfixprobe/tcp-stream.hpp>
+
+namespace ipxp {
+
+// TCP SYN flag
+#define TCP_STREAM_SYN 0x02
+
+void tcp_stream_release(TCPStreamState *state)
+{
+   BlockArena &arena = *state->arena;
+   for (int i = 0; i < 2; i++) {
+      if (state->dir[i].buffer != nullptr) {
+         arena.release(state->dir[i].buffer, state->limit);
+      }
+   }
+   arena.release(state, sizeof(TCPStreamState));
+}
+
+TCPReassembly::TCPReassembly() : m_limit(0), m_arena(nullptr)
+{
+}
+
+void TCPReassembly::add_plugin(ProcessPlugin *plugin)
+{
+   uint32_t bytes = plugin->stream_bytes();
+   if (bytes == 0) {
+      return;
+   }
+   if (m_plugins.size() >= TCP_STREAM_MAX_PLUGINS) {
+      throw PluginError("too many plugins use TCP stream reassembly");
+   }
+   if (m_arena == nullptr) {
+      // Never destroyed, records with reassembly states can outlive the plugins
+      m_arena = new BlockArena();
+   }
+   m_plugins.push_back(plugin);
+   if (bytes > TCP_STREAM_MAX_BYTES) {
+      bytes = TCP_STREAM_MAX_BYTES;
+   }
+   if (bytes > m_limit) {
+      m_limit = bytes;
+   }
+}
+
+TCPStreamState *TCPReassembly::create_state() const
+{
+   TCPStreamState *state = static_cast<TCPStreamState *>(m_arena->alloc(sizeof(TCPStreamState)));
+   if (state == nullptr) {
+      return nullptr;
+   }
+
+   uint32_t subscribers = m_plugins.size() == 32 ? UINT32_MAX : (static_cast<uint32_t>(1) << m_plugins.size()) - 1;
+   state->arena = m_arena;
+   state->limit = m_limit;
+   for (int i = 0; i < 2; i++) {
+      TCPStreamDir &dir = state->dir[i];
+      dir.buffer = nullptr;
+      dir.base = 0;
+      dir.delivered = 0;
+      dir.subscribers = subscribers;
+      dir.base_known = false;
+      dir.range_cnt = 0;
+   }
+   return state;
+}
+
+void TCPReassembly::add_range(TCPStreamDir &dir, uint32_t start, uint32_t end)
+{
+   uint8_t i = 0;
+   while (i < dir.range_cnt && dir.ranges[i].end < start) {
+      i++;
+   }
+   if (i < dir.range_cnt && dir.ranges[i].start <= end) {
+      // Overlaps or touches existing range, extend it and merge the following ones
+      TCPStreamDir::Range &range = dir.ranges[i];
+      if (start < range.start) {
+         range.start = start;
+      }
+      if (end > range.end) {
+         range.end = end;
+      }
+      uint8_t j = i + 1;
+      while (j < dir.range_cnt && dir.ranges[j].start <= range.end) {
+         if (dir.ranges[j].end > range.end) {
+            range.end = dir.ranges[j].end;
+         }
+         j++;
+      }
+      memmove(&dir.ranges[i + 1], &dir.ranges[j], (dir.range_cnt - j) * sizeof(TCPStreamDir::Range));
+      dir.range_cnt -= j - i - 1;
+      return;
+   }
+   if (dir.range_cnt == TCP_STREAM_MAX_RANGES) {
+      // Data are already copied to the buffer but they will not be part of contiguous data
+      return;
+   }
+   memmove(&dir.ranges[i + 1], &dir.ranges[i], (dir.range_cnt - i) * sizeof(TCPStreamDir::Range));
+   dir.ranges[i].start = start;
+   dir.ranges[i].end = end;
+   dir.range_cnt++;
+}
+
+uint32_t TCPReassembly::merge_ranges(TCPStreamDir &dir, uint32_t end)
+{
+   uint8_t i = 0;
+   while (i < dir.range_cnt && dir.ranges[i].start <= end) {
+      if (dir.ranges[i].end > end) {
+         end = dir.ranges[i].end;
+      }
+      i++;
+   }
+   memmove(&dir.ranges[0], &dir.ranges[i], (dir.range_cnt - i) * sizeof(TCPStreamDir::Range));
+   dir.range_cnt -= i;
+   return end;
+}
+
+int TCPReassembly::deliver(Flow &rec, const Packet &pkt, TCPStreamDir &dir, const TCPStreamData &data)
+{
+   int ret = 0;
+   uint32_t subscribers = dir.subscribers;
+   for (uint32_t i = 0; subscribers; i++, subscribers >>= 1) {
+      if (subscribers & 1) {
+         int tmp = m_plugins[i]->stream_data(rec, pkt, data);
+         if (tmp & STREAM_DONE) {
+            dir.subscribers &= ~(static_cast<uint32_t>(1) << i);
+         }
+         ret |= tmp & ~STREAM_DONE;
+      }
+   }
+   return ret;
+}
+
+int TCPReassembly::process(Flow &rec, const Packet &pkt)
+{
+   if (pkt.ip_proto != IPPROTO_TCP) {
+      return 0;
+   }
+
+   TCPStreamState *state = rec.m_streams.get();
+   if (state == nullptr) {
+      if (pkt.payload_len == 0 && !(pkt.tcp_flags & TCP_STREAM_SYN)) {
+         return 0;
+      }
+      state = create_state();
+      if (state == nullptr) {
+         return 0;
+      }
+      rec.m_streams.set(state);
+   }
+
+   TCPStreamDir &dir = state->dir[pkt.source_pkt ? 0 : 1];
+   if (dir.subscribers == 0) {
+      return 0;
+   }
+
+   uint32_t seq = pkt.tcp_seq;
+   if (pkt.tcp_flags & TCP_STREAM_SYN) {
+      seq++;
+      if (!dir.base_known) {
+         dir.base = seq;
+         dir.base_known = true;
+      }
+   }
+   if (pkt.payload_len == 0 || pkt.payload == nullptr) {
+      return 0;
+   }
+   if (!dir.base_known) {
+      // SYN was not seen, the stream starts with the first segment carrying data
+      dir.base = seq;
+      dir.base_known = true;
+   }
+
+   const uint8_t *payload = pkt.payload;
+   uint32_t len = pkt.payload_len;
+   uint32_t start = seq - dir.base;
+   if (static_cast<int32_t>(start) < 0) {
+      // Segment starts before the base, e.g. retransmission with data of SYN
+      uint32_t skip = -start;
+      if (skip >= len) {
+         return 0;
+      }
+      payload += skip;
+      len -= skip;
+      start = 0;
+   }
+   if (start < dir.delivered) {
+      uint32_t skip = dir.delivered - start;
+      if (skip >= len) {
+         return 0;
+      }
+      payload += skip;
+      len -= skip;
+      start = dir.delivered;
+   }
+   if (start >= state->limit) {
+      return 0;
+   }
+   if (len > state->limit - start) {
+      len = state->limit - start;
+   }
+   uint32_t end = start + len;
+
+   TCPStreamData data;
+   data.source = pkt.source_pkt;
+   // Buffers are owned by the arena of the state, so they are always released where they were allocated
+   BlockArena &arena = *state->arena;
+   int ret;
+
+   if (dir.buffer == nullptr && start == 0) {
+      // Stream prefix is contained in the packet, pass it without copying
+      data.data = payload;
+      data.length = end;
+      data.offset = 0;
+      ret = deliver(rec, pkt, dir, data);
+      dir.delivered = end;
+      if (end == state->limit) {
+         dir.subscribers = 0;
+      }
+      if (dir.subscribers != 0) {
+         dir.buffer = static_cast<uint8_t *>(arena.alloc(state->limit));
+         if (dir.buffer == nullptr) {
+            dir.subscribers = 0;
+         } else {
+            memcpy(dir.buffer, payload, end);
+         }
+      }
+      return ret;
+   }
+
+   if (dir.buffer == nullptr) {
+      dir.buffer = static_cast<uint8_t *>(arena.alloc(state->limit));
+      if (dir.buffer == nullptr) {
+         dir.subscribers = 0;
+         return 0;
+      }
+   }
+   memcpy(dir.buffer + start, payload, len);
+   if (start > dir.delivered) {
+      add_range(dir, start, end);
+      return 0;
+   }
+
+   end = merge_ranges(dir, end);
+   data.data = dir.buffer;
+   data.length = end;
+   data.offset = dir.delivered;
+   ret = deliver(rec, pkt, dir, data);
+   dir.delivered = end;
+   if (end == state->limit) {
+      dir.subscribers = 0;
+   }
+   if (dir.subscribers == 0) {
+      arena.release(dir.buffer, state->limit);
+      dir.buffer = nullptr;
+      dir.range_cnt = 0;
+   }
+   return ret;
+}
+
+}
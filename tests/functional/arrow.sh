@@ -0,0 +1,103 @@
+#!/bin/sh
+
+export LC_ALL=C
+
+test -z "$srcdir" && export srcdir=.
+
+ipfixprobe_bin=../../ipfixprobe
+pcap_dir=$srcdir/../../pcaps
+plugins="-p pstats -p phists -p bstats -p http"
+
+if ! [ -f "$ipfixprobe_bin" ]; then
+   echo "ipfixprobe not compiled"
+   exit 77
+fi
+
+if ! `"$ipfixprobe_bin" -h pcap | head -1 | grep -q '^pcap'`; then
+   echo "compiled without pcap"
+   exit 77
+fi
+
+if ! python3 -c 'import pyarrow' 2>/dev/null; then
+   echo "pyarrow not available"
+   exit 77
+fi
+
+# Usage: run_arrow_test <pcap>
+# Flows read back by pyarrow must match the text output of the same pcap.
+run_arrow_test() {
+   rm -f arrow.out arrow.arrow
+   "$ipfixprobe_bin" -i "pcap;file=$pcap_dir/$1" -s "cache;s=17" $plugins -o "text;m;f=arrow.out" >/dev/null || return 1
+   "$ipfixprobe_bin" -i "pcap;file=$pcap_dir/$1" -s "cache;s=17" $plugins -o "arrow;f=arrow.arrow" >/dev/null || return 1
+
+   if python3 - arrow.out arrow.arrow <<'EOF'
+import datetime
+import ipaddress
+import re
+import sys
+
+import pyarrow as pa
+
+def ts(text):
+   sec, usec = text.split('.')
+   return int(sec) * 1000000 + int(usec)
+
+def addr(value):
+   ip = ipaddress.IPv6Address(value)
+   return str(ip.ipv4_mapped) if ip.ipv4_mapped else str(ip)
+
+def values(text, name):
+   m = re.search(name + r'=\(([^)]*)\)', text)
+   return [int(v) if '.' not in v else ts(v) for v in m.group(1).split(',') if v] if m else None
+
+table = pa.ipc.open_file(sys.argv[2]).read_all()
+utc = pa.timestamp('us', tz='UTC')
+assert table.schema.field('time_first').type == utc, 'time_first is not UTC timestamp'
+assert table.schema.field('stats_pckt_sizes').type == pa.list_(pa.field('item', pa.uint16(), nullable=False))
+assert table.schema.field('stats_pckt_timestamps').type == pa.list_(pa.field('item', utc, nullable=False))
+assert table.schema.field('stats_pckt_directions').type == pa.list_(pa.field('item', pa.int8(), nullable=False))
+assert table.schema.field('s_phists_sizes').type == pa.list_(pa.field('item', pa.uint32(), nullable=False))
+
+epoch = datetime.datetime(1970, 1, 1, tzinfo=datetime.timezone.utc)
+def us(value):
+   return (value - epoch) // datetime.timedelta(microseconds=1)
+
+rows = {}
+for row in table.to_pylist():
+   key = '%s:%d->%s:%d' % (addr(row['src_ip']), row['src_port'], addr(row['dst_ip']), row['dst_port'])
+   rows[(row['ip_proto'], key, us(row['time_first']))] = row
+
+lines = [l for l in open(sys.argv[1]) if '@' in l]
+assert len(lines) == len(rows), 'got %d rows, expected %d' % (len(rows), len(lines))
+for line in lines:
+   fields = line.split()
+   proto, key = fields[0].split('@')
+   key = key.replace('[', '').replace(']', '')
+   first = datetime.datetime.strptime(fields[4].split('->')[0], '%Y-%m-%dT%H:%M:%S.%f')
+   row = rows[(int(proto), key, us(first.replace(tzinfo=datetime.timezone.utc)))]
+
+   assert '%d->%d' % (row['src_packets'], row['dst_packets']) == fields[1], key
+   assert values(line, 'ppisizes') == row['stats_pckt_sizes'], key
+   assert values(line, 'ppiflags') == row['stats_pckt_tcpflgs'], key
+   assert values(line, 'ppidirs') == row['stats_pckt_directions'], key
+   # Basic lists carry times in milliseconds
+   assert [t // 1000 * 1000 for t in values(line, 'ppitimes')] == [us(t) for t in row['stats_pckt_timestamps']], key
+   assert values(line, 'sphistsize') == row['s_phists_sizes'], key
+   assert values(line, 'sphistipt') == row['s_phists_ipt'], key
+   assert values(line, 'dphistsize') == row['d_phists_sizes'], key
+   assert values(line, 'dphistipt') == row['d_phists_ipt'], key
+   host = re.search(r'host="([^"]*)"', line)
+   assert (host.group(1).encode() if host else None) == row['http_domain'], key
+EOF
+   then
+      echo "$1 arrow test OK"
+      rm -f arrow.out arrow.arrow
+   else
+      echo "$1 arrow test FAILED"
+      return 1
+   fi
+}
+
+for pcap in http.pcap mixed.pcap; do
+   run_arrow_test $pcap || exit 1
+done
@@ -0,0 +1,54 @@
+#!/bin/sh
+
+export LC_ALL=C
+
+test -z "$srcdir" && export srcdir=.
+
+ipfixprobe_bin=../../ipfixprobe
+pcap_dir=$srcdir/../../pcaps
+plugins="-p pstats -p phists -p bstats -p tls -p http -p dns -p sip -p smtp -p rtsp"
+
+if ! [ -f "$ipfixprobe_bin" ]; then
+   echo "ipfixprobe not compiled"
+   exit 77
+fi
+
+if ! `"$ipfixprobe_bin" -h pcap | head -1 | grep -q '^pcap'`; then
+   echo "compiled without pcap"
+   exit 77
+fi
+
+# Usage: run_cuckoo_test <pcap>
+# Cuckoo cache large enough to hold all flows must export the same flows as the default cache.
+run_cuckoo_test() {
+   "$ipfixprobe_bin" -i "pcap;file=$pcap_dir/$1" -s "cache;s=17" $plugins -o "text;m;f=cuckoo_nht.out" >/dev/null || return 1
+   "$ipfixprobe_bin" -i "pcap;file=$pcap_dir/$1" -s "cuckoo;s=17" $plugins -o "text;m;f=cuckoo.out" >/dev/null || return 1
+
+   sort cuckoo.out > cuckoo.out.sorted
+   if sort cuckoo_nht.out | diff -u - cuckoo.out.sorted; then
+      echo "$1 cuckoo test OK"
+      rm cuckoo_nht.out cuckoo.out cuckoo.out.sorted
+   else
+      echo "$1 cuckoo test FAILED"
+      return 1
+   fi
+}
+
+# Sum of packets of both directions in text output
+packets() {
+   grep '@' "$1" | cut -d' ' -f2 | tr '>' ' ' | awk '{s += $1 + $2} END {print s}'
+}
+
+for pcap in mixed.pcap http.pcap tls.pcap sip.pcap smtp.pcap dns.pcap rtsp.pcap sampling.pcap; do
+   run_cuckoo_test $pcap || exit 1
+done
+
+# 1010 flows in the smallest cache use the stash and evict records, no packet may be lost
+"$ipfixprobe_bin" -i "pcap;file=$pcap_dir/sampling.pcap" -s "cuckoo;s=17" -o "text;m;f=cuckoo_large.out" >/dev/null || exit 1
+"$ipfixprobe_bin" -i "pcap;file=$pcap_dir/sampling.pcap" -s "cuckoo;s=4" -o "text;m;f=cuckoo_small.out" >/dev/null || exit 1
+if [ "`packets cuckoo_large.out`" != "`packets cuckoo_small.out`" ]; then
+   echo "small cuckoo cache lost packets"
+   exit 1
+fi
+echo "small cuckoo cache test OK"
+rm cuckoo_large.out cuckoo_small.out
@@ -0,0 +1,44 @@
+#!/bin/sh
+
+test -z "$srcdir" && export srcdir=.
+
+ipfixprobe_bin=../../ipfixprobe
+receiver_bin=./ipfix_receiver
+port=$((40000 + $$ % 20000))
+flows=2000
+
+if ! [ -f "$ipfixprobe_bin" ] || ! [ -x "$receiver_bin" ]; then
+   echo "ipfixprobe or receiver not compiled"
+   exit 77
+fi
+
+# Usage: run_compress_test <algorithm>
+run_compress_test() {
+   "$receiver_bin" -c "$1" 2>/dev/null
+   if [ $? -eq 2 ]; then
+      echo "$1 compression not compiled"
+      return 0
+   fi
+
+   "$receiver_bin" -p $port -c "$1" > "compress_$1.out" &
+   receiver=$!
+   sleep 1
+   "$ipfixprobe_bin" -i "benchmark;m=nf;p=$flows" -o "ipfix;h=127.0.0.1;p=$port;c=$1" -p pstats >/dev/null
+   if ! wait $receiver; then
+      echo "$1 receiver FAILED"
+      return 1
+   fi
+
+   if grep -q " records $flows " "compress_$1.out"; then
+      echo "$1 compression test OK"
+      rm "compress_$1.out"
+   else
+      echo "$1 compression test FAILED"
+      cat "compress_$1.out"
+      return 1
+   fi
+}
+
+run_compress_test none || exit 1
+run_compress_test lz4 || exit 1
+run_compress_test zstd || exit 1
@@ -0,0 +1,299 @@
+/**
+ * \file ipfix-receiver.cpp
+ * \brief Test collector receiving compressed IPFIX stream over TCP
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+
+#include <config.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cinttypes>
+#include <map>
+#include <vector>
+#include <string>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#ifdef WITH_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+
+/* Lengths of template fields, 0xFFFF marks variable length field */
+static std::map<uint16_t, std::vector<uint16_t>> templates;
+static uint64_t msg_cnt = 0;
+static uint64_t tmplt_cnt = 0;
+static uint64_t rec_cnt = 0;
+static bool failed = false;
+
+static uint16_t get16(const uint8_t *p)
+{
+   return (p[0] << 8) | p[1];
+}
+
+static void parse_templates(const uint8_t *p, const uint8_t *end)
+{
+   while (p + 4 <= end) {
+      uint16_t id = get16(p);
+      uint16_t cnt = get16(p + 2);
+      if (id < 256) {
+         /* Padding */
+         return;
+      }
+      p += 4;
+      std::vector<uint16_t> fields;
+      for (uint16_t i = 0; i < cnt && p + 4 <= end; i++) {
+         uint16_t elem = get16(p);
+         fields.push_back(get16(p + 2));
+         p += (elem & 0x8000) ? 8 : 4;
+      }
+      templates[id] = fields;
+      tmplt_cnt++;
+   }
+}
+
+static void parse_data(uint16_t id, const uint8_t *p, const uint8_t *end)
+{
+   auto it = templates.find(id);
+   if (it == templates.end()) {
+      fprintf(stderr, "data set %u received before its template\n", id);
+      failed = true;
+      return;
+   }
+   while (p < end) {
+      const uint8_t *rec = p;
+      for (uint16_t len : it->second) {
+         if (len == 0xFFFF) {
+            if (p >= end) {
+               return;
+            }
+            len = *p++;
+            if (len == 255) {
+               if (p + 2 > end) {
+                  return;
+               }
+               len = get16(p);
+               p += 2;
+            }
+         }
+         p += len;
+      }
+      if (p > end || p == rec) {
+         /* Padding */
+         return;
+      }
+      rec_cnt++;
+   }
+}
+
+/* Parse complete messages from buffer, returns number of consumed bytes */
+static size_t parse_messages(const uint8_t *data, size_t size, FILE *out)
+{
+   size_t pos = 0;
+   while (size - pos >= 16) {
+      const uint8_t *msg = data + pos;
+      uint16_t len = get16(msg + 2);
+      if (get16(msg) != 10 || len < 16) {
+         fprintf(stderr, "invalid IPFIX message header\n");
+         failed = true;
+         return size;
+      }
+      if (size - pos < len) {
+         break;
+      }
+      for (const uint8_t *set = msg + 16; set + 4 <= msg + len; ) {
+         uint16_t id = get16(set);
+         uint16_t set_len = get16(set + 2);
+         if (set_len < 4 || set + set_len > msg + len) {
+            fprintf(stderr, "invalid IPFIX set length\n");
+            failed = true;
+            return size;
+         }
+         if (id == 2) {
+            parse_templates(set + 4, set + set_len);
+         } else if (id >= 256) {
+            parse_data(id, set + 4, set + set_len);
+         }
+         set += set_len;
+      }
+      if (out != nullptr) {
+         fwrite(msg, len, 1, out);
+      }
+      msg_cnt++;
+      pos += len;
+   }
+   return pos;
+}
+
+static void usage()
+{
+   fprintf(stderr, "Usage: ipfix_receiver -p PORT [-c none|lz4|zstd] [-w FILE]\n");
+   fprintf(stderr, "Exits with status 2 when the compression algorithm is not supported.\n");
+   fprintf(stderr, "Accepts single TCP connection, decompresses the stream and prints statistics of received messages.\n");
+}
+
+int main(int argc, char *argv[])
+{
+   int port = 0;
+   std::string alg = "none";
+   FILE *out = nullptr;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "p:c:w:")) != -1) {
+      switch (opt) {
+      case 'p':
+         port = atoi(optarg);
+         break;
+      case 'c':
+         alg = optarg;
+         break;
+      case 'w':
+         out = fopen(optarg, "wb");
+         if (out == nullptr) {
+            perror("fopen");
+            return 1;
+         }
+         break;
+      default:
+         usage();
+         return 1;
+      }
+   }
+#ifdef WITH_LZ4
+   LZ4F_dctx *lz4 = nullptr;
+   if (alg == "lz4" && LZ4F_isError(LZ4F_createDecompressionContext(&lz4, LZ4F_VERSION))) {
+      fprintf(stderr, "unable to create lz4 decompression context\n");
+      return 1;
+   }
+#endif
+#ifdef WITH_ZSTD
+   ZSTD_DCtx *zstd = nullptr;
+   if (alg == "zstd" && (zstd = ZSTD_createDCtx()) == nullptr) {
+      fprintf(stderr, "unable to create zstd decompression context\n");
+      return 1;
+   }
+#endif
+   if (alg != "none"
+#ifdef WITH_LZ4
+         && alg != "lz4"
+#endif
+#ifdef WITH_ZSTD
+         && alg != "zstd"
+#endif
+         ) {
+      fprintf(stderr, "unsupported compression %s\n", alg.c_str());
+      return 2;
+   }
+   if (port == 0) {
+      usage();
+      return 1;
+   }
+
+   int sock = socket(AF_INET, SOCK_STREAM, 0);
+   int one = 1;
+   setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+   struct sockaddr_in addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(port);
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(sock, 1) == -1) {
+      perror("bind");
+      return 1;
+   }
+   int conn = accept(sock, nullptr, nullptr);
+   if (conn == -1) {
+      perror("accept");
+      return 1;
+   }
+
+   std::vector<uint8_t> in(65536);
+   std::vector<uint8_t> raw;
+   uint64_t in_bytes = 0;
+   uint64_t raw_bytes = 0;
+   ssize_t ret;
+   while ((ret = recv(conn, in.data(), in.size(), 0)) > 0) {
+      in_bytes += ret;
+      size_t old = raw.size();
+      if (alg == "none") {
+         raw.insert(raw.end(), in.begin(), in.begin() + ret);
+      }
+#ifdef WITH_LZ4
+      if (lz4 != nullptr) {
+         size_t pos = 0;
+         while (pos < (size_t) ret) {
+            uint8_t tmp[65536];
+            size_t dst = sizeof(tmp);
+            size_t src = ret - pos;
+            size_t hint = LZ4F_decompress(lz4, tmp, &dst, in.data() + pos, &src, nullptr);
+            if (LZ4F_isError(hint)) {
+               fprintf(stderr, "lz4: %s\n", LZ4F_getErrorName(hint));
+               return 1;
+            }
+            raw.insert(raw.end(), tmp, tmp + dst);
+            pos += src;
+         }
+      }
+#endif
+#ifdef WITH_ZSTD
+      if (zstd != nullptr) {
+         ZSTD_inBuffer src = {in.data(), (size_t) ret, 0};
+         while (src.pos < src.size) {
+            uint8_t tmp[65536];
+            ZSTD_outBuffer dst = {tmp, sizeof(tmp), 0};
+            size_t hint = ZSTD_decompressStream(zstd, &dst, &src);
+            if (ZSTD_isError(hint)) {
+               fprintf(stderr, "zstd: %s\n", ZSTD_getErrorName(hint));
+               return 1;
+            }
+            raw.insert(raw.end(), tmp, tmp + dst.pos);
+         }
+      }
+#endif
+      raw_bytes += raw.size() - old;
+      size_t used = parse_messages(raw.data(), raw.size(), out);
+      raw.erase(raw.begin(), raw.begin() + used);
+   }
+
+   if (!raw.empty()) {
+      fprintf(stderr, "stream ended inside of a message\n");
+      failed = true;
+   }
+
+   printf("messages %" PRIu64 " templates %" PRIu64 " records %" PRIu64 " received %" PRIu64 " decompressed %" PRIu64 "\n",
+      msg_cnt, tmplt_cnt, rec_cnt, in_bytes, raw_bytes);
+
+   if (out != nullptr) {
+      fclose(out);
+   }
+   close(conn);
+   close(sock);
+   return failed ? 1 : 0;
+}
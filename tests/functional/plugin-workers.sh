@@ -0,0 +1,43 @@
+#!/bin/sh
+
+test -z "$srcdir" && export srcdir=.
+
+ipfixprobe_bin=../../ipfixprobe
+pcap_dir=$srcdir/../../pcaps
+plugins="-p pstats -p phists -p bstats -p tls -p http -p dns -p sip -p smtp -p rtsp"
+
+if ! [ -f "$ipfixprobe_bin" ]; then
+   echo "ipfixprobe not compiled"
+   exit 77
+fi
+
+if ! `"$ipfixprobe_bin" -h pcap | head -1 | grep -q '^pcap'`; then
+   echo "compiled without pcap"
+   exit 77
+fi
+
+# Usage: run_workers_test <pcap> <cache params>
+# Flows processed by plugin workers must be the same as flows processed in the cache thread.
+run_workers_test() {
+   "$ipfixprobe_bin" -i "pcap;file=$pcap_dir/$1" -s "cache;$2;w=0" $plugins -o "text;m;f=workers_0.out" >/dev/null || return 1
+   "$ipfixprobe_bin" -i "pcap;file=$pcap_dir/$1" -s "cache;$2;w=3;wq=4" $plugins -o "text;m;f=workers_3.out" >/dev/null || return 1
+
+   sort workers_3.out > workers_3.out.sorted
+   if sort workers_0.out | diff -u - workers_3.out.sorted; then
+      echo "$1 ($2) plugin workers test OK"
+      rm workers_0.out workers_3.out workers_3.out.sorted
+   else
+      echo "$1 ($2) plugin workers test FAILED"
+      return 1
+   fi
+}
+
+for pcap in mixed.pcap http.pcap tls.pcap sip.pcap smtp.pcap dns.pcap rtsp.pcap; do
+   run_workers_test $pcap "s=17" || exit 1
+done
+# Small cache with full flow lines exercises eviction and flushes of records owned by workers
+run_workers_test mixed.pcap "s=4;l=2;r=slru" || exit 1
+run_workers_test mixed.pcap "s=4;l=2;r=bytes" || exit 1
+# Packets skipped by packet sampling only update counters, flushes of sip and http defer packets in workers
+run_workers_test mixed.pcap "s=17;sa=2;sp=3" || exit 1
+run_workers_test sip.pcap "s=4;l=2;r=clock" || exit 1
@@ -0,0 +1,84 @@
+#!/bin/sh
+
+export LC_ALL=C
+
+test -z "$srcdir" && export srcdir=.
+
+ipfixprobe_bin=../../ipfixprobe
+pcap=$srcdir/../../pcaps/sampling.pcap
+
+# sampling.pcap contains 1000 UDP biflows with one packet in each direction (every 100th of them with
+# the same address and port in both directions) and 10 elephant biflows with 10 packets of 228 bytes
+# in each direction.
+FLOWS=1010
+ELEPHANTS=10
+
+if ! [ -f "$ipfixprobe_bin" ]; then
+   echo "ipfixprobe not compiled"
+   exit 77
+fi
+
+if ! `"$ipfixprobe_bin" -h pcap | head -1 | grep -q '^pcap'`; then
+   echo "compiled without pcap"
+   exit 77
+fi
+
+# Usage: run <output file> <cache params> [process plugins]
+run() {
+   out=$1
+   shift
+   cache=$1
+   shift
+   "$ipfixprobe_bin" -i "pcap;file=$pcap" -s "cache;$cache" "$@" -o "text;m;f=$out" >/dev/null || exit 1
+}
+
+# Flow part of text output without extensions
+flows() {
+   grep '@' "$1" | cut -d' ' -f1-5 | sort
+}
+
+fail() {
+   echo "$1"
+   exit 1
+}
+
+run sampling_all.out ""
+flows sampling_all.out > sampling_all.flows
+test `wc -l < sampling_all.flows` -eq $FLOWS || fail "unexpected number of flows without sampling"
+
+# Flow sampling keeps roughly 1 out of N biflows with exact counters of both directions
+for n in 2 4 8; do
+   run sampling_sf.out "sf=$n"
+   flows sampling_sf.out > sampling_sf.flows
+   cnt=`wc -l < sampling_sf.flows`
+   expected=$((FLOWS / n))
+   if [ $cnt -lt $((expected * 3 / 4)) ] || [ $cnt -gt $((expected * 5 / 4)) ]; then
+      fail "sf=$n kept $cnt flows, expected about $expected"
+   fi
+   # A biflow sampled by direction would appear with counters of a single direction
+   if [ -n "`comm -13 sampling_all.flows sampling_sf.flows`" ]; then
+      fail "sf=$n exported flows which differ from unsampled ones (biflow split or counters changed)"
+   fi
+   grep -q "hashselectedmax=$((4294967296 / n - 1))," sampling_sf.out || fail "sf=$n sampling extension is missing"
+done
+echo "flow sampling test OK"
+
+# Packet sampling changes only data of process plugins, elephants have 20 packets,
+# plugins get the first 2 and then every 3rd packet: 2 + 6
+run sampling_sp.out "sa=2;sp=3" -p pstats
+flows sampling_sp.out | diff -u sampling_all.flows - || fail "packet sampling changed flow counters"
+grep '@10.1.0.1:40000' sampling_sp.out | grep -q 'pluginsampleafter=2,pluginsampleinterval=3 ppisizes=(200,200,200,200,200,200,200,200),' ||
+   fail "pstats of sampled elephant flow do not match"
+echo "packet sampling test OK"
+
+# Elephant filter exports only flows reaching packet or byte threshold
+for opt in "ep=20" "eb=4000" "ep=1000;eb=4000"; do
+   run sampling_elephant.out "$opt"
+   flows sampling_elephant.out > sampling_elephant.flows
+   test `wc -l < sampling_elephant.flows` -eq $ELEPHANTS || fail "$opt did not export exactly the elephant flows"
+   grep '10->10 2280->2280' sampling_all.flows | diff -u - sampling_elephant.flows || fail "$opt exported different flows"
+done
+echo "elephant filter test OK"
+
+rm -f sampling_all.out sampling_all.flows sampling_sf.out sampling_sf.flows sampling_sp.out \
+   sampling_elephant.out sampling_elephant.flows
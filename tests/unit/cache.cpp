@@ -0,0 +1,192 @@
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include <ipfixprobe/ring.h>
+#include <ipfixprobe/hash.hpp>
+#include "storage/cache.hpp"
+
+namespace ipxp_test {
+
+using namespace ipxp;
+
+// Cache of 16 records in 4 lines of 4 records, new flows are inserted into the middle of a line
+static const uint32_t LINE_SIZE = 4;
+static const uint32_t LINE_MASK = 16 - LINE_SIZE;
+
+class CacheTest : public ::testing::Test
+{
+protected:
+   ipx_ring_t *m_ring;
+   NHTFlowCache m_cache;
+   uint16_t m_port;
+
+   void SetUp()
+   {
+      m_ring = ipx_ring_init(64, false);
+      ASSERT_NE(m_ring, nullptr);
+      m_cache.set_queue(m_ring);
+      m_port = 1;
+   }
+
+   void TearDown()
+   {
+      m_cache.close();
+      ipx_ring_destroy(m_ring);
+   }
+
+   void init(const std::string &policy)
+   {
+      m_cache.init(("s=4;l=2;fe=false;r=" + policy).c_str());
+   }
+
+   /**
+    * \brief Create packet of a new flow in the first line of the cache.
+    */
+   Packet new_flow(uint16_t ip_len = 100)
+   {
+      while (true) {
+         Packet pkt;
+         pkt.ts.tv_sec = 1;
+         pkt.ip_version = IP::v4;
+         pkt.ip_proto = 17;
+         pkt.src_ip.v4 = 0x0100000a;
+         pkt.dst_ip.v4 = 0x0200000a;
+         pkt.src_port = m_port++;
+         pkt.dst_port = 53;
+         pkt.ip_len = ip_len;
+
+         char key[MAX_KEY_LENGTH];
+         char key_inv[MAX_KEY_LENGTH];
+         uint8_t keylen;
+         create_flow_key(pkt, key, key_inv, keylen);
+         if ((hash_bytes(key, keylen) & LINE_MASK) == 0) {
+            return pkt;
+         }
+      }
+   }
+
+   /**
+    * \brief Put packet into the cache.
+    * \return Source port of the flow exported by the packet, 0 when none was exported.
+    */
+   uint16_t put(Packet &pkt)
+   {
+      m_cache.put_pkt(pkt);
+      uint16_t port = 0;
+      Flow *flow;
+      while ((flow = reinterpret_cast<Flow *>(ipx_ring_pop(m_ring))) != nullptr) {
+         EXPECT_EQ(port, 0);
+         EXPECT_EQ(flow->end_reason, FLOW_END_NO_RES);
+         port = flow->src_port;
+      }
+      return port;
+   }
+
+   /**
+    * \brief Fill the first line with four flows.
+    */
+   std::vector<Packet> fill(const std::vector<uint16_t> &ip_lens = {100, 100, 100, 100})
+   {
+      std::vector<Packet> pkts;
+      for (auto len : ip_lens) {
+         pkts.push_back(new_flow(len));
+         EXPECT_EQ(put(pkts.back()), 0);
+      }
+      return pkts;
+   }
+};
+
+TEST_F(CacheTest, slru)
+{
+   init("slru");
+   std::vector<Packet> f = fill(); // A B C D
+   EXPECT_EQ(put(f[3]), 0); // Hit moves D to the start: D A B C
+
+   Packet e = new_flow();
+   EXPECT_EQ(put(e), f[2].src_port); // D A E B
+   Packet g = new_flow();
+   EXPECT_EQ(put(g), f[1].src_port); // D A G E
+   // New flows which were not hit again are evicted before older protected ones
+   Packet h = new_flow();
+   EXPECT_EQ(put(h), e.src_port); // D A H G
+   Packet i = new_flow();
+   EXPECT_EQ(put(i), g.src_port);
+}
+
+TEST_F(CacheTest, lru)
+{
+   init("lru");
+   std::vector<Packet> f = fill(); // A B C D
+   EXPECT_EQ(put(f[3]), 0); // D A B C
+
+   Packet e = new_flow();
+   EXPECT_EQ(put(e), f[2].src_port); // E D A B
+   Packet g = new_flow();
+   EXPECT_EQ(put(g), f[1].src_port); // G E D A
+   Packet h = new_flow();
+   EXPECT_EQ(put(h), f[0].src_port); // H G E D
+   Packet i = new_flow();
+   EXPECT_EQ(put(i), f[3].src_port);
+}
+
+TEST_F(CacheTest, clock)
+{
+   init("clock");
+   std::vector<Packet> f = fill(); // A B C D, hand at A
+   EXPECT_EQ(put(f[1]), 0); // Hit sets reference bit of B
+
+   Packet e = new_flow();
+   EXPECT_EQ(put(e), f[0].src_port); // E B C D, hand at B
+   // Hand clears reference bit of B and evicts C
+   Packet g = new_flow();
+   EXPECT_EQ(put(g), f[2].src_port); // E B G D, hand at D
+   Packet h = new_flow();
+   EXPECT_EQ(put(h), f[3].src_port); // E B G H, hand wraps to E
+   Packet i = new_flow();
+   EXPECT_EQ(put(i), e.src_port); // I B G H, hand at B
+   // Reference bit of B was cleared by the previous pass
+   Packet j = new_flow();
+   EXPECT_EQ(put(j), f[1].src_port);
+}
+
+TEST_F(CacheTest, clockRecordsStayInPlace)
+{
+   init("clock");
+   std::vector<Packet> f = fill();
+   for (auto &pkt : f) {
+      EXPECT_EQ(put(pkt), 0); // All records referenced
+   }
+
+   // Full pass clears all reference bits and evicts the record under the hand
+   Packet e = new_flow();
+   EXPECT_EQ(put(e), f[0].src_port);
+   Packet g = new_flow();
+   EXPECT_EQ(put(g), f[1].src_port);
+}
+
+TEST_F(CacheTest, bytes)
+{
+   init("bytes");
+   std::vector<Packet> f = fill({100, 100, 100, 1000}); // A B C D
+
+   // Lightest record of the second half is evicted instead of the last one
+   Packet e = new_flow();
+   EXPECT_EQ(put(e), f[2].src_port); // A B E D
+   Packet g = new_flow();
+   EXPECT_EQ(put(g), e.src_port); // A B G D
+
+   // Heavy flow is evicted once it is the lightest one
+   Packet h = new_flow(2000);
+   EXPECT_EQ(put(h), g.src_port); // A B H D
+   Packet i = new_flow();
+   EXPECT_EQ(put(i), f[3].src_port);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include <ipfixprobe/ring.h>
+#include <ipfixprobe/hash.hpp>
+#include "storage/cache.hpp"
+#include "storage/cuckoo.hpp"
+
+namespace ipxp_test {
+
+using namespace ipxp;
+
+// Cache with size exponent 5 has 4 buckets of CUCKOO_BUCKET_SIZE slots
+static const uint32_t SIZE_EXP = 5;
+static const uint32_t BUCKETS = (1 << SIZE_EXP) / CUCKOO_BUCKET_SIZE;
+
+class CuckooTest : public ::testing::Test
+{
+protected:
+   ipx_ring_t *m_ring;
+   CuckooFlowCache m_cache;
+   uint16_t m_port;
+
+   void SetUp()
+   {
+      m_ring = ipx_ring_init(64, false);
+      ASSERT_NE(m_ring, nullptr);
+      m_cache.set_queue(m_ring);
+      m_cache.init("s=5;fe=false");
+      m_port = 1;
+   }
+
+   void TearDown()
+   {
+      m_cache.close();
+      ipx_ring_destroy(m_ring);
+   }
+
+   static Packet make_pkt(uint16_t port)
+   {
+      Packet pkt;
+      pkt.ts.tv_sec = 1;
+      pkt.ip_version = IP::v4;
+      pkt.ip_proto = 17;
+      pkt.src_ip.v4 = 0x0100000a;
+      pkt.dst_ip.v4 = 0x0200000a;
+      pkt.src_port = port;
+      pkt.dst_port = 53;
+      pkt.ip_len = 100;
+      return pkt;
+   }
+
+   static uint64_t flow_hash(const Packet &pkt)
+   {
+      char key[MAX_KEY_LENGTH];
+      char key_inv[MAX_KEY_LENGTH];
+      uint8_t keylen;
+      create_flow_key(pkt, key, key_inv, keylen);
+      return hash_bytes(key, keylen);
+   }
+
+   /**
+    * \brief Find next packet of new flow which can be stored only in given buckets.
+    */
+   Packet next_pkt(uint32_t bucket, uint32_t alt)
+   {
+      while (true) {
+         Packet pkt = make_pkt(m_port++);
+         uint64_t hash = flow_hash(pkt);
+         uint32_t b = hash & (BUCKETS - 1);
+         if (b == bucket && ((b ^ ((hash >> 32) | 1)) & (BUCKETS - 1)) == alt) {
+            return pkt;
+         }
+      }
+   }
+
+   /**
+    * \brief Pop next exported flow.
+    * \return Flow or null when queue is empty.
+    */
+   Flow *pop()
+   {
+      return reinterpret_cast<Flow *>(ipx_ring_pop(m_ring));
+   }
+
+   /**
+    * \brief Pop all exported flows.
+    * \return Number of flows, end reason of each one is checked.
+    */
+   int exported(uint8_t reason)
+   {
+      int cnt = 0;
+      Flow *flow;
+      while ((flow = pop()) != nullptr) {
+         EXPECT_EQ(flow->end_reason, reason);
+         cnt++;
+      }
+      return cnt;
+   }
+};
+
+TEST_F(CuckooTest, relocation)
+{
+   // Fill bucket 0 with flows which can move to bucket 1 and bucket 1 with flows which can move to bucket 2
+   for (uint32_t i = 0; i < CUCKOO_BUCKET_SIZE; i++) {
+      Packet pkt = next_pkt(0, 1);
+      m_cache.put_pkt(pkt);
+   }
+   for (uint32_t i = 0; i < CUCKOO_BUCKET_SIZE; i++) {
+      Packet pkt = next_pkt(1, 2);
+      m_cache.put_pkt(pkt);
+   }
+   EXPECT_EQ(exported(0), 0);
+
+   // Both buckets of new flows are full, records have to be moved to buckets 2 and 3
+   std::vector<Packet> pkts;
+   for (uint32_t i = 0; i < CUCKOO_BUCKET_SIZE; i++) {
+      pkts.push_back(next_pkt(0, 1));
+      m_cache.put_pkt(pkts.back());
+   }
+   EXPECT_EQ(exported(0), 0);
+
+   // Relocated flows are still found
+   for (auto &pkt : pkts) {
+      m_cache.put_pkt(pkt);
+   }
+   EXPECT_EQ(exported(0), 0);
+
+   m_cache.finish();
+   int cnt = 0;
+   Flow *flow;
+   while ((flow = pop()) != nullptr) {
+      EXPECT_EQ(flow->end_reason, FLOW_END_FORCED);
+      uint16_t port = flow->src_port;
+      bool twice = std::find_if(pkts.begin(), pkts.end(), [port](const Packet &p) { return p.src_port == port; }) != pkts.end();
+      EXPECT_EQ(flow->src_packets, twice ? 2u : 1u);
+      cnt++;
+   }
+   EXPECT_EQ(cnt, 3 * CUCKOO_BUCKET_SIZE);
+}
+
+TEST_F(CuckooTest, stash)
+{
+   // Fill the whole table, flows can be placed only by relocation of others
+   for (uint32_t i = 0; i < BUCKETS * CUCKOO_BUCKET_SIZE; i++) {
+      Packet pkt = next_pkt(i % BUCKETS, (i % BUCKETS) ^ 1);
+      m_cache.put_pkt(pkt);
+   }
+   EXPECT_EQ(exported(0), 0);
+
+   // No record can be moved, new flows go to the stash
+   std::vector<Packet> stashed;
+   for (uint32_t i = 0; i < CUCKOO_STASH_SIZE; i++) {
+      stashed.push_back(next_pkt(0, 1));
+      m_cache.put_pkt(stashed.back());
+   }
+   EXPECT_EQ(exported(0), 0);
+
+   // Stashed flows are found and updated
+   for (auto &pkt : stashed) {
+      m_cache.put_pkt(pkt);
+   }
+   EXPECT_EQ(exported(0), 0);
+
+   // Stash is full, one record of the buckets is evicted
+   Packet pkt = next_pkt(2, 3);
+   m_cache.put_pkt(pkt);
+   EXPECT_EQ(exported(FLOW_END_NO_RES), 1);
+
+   m_cache.finish();
+   int cnt = 0;
+   int updated = 0;
+   Flow *flow;
+   while ((flow = pop()) != nullptr) {
+      EXPECT_EQ(flow->end_reason, FLOW_END_FORCED);
+      updated += flow->src_packets == 2;
+      cnt++;
+   }
+   EXPECT_EQ(cnt, BUCKETS * CUCKOO_BUCKET_SIZE + CUCKOO_STASH_SIZE);
+   EXPECT_EQ(updated, CUCKOO_STASH_SIZE);
+}
+
+TEST_F(CuckooTest, reuseStash)
+{
+   // Slots of exported stash records are used again
+   for (uint32_t i = 0; i < BUCKETS * CUCKOO_BUCKET_SIZE + CUCKOO_STASH_SIZE; i++) {
+      Packet pkt = next_pkt(i % BUCKETS, (i % BUCKETS) ^ 1);
+      m_cache.put_pkt(pkt);
+   }
+   EXPECT_EQ(exported(0), 0);
+
+   // Inactive timeout exports all records including the stash
+   time_t ts = 1 + DEFAULT_INACTIVE_TIMEOUT;
+   for (uint32_t i = 0; i < BUCKETS; i++) {
+      m_cache.export_expired(ts);
+   }
+   EXPECT_EQ(exported(FLOW_END_INACTIVE), BUCKETS * CUCKOO_BUCKET_SIZE + CUCKOO_STASH_SIZE);
+
+   for (uint32_t i = 0; i < BUCKETS * CUCKOO_BUCKET_SIZE + CUCKOO_STASH_SIZE; i++) {
+      Packet pkt = next_pkt(i % BUCKETS, (i % BUCKETS) ^ 1);
+      pkt.ts.tv_sec = ts;
+      m_cache.put_pkt(pkt);
+   }
+   EXPECT_EQ(exported(0), 0);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
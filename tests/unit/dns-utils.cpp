@@ -0,0 +1,219 @@
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "process/dns-utils.hpp"
+
+namespace ipxp_test {
+
+using namespace ipxp;
+
+typedef std::vector<uint8_t> Bytes;
+
+/**
+ * \brief Create DNS message with given counts of questions and answers followed by body.
+ */
+static Bytes message(uint16_t qd, uint16_t an, const Bytes &body)
+{
+   Bytes msg = {0x12, 0x34, 0x81, 0x80, 0, static_cast<uint8_t>(qd), 0, static_cast<uint8_t>(an), 0, 0, 0, 0};
+   msg.insert(msg.end(), body.begin(), body.end());
+   return msg;
+}
+
+/**
+ * \brief Encode name as labels terminated by root label.
+ */
+static Bytes name(const std::vector<std::string> &labels)
+{
+   Bytes out;
+   for (auto &label : labels) {
+      out.push_back(label.size());
+      out.insert(out.end(), label.begin(), label.end());
+   }
+   out.push_back(0);
+   return out;
+}
+
+static Bytes cat(std::initializer_list<Bytes> parts)
+{
+   Bytes out;
+   for (auto &part : parts) {
+      out.insert(out.end(), part.begin(), part.end());
+   }
+   return out;
+}
+
+static const Bytes QUESTION = {0, 1, 0, 1}; // Type A, class IN
+static const Bytes ANSWER_A = {0, 1, 0, 1, 0, 0, 0, 60, 0, 4, 10, 0, 0, 1}; // TTL 60, 10.0.0.1
+
+static std::string get_name(const DnsMessage &msg, uint32_t offset)
+{
+   char buffer[DNS_MAX_NAME_LEN + 1];
+   if (dns_get_name(msg, offset, buffer, sizeof(buffer)) < 0) {
+      return "<malformed>";
+   }
+   return buffer;
+}
+
+TEST(DnsParse, compressedAnswer)
+{
+   Bytes data = message(1, 1, cat({name({"www", "example", "com"}), QUESTION, {0xC0, 12}, ANSWER_A}));
+   const DnsMessage *msg = dns_parse(data.data(), data.size(), false, 0);
+   ASSERT_NE(msg, nullptr);
+   EXPECT_EQ(msg->end, DNS_PARSE_OK);
+   EXPECT_EQ(msg->qd_parsed, 1);
+   EXPECT_EQ(msg->an_parsed, 1);
+   ASSERT_EQ(msg->rr_cnt, 1);
+   EXPECT_EQ(msg->rr[0].type, DNS_TYPE_A);
+   EXPECT_EQ(msg->rr[0].ttl, 60u);
+   EXPECT_EQ(get_name(*msg, 12), "www.example.com");
+   EXPECT_EQ(get_name(*msg, msg->rr[0].name), "www.example.com");
+}
+
+TEST(DnsParse, pointerLoop)
+{
+   // Name pointing to itself
+   Bytes data = message(1, 0, cat({{0xC0, 12}, QUESTION}));
+   const DnsMessage *msg = dns_parse(data.data(), data.size(), false, 0);
+   ASSERT_NE(msg, nullptr);
+   EXPECT_EQ(get_name(*msg, 12), "<malformed>");
+
+   // Two names pointing to each other
+   data = message(1, 1, cat({{1, 'a', 0xC0, 20}, QUESTION, {0xC0, 12}, ANSWER_A}));
+   msg = dns_parse(data.data(), data.size(), false, 0);
+   ASSERT_NE(msg, nullptr);
+   ASSERT_EQ(msg->rr_cnt, 1);
+   EXPECT_EQ(get_name(*msg, 12), "<malformed>");
+   EXPECT_EQ(get_name(*msg, msg->rr[0].name), "<malformed>");
+}
+
+TEST(DnsParse, forwardPointer)
+{
+   // Question name points to the answer name which follows it
+   Bytes data = message(1, 1, cat({{0xC0, 18}, QUESTION, name({"example"}), ANSWER_A}));
+   const DnsMessage *msg = dns_parse(data.data(), data.size(), false, 0);
+   ASSERT_NE(msg, nullptr);
+   EXPECT_EQ(msg->end, DNS_PARSE_OK);
+   EXPECT_EQ(get_name(*msg, 18), "example");
+   EXPECT_EQ(get_name(*msg, 12), "<malformed>");
+}
+
+TEST(DnsParse, longLabel)
+{
+   Bytes label(64, 'a');
+   label[0] = 63;
+   Bytes data = message(1, 0, cat({label, {0}, QUESTION}));
+   const DnsMessage *msg = dns_parse(data.data(), data.size(), false, 0);
+   ASSERT_NE(msg, nullptr);
+   EXPECT_EQ(msg->end, DNS_PARSE_OK);
+   EXPECT_EQ(get_name(*msg, 12), std::string(63, 'a'));
+
+   // Label lengths 64-191 are reserved, walk and decompression both reject them
+   label.push_back('a');
+   label[0] = 64;
+   data = message(1, 0, cat({label, {0}, QUESTION}));
+   msg = dns_parse(data.data(), data.size(), false, 0);
+   ASSERT_NE(msg, nullptr);
+   EXPECT_EQ(msg->end, DNS_PARSE_MALFORMED);
+   EXPECT_EQ(msg->qd_parsed, 0);
+   EXPECT_EQ(get_name(*msg, 12), "<malformed>");
+}
+
+TEST(DnsParse, truncatedPointer)
+{
+   // Pointer cut in half by the end of the message
+   Bytes data = message(1, 0, {0xC0});
+   const DnsMessage *msg = dns_parse(data.data(), data.size(), false, 0);
+   ASSERT_NE(msg, nullptr);
+   EXPECT_EQ(msg->end, DNS_PARSE_MALFORMED);
+   EXPECT_EQ(get_name(*msg, 12), "<malformed>");
+}
+
+TEST(DnsParse, truncatedRR)
+{
+   Bytes body = cat({name({"example"}), QUESTION, {0xC0, 12}, ANSWER_A});
+
+   // RDATA exceeds the message
+   Bytes data = message(1, 1, Bytes(body.begin(), body.end() - 1));
+   const DnsMessage *msg = dns_parse(data.data(), data.size(), false, 0);
+   ASSERT_NE(msg, nullptr);
+   EXPECT_EQ(msg->end, DNS_PARSE_TRUNCATED);
+   EXPECT_EQ(msg->qd_parsed, 1);
+   EXPECT_EQ(msg->an_parsed, 0);
+
+   // Fixed part of the record exceeds the message
+   data = message(1, 1, Bytes(body.begin(), body.end() - 10));
+   msg = dns_parse(data.data(), data.size(), false, 0);
+   ASSERT_NE(msg, nullptr);
+   EXPECT_EQ(msg->end, DNS_PARSE_TRUNCATED);
+   EXPECT_EQ(msg->an_parsed, 0);
+
+   // Owner name exceeds the message
+   data = message(1, 1, cat({name({"example"}), QUESTION, {7, 'e', 'x'}}));
+   msg = dns_parse(data.data(), data.size(), false, 0);
+   ASSERT_NE(msg, nullptr);
+   EXPECT_EQ(msg->end, DNS_PARSE_MALFORMED);
+   EXPECT_EQ(msg->an_parsed, 0);
+
+   // Question count larger than the message
+   data = message(2, 0, cat({name({"example"}), QUESTION}));
+   msg = dns_parse(data.data(), data.size(), false, 0);
+   ASSERT_NE(msg, nullptr);
+   EXPECT_EQ(msg->end, DNS_PARSE_MALFORMED);
+   EXPECT_EQ(msg->qd_parsed, 1);
+}
+
+TEST(DnsParse, labelCountCap)
+{
+   std::vector<std::string> labels(DNS_MAX_LABEL_CNT, "a");
+   Bytes data = message(1, 0, cat({name(labels), QUESTION}));
+   const DnsMessage *msg = dns_parse(data.data(), data.size(), false, 0);
+   ASSERT_NE(msg, nullptr);
+   EXPECT_EQ(msg->end, DNS_PARSE_OK);
+   char buffer[1024];
+   EXPECT_EQ(dns_get_name(*msg, 12, buffer, sizeof(buffer)), 2 * DNS_MAX_LABEL_CNT - 1);
+
+   // Pointers count as labels too
+   labels.push_back("a");
+   data = message(1, 0, cat({name(labels), QUESTION}));
+   msg = dns_parse(data.data(), data.size(), false, 0);
+   ASSERT_NE(msg, nullptr);
+   EXPECT_EQ(get_name(*msg, 12), "<malformed>");
+
+   labels.resize(DNS_MAX_LABEL_CNT - 1);
+   data = message(1, 1, cat({name(labels), QUESTION, {1, 'b', 0xC0, 12}, ANSWER_A}));
+   msg = dns_parse(data.data(), data.size(), false, 0);
+   ASSERT_NE(msg, nullptr);
+   ASSERT_EQ(msg->rr_cnt, 1);
+   EXPECT_EQ(get_name(*msg, msg->rr[0].name), "<malformed>");
+}
+
+TEST(DnsParse, tcpLengthPrefix)
+{
+   Bytes data = message(1, 0, cat({name({"example"}), QUESTION}));
+   Bytes tcp = cat({{static_cast<uint8_t>(data.size() >> 8), static_cast<uint8_t>(data.size())}, data});
+   const DnsMessage *msg = dns_parse(tcp.data(), tcp.size(), true, 0);
+   ASSERT_NE(msg, nullptr);
+   EXPECT_EQ(msg->len, data.size());
+   EXPECT_EQ(msg->end, DNS_PARSE_OK);
+   EXPECT_EQ(get_name(*msg, 12), "example");
+
+   // Message split into more segments
+   tcp[1]++;
+   EXPECT_EQ(dns_parse(tcp.data(), tcp.size(), true, 0), nullptr);
+   EXPECT_EQ(dns_parse(tcp.data(), 1, true, 0), nullptr);
+
+   // Prefix alone or shorter than header
+   Bytes empty = {0, 0};
+   EXPECT_EQ(dns_parse(empty.data(), empty.size(), true, 0), nullptr);
+   Bytes short_msg = {0, 4, 1, 2, 3, 4};
+   EXPECT_EQ(dns_parse(short_msg.data(), short_msg.size(), true, 0), nullptr);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
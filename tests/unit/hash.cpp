@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "ipfixprobe/hash.hpp"
+
+namespace ipxp_test {
+
+using namespace ipxp;
+
+template<typename Hash>
+static std::string hex(Hash &hash)
+{
+   static const char digits[] = "0123456789abcdef";
+   const uint8_t *digest = hash.finalize();
+   std::string out;
+   for (size_t i = 0; i < Hash::DIGEST_SIZE; i++) {
+      out += digits[digest[i] >> 4];
+      out += digits[digest[i] & 0xF];
+   }
+   return out;
+}
+
+template<typename Hash>
+static std::string digest(Hash &hash, const std::string &data)
+{
+   hash.reset();
+   hash.update(data.data(), data.size());
+   return hex(hash);
+}
+
+static std::vector<uint8_t> sequence(size_t len, size_t mod)
+{
+   std::vector<uint8_t> data(len);
+   for (size_t i = 0; i < len; i++) {
+      data[i] = i % mod;
+   }
+   return data;
+}
+
+TEST(HashBytes, xxh3Vectors)
+{
+   // Reference values of XXH3_64bits_withSeed from the xxHash project with IPXP_HASH_SEED
+   const struct {
+      std::vector<uint8_t> data;
+      uint64_t hash;
+   } vectors[] = {
+      {{}, 0x602b0e2cd6662c8bULL},
+      {{'a'}, 0x7b013ec73230c3a1ULL},
+      {{'a', 'b', 'c'}, 0xfc1ae99bb3de2336ULL},
+      {sequence(13, 256), 0x825d5859836382afULL}, // IPv4 flow key
+      {sequence(37, 256), 0x4a8e2fc04543b217ULL}, // IPv6 flow key
+      {sequence(200, 256), 0xb913db1647edd288ULL},
+      {sequence(1000, 251), 0x629f9f11706b5c21ULL}, // Long input uses the SIMD accumulators
+   };
+
+   for (auto &it : vectors) {
+      EXPECT_EQ(hash_bytes(it.data.data(), it.data.size()), it.hash) << it.data.size();
+   }
+}
+
+class HashTest : public ::testing::TestWithParam<bool>
+{
+};
+
+TEST_P(HashTest, md5Vectors)
+{
+   // RFC 1321 test suite
+   HashMD5 md5(GetParam());
+   EXPECT_EQ(digest(md5, ""), "d41d8cd98f00b204e9800998ecf8427e");
+   EXPECT_EQ(digest(md5, "a"), "0cc175b9c0f1b6a831c399e269772661");
+   EXPECT_EQ(digest(md5, "abc"), "900150983cd24fb0d6963f7d28e17f72");
+   EXPECT_EQ(digest(md5, "message digest"), "f96b697d7cb7938d525a2f31aaf161d0");
+   EXPECT_EQ(digest(md5, "abcdefghijklmnopqrstuvwxyz"), "c3fcd3d76192e4007dfb496cca67e13b");
+   EXPECT_EQ(digest(md5, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789"),
+      "d174ab98d277d9f5a5611c2c9f419d9f");
+   std::string digits;
+   for (int i = 0; i < 8; i++) {
+      digits += "1234567890";
+   }
+   EXPECT_EQ(digest(md5, digits), "57edf4a22be3c955ac49da2e2107b67a");
+}
+
+TEST_P(HashTest, sha256Vectors)
+{
+   // FIPS 180-4 examples
+   HashSHA256 sha(GetParam());
+   EXPECT_EQ(digest(sha, ""), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+   EXPECT_EQ(digest(sha, "abc"), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+   EXPECT_EQ(digest(sha, "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+   // Message of exactly one block, padding goes to the next one
+   EXPECT_EQ(digest(sha, std::string(64, 'a')), "ffe054fe7ae0cb6dc65c3af9b61d5209f439851db43d0ba5997337df154668eb");
+}
+
+TEST_P(HashTest, streaming)
+{
+   // Million of 'a' fed in chunks which are not aligned to the block size
+   HashMD5 md5(GetParam());
+   HashSHA256 sha(GetParam());
+   std::string chunk(999, 'a');
+   for (size_t left = 1000000; left; ) {
+      size_t len = std::min(left, chunk.size());
+      md5.update(chunk.data(), len);
+      sha.update(chunk.data(), len);
+      left -= len;
+   }
+   EXPECT_EQ(hex(md5), "7707d6ae4e027c70eea2a935c2296f21");
+   EXPECT_EQ(hex(sha), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+
+   // Object is reused after reset and copies start a new digest
+   EXPECT_EQ(digest(md5, "abc"), "900150983cd24fb0d6963f7d28e17f72");
+   md5.reset();
+   md5.update("ab", 2);
+   HashMD5 copy(md5);
+   EXPECT_EQ(copy.openssl(), md5.openssl());
+   copy.update("abc", 3);
+   EXPECT_EQ(hex(copy), "900150983cd24fb0d6963f7d28e17f72");
+   md5.update("c", 1);
+   EXPECT_EQ(hex(md5), "900150983cd24fb0d6963f7d28e17f72");
+}
+
+TEST(Hash, builtinBackend)
+{
+   EXPECT_FALSE(HashMD5(true).openssl());
+   EXPECT_FALSE(HashSHA256(true).openssl());
+}
+
+INSTANTIATE_TEST_SUITE_P(Backend, HashTest, ::testing::Values(false, true),
+   [](const ::testing::TestParamInfo<bool> &info) { return info.param ? "builtin" : "default"; });
+
+}
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
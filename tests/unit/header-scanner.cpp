@@ -0,0 +1,195 @@
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "process/header-scanner.hpp"
+
+namespace ipxp_test {
+
+using namespace ipxp;
+
+static const size_t BLOCK = HeaderScanner::BLOCK_SIZE;
+
+struct Line {
+   size_t begin;
+   size_t end;
+   ptrdiff_t colon; /**< Offset of colon, -1 when there is none. */
+   bool terminated;
+
+   bool operator==(const Line &other) const
+   {
+      return begin == other.begin && end == other.end && colon == other.colon && terminated == other.terminated;
+   }
+};
+
+/**
+ * \brief Split data into lines without HeaderScanner.
+ */
+static std::vector<Line> reference_lines(const std::string &data)
+{
+   std::vector<Line> lines;
+   size_t begin = 0;
+   while (begin < data.size()) {
+      size_t end = data.find('\n', begin);
+      bool terminated = end != std::string::npos;
+      if (!terminated) {
+         end = data.size();
+      }
+      size_t colon = data.find(':', begin);
+      lines.push_back({begin, end, colon < end ? static_cast<ptrdiff_t>(colon) : -1, terminated});
+      begin = end + 1;
+   }
+   return lines;
+}
+
+static std::vector<Line> scanner_lines(const std::string &data)
+{
+   std::vector<Line> lines;
+   HeaderScanner scanner(data.data(), data.size());
+   HeaderLine line;
+   while (scanner.next(line)) {
+      lines.push_back({static_cast<size_t>(line.begin - data.data()), static_cast<size_t>(line.end - data.data()),
+         line.colon ? line.colon - data.data() : -1, true});
+   }
+   if (scanner.tail(line)) {
+      lines.push_back({static_cast<size_t>(line.begin - data.data()), static_cast<size_t>(line.end - data.data()),
+         line.colon ? line.colon - data.data() : -1, false});
+   }
+   EXPECT_FALSE(scanner.tail(line));
+   return lines;
+}
+
+TEST(HeaderName, recognized)
+{
+   const struct {
+      const char *name;
+      HeaderName id;
+   } names[] = {
+      {"Host", HeaderName::HOST},
+      {"User-Agent", HeaderName::USER_AGENT},
+      {"Referer", HeaderName::REFERER},
+      {"Content-Type", HeaderName::CONTENT_TYPE},
+      {"Server", HeaderName::SERVER},
+      {"Set-Cookie", HeaderName::SET_COOKIE},
+   };
+
+   for (auto &it : names) {
+      EXPECT_EQ(header_name(it.name, strlen(it.name)), it.id) << it.name;
+   }
+   // Recognized names have distinct slots, so none of them hides another one
+   for (auto &a : names) {
+      for (auto &b : names) {
+         if (&a != &b) {
+            size_t la = strlen(a.name);
+            size_t lb = strlen(b.name);
+            EXPECT_NE((la ^ static_cast<uint8_t>(a.name[la - 1])) & 7, (lb ^ static_cast<uint8_t>(b.name[lb - 1])) & 7)
+               << a.name << " " << b.name;
+         }
+      }
+   }
+}
+
+TEST(HeaderName, other)
+{
+   const char *names[] = {
+      "", "H", "host", "HOST", "Hos", "Hosts", "Hosx", "Xost", "User-Agenx", "Set-Cookiz", "Content-Length",
+      "Content-Typ", "Accept", "Accept-Encoding", "Connection", "Cookie", "Location", "Date", "Via", "Servers",
+      "Refere", "Referrer", "Set-Cookie2", "Transfer-Encoding", "Cache-Control",
+   };
+
+   for (auto name : names) {
+      EXPECT_EQ(header_name(name, strlen(name)), HeaderName::OTHER) << name;
+   }
+   // Name is not required to be null terminated
+   EXPECT_EQ(header_name("Hostname", 4), HeaderName::HOST);
+   EXPECT_EQ(header_name("Server", 5), HeaderName::OTHER);
+}
+
+TEST(HeaderScanner, findBlock)
+{
+   std::mt19937 rnd(1);
+   const char alphabet[] = {'\n', ':', '\r', 'a', ' ', 0, '\x8a', '\xba'};
+
+   for (int i = 0; i < 10000; i++) {
+      char block[BLOCK];
+      for (auto &c : block) {
+         c = alphabet[rnd() % sizeof(alphabet)];
+      }
+      uint32_t lf, colon, lf_scalar, colon_scalar;
+      HeaderScanner::find_block(block, lf, colon);
+      HeaderScanner::find_block_scalar(block, lf_scalar, colon_scalar);
+      ASSERT_EQ(lf, lf_scalar);
+      ASSERT_EQ(colon, colon_scalar);
+   }
+
+   // Edge bytes of both halves
+   char block[BLOCK];
+   memset(block, 'a', sizeof(block));
+   block[0] = block[15] = block[16] = block[31] = '\n';
+   block[1] = block[14] = block[17] = block[30] = ':';
+   uint32_t lf, colon;
+   HeaderScanner::find_block(block, lf, colon);
+   EXPECT_EQ(lf, 0x80018001u);
+   EXPECT_EQ(colon, 0x40024002u);
+}
+
+TEST(HeaderScanner, shortBuffers)
+{
+   EXPECT_TRUE(scanner_lines("").empty());
+   const char *data[] = {
+      "\n", ":", "a", "\n\n", "a:b", "a:b\n", "Host: x\r\n\r\n", "GET / HTTP/1.1\r\nHost: a:b\r\n",
+      "no colon\nX:", "0123456789012345678901234567890",
+   };
+   for (auto it : data) {
+      std::string str = it;
+      EXPECT_EQ(scanner_lines(str), reference_lines(str)) << str;
+   }
+}
+
+TEST(HeaderScanner, blockBoundaries)
+{
+   // Line feed and colon at every position around the first and second block boundary
+   for (size_t lf = 1; lf < 3 * BLOCK; lf++) {
+      for (size_t colon = 0; colon < 3 * BLOCK; colon++) {
+         for (size_t len : {lf, lf + 1, 2 * BLOCK, 3 * BLOCK + 5}) {
+            std::string str(len, 'x');
+            if (lf < len) {
+               str[lf] = '\n';
+            }
+            if (colon < len && colon != lf) {
+               str[colon] = ':';
+            }
+            ASSERT_EQ(scanner_lines(str), reference_lines(str)) << "lf " << lf << " colon " << colon << " len " << len;
+         }
+      }
+   }
+}
+
+TEST(HeaderScanner, random)
+{
+   std::mt19937 rnd(2);
+   const char alphabet[] = {'\n', ':', '\r', 'a', 'b', ' '};
+
+   for (int i = 0; i < 2000; i++) {
+      std::string str(rnd() % (4 * BLOCK + 1), 0);
+      for (auto &c : str) {
+         c = alphabet[rnd() % sizeof(alphabet)];
+      }
+      ASSERT_EQ(scanner_lines(str), reference_lines(str)) << str;
+   }
+
+   // Long headers spanning more blocks
+   std::string header = "GET / HTTP/1.1\r\nHost: " + std::string(100, 'h') + "\r\nUser-Agent" +
+      std::string(70, 'u') + ": a:b:c\r\n\r\nbody: without line feed";
+   EXPECT_EQ(scanner_lines(header), reference_lines(header));
+}
+
+}
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,170 @@
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "gtest/gtest.h"
+
+#include "process/osquery.hpp"
+
+namespace ipxp_test {
+
+using namespace ipxp;
+
+// Answers like "osqueryi --json", program name contains pid from the query
+static const char *MOCK_OSQUERY = R"sh(while read -r query; do
+   case "$query" in
+   *os_version*)
+      printf '[\n  {"arch":"x86_64","build":"1","hostname":"mockhost","major":"1","minor":"2","name":"MockOS","platform":"mock","platform_like":"mock","version":"6.1"}\n]\n'
+      ;;
+   *processes*)
+      printf '[\n  {"name":"prog%s","username":"mockuser"}\n]\n' "$(echo "$query" | tr -dc 0-9)"
+      ;;
+   esac
+done
+)sh";
+
+class OsqueryTest : public ::testing::Test
+{
+protected:
+   std::string m_dir;
+   std::string m_cmd;
+
+   void SetUp()
+   {
+      char dir[] = "/tmp/ipxp-osquery-XXXXXX";
+      ASSERT_NE(mkdtemp(dir), nullptr);
+      m_dir = dir;
+      write(m_dir + "/osqueryi.sh", MOCK_OSQUERY);
+      m_cmd = "sh " + m_dir + "/osqueryi.sh";
+   }
+
+   void TearDown()
+   {
+      std::string cmd = "rm -rf " + m_dir;
+      EXPECT_EQ(system(cmd.c_str()), 0);
+   }
+
+   static void write(const std::string &path, const std::string &data)
+   {
+      std::ofstream file(path);
+      file << data;
+   }
+
+   /**
+    * \brief Wait until the resolver publishes a new snapshot.
+    */
+   static std::shared_ptr<const OsquerySnapshot> wait_snapshot(OsqueryResolver &resolver, uint64_t &gen)
+   {
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+      uint64_t prev = gen;
+      while (resolver.getGeneration() == prev && std::chrono::steady_clock::now() < deadline) {
+         std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      return resolver.getSnapshot(gen);
+   }
+};
+
+TEST_F(OsqueryTest, pluginWithMockCommand)
+{
+   OSQUERYPlugin plugin;
+   plugin.init(("cmd=" + m_cmd + ";interval=50").c_str());
+
+   // Local connection created after the first refresh
+   int server = socket(AF_INET, SOCK_STREAM, 0);
+   int client = socket(AF_INET, SOCK_STREAM, 0);
+   ASSERT_GE(server, 0);
+   ASSERT_GE(client, 0);
+   struct sockaddr_in addr = {};
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   socklen_t len = sizeof(addr);
+   ASSERT_EQ(bind(server, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)), 0);
+   ASSERT_EQ(listen(server, 1), 0);
+   ASSERT_EQ(getsockname(server, reinterpret_cast<struct sockaddr *>(&addr), &len), 0);
+   ASSERT_EQ(connect(client, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)), 0);
+   struct sockaddr_in local = {};
+   len = sizeof(local);
+   ASSERT_EQ(getsockname(client, reinterpret_cast<struct sockaddr *>(&local), &len), 0);
+
+   Flow rec;
+   Packet pkt;
+   rec.ip_version = IP::v4;
+   rec.src_ip.v4 = local.sin_addr.s_addr;
+   rec.dst_ip.v4 = addr.sin_addr.s_addr;
+   rec.src_port = ntohs(local.sin_port);
+   rec.dst_port = ntohs(addr.sin_port);
+
+   // Cache miss requests a refresh, program is added before export
+   plugin.post_create(rec, pkt);
+   auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+   while (rec.get_extension(RecordExtOSQUERY::REGISTERED_ID) == nullptr &&
+      std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      plugin.pre_export(rec);
+   }
+
+   RecordExtOSQUERY *ext = static_cast<RecordExtOSQUERY *>(rec.get_extension(RecordExtOSQUERY::REGISTERED_ID));
+   ASSERT_NE(ext, nullptr);
+   EXPECT_EQ(ext->program_name, "prog" + std::to_string(getpid()));
+   EXPECT_EQ(ext->username, "mockuser");
+   EXPECT_EQ(ext->os_name, "MockOS");
+   EXPECT_EQ(ext->os_major, 1);
+   EXPECT_EQ(ext->system_hostname, "mockhost");
+
+   close(client);
+   close(server);
+   plugin.close();
+}
+
+TEST_F(OsqueryTest, retryUnknownOwner)
+{
+   // Socket 10.0.0.1:1000 -> 10.0.0.2:80 whose process does not list it yet
+   std::string proc = m_dir + "/proc";
+   ASSERT_EQ(mkdir(proc.c_str(), 0700), 0);
+   ASSERT_EQ(mkdir((proc + "/net").c_str(), 0700), 0);
+   ASSERT_EQ(mkdir((proc + "/4242").c_str(), 0700), 0);
+   ASSERT_EQ(mkdir((proc + "/4242/fd").c_str(), 0700), 0);
+   write(proc + "/net/tcp",
+      "  sl  local_address rem_address   st tx_queue rx_queue tr tm->when retrnsmt   uid  timeout inode\n"
+      "   0: 0100000A:03E8 0200000A:0050 01 00000000:00000000 00:00000000 00000000     0        0 555 1 0 20 4 30 10 -1\n");
+
+   OsqueryResolver resolver(m_cmd, 50, 60, proc);
+   uint64_t gen;
+   auto snapshot = resolver.getSnapshot(gen);
+
+   Flow rec;
+   rec.ip_version = IP::v4;
+   rec.src_ip.v4 = 0x0100000a;
+   rec.dst_ip.v4 = 0x0200000a;
+   rec.src_port = 1000;
+   rec.dst_port = 80;
+   ASSERT_NE(snapshot, nullptr);
+   EXPECT_EQ(snapshot->find(rec), nullptr);
+
+   // Owner appears, socket cached without program is looked up again
+   ASSERT_EQ(symlink("socket:[555]", (proc + "/4242/fd/3").c_str()), 0);
+   snapshot = wait_snapshot(resolver, gen);
+   const OsqueryProgram *program = snapshot->find(rec);
+   ASSERT_NE(program, nullptr);
+   EXPECT_EQ(program->program_name, "prog4242");
+   EXPECT_EQ(program->username, "mockuser");
+
+   // Flow started by the remote side
+   std::swap(rec.src_ip, rec.dst_ip);
+   std::swap(rec.src_port, rec.dst_port);
+   EXPECT_EQ(snapshot->find(rec), program);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "ipfixprobe/block-arena.hpp"
+#include "ipfixprobe/small-vector.hpp"
+
+namespace ipxp_test {
+
+using namespace ipxp;
+
+typedef SmallVector<uint64_t, 4> Vector;
+
+static_assert(!std::is_copy_constructible<Vector>::value, "copy would share the arena block");
+static_assert(!std::is_copy_assignable<Vector>::value, "copy would share the arena block");
+static_assert(!std::is_move_assignable<Vector>::value, "assignment cannot release the old block");
+static_assert(std::is_move_constructible<Vector>::value, "vector can be moved");
+
+static bool is_inline(const Vector &vec)
+{
+   const uint8_t *begin = reinterpret_cast<const uint8_t *>(&vec);
+   const uint8_t *data = reinterpret_cast<const uint8_t *>(vec.data());
+   return data >= begin && data < begin + sizeof(vec);
+}
+
+TEST(BlockArena, alloc)
+{
+   BlockArena arena;
+   std::vector<uint8_t *> blocks;
+   for (uint32_t size : {1u, 16u, 17u, 100u, 4096u, 65536u, BlockArena::MAX_BLOCK}) {
+      uint8_t *block = static_cast<uint8_t *>(arena.alloc(size));
+      ASSERT_NE(block, nullptr) << size;
+      EXPECT_EQ(reinterpret_cast<uintptr_t>(block) % sizeof(void *), 0u) << size;
+      memset(block, 0xAA, size);
+      blocks.push_back(block);
+   }
+   EXPECT_EQ(arena.alloc(BlockArena::MAX_BLOCK + 1), nullptr);
+
+   // Blocks do not overlap
+   std::sort(blocks.begin(), blocks.end());
+   EXPECT_EQ(std::adjacent_find(blocks.begin(), blocks.end()), blocks.end());
+}
+
+TEST(BlockArena, reuse)
+{
+   BlockArena arena;
+
+   // Largest blocks have a slab each, so the released block is the only free one
+   void *block = arena.alloc(BlockArena::MAX_BLOCK);
+   ASSERT_NE(block, nullptr);
+   arena.release(block, BlockArena::MAX_BLOCK);
+   EXPECT_EQ(arena.alloc(BlockArena::MAX_BLOCK), block);
+
+   // Sizes are rounded up to the same class
+   arena.release(block, BlockArena::MAX_BLOCK / 2 + 1);
+   EXPECT_EQ(arena.alloc(BlockArena::MAX_BLOCK - 1), block);
+}
+
+TEST(BlockArena, releaseFromOtherThreads)
+{
+   BlockArena arena;
+   const uint32_t size = 16;
+   const size_t count = 65536 / size; // One slab
+
+   std::vector<void *> blocks;
+   for (size_t i = 0; i < count; i++) {
+      blocks.push_back(arena.alloc(size));
+      ASSERT_NE(blocks.back(), nullptr);
+   }
+
+   // Slab is used up, owner takes over blocks released concurrently by other threads
+   std::vector<std::thread> threads;
+   for (size_t t = 0; t < 4; t++) {
+      threads.emplace_back([&arena, &blocks, t, count]() {
+         for (size_t i = t; i < count; i += 4) {
+            arena.release(blocks[i], size);
+         }
+      });
+   }
+   for (auto &it : threads) {
+      it.join();
+   }
+
+   std::vector<void *> reused;
+   for (size_t i = 0; i < count; i++) {
+      reused.push_back(arena.alloc(size));
+   }
+   std::sort(blocks.begin(), blocks.end());
+   std::sort(reused.begin(), reused.end());
+   EXPECT_EQ(reused, blocks);
+
+   // Next allocation needs a new slab
+   void *block = arena.alloc(size);
+   ASSERT_NE(block, nullptr);
+   EXPECT_FALSE(std::binary_search(blocks.begin(), blocks.end(), block));
+}
+
+TEST(SmallVector, inlineToHeap)
+{
+   BlockArena arena;
+   Vector vec;
+   EXPECT_TRUE(vec.empty());
+
+   for (uint64_t i = 0; i < 4; i++) {
+      ASSERT_TRUE(vec.push_back(arena, i));
+      EXPECT_TRUE(is_inline(vec));
+   }
+
+   // Fifth element moves the array to a block of the arena
+   ASSERT_TRUE(vec.push_back(arena, 4));
+   EXPECT_FALSE(is_inline(vec));
+   const uint64_t *heap = vec.data();
+   for (uint64_t i = 5; i < 8; i++) {
+      ASSERT_TRUE(vec.push_back(arena, i));
+   }
+   EXPECT_EQ(vec.data(), heap);
+
+   // Capacity doubles again, elements are copied into the new block
+   ASSERT_TRUE(vec.push_back(arena, 8));
+   EXPECT_NE(vec.data(), heap);
+   ASSERT_EQ(vec.size(), 9);
+   for (uint64_t i = 0; i < 9; i++) {
+      EXPECT_EQ(vec[i], i);
+   }
+   EXPECT_EQ(vec.back(), 8u);
+
+   vec.release(arena);
+   EXPECT_TRUE(vec.empty());
+   EXPECT_TRUE(is_inline(vec));
+   ASSERT_TRUE(vec.push_back(arena, 10));
+   EXPECT_TRUE(is_inline(vec));
+   EXPECT_EQ(vec[0], 10u);
+}
+
+TEST(SmallVector, maxBlock)
+{
+   BlockArena arena;
+   Vector vec;
+   const uint32_t max = BlockArena::MAX_BLOCK / sizeof(uint64_t);
+
+   for (uint32_t i = 0; i < max; i++) {
+      ASSERT_TRUE(vec.push_back(arena, i));
+   }
+   // Doubled capacity would not fit the largest block
+   EXPECT_FALSE(vec.push_back(arena, max));
+   ASSERT_EQ(vec.size(), max);
+   EXPECT_EQ(vec.back(), max - 1);
+
+   // Block of the full vector is reused
+   const uint64_t *data = vec.data();
+   vec.release(arena);
+   EXPECT_EQ(arena.alloc(BlockArena::MAX_BLOCK), data);
+}
+
+TEST(SmallVector, move)
+{
+   BlockArena arena;
+
+   Vector small;
+   small.push_back(arena, 1);
+   small.push_back(arena, 2);
+   Vector small_moved(std::move(small));
+   EXPECT_TRUE(small.empty());
+   EXPECT_TRUE(is_inline(small_moved));
+   ASSERT_EQ(small_moved.size(), 2);
+   EXPECT_EQ(small_moved[0], 1u);
+   EXPECT_EQ(small_moved[1], 2u);
+
+   Vector large;
+   for (uint64_t i = 0; i < 6; i++) {
+      large.push_back(arena, i);
+   }
+   const uint64_t *heap = large.data();
+   Vector large_moved(std::move(large));
+   EXPECT_TRUE(large.empty());
+   EXPECT_TRUE(is_inline(large));
+   EXPECT_EQ(large_moved.data(), heap);
+   ASSERT_EQ(large_moved.size(), 6);
+
+   // Moved vector keeps growing from the block it took over
+   large_moved.push_back(arena, 6);
+   large_moved.push_back(arena, 7);
+   EXPECT_EQ(large_moved.data(), heap);
+   for (uint64_t i = 0; i < 8; i++) {
+      EXPECT_EQ(large_moved[i], i);
+   }
+
+   // Moved-from vector is usable
+   large.push_back(arena, 9);
+   EXPECT_EQ(large[0], 9u);
+   EXPECT_TRUE(is_inline(large));
+
+   large_moved.release(arena);
+   small_moved.release(arena);
+   large.release(arena);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,120 @@
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "ipfixprobe/token-bucket.hpp"
+
+namespace ipxp_test {
+
+using namespace ipxp;
+
+static const uint64_t MS = 1000000;
+
+/**
+ * \brief Simulated clock, sleeping only advances the time.
+ */
+struct FakeClock {
+   static uint64_t time;
+   static std::vector<uint64_t> sleeps;
+
+   static uint64_t now()
+   {
+      return time;
+   }
+
+   static void sleep(uint64_t ns)
+   {
+      sleeps.push_back(ns);
+      time += ns;
+   }
+};
+
+uint64_t FakeClock::time = 0;
+std::vector<uint64_t> FakeClock::sleeps;
+
+class TokenBucketTest : public ::testing::Test
+{
+protected:
+   // 1000 tokens per second, quantum is 10 tokens (10 ms)
+   BasicTokenBucket<FakeClock> m_bucket;
+
+   void SetUp()
+   {
+      FakeClock::time = 1000 * MS;
+      FakeClock::sleeps.clear();
+      m_bucket.init(1000, 100);
+   }
+};
+
+TEST_F(TokenBucketTest, refillRate)
+{
+   m_bucket.consume(100);
+   EXPECT_TRUE(FakeClock::sleeps.empty());
+
+   // 50 ms refill exactly 50 tokens
+   FakeClock::time += 50 * MS;
+   m_bucket.consume(50);
+   EXPECT_TRUE(FakeClock::sleeps.empty());
+
+   // Debt of one token waits for it and one quantum
+   m_bucket.consume(1);
+   ASSERT_EQ(FakeClock::sleeps.size(), 1u);
+   EXPECT_EQ(FakeClock::sleeps[0], 11 * MS);
+   EXPECT_EQ(m_bucket.delay(), 11000u);
+
+   // Quantum is available after the sleep
+   m_bucket.consume(10);
+   EXPECT_EQ(FakeClock::sleeps.size(), 1u);
+}
+
+TEST_F(TokenBucketTest, burstCap)
+{
+   // Long idle time fills the bucket only up to the burst size
+   m_bucket.consume(100);
+   FakeClock::time += 10000 * MS;
+   m_bucket.consume(300);
+   ASSERT_EQ(FakeClock::sleeps.size(), 1u);
+   EXPECT_EQ(FakeClock::sleeps[0], 210 * MS);
+}
+
+TEST_F(TokenBucketTest, largerThanBurst)
+{
+   // Message larger than the burst is let through and its debt is paid by a single sleep
+   m_bucket.consume(350);
+   ASSERT_EQ(FakeClock::sleeps.size(), 1u);
+   EXPECT_EQ(FakeClock::sleeps[0], 260 * MS);
+
+   m_bucket.consume(10);
+   EXPECT_EQ(FakeClock::sleeps.size(), 1u);
+   m_bucket.consume(1);
+   ASSERT_EQ(FakeClock::sleeps.size(), 2u);
+   EXPECT_EQ(FakeClock::sleeps[1], 11 * MS);
+   EXPECT_EQ(m_bucket.delay(), 271000u);
+}
+
+TEST_F(TokenBucketTest, defaultBurst)
+{
+   // Default burst is 100 ms of tokens
+   BasicTokenBucket<FakeClock> bucket;
+   bucket.init(1000);
+   bucket.consume(100);
+   EXPECT_TRUE(FakeClock::sleeps.empty());
+   bucket.consume(1);
+   EXPECT_EQ(FakeClock::sleeps.size(), 1u);
+}
+
+TEST_F(TokenBucketTest, disabled)
+{
+   BasicTokenBucket<FakeClock> bucket;
+   EXPECT_FALSE(bucket.enabled());
+   bucket.consume(1000000);
+   EXPECT_TRUE(FakeClock::sleeps.empty());
+   EXPECT_TRUE(m_bucket.enabled());
+}
+
+}
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
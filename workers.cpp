@@ -29,13 +29,13 @@
 #include <unistd.h>
 #include <sys/time.h>
 
+#include <ipfixprobe/token-bucket.hpp>
+
 #include "workers.hpp"
 #include "ipfixprobe.hpp"
 
 namespace ipxp {
 
-#define MICRO_SEC 1000000L
-
 void input_storage_worker(InputPlugin *plugin, StoragePlugin *cache, size_t queue_size, uint64_t pkt_limit,
                   std::promise<WorkerResult> *out, std::atomic<InputStats> *out_stats)
 {
@@ -48,6 +48,7 @@ void input_storage_worker(InputPlugin *plugin, StoragePlugin *cache, size_t queu
    InputPlugin::Result ret;
    InputStats stats = {0, 0, 0, 0, 0};
    WorkerResult res = {false, ""};
+   uint64_t pkt_seq = 0;
 
    PacketBlock block(queue_size);
 
@@ -96,6 +97,7 @@ void input_storage_worker(InputPlugin *plugin, StoragePlugin *cache, size_t queu
          clock_gettime(clk_id, &start_cache);
          try {
             for (unsigned i = 0; i < block.cnt; i++) {
+               block.pkts[i].seq = ++pkt_seq;
                cache->put_pkt(block.pkts[i]);
             }
             ts = block.pkts[block.cnt - 1].ts;
@@ -135,38 +137,26 @@ void input_storage_worker(InputPlugin *plugin, StoragePlugin *cache, size_t queu
    out->set_value(res);
 }
 
-static long timeval_diff(const struct timeval *start, const struct timeval *end)
-{
-   return (end->tv_sec - start->tv_sec) * MICRO_SEC
-          + (end->tv_usec - start->tv_usec);
-}
-
 void output_worker(OutputPlugin *exp, ipx_ring_t *queue, std::promise<WorkerResult> *out, std::atomic<OutputStats> *out_stats,
    uint32_t fps)
 {
    WorkerResult res = {false, ""};
-   OutputStats stats = {0, 0, 0, 0};
-   struct timespec sleep_time = {0};
-   struct timeval begin;
-   struct timeval end;
+   OutputStats stats = {0, 0, 0, 0, 0};
+   struct timeval now;
    struct timeval last_flush;
-   uint32_t pkts_from_begin = 0;
-   double time_per_pkt = 0;
+   TokenBucket shaper;
 
    if (fps != 0) {
-      time_per_pkt = 1000000.0 / fps; // [micro seconds]
+      shaper.init(fps);
    }
 
-   // Rate limiting algorithm from https://github.com/CESNET/ipfixcol2/blob/master/src/tools/ipfixsend/sender.c#L98
-   gettimeofday(&begin, nullptr);
-   last_flush = begin;
+   gettimeofday(&last_flush, nullptr);
    while (1) {
-      gettimeofday(&end, nullptr);
-
       Flow *flow = static_cast<Flow *>(ipx_ring_pop(queue));
       if (!flow) {
-         if (end.tv_sec - last_flush.tv_sec > 1) {
-            last_flush = end;
+         gettimeofday(&now, nullptr);
+         if (now.tv_sec - last_flush.tv_sec > 1) {
+            last_flush = now;
             exp->flush();
          }
          if (terminate_export && !ipx_ring_cnt(queue)) {
@@ -179,6 +169,7 @@ void output_worker(OutputPlugin *exp, ipx_ring_t *queue, std::promise<WorkerResu
       stats.bytes += flow->src_bytes + flow->dst_bytes;
       stats.packets += flow->src_packets + flow->dst_packets;
       stats.dropped = exp->m_flows_dropped;
+      stats.delay = shaper.delay() + exp->m_shaping_delay;
       out_stats->store(stats);
       try {
          exp->export_flow(*flow);
@@ -188,41 +179,13 @@ void output_worker(OutputPlugin *exp, ipx_ring_t *queue, std::promise<WorkerResu
          break;
       }
 
-      pkts_from_begin++;
-      if (fps == 0) {
-         // Limit for packets/s is not enabled
-         continue;
-      }
-
-      // Calculate expected time of sending next packet
-      long elapsed = timeval_diff(&begin, &end);
-      if (elapsed < 0) {
-         // Should be never negative. Just for sure...
-         elapsed = pkts_from_begin * time_per_pkt;
-      }
-
-      long next_start = pkts_from_begin * time_per_pkt;
-      long diff = next_start - elapsed;
-
-      if (diff >= MICRO_SEC) {
-         diff = MICRO_SEC - 1;
-      }
-
-      // Sleep
-      if (diff > 0) {
-         sleep_time.tv_nsec = diff * 1000L;
-         nanosleep(&sleep_time, nullptr);
-      }
-
-      if (pkts_from_begin >= fps) {
-         // Restart counter
-         gettimeofday(&begin, nullptr);
-         pkts_from_begin = 0;
-      }
+      // Sleeps only when the flow limit is exhausted, per batch of flows
+      shaper.consume(1);
    }
 
    exp->flush();
    stats.dropped = exp->m_flows_dropped;
+   stats.delay = shaper.delay() + exp->m_shaping_delay;
    out_stats->store(stats);
    out->set_value(res);
 }